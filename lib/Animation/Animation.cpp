@@ -0,0 +1,203 @@
+#include "Animation.h"
+
+static bool isDigit(uint8_t tube)
+{
+	return tube <= 9;
+}
+
+bool Animation::add(const AnimationFrame &f)
+{
+	if (count >= ANIMATION_MAX_FRAMES) {
+		return false;
+	}
+	frames[count++] = f;
+	return true;
+}
+
+/*
+ * The frames between 'from' and 'to', without either. Each step moves every
+ * tube still short of its digit in 'to' by one.
+ */
+bool Animation::tween(const AnimationFrame &from, const AnimationFrame &to)
+{
+	AnimationFrame f = from;
+	for (;;) {
+		bool moved = false;
+		for (uint8_t i = 0; i < 4; i++) {
+			if (!isDigit(f.tubes[i]) || !isDigit(to.tubes[i]) || f.tubes[i] == to.tubes[i]) {
+				continue;
+			}
+			f.tubes[i] += f.tubes[i] < to.tubes[i] ? 1 : -1;
+			moved = true;
+		}
+		if (!moved || memcmp(f.tubes, to.tubes, sizeof(f.tubes)) == 0) {
+			return true;
+		}
+		if (!add(f)) {
+			return false;
+		}
+	}
+}
+
+bool Animation::fail(const char *message, uint16_t offset)
+{
+	count = 0;
+	error_message = message;
+	error_offset = offset;
+	return false;
+}
+
+bool Animation::compile(const char *script)
+{
+	const char *p = script;
+	uint16_t ms = ANIMATION_DEFAULT_MS;
+	bool tweening = false;
+
+	clear();
+	for (;;) {
+		while (isspace(*p)) {
+			p++;
+		}
+		if (*p == '\0') {
+			break;
+		}
+		if (*p == '~') {
+			if (count == 0 || tweening) {
+				return fail("'~' must follow a keyframe", p - script);
+			}
+			tweening = true;
+			p++;
+			continue;
+		}
+
+		AnimationFrame f;
+		for (uint8_t i = 0; i < 4; i++, p++) {
+			if (*p >= '0' && *p <= '9') {
+				f.tubes[i] = *p - '0';
+			} else if (*p == '-') {
+				f.tubes[i] = ANIMATION_OFF;
+			} else if (*p == 't') {
+				f.tubes[i] = ANIMATION_TARGET;
+			} else {
+				return fail("expected 4 tubes of 0-9, - or t", p - script);
+			}
+		}
+		f.dots = 0;
+		if (*p == ':') {
+			p++;
+			for (uint8_t i = 0; i < 4; i++, p++) {
+				if (*p != '0' && *p != '1') {
+					return fail("expected 4 dots of 0 or 1", p - script);
+				}
+				f.dots |= (*p - '0') << (i + 1);
+			}
+		}
+		if (*p == '/') {
+			const char *start = ++p;
+			uint32_t v = 0;
+			while (*p >= '0' && *p <= '9' && v <= UINT16_MAX) {
+				v = v * 10 + *p++ - '0';
+			}
+			if (p == start || v == 0 || v > UINT16_MAX) {
+				return fail("expected a time of 1-65535 ms", start - script);
+			}
+			ms = v;
+		}
+		f.ms = ms;
+		if (*p != '\0' && !isspace(*p) && *p != '~') {
+			return fail("expected a space", p - script);
+		}
+
+		if (tweening && !tween(frames[count - 1], f)) {
+			return fail("too many frames", p - script);
+		}
+		tweening = false;
+		if (!add(f)) {
+			return fail("too many frames", p - script);
+		}
+	}
+	if (tweening) {
+		return fail("'~' must be followed by a keyframe", p - script);
+	}
+	return true;
+}
+
+void Animation::clear()
+{
+	count = 0;
+	error_message = NULL;
+	error_offset = 0;
+}
+
+uint8_t Animation::length() const
+{
+	return count;
+}
+
+const AnimationFrame &Animation::frame(uint8_t i) const
+{
+	return frames[i];
+}
+
+uint32_t Animation::duration() const
+{
+	uint32_t ms = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		ms += frames[i].ms;
+	}
+	return ms;
+}
+
+const char *Animation::error() const
+{
+	return error_message;
+}
+
+uint16_t Animation::errorOffset() const
+{
+	return error_offset;
+}
+
+void AnimationPlayer::start(const Animation &animation, const uint8_t target[4], uint32_t now_ms)
+{
+	this->animation = animation.length() > 0 ? &animation : NULL;
+	setTarget(target);
+	next = 0;
+	due_ms = now_ms;
+}
+
+void AnimationPlayer::setTarget(const uint8_t target[4])
+{
+	memcpy(this->target, target, sizeof(this->target));
+}
+
+void AnimationPlayer::stop()
+{
+	animation = NULL;
+}
+
+bool AnimationPlayer::running() const
+{
+	return animation != NULL;
+}
+
+bool AnimationPlayer::poll(uint32_t now_ms, uint8_t tubes[4], uint8_t &dots)
+{
+	if (animation == NULL || (int32_t)(now_ms - due_ms) < 0) {
+		return false;
+	}
+	if (next >= animation->length()) {
+		animation = NULL;
+		return false;
+	}
+
+	// Frames are timed from when the first was due, so a late frame
+	// doesn't delay the rest.
+	const AnimationFrame &f = animation->frame(next++);
+	for (uint8_t i = 0; i < 4; i++) {
+		tubes[i] = f.tubes[i] == ANIMATION_TARGET ? target[i] : f.tubes[i];
+	}
+	dots = f.dots;
+	due_ms += f.ms;
+	return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * Animation.h - keyframe animations for the nixie tubes
+ *
+ * A script lists keyframes separated by spaces, e.g.
+ *
+ *	0000/40 ~ 9999 tttt:0100/300
+ *
+ * A keyframe gives the four tubes from the left, each as a digit, '-' for off
+ * or 't' for the digit the animation ends on. It may be followed by ':' and
+ * the four dots from the left as '0' or '1', and by '/' and the time it is
+ * shown in milliseconds, otherwise that of the keyframe before it or
+ * ANIMATION_DEFAULT_MS. A '~' between two keyframes adds the frames stepping
+ * each tube that shows a digit in both by one digit at a time from the first
+ * to the second, each shown for the first keyframe's time.
+ *
+ * compile() expands a script into a flat array of frames once, so that the
+ * player only looks up the next frame when it is due and never blocks.
+ */
+
+#ifndef _ANIMATION_h /* Include guard */
+#define _ANIMATION_h
+
+#include <Arduino.h>
+
+#define ANIMATION_MAX_FRAMES		64
+#define ANIMATION_DEFAULT_MS		50
+
+// Tube values besides the digits. ANIMATION_OFF is what Nixie::write() takes
+// for a tube that is off.
+#define ANIMATION_OFF			10
+#define ANIMATION_TARGET		11
+
+struct AnimationFrame {
+	uint8_t tubes[4];
+	uint8_t dots;	// as Nixie::write() takes them
+	uint16_t ms;
+};
+
+class Animation {
+	AnimationFrame frames[ANIMATION_MAX_FRAMES];
+	uint8_t count = 0;
+	const char *error_message = NULL;
+	uint16_t error_offset = 0;
+
+	bool add(const AnimationFrame &f);
+	bool tween(const AnimationFrame &from, const AnimationFrame &to);
+	bool fail(const char *message, uint16_t offset);
+
+    public:
+	// On a syntax error or a script of more than ANIMATION_MAX_FRAMES
+	// frames, returns false and leaves no frames.
+	bool compile(const char *script);
+	void clear();
+
+	uint8_t length() const;
+	const AnimationFrame &frame(uint8_t i) const;
+	uint32_t duration() const;	// in milliseconds
+
+	// Why and where, as an offset into the script, compile() failed.
+	const char *error() const;
+	uint16_t errorOffset() const;
+};
+
+class AnimationPlayer {
+	const Animation *animation = NULL;
+	uint8_t target[4];
+	uint8_t next = 0;
+	uint32_t due_ms = 0;
+
+    public:
+	// Play from 'now_ms', ending on the 'target' digits.
+	void start(const Animation &animation, const uint8_t target[4], uint32_t now_ms);
+	void setTarget(const uint8_t target[4]);
+	void stop();
+	bool running() const;
+
+	// If a frame is due at 'now_ms', returns true with its tubes and dots.
+	// Stops once the last frame has been shown for its time.
+	bool poll(uint32_t now_ms, uint8_t tubes[4], uint8_t &dots);
+};
+
+#endif // _ANIMATION_h
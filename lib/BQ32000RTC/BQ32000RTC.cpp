@@ -4,6 +4,7 @@
 #include <Wire.h>
 #include <Arduino.h>
 #include <pgmspace.h>
+#include <CivilDate.h>
 #include "BQ32000RTC.h"
 
 BQ32000RTC::BQ32000RTC()
@@ -22,13 +23,24 @@ time_t BQ32000RTC::get()
 	tmElements_t tm;
 	if (read(tm) == false)
 		return 0;
-	return (makeTime(tm));
+	// The year register holds years since 1970, as tmElements_t does.
+	uint16_t year = tmYearToCalendar(tm.Year);
+	if (!civil::isValid(year, tm.Month, tm.Day, tm.Hour, tm.Minute, tm.Second))
+		return 0;
+	return civil::toUnix(year, tm.Month, tm.Day, tm.Hour, tm.Minute, tm.Second);
 }
 
 bool BQ32000RTC::set(time_t t)
 {
 	tmElements_t tm;
-	breakTime(t, tm);
+	civil::DateTime dt = civil::fromUnix(t);
+	tm.Year = CalendarYrToTm(dt.year);
+	tm.Month = dt.month;
+	tm.Day = dt.day;
+	tm.Hour = dt.hour;
+	tm.Minute = dt.minute;
+	tm.Second = dt.second;
+	tm.Wday = dt.weekday;
 	return write(tm);
 }
 
@@ -37,13 +49,15 @@ bool BQ32000RTC::read(tmElements_t &tm)
 	uint8_t sec;
 	Wire.beginTransmission(BQ32000_ADDRESS);
 	Wire.write((byte)0);
-	if (Wire.endTransmission() != 0) {
+	if (!endTransmission()) {
 		exists = false;
 		return false;
 	}
 	exists = true;
 	delayMicroseconds(60);
-	Wire.requestFrom(BQ32000_ADDRESS, 7);
+	if (!requestFrom(7)) {
+		return false;
+	}
 	sec = Wire.read();
 	tm.Second = bcd2bin(sec & 0x7f);
 	tm.Minute = bcd2bin(Wire.read());
@@ -69,7 +83,7 @@ bool BQ32000RTC::write(tmElements_t &tm)
 	Wire.write(bin2bcd(tm.Day));
 	Wire.write(bin2bcd(tm.Month));
 	Wire.write(bin2bcd(tm.Year));
-	if (Wire.endTransmission() != 0) {
+	if (!endTransmission()) {
 		exists = false;
 		return false;
 	}
@@ -89,7 +103,7 @@ void BQ32000RTC::setIRQ(uint8_t state)
 		Wire.write(BQ32000_SFKEY1_VAL);
 		Wire.write(BQ32000_SFKEY2_VAL);
 		Wire.write((state == 1) ? BQ32000_FTF_1HZ : BQ32000_FTF_512HZ);
-		Wire.endTransmission();
+		endTransmission();
 		delayMicroseconds(60);
 	}
 	value = readRegister(BQ32000_CAL_CFG1);
@@ -159,8 +173,10 @@ uint8_t BQ32000RTC::readRegister(uint8_t address)
 	/* Read and return the value in the register at the given address. */
 	Wire.beginTransmission(BQ32000_ADDRESS);
 	Wire.write((byte)address);
-	Wire.endTransmission();
-	Wire.requestFrom(BQ32000_ADDRESS, 1);
+	endTransmission();
+	if (!requestFrom(1)) {
+		return 0;
+	}
 	// Get register state:
 	return Wire.read();
 }
@@ -171,7 +187,7 @@ void BQ32000RTC::writeRegister(uint8_t address, uint8_t value)
 	Wire.beginTransmission(BQ32000_ADDRESS);
 	Wire.write(address);
 	Wire.write(value);
-	Wire.endTransmission();
+	endTransmission();
 	delayMicroseconds(60);
 }
 
@@ -180,6 +196,27 @@ unsigned char BQ32000RTC::isRunning()
 	return !(readRegister(0x0) >> 7);
 }
 
+bool BQ32000RTC::endTransmission()
+{
+	/* End a write transfer, counting it if it failed. */
+	if (Wire.endTransmission() != 0) {
+		errors++;
+		return false;
+	}
+	return true;
+}
+
+bool BQ32000RTC::requestFrom(uint8_t quantity)
+{
+	/* Read 'quantity' bytes, counting the transfer if it came up short. */
+	if (Wire.requestFrom((int)BQ32000_ADDRESS, (int)quantity) != quantity) {
+		errors++;
+		return false;
+	}
+	return true;
+}
+
 bool BQ32000RTC::exists = false;
+uint32_t BQ32000RTC::errors = 0;
 
 BQ32000RTC RTC = BQ32000RTC();
@@ -41,6 +41,10 @@ class BQ32000RTC {
 	{
 		return exists;
 	}
+	static uint32_t i2cErrors()
+	{
+		return errors;
+	}
 	static unsigned char isRunning();
 
 	static void setIRQ(uint8_t state);
@@ -71,6 +75,9 @@ class BQ32000RTC {
 
     private:
 	static bool exists;
+	static uint32_t errors; // failed or short I2C transfers
+	static bool endTransmission();
+	static bool requestFrom(uint8_t quantity);
 	static uint8_t bcd2bin(uint8_t val)
 	{
 		return val - 6 * (val >> 4);
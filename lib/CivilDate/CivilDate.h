@@ -0,0 +1,110 @@
+/*
+ * CivilDate.h - constant-time conversions between Unix time and the
+ * proleptic Gregorian calendar
+ *
+ * daysFromCivil() and civilFromDays() are Howard Hinnant's algorithms
+ * (http://howardhinnant.github.io/date_algorithms.html). They count years
+ * from 1 March in 400-year eras of 146097 days, so the leap day is the last
+ * day of a year and the month lengths follow a linear pattern: a date is
+ * converted with a few multiplications and divisions, without the loops over
+ * years and months of TimeLib's makeTime() and breakTime(). Every function is
+ * constexpr and valid for any date in the int32_t range of days.
+ */
+
+#ifndef _CIVIL_DATE_h /* Include guard */
+#define _CIVIL_DATE_h
+
+#include <stdint.h>
+
+namespace civil {
+
+struct Date {
+	int32_t year;
+	uint8_t month;	// 1-12
+	uint8_t day;	// 1-31
+};
+
+struct DateTime {
+	int32_t year;
+	uint8_t month;	// 1-12
+	uint8_t day;	// 1-31
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	uint8_t weekday;	// 1-7, Sunday is 1, as in TimeLib
+};
+
+constexpr int32_t SECONDS_PER_DAY = 86400;
+
+constexpr bool isLeapYear(int32_t year)
+{
+	// Divisible by 4, and by 16 if divisible by 25.
+	return (year & 3) == 0 && ((year % 25) != 0 || (year & 15) == 0);
+}
+
+constexpr uint8_t daysInMonth(int32_t year, uint8_t month)
+{
+	// Months alternate between 31 and 30 days, with the phase flipping in
+	// August.
+	return month == 2 ? 28 + isLeapYear(year) : 30 + ((month + (month >> 3)) & 1);
+}
+
+constexpr bool isValid(int32_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0)
+{
+	return month >= 1 && month <= 12 && day >= 1 && day <= daysInMonth(year, month) &&
+	       hour < 24 && minute < 60 && second < 60;
+}
+
+// Days from 1970-01-01 to the given date, which must be valid.
+constexpr int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day)
+{
+	year -= month <= 2;
+	const int32_t era = (year >= 0 ? year : year - 399) / 400;
+	const uint32_t yoe = year - era * 400;
+	const uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int32_t)doe - 719468;
+}
+
+// The date 'days' days after 1970-01-01.
+constexpr Date civilFromDays(int32_t days)
+{
+	days += 719468;
+	const int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+	const uint32_t doe = days - era * 146097;
+	const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const uint32_t mp = (5 * doy + 2) / 153;
+	const uint8_t day = doy - (153 * mp + 2) / 5 + 1;
+	const uint8_t month = mp < 10 ? mp + 3 : mp - 9;
+	return Date{ (int32_t)yoe + era * 400 + (month <= 2), month, day };
+}
+
+// 1970-01-01 was a Thursday.
+constexpr uint8_t weekdayFromDays(int32_t days)
+{
+	return (days % 7 + 11) % 7 + 1;
+}
+
+constexpr int64_t toUnix(int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+	return (int64_t)daysFromCivil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+}
+
+constexpr int64_t toUnix(const DateTime &t)
+{
+	return toUnix(t.year, t.month, t.day, t.hour, t.minute, t.second);
+}
+
+constexpr DateTime fromUnix(int64_t t)
+{
+	const int32_t days = (t >= 0 ? t : t - (SECONDS_PER_DAY - 1)) / SECONDS_PER_DAY;
+	const uint32_t seconds = t - (int64_t)days * SECONDS_PER_DAY;
+	const Date date = civilFromDays(days);
+	return DateTime{ date.year, date.month, date.day, (uint8_t)(seconds / 3600), (uint8_t)(seconds / 60 % 60),
+			 (uint8_t)(seconds % 60), weekdayFromDays(days) };
+}
+
+} // namespace civil
+
+#endif // _CIVIL_DATE_h
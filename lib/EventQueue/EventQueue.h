@@ -0,0 +1,88 @@
+/*
+ * EventQueue.h - lock-free single-producer/single-consumer event ring
+ *
+ * One context posts events, for example the GPIO interrupt handlers, and one
+ * context drains them, normally loop(). The producer only writes 'head' and
+ * the consumer only writes 'tail', so neither side needs to disable
+ * interrupts. This relies on the ESP8266 having a single core: byte-sized
+ * loads and stores are atomic, and a compiler barrier is enough to keep the
+ * event contents from being published before they have been written.
+ */
+
+#ifndef _EVENT_QUEUE_h /* Include guard */
+#define _EVENT_QUEUE_h
+
+#include <Arduino.h>
+
+#define EVENT_QUEUE_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+struct Event {
+	uint32_t time_us;	// micros() when the event was posted
+	uint8_t type;
+	uint8_t reserved;
+	int16_t arg;
+};
+
+template <uint8_t SIZE>
+class EventQueue {
+	static_assert(SIZE > 0 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0,
+		      "EventQueue size must be a power of 2 no larger than 128");
+
+	Event events[SIZE];
+	volatile uint8_t head = 0;
+	volatile uint8_t tail = 0;
+
+    public:
+	// Written by the producer only.
+	volatile uint32_t posted = 0;
+	volatile uint32_t dropped = 0;
+	volatile uint8_t high_water = 0;
+
+	// Producer side. Returns false and counts the event as dropped if the
+	// queue is full.
+	IRAM_ATTR bool post(uint8_t type, int16_t arg = 0)
+	{
+		uint8_t h = head;
+		uint8_t used = h - tail;
+
+		if (used >= SIZE) {
+			dropped = dropped + 1;
+			return false;
+		}
+
+		Event &e = events[h & (SIZE - 1)];
+		e.time_us = micros();
+		e.type = type;
+		e.reserved = 0;
+		e.arg = arg;
+		EVENT_QUEUE_BARRIER();
+		head = h + 1;
+
+		posted = posted + 1;
+		if (used + 1 > high_water) {
+			high_water = used + 1;
+		}
+		return true;
+	}
+
+	// Consumer side. Copies the oldest event into 'e' without removing it.
+	bool peek(Event &e)
+	{
+		uint8_t t = tail;
+		if (t == head) {
+			return false;
+		}
+		EVENT_QUEUE_BARRIER();
+		e = events[t & (SIZE - 1)];
+		return true;
+	}
+
+	// Consumer side. Removes the oldest event.
+	void pop()
+	{
+		EVENT_QUEUE_BARRIER();
+		tail = tail + 1;
+	}
+};
+
+#endif // _EVENT_QUEUE_h
@@ -0,0 +1,61 @@
+#include "HeapMonitor.h"
+#include <coredecls.h>
+
+static volatile uint32_t allocationCount = 0;
+
+extern "C" {
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static inline void countAllocation()
+{
+	// can_yield() is false in the system context and in interrupt handlers.
+	if (can_yield()) {
+		allocationCount = allocationCount + 1;
+	}
+}
+
+void *__wrap_malloc(size_t size)
+{
+	countAllocation();
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	countAllocation();
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	countAllocation();
+	return __real_realloc(ptr, size);
+}
+
+} // extern "C"
+
+uint32_t HeapMonitor::allocations()
+{
+	return allocationCount;
+}
+
+void HeapMonitor::sample()
+{
+	free_heap = ESP.getFreeHeap();
+	max_block = ESP.getMaxFreeBlockSize();
+	fragmentation = ESP.getHeapFragmentation();
+
+	samples++;
+	if (free_heap < min_free_heap) {
+		min_free_heap = free_heap;
+	}
+	if (max_block < min_max_block) {
+		min_max_block = max_block;
+	}
+	if (fragmentation > max_fragmentation) {
+		max_fragmentation = fragmentation;
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * HeapMonitor.h - heap allocation counter and heap state sampling
+ *
+ * Allocations are counted by wrapping malloc(), calloc() and realloc() at link
+ * time, which needs "-Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc"
+ * in the build flags. On the ESP8266 the String class and operator new both
+ * end up in these functions. Only allocations made from the loop() context
+ * are counted, not those made by the network stack in the system context.
+ */
+
+#ifndef _HEAP_MONITOR_h /* Include guard */
+#define _HEAP_MONITOR_h
+
+#include <Arduino.h>
+
+class HeapMonitor {
+    public:
+	// Number of allocations made from the loop() context since boot.
+	static uint32_t allocations();
+
+	// Read the current heap state and update the extremes.
+	void sample();
+
+	uint32_t samples = 0;
+	uint32_t free_heap = 0;
+	uint32_t min_free_heap = UINT32_MAX;
+	uint32_t max_block = 0;
+	uint32_t min_max_block = UINT32_MAX;
+	uint8_t fragmentation = 0;
+	uint8_t max_fragmentation = 0;
+};
+
+#endif // _HEAP_MONITOR_h
@@ -0,0 +1,223 @@
+#include "LoopWatchdog.h"
+#include <coredecls.h>
+
+void LoopWatchdog::stage(uint8_t event)
+{
+	uint32_t now = micros();
+
+	TRACE(TRACE_LOOP, event, 0);
+	if (current != TRACE_EVENT_COUNT) {
+		stage_us[current - TRACE_EVENT_LOOP_ACCOUNTING] += now - stage_start_us;
+	}
+	current = event;
+	stage_start_us = now;
+	if (event != TRACE_EVENT_LOOP_ACCOUNTING) {
+		return;
+	}
+
+	// An iteration ends where the next one starts, after the system
+	// context has run.
+	if (iterations > 0) {
+		last_us = now - iteration_start_us;
+		last_stage_us = 0;
+		for (uint8_t i = 0; i < LOOP_STAGE_COUNT; i++) {
+			if (stage_us[i] > last_stage_us) {
+				last_stage_us = stage_us[i];
+				last_stage = TRACE_EVENT_LOOP_ACCOUNTING + i;
+			}
+		}
+	}
+	memset(stage_us, 0, sizeof(stage_us));
+	iteration_start_us = now;
+	iterations++;
+}
+
+bool LoopWatchdog::check(uint32_t budget_us)
+{
+	if (budget_us == 0 || last_us <= budget_us) {
+		return false;
+	}
+
+	overruns++;
+	stage_overruns[last_stage - TRACE_EVENT_LOOP_ACCOUNTING]++;
+	if (last_us > worst_us) {
+		worst_us = last_us;
+		worst_stage = last_stage;
+	}
+	TRACE(TRACE_WATCHDOG, TRACE_EVENT_LOOP_OVERRUN,
+	      (last_stage - TRACE_EVENT_LOOP_ACCOUNTING) << 12 | min(last_us / 1000, (uint32_t)0xfff));
+	return true;
+}
+
+/*
+ * Interrupts are masked while the trace is read, so that the records and the
+ * time they are measured from agree.
+ */
+void LoopWatchdog::save(uint32_t rtc_offset, const struct rst_info &info)
+{
+	PostmortemData &p = postmortem;
+	uint32_t cycles_per_ms = ESP.getCpuFreqMHz() * 1000;
+
+	memset(&p, 0, sizeof(p));
+	p.reason = info.reason;
+	p.exccause = info.exccause;
+	p.epc1 = info.epc1;
+	p.excvaddr = info.excvaddr;
+	p.uptime_ms = millis();
+	p.iterations = iterations;
+	p.overruns = overruns;
+	p.worst_us = worst_us;
+	p.worst_stage = worst_stage;
+	p.stage = current;
+	p.stage_us = current != TRACE_EVENT_COUNT ? micros() - stage_start_us : 0;
+
+	uint32_t ps = xt_rsil(15);
+	uint32_t next = ESP.getCycleCount();
+	p.count = min(trace.count(), (uint32_t)POSTMORTEM_RECORDS);
+	for (uint32_t age = 0; age < p.count; age++) {
+		const TraceRecord &r = trace.recent(age);
+		uint32_t ms = min((next - r.cycles) / cycles_per_ms, (uint32_t)POSTMORTEM_MAX_DELTA_MS);
+		p.records[p.count - 1 - age] = (uint32_t)r.event << 27 | ms << 16 | r.arg;
+		next = r.cycles;
+	}
+	xt_wsr_ps(ps);
+
+	p.crc = crc32((uint8_t *)&p + sizeof(p.crc), sizeof(p) - sizeof(p.crc));
+	ESP.rtcUserMemoryWrite(rtc_offset, (uint32_t *)&p, sizeof(p));
+}
+
+bool LoopWatchdog::load(uint32_t rtc_offset)
+{
+	uint32_t invalid = 0;
+
+	postmortem_valid = ESP.rtcUserMemoryRead(rtc_offset, (uint32_t *)&postmortem, sizeof(postmortem)) &&
+			   postmortem.crc == crc32((uint8_t *)&postmortem + sizeof(postmortem.crc),
+						   sizeof(postmortem) - sizeof(postmortem.crc)) &&
+			   postmortem.count <= POSTMORTEM_RECORDS;
+	if (postmortem_valid) {
+		ESP.rtcUserMemoryWrite(rtc_offset, &invalid, sizeof(invalid));
+	}
+	return postmortem_valid;
+}
+
+const char *LoopWatchdog::stageName(uint8_t event)
+{
+	if (event == TRACE_EVENT_COUNT) {
+		return "setup";
+	}
+	// The end of an iteration lasts while the system context runs.
+	return event == TRACE_EVENT_LOOP_END ? "system" : Trace::eventName(event);
+}
+
+static const char *reasonName(uint32_t reason)
+{
+	switch (reason) {
+	case REASON_WDT_RST:
+		return "a hardware watchdog reset";
+	case REASON_EXCEPTION_RST:
+		return "an exception";
+	case REASON_SOFT_WDT_RST:
+		return "a soft watchdog reset";
+	case REASON_SOFT_RESTART:
+		return "a restart";
+	}
+	return "an unknown reset";
+}
+
+void LoopWatchdog::printStats(Print &out, uint32_t budget_us) const
+{
+	out.print("[Watchdog] Budget ");
+	if (budget_us == 0) {
+		out.print("off");
+	} else {
+		out.print(budget_us / 1000);
+		out.print(" ms");
+	}
+	out.print(", ");
+	out.print(iterations);
+	out.print(" loop iterations, ");
+	out.print(overruns);
+	out.print(" over the budget");
+	if (overruns > 0) {
+		out.print(", the longest ");
+		out.print(worst_us / 1000);
+		out.print(" ms, mostly in the ");
+		out.print(stageName(worst_stage));
+		out.print(" stage");
+	}
+	out.println(".");
+
+	out.print("[Watchdog] Over the budget by stage:");
+	for (uint8_t i = 0; i < LOOP_STAGE_COUNT; i++) {
+		out.print(' ');
+		out.print(stageName(TRACE_EVENT_LOOP_ACCOUNTING + i));
+		out.print(' ');
+		out.print(stage_overruns[i]);
+	}
+	out.println();
+}
+
+void LoopWatchdog::printPostmortem(Print &out) const
+{
+	const PostmortemData &p = postmortem;
+
+	out.print("[Postmortem] Reset reason: ");
+	out.println(ESP.getResetReason());
+	if (!postmortem_valid) {
+		out.println("[Postmortem] None saved before the last reset.");
+		return;
+	}
+
+	out.print("[Postmortem] Saved ");
+	out.print(p.uptime_ms);
+	out.print(" ms after boot at ");
+	out.print(reasonName(p.reason));
+	out.print(", ");
+	out.print(p.stage_us / 1000);
+	out.print(" ms into the ");
+	out.print(stageName(p.stage));
+	out.println(" stage.");
+	if (p.reason == REASON_EXCEPTION_RST) {
+		char line[64];
+		snprintf(line, sizeof(line), "[Postmortem] Exception %u at 0x%08x, address 0x%08x.", (unsigned)p.exccause,
+			 (unsigned)p.epc1, (unsigned)p.excvaddr);
+		out.println(line);
+	}
+	out.print("[Postmortem] ");
+	out.print(p.iterations);
+	out.print(" loop iterations, ");
+	out.print(p.overruns);
+	out.print(" over the budget");
+	if (p.overruns > 0) {
+		out.print(", the longest ");
+		out.print(p.worst_us / 1000);
+		out.print(" ms, mostly in the ");
+		out.print(stageName(p.worst_stage));
+		out.print(" stage");
+	}
+	out.println(".");
+
+	// Times are summed back from the save. Past a saturated gap they are
+	// only bounds, marked with '<'.
+	out.print("[Postmortem] The last ");
+	out.print(p.count);
+	out.println(" trace events, in milliseconds before the save:");
+	uint32_t ms = 0;
+	int16_t last_bound = -1;
+	for (uint16_t i = 0; i < p.count; i++) {
+		uint32_t delta = p.records[i] >> 16 & 0x7ff;
+		ms += delta;
+		if (delta == POSTMORTEM_MAX_DELTA_MS) {
+			last_bound = i;
+		}
+	}
+	for (uint16_t i = 0; i < p.count; i++) {
+		uint32_t r = p.records[i];
+		char line[64];
+		snprintf(line, sizeof(line), "[Postmortem] %s-%u %s 0x%04x", (int16_t)i <= last_bound ? "<" : " ",
+			 (unsigned)ms, Trace::eventName(r >> 27), (unsigned)(r & 0xffff));
+		out.println(line);
+		ms -= r >> 16 & 0x7ff;
+	}
+	out.println("[Postmortem] End.");
+}
@@ -0,0 +1,94 @@
+/*
+ * LoopWatchdog.h - loop() iterations over a time budget, and a post-mortem
+ * of the last trace events kept across resets
+ *
+ * loop() marks the start of each of its stages with stage(), which also
+ * records the stage in the trace. At the start of the next iteration check()
+ * compares the iteration's length with the budget. An iteration over it is
+ * counted against the stage that took longest and recorded in the trace.
+ *
+ * save() writes the counters, the stage executing and the last
+ * POSTMORTEM_RECORDS trace events to RTC user memory, which survives
+ * restarts and watchdog resets but not a loss of power. It is meant for the
+ * core's crash callback, which runs on exceptions and soft watchdog resets,
+ * and for restarts. RTC user memory holds 512 bytes in all, of which eboot
+ * keeps 128 for its command and the firmware's other records take some, so
+ * each event is packed into 4 bytes: the event, the milliseconds until the
+ * next event or the save, saturating after about 2 seconds, and the
+ * argument. load() reads the post-mortem back at boot and invalidates it, so
+ * it only describes the last reset.
+ */
+
+#ifndef _LOOP_WATCHDOG_h /* Include guard */
+#define _LOOP_WATCHDOG_h
+
+#include <Arduino.h>
+#include <Trace.h>
+
+extern "C" {
+#include <user_interface.h>
+}
+
+#define LOOP_STAGE_COUNT		(TRACE_EVENT_LOOP_END - TRACE_EVENT_LOOP_ACCOUNTING + 1)
+
+#define POSTMORTEM_RECORDS		64
+#define POSTMORTEM_MAX_DELTA_MS		2047
+
+struct PostmortemData {
+	uint32_t crc;
+	uint32_t reason;		// enum rst_reason
+	uint32_t exccause;
+	uint32_t epc1;
+	uint32_t excvaddr;
+	uint32_t uptime_ms;
+	uint32_t iterations;
+	uint32_t overruns;
+	uint32_t worst_us;
+	uint32_t stage_us;		// time spent in 'stage' when saved
+	uint8_t stage;			// a loop stage event, or TRACE_EVENT_COUNT in setup()
+	uint8_t worst_stage;
+	uint16_t count;			// records held
+	// Oldest first: event << 27 | milliseconds to the next one << 16 | arg.
+	uint32_t records[POSTMORTEM_RECORDS];
+};
+
+// In RTC user memory blocks of 4 bytes.
+#define POSTMORTEM_BLOCKS		(sizeof(PostmortemData) / 4)
+
+class LoopWatchdog {
+	uint8_t current = TRACE_EVENT_COUNT;
+	uint32_t stage_start_us = 0;
+	uint32_t iteration_start_us = 0;
+	uint32_t stage_us[LOOP_STAGE_COUNT] = {};
+
+	PostmortemData postmortem;
+	bool postmortem_valid = false;
+
+    public:
+	// Start a loop stage, given as its trace event.
+	void stage(uint8_t event);
+
+	// Whether the iteration that ended at the last TRACE_EVENT_LOOP_ACCOUNTING
+	// stage took longer than 'budget_us', counting it if so. 0 disables.
+	bool check(uint32_t budget_us);
+
+	void save(uint32_t rtc_offset, const struct rst_info &info);
+	// Whether a post-mortem was saved before the last reset.
+	bool load(uint32_t rtc_offset);
+
+	void printStats(Print &out, uint32_t budget_us) const;
+	void printPostmortem(Print &out) const;
+
+	static const char *stageName(uint8_t event);
+
+	uint32_t iterations = 0;
+	uint32_t overruns = 0;
+	uint32_t stage_overruns[LOOP_STAGE_COUNT] = {};
+	uint32_t last_us = 0;			// length of the last iteration
+	uint8_t last_stage = TRACE_EVENT_LOOP_END;	// its longest stage
+	uint32_t last_stage_us = 0;
+	uint32_t worst_us = 0;
+	uint8_t worst_stage = TRACE_EVENT_LOOP_END;
+};
+
+#endif // _LOOP_WATCHDOG_h
@@ -0,0 +1,360 @@
+#include "MetricsServer.h"
+
+#define METRICS_PATH		"/metrics"
+// In units of lwIP's 500 ms slow timer.
+#define METRICS_POLL_INTERVAL	2
+
+static const char RESPONSE_OK[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: text/plain; version=0.0.4\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static const char RESPONSE_NOT_FOUND[] =
+	"HTTP/1.0 404 Not Found\r\n"
+	"Content-Type: text/plain\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Not found\n";
+
+static_assert(sizeof(RESPONSE_OK) <= METRICS_BUFFER_SIZE && sizeof(RESPONSE_NOT_FOUND) <= METRICS_BUFFER_SIZE,
+	      "METRICS_BUFFER_SIZE must hold the response headers");
+
+/*
+ * Format a fixed-point value with 'decimals' digits after the decimal point.
+ * 'buf' must hold at least 22 characters.
+ */
+static void formatValue(int64_t value, uint8_t decimals, char *buf)
+{
+	char digits[21];
+	uint8_t n = 0;
+	uint64_t v = value < 0 ? -(uint64_t)value : value;
+
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0 || n <= decimals);
+
+	if (value < 0) {
+		*buf++ = '-';
+	}
+	while (n > 0) {
+		if (n == decimals) {
+			*buf++ = '.';
+		}
+		*buf++ = digits[--n];
+	}
+	*buf = '\0';
+}
+
+void MetricsWriter::begin(const Metric *metrics, uint8_t count)
+{
+	this->metrics = metrics;
+	this->count = count;
+	index = 0;
+}
+
+size_t MetricsWriter::next(char *buf, size_t size)
+{
+	while (index < count) {
+		const Metric &m = metrics[index++];
+		const char *type = m.type == METRIC_COUNTER ? "counter" : "gauge";
+		char value[22];
+		int64_t v;
+		int n;
+
+		if (!m.read(v)) {
+			continue;
+		}
+		formatValue(v, m.decimals, value);
+
+		n = snprintf(buf, size, "# HELP %s %s\n# TYPE %s %s\n%s %s\n", m.name, m.help, m.name, type, m.name, value);
+		if (n > 0 && (size_t)n < size) {
+			return n;
+		}
+		n = snprintf(buf, size, "# TYPE %s %s\n%s %s\n", m.name, type, m.name, value);
+		if (n > 0 && (size_t)n < size) {
+			return n;
+		}
+	}
+	return 0;
+}
+
+bool MetricsServer::begin(const Metric *metrics, uint8_t count, uint16_t port)
+{
+	if (listener != NULL) {
+		return true;
+	}
+	this->metrics = metrics;
+	this->count = count;
+
+	struct tcp_pcb *pcb = tcp_new();
+	if (pcb == NULL) {
+		return false;
+	}
+	if (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK) {
+		tcp_abort(pcb);
+		return false;
+	}
+	// On success the PCB is replaced by a smaller listening one.
+	listener = tcp_listen(pcb);
+	if (listener == NULL) {
+		tcp_abort(pcb);
+		return false;
+	}
+	tcp_arg(listener, this);
+	tcp_accept(listener, accept);
+	return true;
+}
+
+void MetricsServer::end()
+{
+	if (listener == NULL) {
+		return;
+	}
+	tcp_close(listener);
+	listener = NULL;
+	for (uint8_t i = 0; i < METRICS_CONNECTIONS; i++) {
+		if (connections[i].state != STATE_FREE) {
+			abort(connections[i]);
+		}
+	}
+}
+
+bool MetricsServer::running()
+{
+	return listener != NULL;
+}
+
+err_t MetricsServer::accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+	MetricsServer *server = (MetricsServer *)arg;
+	Connection *c = NULL;
+
+	if (err != ERR_OK || pcb == NULL) {
+		return ERR_VAL;
+	}
+	for (uint8_t i = 0; i < METRICS_CONNECTIONS; i++) {
+		if (server->connections[i].state == STATE_FREE) {
+			c = &server->connections[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		server->rejected++;
+		tcp_abort(pcb);
+		return ERR_ABRT;
+	}
+
+	c->pcb = pcb;
+	c->server = server;
+	c->state = STATE_REQUEST;
+	c->found = false;
+	c->request_len = 0;
+	c->line_len = 0;
+	c->request_line_done = false;
+	c->last_ms = millis();
+	c->start_us = micros();
+	c->header_sent = false;
+	c->unacked = 0;
+	c->len = 0;
+	c->written = 0;
+
+	tcp_arg(pcb, c);
+	tcp_recv(pcb, receive);
+	tcp_sent(pcb, sent);
+	tcp_poll(pcb, poll, METRICS_POLL_INTERVAL);
+	tcp_err(pcb, error);
+	return ERR_OK;
+}
+
+/*
+ * Scan the request for its path and the blank line ending the headers.
+ * Returns true once the headers are complete.
+ */
+bool MetricsServer::parse(Connection &c, struct pbuf *p)
+{
+	for (struct pbuf *q = p; q != NULL; q = q->next) {
+		const char *data = (const char *)q->payload;
+		for (u16_t i = 0; i < q->len; i++) {
+			char ch = data[i];
+			if (ch == '\r') {
+				continue;
+			}
+			if (ch != '\n') {
+				c.line_len = c.line_len < 255 ? c.line_len + 1 : 255;
+				if (!c.request_line_done && c.request_len < sizeof(c.request) - 1) {
+					c.request[c.request_len++] = ch;
+				}
+				continue;
+			}
+			if (!c.request_line_done) {
+				c.request_line_done = true;
+				c.request[c.request_len] = '\0';
+				static const char prefix[] = "GET " METRICS_PATH;
+				size_t len = sizeof(prefix) - 1;
+				c.found = strncmp(c.request, prefix, len) == 0 &&
+					  (c.request[len] == ' ' || c.request[len] == '?' || c.request[len] == '\0');
+			} else if (c.line_len == 0) {
+				return true;
+			}
+			c.line_len = 0;
+		}
+	}
+	return false;
+}
+
+err_t MetricsServer::receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+	Connection *c = (Connection *)arg;
+
+	if (p == NULL) {
+		// The client closed its side. Finish any response.
+		if (c != NULL && c->state == STATE_REQUEST) {
+			c->server->close(*c);
+		}
+		return ERR_OK;
+	}
+	tcp_recved(pcb, p->tot_len);
+	if (c == NULL || err != ERR_OK || c->state != STATE_REQUEST) {
+		pbuf_free(p);
+		return ERR_OK;
+	}
+
+	c->last_ms = millis();
+	bool complete = c->server->parse(*c, p);
+	pbuf_free(p);
+	if (!complete) {
+		return ERR_OK;
+	}
+
+	c->state = STATE_RESPONSE;
+	c->writer.begin(c->server->metrics, c->server->count);
+	return c->server->send(*c);
+}
+
+/*
+ * Write as much of the response as the send buffer takes, serializing the
+ * next metric whenever the buffer has been written out.
+ */
+err_t MetricsServer::send(Connection &c)
+{
+	while (c.state == STATE_RESPONSE) {
+		if (c.written == c.len) {
+			c.written = 0;
+			if (!c.header_sent) {
+				if (c.found) {
+					c.len = sizeof(RESPONSE_OK) - 1;
+					memcpy(c.buf, RESPONSE_OK, c.len);
+				} else {
+					c.len = sizeof(RESPONSE_NOT_FOUND) - 1;
+					memcpy(c.buf, RESPONSE_NOT_FOUND, c.len);
+				}
+				c.header_sent = true;
+			} else if (c.found) {
+				c.len = c.writer.next(c.buf, sizeof(c.buf));
+			} else {
+				c.len = 0;
+			}
+			if (c.len == 0) {
+				c.state = STATE_CLOSING;
+				break;
+			}
+		}
+
+		u16_t n = min((u16_t)(c.len - c.written), tcp_sndbuf(c.pcb));
+		if (n == 0) {
+			break;
+		}
+		err_t err = tcp_write(c.pcb, c.buf + c.written, n, TCP_WRITE_FLAG_COPY);
+		if (err == ERR_MEM) {
+			// Out of segments; retried from the sent and poll callbacks.
+			break;
+		}
+		if (err != ERR_OK) {
+			abort(c);
+			return ERR_ABRT;
+		}
+		c.written += n;
+		c.unacked += n;
+	}
+	tcp_output(c.pcb);
+
+	if (c.state == STATE_CLOSING && c.unacked == 0) {
+		uint32_t elapsed = micros() - c.start_us;
+		if (c.found) {
+			scrapes++;
+			last_scrape_us = elapsed;
+			max_scrape_us = max(max_scrape_us, elapsed);
+		} else {
+			not_found++;
+		}
+		close(c);
+	}
+	return ERR_OK;
+}
+
+err_t MetricsServer::sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+	Connection *c = (Connection *)arg;
+	(void)pcb;
+
+	if (c == NULL) {
+		return ERR_OK;
+	}
+	c->unacked -= min(len, c->unacked);
+	c->last_ms = millis();
+	return c->server->send(*c);
+}
+
+err_t MetricsServer::poll(void *arg, struct tcp_pcb *pcb)
+{
+	Connection *c = (Connection *)arg;
+	(void)pcb;
+
+	if (c == NULL) {
+		return ERR_OK;
+	}
+	if (millis() - c->last_ms > METRICS_TIMEOUT_MS) {
+		c->server->abort(*c);
+		return ERR_ABRT;
+	}
+	return c->server->send(*c);
+}
+
+void MetricsServer::error(void *arg, err_t err)
+{
+	Connection *c = (Connection *)arg;
+	(void)err;
+
+	// lwIP has already freed the PCB.
+	if (c != NULL) {
+		c->server->aborted++;
+		c->pcb = NULL;
+		c->state = STATE_FREE;
+	}
+}
+
+void MetricsServer::close(Connection &c)
+{
+	tcp_arg(c.pcb, NULL);
+	tcp_recv(c.pcb, NULL);
+	tcp_sent(c.pcb, NULL);
+	tcp_poll(c.pcb, NULL, 0);
+	tcp_err(c.pcb, NULL);
+	if (tcp_close(c.pcb) != ERR_OK) {
+		tcp_abort(c.pcb);
+	}
+	c.pcb = NULL;
+	c.state = STATE_FREE;
+}
+
+void MetricsServer::abort(Connection &c)
+{
+	aborted++;
+	tcp_arg(c.pcb, NULL);
+	tcp_err(c.pcb, NULL);
+	tcp_abort(c.pcb);
+	c.pcb = NULL;
+	c.state = STATE_FREE;
+}
@@ -0,0 +1,114 @@
+/*
+ * MetricsServer.h - Prometheus text format metrics over HTTP
+ *
+ * The metrics are described by a table of name, help text, type and a
+ * function reading the current value. A scrape is serialized one metric at a
+ * time into a small buffer per connection, and only as much as fits into the
+ * TCP send buffer is written at once; the rest follows from the lwIP sent and
+ * poll callbacks. A scrape therefore never holds more than one TCP window of
+ * data, doesn't allocate beyond lwIP's own segments, and never blocks loop().
+ *
+ * The callbacks run in the system context, which never preempts loop(), so
+ * the value functions see the firmware's state consistently.
+ */
+
+#ifndef _METRICS_SERVER_h /* Include guard */
+#define _METRICS_SERVER_h
+
+#include <Arduino.h>
+#include <lwip/tcp.h>
+
+#define METRICS_PORT			80
+#define METRICS_CONNECTIONS		2
+#define METRICS_BUFFER_SIZE		256
+#define METRICS_TIMEOUT_MS		10000
+
+enum MetricType {
+	METRIC_GAUGE,
+	METRIC_COUNTER,
+};
+
+struct Metric {
+	const char *name;
+	const char *help;
+	uint8_t type;
+	// The value is in units of 10^-decimals, e.g. microseconds for a
+	// metric in seconds with 6 decimals.
+	uint8_t decimals;
+	// Returns false if there is no value, and the metric is left out.
+	bool (*read)(int64_t &value);
+};
+
+/*
+ * Serializes a metrics table one metric at a time.
+ */
+class MetricsWriter {
+	const Metric *metrics = NULL;
+	uint8_t count = 0;
+	uint8_t index = 0;
+
+    public:
+	void begin(const Metric *metrics, uint8_t count);
+	// Writes the next metric with a value to 'buf' and returns its length,
+	// or 0 once all metrics have been written. A metric that doesn't fit
+	// into 'size' bytes is written without its help text, or left out.
+	size_t next(char *buf, size_t size);
+};
+
+class MetricsServer {
+	enum State {
+		STATE_FREE,
+		STATE_REQUEST,		// reading the request headers
+		STATE_RESPONSE,		// writing the response
+		STATE_CLOSING,		// waiting for the response to be acknowledged
+	};
+
+	struct Connection {
+		struct tcp_pcb *pcb;
+		MetricsServer *server;
+		uint8_t state;
+		bool found;		// the request was for the metrics path
+		char request[16];	// start of the request line
+		uint8_t request_len;
+		uint8_t line_len;	// length of the current header line
+		bool request_line_done;
+		uint32_t last_ms;
+		uint32_t start_us;
+		MetricsWriter writer;
+		bool header_sent;
+		uint16_t unacked;
+		char buf[METRICS_BUFFER_SIZE];
+		uint16_t len;		// bytes in 'buf'
+		uint16_t written;	// bytes of 'buf' passed to tcp_write()
+	};
+
+	struct tcp_pcb *listener = NULL;
+	const Metric *metrics = NULL;
+	uint8_t count = 0;
+	Connection connections[METRICS_CONNECTIONS] = {};
+
+	static err_t accept(void *arg, struct tcp_pcb *pcb, err_t err);
+	static err_t receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+	static err_t sent(void *arg, struct tcp_pcb *pcb, u16_t len);
+	static err_t poll(void *arg, struct tcp_pcb *pcb);
+	static void error(void *arg, err_t err);
+
+	bool parse(Connection &c, struct pbuf *p);
+	err_t send(Connection &c);
+	void close(Connection &c);
+	void abort(Connection &c);
+
+    public:
+	bool begin(const Metric *metrics, uint8_t count, uint16_t port = METRICS_PORT);
+	void end();
+	bool running();
+
+	uint32_t scrapes = 0;
+	uint32_t not_found = 0;
+	uint32_t rejected = 0;		// no free connection
+	uint32_t aborted = 0;		// reset, timed out or failed
+	uint32_t last_scrape_us = 0;	// request to last byte acknowledged
+	uint32_t max_scrape_us = 0;
+};
+
+#endif // _METRICS_SERVER_h
@@ -0,0 +1,492 @@
+#include "OtaServer.h"
+#include <Updater.h>
+
+#define OTA_PATH		"/update"
+// In units of lwIP's 500 ms slow timer.
+#define OTA_POLL_INTERVAL	2
+
+static const char RESPONSE_CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static int hexValue(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/*
+ * Decode %XX escapes and '+' in a query string value, in place.
+ */
+static void urlDecode(char *s)
+{
+	char *out = s;
+
+	while (*s != '\0') {
+		if (*s == '%' && hexValue(s[1]) >= 0 && hexValue(s[2]) >= 0) {
+			*out++ = hexValue(s[1]) << 4 | hexValue(s[2]);
+			s += 3;
+		} else {
+			*out++ = *s == '+' ? ' ' : *s;
+			s++;
+		}
+	}
+	*out = '\0';
+}
+
+/*
+ * Copy an MD5 in hex to 'dst' in lower case, or clear 'dst' if it isn't one.
+ */
+static void copyMD5(char *dst, const char *src)
+{
+	for (uint8_t i = 0; i < 32; i++) {
+		if (hexValue(src[i]) < 0) {
+			dst[0] = '\0';
+			return;
+		}
+		dst[i] = src[i] | 0x20;
+	}
+	dst[src[32] == '\0' ? 32 : 0] = '\0';
+}
+
+bool OtaServer::begin(const char *password, uint16_t port)
+{
+	size_t len = strlen(password);
+
+	if (listener != NULL) {
+		return true;
+	}
+	if (len == 0 || len >= sizeof(this->password)) {
+		return false;
+	}
+	memcpy(this->password, password, len + 1);
+
+	struct tcp_pcb *pcb = tcp_new();
+	if (pcb == NULL) {
+		return false;
+	}
+	if (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK) {
+		tcp_abort(pcb);
+		return false;
+	}
+	// On success the PCB is replaced by a smaller listening one.
+	listener = tcp_listen(pcb);
+	if (listener == NULL) {
+		tcp_abort(pcb);
+		return false;
+	}
+	tcp_arg(listener, this);
+	tcp_accept(listener, accept);
+	return true;
+}
+
+void OtaServer::end()
+{
+	if (listener == NULL) {
+		return;
+	}
+	tcp_close(listener);
+	listener = NULL;
+	if (pcb != NULL) {
+		abort();
+	}
+}
+
+bool OtaServer::running()
+{
+	return listener != NULL;
+}
+
+void OtaServer::onEvent(void (*fn)(OtaEvent event, int16_t arg))
+{
+	event_fn = fn;
+}
+
+const char *OtaServer::sketchMD5()
+{
+	return sketch_md5;
+}
+
+void OtaServer::emit(OtaEvent event, int16_t arg)
+{
+	if (event_fn != NULL) {
+		event_fn(event, arg);
+	}
+}
+
+void OtaServer::fail(int16_t error)
+{
+	failures++;
+	emit(OTA_FAILED, error);
+}
+
+err_t OtaServer::accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+	OtaServer *server = (OtaServer *)arg;
+
+	if (err != ERR_OK || pcb == NULL) {
+		return ERR_VAL;
+	}
+	if (server->pcb != NULL) {
+		server->rejected++;
+		tcp_abort(pcb);
+		return ERR_ABRT;
+	}
+
+	server->pcb = pcb;
+	server->state = STATE_HEADERS;
+	server->line_len = 0;
+	server->request_line_done = false;
+	server->update_path = false;
+	server->upload_method = false;
+	server->password_ok = false;
+	server->has_length = false;
+	server->expect_continue = false;
+	server->md5[0] = '\0';
+	server->request_sketch_md5[0] = '\0';
+	server->last_ms = millis();
+	server->unacked = 0;
+	server->completed = false;
+
+	tcp_arg(pcb, server);
+	tcp_recv(pcb, receive);
+	tcp_sent(pcb, sent);
+	tcp_poll(pcb, poll, OTA_POLL_INTERVAL);
+	tcp_err(pcb, error);
+	return ERR_OK;
+}
+
+void OtaServer::parseQuery(char *query)
+{
+	char *param = query;
+
+	while (param != NULL) {
+		char *next = strchr(param, '&');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		char *value = strchr(param, '=');
+		if (value != NULL) {
+			*value++ = '\0';
+			urlDecode(value);
+			if (strcmp(param, "md5") == 0) {
+				copyMD5(md5, value);
+			} else if (strcmp(param, "sketch_md5") == 0) {
+				copyMD5(request_sketch_md5, value);
+			} else if (strcmp(param, "password") == 0) {
+				password_ok = strcmp(value, password) == 0;
+			}
+		}
+		param = next;
+	}
+}
+
+/*
+ * Handle a complete request or header line in 'line'.
+ */
+void OtaServer::parseLine()
+{
+	if (!request_line_done) {
+		request_line_done = true;
+
+		char *target = strchr(line, ' ');
+		if (target == NULL) {
+			return;
+		}
+		*target++ = '\0';
+		upload_method = strcmp(line, "PUT") == 0 || strcmp(line, "POST") == 0;
+
+		char *version = strchr(target, ' ');
+		if (version != NULL) {
+			*version = '\0';
+		}
+		char *query = strchr(target, '?');
+		if (query != NULL) {
+			*query++ = '\0';
+			parseQuery(query);
+		}
+		update_path = strcmp(target, OTA_PATH) == 0;
+		return;
+	}
+
+	char *value = strchr(line, ':');
+	if (value == NULL) {
+		return;
+	}
+	*value++ = '\0';
+	while (*value == ' ') {
+		value++;
+	}
+	if (strcasecmp(line, "Content-Length") == 0) {
+		size = strtoul(value, NULL, 10);
+		has_length = true;
+	} else if (strcasecmp(line, "Expect") == 0) {
+		expect_continue = strcasecmp(value, "100-continue") == 0;
+	}
+}
+
+/*
+ * Scan request data for complete lines, up to the blank line ending the
+ * headers. Returns the number of bytes used.
+ */
+size_t OtaServer::parse(const char *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		char ch = data[i];
+		if (ch == '\r') {
+			continue;
+		}
+		if (ch != '\n') {
+			// Overlong lines are truncated.
+			if (line_len < sizeof(line) - 1) {
+				line[line_len++] = ch;
+			}
+			continue;
+		}
+		if (line_len == 0 && request_line_done) {
+			startUpdate();
+			return i + 1;
+		}
+		line[line_len] = '\0';
+		parseLine();
+		line_len = 0;
+	}
+	return len;
+}
+
+void OtaServer::startUpdate()
+{
+	if (!update_path) {
+		respond("404 Not Found", "Not found");
+		return;
+	}
+	if (!upload_method) {
+		respond("405 Method Not Allowed", "Upload the image with PUT or POST");
+		return;
+	}
+	if (!password_ok) {
+		respond("403 Forbidden", "Wrong password");
+		fail(OTA_ERROR_AUTH);
+		return;
+	}
+	if (ready) {
+		respond("503 Service Unavailable", "Restarting into the last update");
+		return;
+	}
+	if (!has_length || size == 0) {
+		respond("411 Length Required", "Content-Length required");
+		fail(OTA_ERROR_REQUEST);
+		return;
+	}
+	if (md5[0] == '\0') {
+		respond("400 Bad Request", "md5 parameter missing or invalid");
+		fail(OTA_ERROR_REQUEST);
+		return;
+	}
+	if (!Update.begin(size)) {
+		respond("500 Internal Server Error", Update.getErrorString().c_str());
+		fail(Update.getError());
+		return;
+	}
+	Update.setMD5(md5);
+
+	state = STATE_BODY;
+	received = 0;
+	gzip = false;
+	start_ms = millis();
+	if (expect_continue && tcp_write(pcb, RESPONSE_CONTINUE, sizeof(RESPONSE_CONTINUE) - 1, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+		unacked += sizeof(RESPONSE_CONTINUE) - 1;
+		tcp_output(pcb);
+	}
+}
+
+void OtaServer::writeImage(uint8_t *data, size_t len)
+{
+	// Anything beyond Content-Length is ignored.
+	size_t n = min(len, (size_t)(size - received));
+
+	if (n == 0) {
+		return;
+	}
+	if (received == 0) {
+		gzip = data[0] == 0x1f;
+		emit(OTA_STARTED, gzip);
+	}
+	if (Update.write(data, n) != n) {
+		uint8_t err = Update.getError();
+		respond("500 Internal Server Error", Update.getErrorString().c_str());
+		Update.end();
+		fail(err);
+		return;
+	}
+	received += n;
+	if (received < size) {
+		return;
+	}
+
+	// Checks the MD5 and arms the bootloader to install the image.
+	if (!Update.end()) {
+		respond("500 Internal Server Error", Update.getErrorString().c_str());
+		fail(Update.getError());
+		return;
+	}
+	if (request_sketch_md5[0] != '\0') {
+		memcpy(sketch_md5, request_sketch_md5, sizeof(sketch_md5));
+	} else if (!gzip) {
+		memcpy(sketch_md5, md5, sizeof(sketch_md5));
+	} else {
+		sketch_md5[0] = '\0';
+	}
+	duration_ms = millis() - start_ms;
+	updates++;
+	ready = true;
+	completed = true;
+	respond("200 OK", "Update accepted, restarting");
+}
+
+void OtaServer::respond(const char *status, const char *text)
+{
+	char buf[192];
+	int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n%s\n", status, text);
+
+	state = STATE_RESPONSE;
+	n = min(n, (int)sizeof(buf) - 1);
+	if (n > 0 && tcp_write(pcb, buf, n, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+		unacked += n;
+		tcp_output(pcb);
+	}
+	if (unacked == 0) {
+		finish();
+	}
+}
+
+err_t OtaServer::receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+	OtaServer *server = (OtaServer *)arg;
+
+	if (p == NULL) {
+		// The client closed its side before the request was complete.
+		if (server != NULL && (server->state == STATE_HEADERS || server->state == STATE_BODY)) {
+			if (server->state == STATE_BODY) {
+				Update.end();
+				server->fail(OTA_ERROR_ABORTED);
+			}
+			server->finish();
+		}
+		return ERR_OK;
+	}
+	if (server == NULL || err != ERR_OK || server->state == STATE_RESPONSE) {
+		tcp_recved(pcb, p->tot_len);
+		pbuf_free(p);
+		return ERR_OK;
+	}
+
+	server->last_ms = millis();
+	for (struct pbuf *q = p; q != NULL; q = q->next) {
+		size_t offset = 0;
+		if (server->state == STATE_HEADERS) {
+			offset = server->parse((const char *)q->payload, q->len);
+		}
+		if (server->state == STATE_BODY && offset < q->len) {
+			server->writeImage((uint8_t *)q->payload + offset, q->len - offset);
+		}
+	}
+	// Only now that the data is in flash may the client send more.
+	if (server->pcb == pcb) {
+		tcp_recved(pcb, p->tot_len);
+	}
+	pbuf_free(p);
+	return ERR_OK;
+}
+
+err_t OtaServer::sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+	OtaServer *server = (OtaServer *)arg;
+	(void)pcb;
+
+	if (server == NULL) {
+		return ERR_OK;
+	}
+	server->unacked -= min(len, server->unacked);
+	server->last_ms = millis();
+	if (server->state == STATE_RESPONSE && server->unacked == 0) {
+		server->finish();
+	}
+	return ERR_OK;
+}
+
+err_t OtaServer::poll(void *arg, struct tcp_pcb *pcb)
+{
+	OtaServer *server = (OtaServer *)arg;
+	(void)pcb;
+
+	if (server != NULL && millis() - server->last_ms > OTA_TIMEOUT_MS) {
+		server->abort();
+		return ERR_ABRT;
+	}
+	return ERR_OK;
+}
+
+void OtaServer::error(void *arg, err_t err)
+{
+	OtaServer *server = (OtaServer *)arg;
+	(void)err;
+
+	// lwIP has already freed the PCB.
+	if (server == NULL) {
+		return;
+	}
+	server->pcb = NULL;
+	if (server->state == STATE_BODY) {
+		Update.end();
+		server->fail(OTA_ERROR_ABORTED);
+	}
+	server->state = STATE_FREE;
+	if (server->completed) {
+		server->completed = false;
+		server->emit(OTA_COMPLETED, 0);
+	}
+}
+
+/*
+ * Close the connection once the response has been sent. A completed update
+ * is only reported now, so that the restart doesn't cut off the response.
+ */
+void OtaServer::finish()
+{
+	tcp_arg(pcb, NULL);
+	tcp_recv(pcb, NULL);
+	tcp_sent(pcb, NULL);
+	tcp_poll(pcb, NULL, 0);
+	tcp_err(pcb, NULL);
+	if (tcp_close(pcb) != ERR_OK) {
+		tcp_abort(pcb);
+	}
+	pcb = NULL;
+	state = STATE_FREE;
+	if (completed) {
+		completed = false;
+		emit(OTA_COMPLETED, 0);
+	}
+}
+
+void OtaServer::abort()
+{
+	if (state == STATE_BODY) {
+		Update.end();
+		fail(OTA_ERROR_ABORTED);
+	}
+	tcp_arg(pcb, NULL);
+	tcp_err(pcb, NULL);
+	tcp_abort(pcb);
+	pcb = NULL;
+	state = STATE_FREE;
+	if (completed) {
+		completed = false;
+		emit(OTA_COMPLETED, 0);
+	}
+}
@@ -0,0 +1,117 @@
+/*
+ * OtaServer.h - firmware updates uploaded over HTTP
+ *
+ * An image is uploaded with PUT (or POST) to /update, with the MD5 of the
+ * uploaded file and the password as query parameters, e.g.
+ *
+ *   curl -T firmware.bin.gz 'http://<address>:8080/update?md5=<md5>&password=<password>'
+ *
+ * Each TCP segment is passed to the Updater from the lwIP receive callback
+ * and only then acknowledged to the network stack, so the sender is held to
+ * the speed of the flash writes and loop() runs between segments. The image
+ * may be gzip-compressed; the bootloader inflates it when it copies the new
+ * firmware into place at the next restart.
+ *
+ * The MD5 of the upload is checked before the image is accepted. Optionally
+ * 'sketch_md5' gives the MD5 of the uncompressed image, which is what
+ * ESP.getSketchMD5() reports once the new firmware runs. For an uncompressed
+ * upload it is the same as 'md5'.
+ */
+
+#ifndef _OTA_SERVER_h /* Include guard */
+#define _OTA_SERVER_h
+
+#include <Arduino.h>
+#include <lwip/tcp.h>
+
+#define OTA_PORT			8080
+#define OTA_PASSWORD_SIZE		50
+#define OTA_LINE_SIZE			192
+#define OTA_TIMEOUT_MS			10000
+
+enum OtaEvent {
+	OTA_STARTED,		// arg: 1 for a gzip-compressed image
+	OTA_COMPLETED,		// the image is verified and boots at the next restart
+	OTA_FAILED,		// arg: OtaError, or an Updater error code if positive
+};
+
+enum OtaError {
+	OTA_ERROR_AUTH = -1,		// wrong password
+	OTA_ERROR_REQUEST = -2,		// missing length or MD5
+	OTA_ERROR_ABORTED = -3,		// connection reset or timed out
+};
+
+class OtaServer {
+	enum State {
+		STATE_FREE,
+		STATE_HEADERS,		// reading the request headers
+		STATE_BODY,		// writing the image
+		STATE_RESPONSE,		// waiting for the response to be acknowledged
+	};
+
+	struct tcp_pcb *listener = NULL;
+	struct tcp_pcb *pcb = NULL;
+	char password[OTA_PASSWORD_SIZE] = "";
+	void (*event_fn)(OtaEvent event, int16_t arg) = NULL;
+
+	// The single connection.
+	uint8_t state = STATE_FREE;
+	char line[OTA_LINE_SIZE];
+	uint8_t line_len = 0;
+	bool request_line_done = false;
+	bool update_path = false;
+	bool upload_method = false;
+	bool password_ok = false;
+	bool has_length = false;
+	bool expect_continue = false;
+	char md5[33];
+	char request_sketch_md5[33];
+	uint32_t start_ms = 0;
+	uint32_t last_ms = 0;
+	uint16_t unacked = 0;
+	bool completed = false;
+
+	// Set once an image has been accepted.
+	bool ready = false;
+	char sketch_md5[33] = "";
+
+	static err_t accept(void *arg, struct tcp_pcb *pcb, err_t err);
+	static err_t receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+	static err_t sent(void *arg, struct tcp_pcb *pcb, u16_t len);
+	static err_t poll(void *arg, struct tcp_pcb *pcb);
+	static void error(void *arg, err_t err);
+
+	size_t parse(const char *data, size_t len);
+	void parseLine();
+	void parseQuery(char *query);
+	void startUpdate();
+	void writeImage(uint8_t *data, size_t len);
+	void respond(const char *status, const char *text);
+	void fail(int16_t error);
+	void finish();
+	void abort();
+	void emit(OtaEvent event, int16_t arg);
+
+    public:
+	// Starts listening. Uploads need 'password', which must not be empty.
+	bool begin(const char *password, uint16_t port = OTA_PORT);
+	void end();
+	bool running();
+
+	// Called from the network stack's callbacks.
+	void onEvent(void (*fn)(OtaEvent event, int16_t arg));
+
+	// The expected ESP.getSketchMD5() of the accepted image, or "" if
+	// unknown.
+	const char *sketchMD5();
+
+	uint32_t updates = 0;
+	uint32_t failures = 0;
+	uint32_t rejected = 0;		// connections while one was active
+	uint32_t size = 0;		// of the current or last upload
+	uint32_t received = 0;
+	bool gzip = false;
+	uint32_t duration_ms = 0;	// of the last completed upload
+};
+
+#endif // _OTA_SERVER_h
@@ -0,0 +1,318 @@
+#include <CivilDate.h>
+#include "PosixTz.h"
+
+// Offsets are within a day, transition times within a week (RFC 8536).
+#define MAX_OFFSET_HOURS	24
+#define MAX_TIME_HOURS		167
+#define DEFAULT_TIME		(2 * 3600)
+
+static const char *parseNumber(const char *&p, int32_t min, int32_t max, int32_t &value)
+{
+	if (!isdigit(*p)) {
+		return "expected a number";
+	}
+	const char *start = p;
+	value = 0;
+	while (isdigit(*p)) {
+		value = value * 10 + (*p++ - '0');
+		if (value > max) {
+			p = start;
+			return "number out of range";
+		}
+	}
+	if (value < min) {
+		p = start;
+		return "number out of range";
+	}
+	return NULL;
+}
+
+// A name of letters, or <quoted> with digits and signs, e.g. "<+0530>".
+static const char *parseName(const char *&p, char (&name)[POSIX_TZ_NAME_SIZE])
+{
+	const char *start = p;
+	bool quoted = *p == '<';
+	uint8_t n = 0;
+
+	if (quoted) {
+		p++;
+	}
+	while (isalpha(*p) || (quoted && (isdigit(*p) || *p == '+' || *p == '-'))) {
+		if (n == POSIX_TZ_NAME_SIZE - 1) {
+			p = start;
+			return "name longer than 7 characters";
+		}
+		name[n++] = *p++;
+	}
+	name[n] = '\0';
+	if (n < 3) {
+		p = start;
+		return "expected a name of at least 3 characters";
+	}
+	if (quoted && *p++ != '>') {
+		p--;
+		return "expected '>'";
+	}
+	return NULL;
+}
+
+// [+-]hh[:mm[:ss]], in seconds.
+static const char *parseTime(const char *&p, int32_t max_hours, int32_t &seconds)
+{
+	int32_t sign = 1, hours, minutes = 0, secs = 0;
+	const char *error;
+
+	if (*p == '+' || *p == '-') {
+		sign = *p++ == '-' ? -1 : 1;
+	}
+	if ((error = parseNumber(p, 0, max_hours, hours)) != NULL) {
+		return error;
+	}
+	if (*p == ':') {
+		p++;
+		if ((error = parseNumber(p, 0, 59, minutes)) != NULL) {
+			return error;
+		}
+		if (*p == ':') {
+			p++;
+			if ((error = parseNumber(p, 0, 59, secs)) != NULL) {
+				return error;
+			}
+		}
+	}
+	seconds = sign * (hours * 3600 + minutes * 60 + secs);
+	return NULL;
+}
+
+static const char *parseDate(const char *&p, PosixTzTransition &tr)
+{
+	int32_t v;
+	const char *error;
+
+	if (*p == 'J') {
+		p++;
+		tr.kind = POSIX_TZ_DATE_JULIAN;
+		if ((error = parseNumber(p, 1, 365, v)) != NULL) {
+			return error;
+		}
+		tr.day = v;
+	} else if (isdigit(*p)) {
+		tr.kind = POSIX_TZ_DATE_DAY_OF_YEAR;
+		if ((error = parseNumber(p, 0, 365, v)) != NULL) {
+			return error;
+		}
+		tr.day = v;
+	} else if (*p == 'M') {
+		p++;
+		tr.kind = POSIX_TZ_DATE_MONTH_WEEK_DAY;
+		if ((error = parseNumber(p, 1, 12, v)) != NULL) {
+			return error;
+		}
+		tr.month = v;
+		if (*p++ != '.') {
+			p--;
+			return "expected '.'";
+		}
+		if ((error = parseNumber(p, 1, 5, v)) != NULL) {
+			return error;
+		}
+		tr.week = v;
+		if (*p++ != '.') {
+			p--;
+			return "expected '.'";
+		}
+		if ((error = parseNumber(p, 0, 6, v)) != NULL) {
+			return error;
+		}
+		tr.weekday = v;
+	} else {
+		return "expected a date: Jn, n or Mm.w.d";
+	}
+
+	tr.time = DEFAULT_TIME;
+	if (*p == '/') {
+		p++;
+		return parseTime(p, MAX_TIME_HOURS, tr.time);
+	}
+	return NULL;
+}
+
+bool PosixTimeZone::parse(const char *rule)
+{
+	PosixTimeZone z;
+	const char *p = rule;
+	const char *error;
+	int32_t offset;
+
+	if ((error = parseName(p, z.std_name)) != NULL || (error = parseTime(p, MAX_OFFSET_HOURS, offset)) != NULL) {
+		goto fail;
+	}
+	// POSIX offsets are west of UTC.
+	z.std_offset = -offset;
+	z.dst_offset = z.std_offset;
+
+	if (*p != '\0') {
+		if ((error = parseName(p, z.dst_name)) != NULL) {
+			goto fail;
+		}
+		z.has_dst = true;
+		z.dst_offset = z.std_offset + 3600;
+		if (*p != '\0' && *p != ',') {
+			if ((error = parseTime(p, MAX_OFFSET_HOURS, offset)) != NULL) {
+				goto fail;
+			}
+			z.dst_offset = -offset;
+		}
+		if (*p == '\0') {
+			// The US rules: from the second Sunday of March to the
+			// first Sunday of November.
+			z.dst_start = { POSIX_TZ_DATE_MONTH_WEEK_DAY, 3, 2, 0, 0, DEFAULT_TIME };
+			z.dst_end = { POSIX_TZ_DATE_MONTH_WEEK_DAY, 11, 1, 0, 0, DEFAULT_TIME };
+		} else {
+			if (*p++ != ',') {
+				p--;
+				error = "expected ','";
+				goto fail;
+			}
+			if ((error = parseDate(p, z.dst_start)) != NULL) {
+				goto fail;
+			}
+			if (*p++ != ',') {
+				p--;
+				error = "expected ','";
+				goto fail;
+			}
+			if ((error = parseDate(p, z.dst_end)) != NULL) {
+				goto fail;
+			}
+		}
+	}
+	if (*p != '\0') {
+		error = "unexpected character";
+		goto fail;
+	}
+
+	// FNV-1a.
+	z.zone_id = 2166136261u;
+	for (p = rule; *p != '\0'; p++) {
+		z.zone_id = (z.zone_id ^ (uint8_t)*p) * 16777619u;
+	}
+	z.hits = hits;
+	z.misses = misses;
+	*this = z;
+	return true;
+
+fail:
+	error_message = error;
+	error_offset = p - rule;
+	return false;
+}
+
+/*
+ * The time of the transition in 'year', in Unix seconds, given the offset in
+ * effect before it.
+ */
+int64_t PosixTimeZone::transitionAt(const PosixTzTransition &tr, int32_t year, int32_t offset) const
+{
+	int32_t days;
+
+	switch (tr.kind) {
+	case POSIX_TZ_DATE_JULIAN:
+		days = civil::daysFromCivil(year, 1, 1) + tr.day - 1;
+		if (tr.day >= 60 && civil::isLeapYear(year)) {
+			days++;
+		}
+		break;
+	case POSIX_TZ_DATE_DAY_OF_YEAR:
+		days = civil::daysFromCivil(year, 1, 1) + tr.day;
+		break;
+	default: {
+		// The first such weekday of the month, then the week. The
+		// fifth week is the last, which may be the fourth.
+		int32_t first = civil::daysFromCivil(year, tr.month, 1);
+		uint8_t weekday = civil::weekdayFromDays(first) - 1;
+		days = first + (tr.weekday - weekday + 7) % 7 + 7 * (tr.week - 1);
+		if (days >= first + civil::daysInMonth(year, tr.month)) {
+			days -= 7;
+		}
+		break;
+	}
+	}
+	return (int64_t)days * civil::SECONDS_PER_DAY + tr.time - offset;
+}
+
+/*
+ * Find the transitions around 't' among those of the years before and after
+ * its own, so that rules crossing the new year, as in the southern
+ * hemisphere, need no special case.
+ */
+void PosixTimeZone::lookup(int64_t t) const
+{
+	struct {
+		int64_t at;
+		bool dst;
+	} tr[6];
+	uint8_t n = 0;
+
+	misses++;
+	if (!has_dst) {
+		cached_from = INT64_MIN;
+		cached_until = INT64_MAX;
+		cached_offset = std_offset;
+		cached_dst = false;
+		return;
+	}
+
+	int32_t year = civil::fromUnix(t + std_offset).year;
+	for (int32_t y = year - 1; y <= year + 1; y++) {
+		tr[n++] = { transitionAt(dst_start, y, std_offset), true };
+		tr[n++] = { transitionAt(dst_end, y, dst_offset), false };
+	}
+	// Sorted by time. When DST ends as it starts again, as in a rule for
+	// DST all year, the end goes first.
+	for (uint8_t i = 1; i < n; i++) {
+		for (uint8_t j = i; j > 0; j--) {
+			if (tr[j - 1].at < tr[j].at || (tr[j - 1].at == tr[j].at && !tr[j - 1].dst)) {
+				break;
+			}
+			auto swap = tr[j];
+			tr[j] = tr[j - 1];
+			tr[j - 1] = swap;
+		}
+	}
+
+	uint8_t i = 0;
+	while (i < n && tr[i].at <= t) {
+		i++;
+	}
+	cached_from = i > 0 ? tr[i - 1].at : INT64_MIN;
+	cached_until = i < n ? tr[i].at : INT64_MAX;
+	cached_dst = i > 0 ? tr[i - 1].dst : !tr[0].dst;
+	cached_offset = cached_dst ? dst_offset : std_offset;
+}
+
+bool PosixTimeZone::isDstAt(int64_t t) const
+{
+	offsetAt(t);
+	return cached_dst;
+}
+
+const char *PosixTimeZone::nameAt(int64_t t) const
+{
+	return isDstAt(t) ? dst_name : std_name;
+}
+
+uint32_t PosixTimeZone::id() const
+{
+	return zone_id;
+}
+
+const char *PosixTimeZone::error() const
+{
+	return error_message;
+}
+
+uint8_t PosixTimeZone::errorOffset() const
+{
+	return error_offset;
+}
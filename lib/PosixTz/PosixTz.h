@@ -0,0 +1,98 @@
+/*
+ * PosixTz.h - time zones given as POSIX TZ rule strings
+ *
+ * A rule such as "CET-1CEST,M3.5.0,M10.5.0/3" names the standard time and
+ * its offset west of UTC, and optionally the daylight saving time, its
+ * offset, and the local times at which it starts and ends each year. This
+ * is the format of the last line of a TZif file (RFC 8536), so it describes
+ * a zone's current rules without its history, in a few dozen bytes instead
+ * of the zone database and its processor.
+ *
+ * The transitions of a year are computed in closed form from the rule with
+ * the calendar arithmetic of CivilDate. offsetAt() keeps the interval between
+ * the transitions around the last time looked up, so consecutive lookups
+ * compare the time with its bounds and return.
+ *
+ * Supported are names of 3 to 7 letters or <quoted> names with digits and
+ * signs, offsets [+-]hh[:mm[:ss]], and the rule dates Jn, n and Mm.w.d, with
+ * transition times of -167 to 167 hours as in RFC 8536. Without a rule, DST
+ * follows the US rules, as glibc does.
+ */
+
+#ifndef _POSIX_TZ_h /* Include guard */
+#define _POSIX_TZ_h
+
+#include <Arduino.h>
+
+// Holds a name of up to 7 characters.
+#define POSIX_TZ_NAME_SIZE		8
+
+enum PosixTzDateKind : uint8_t {
+	POSIX_TZ_DATE_JULIAN,		// Jn, 1-365, February 29 not counted
+	POSIX_TZ_DATE_DAY_OF_YEAR,	// n, 0-365
+	POSIX_TZ_DATE_MONTH_WEEK_DAY,	// Mm.w.d
+};
+
+// When DST starts or ends.
+struct PosixTzTransition {
+	PosixTzDateKind kind;
+	uint8_t month;		// 1-12
+	uint8_t week;		// 1-5, 5 is the last
+	uint8_t weekday;	// 0-6, Sunday is 0
+	uint16_t day;		// of the year, for Jn and n
+	int32_t time;		// seconds from local midnight
+};
+
+class PosixTimeZone {
+	char std_name[POSIX_TZ_NAME_SIZE] = "UTC";
+	char dst_name[POSIX_TZ_NAME_SIZE] = "";
+	int32_t std_offset = 0;		// seconds east of UTC
+	int32_t dst_offset = 0;
+	bool has_dst = false;
+	PosixTzTransition dst_start = {};
+	PosixTzTransition dst_end = {};
+	uint32_t zone_id = 0;
+
+	// The interval [cached_from, cached_until) of the last lookup, during
+	// which the offset is cached_offset.
+	mutable int64_t cached_from = 1;
+	mutable int64_t cached_until = 0;
+	mutable int32_t cached_offset = 0;
+	mutable bool cached_dst = false;
+
+	const char *error_message = NULL;
+	uint8_t error_offset = 0;
+
+	int64_t transitionAt(const PosixTzTransition &tr, int32_t year, int32_t offset) const;
+	void lookup(int64_t t) const;
+
+    public:
+	// Parses 'rule'. On an error, keeps the zone parsed before and returns
+	// false; error() and errorOffset() tell why and where.
+	bool parse(const char *rule);
+
+	// The offset from UTC at 't', in seconds east.
+	int32_t offsetAt(int64_t t) const
+	{
+		if (t >= cached_from && t < cached_until) {
+			hits++;
+		} else {
+			lookup(t);
+		}
+		return cached_offset;
+	}
+
+	bool isDstAt(int64_t t) const;
+	const char *nameAt(int64_t t) const;	// e.g. "CEST"
+
+	// A hash of the rule, which changes when another rule is parsed.
+	uint32_t id() const;
+
+	const char *error() const;
+	uint8_t errorOffset() const;
+
+	mutable uint32_t hits = 0;	// lookups within the cached interval
+	mutable uint32_t misses = 0;	// lookups computing the transitions
+};
+
+#endif // _POSIX_TZ_h
@@ -0,0 +1,164 @@
+#include <EEPROM.h>
+#include "Settings.h"
+
+/*
+ * Numbers are copied between their variables, a uint32_t and the EEPROM by
+ * their size, which holds on the little-endian ESP8266.
+ */
+static uint32_t unsetNumber(const Setting &s)
+{
+	return s.size >= 4 ? 0xffffffff : (1UL << (8 * s.size)) - 1;
+}
+
+const Setting *Settings::find(const char *command, const char *&value) const
+{
+	for (uint8_t i = 0; i < count; i++) {
+		size_t n = strlen(settings[i].name);
+		if (strncmp(command, settings[i].name, n) == 0 && command[n] == ' ' && command[n + 1] != '\0') {
+			value = command + n + 1;
+			return &settings[i];
+		}
+	}
+	return NULL;
+}
+
+const Setting *Settings::named(const char *name) const
+{
+	for (uint8_t i = 0; i < count; i++) {
+		if (strcmp(name, settings[i].name) == 0) {
+			return &settings[i];
+		}
+	}
+	return NULL;
+}
+
+// Prints a value laid out as in the variable, or the EEPROM.
+void Settings::print(const char *tag, const Setting &s, const void *value) const
+{
+	Serial.print(tag);
+	Serial.print(s.name);
+	Serial.print(": ");
+	if (s.type != SETTING_STRING) {
+		uint32_t number = 0;
+		memcpy(&number, value, s.size);
+		Serial.println(number);
+	} else if (((const char *)value)[0] == '\0') {
+		Serial.println(s.empty);
+	} else {
+		Serial.println(s.secret ? "(set)" : (const char *)value);
+	}
+}
+
+void Settings::store(const Setting &s) const
+{
+	memcpy(EEPROM.getDataPtr() + s.address, s.value, s.size);
+}
+
+bool Settings::parse(const Setting &s, const char *text, uint32_t &number) const
+{
+	if (s.type == SETTING_STRING) {
+		size_t length = strlen(text);
+		if (length < s.min || length > s.max) {
+			Serial.print("[EEPROM] ");
+			Serial.print(s.name);
+			Serial.print(" must be ");
+			Serial.print(s.min);
+			Serial.print(" to ");
+			Serial.print(s.max);
+			Serial.println(" characters long.");
+			return false;
+		}
+		return s.check == NULL || s.check(text);
+	}
+
+	char *end;
+	unsigned long long v = strtoull(text, &end, 10);
+	if (!isdigit(text[0]) || *end != '\0' || v < s.min || v > s.max) {
+		Serial.print("[EEPROM] ");
+		Serial.print(s.name);
+		Serial.print(" must be a number from ");
+		Serial.print(s.min);
+		Serial.print(" to ");
+		Serial.print(s.max);
+		Serial.println(".");
+		return false;
+	}
+	number = v;
+	return true;
+}
+
+bool Settings::set(const Setting &s, const char *value) const
+{
+	uint32_t number = 0;
+	if (!parse(s, value, number)) {
+		return false;
+	}
+	if (s.type == SETTING_STRING) {
+		strncpy((char *)s.value, value, s.size);
+	} else {
+		memcpy(s.value, &number, s.size);
+	}
+	print("[EEPROM Write] ", s, s.value);
+	store(s);
+	if (s.apply != NULL) {
+		s.apply();
+	}
+	return true;
+}
+
+bool Settings::unset(const Setting &s) const
+{
+	if (s.type != SETTING_STRING) {
+		Serial.print("[EEPROM] ");
+		Serial.print(s.name);
+		Serial.println(" is a number and can't be unset.");
+		return false;
+	}
+	return set(s, "");
+}
+
+void Settings::load() const
+{
+	for (uint8_t i = 0; i < count; i++) {
+		const Setting &s = settings[i];
+		memcpy(s.value, EEPROM.getConstDataPtr() + s.address, s.size);
+
+		if (s.type == SETTING_STRING) {
+			char *value = (char *)s.value;
+			value[s.size - 1] = '\0';
+			size_t length = strlen(value);
+			if ((uint8_t)value[0] == 0xff || length < s.min || (s.check != NULL && !s.check(value))) {
+				strncpy(value, s.default_string, s.size);
+			}
+		} else {
+			uint32_t number = 0;
+			memcpy(&number, s.value, s.size);
+			if (number == unsetNumber(s) || number < s.min || number > s.max) {
+				memcpy(s.value, &s.default_number, s.size);
+			}
+		}
+		print("[EEPROM Read] ", s, s.value);
+	}
+}
+
+void Settings::reset() const
+{
+	for (uint8_t i = 0; i < count; i++) {
+		const Setting &s = settings[i];
+		uint8_t *p = EEPROM.getDataPtr() + s.address;
+		if (s.type == SETTING_STRING) {
+			strncpy((char *)p, s.default_string, s.size);
+		} else {
+			memcpy(p, &s.default_number, s.size);
+		}
+		print("[EEPROM Reset] ", s, p);
+	}
+}
+
+void Settings::printNames(Print &out) const
+{
+	for (uint8_t i = 0; i < count; i++) {
+		out.print(settings[i].name);
+		out.print(", ");
+	}
+}
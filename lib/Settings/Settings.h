@@ -0,0 +1,126 @@
+/*
+ * Settings.h - settings kept in the EEPROM, described by a table
+ *
+ * Each setting gives its name, the variable holding it, its place in the
+ * EEPROM, its bounds and default, and an optional hook applying a new value.
+ * Setting, loading, resetting and printing are the same code for all of them:
+ * a value is only stored once it parses and is within its bounds, and a value
+ * read back that is unset (all ones) or out of bounds is replaced with the
+ * default.
+ *
+ * The table is constexpr, so overlaps() can check its EEPROM layout at
+ * compile time.
+ */
+
+#ifndef _SETTINGS_h /* Include guard */
+#define _SETTINGS_h
+
+#include <Arduino.h>
+
+enum SettingType : uint8_t {
+	SETTING_UINT8,
+	SETTING_UINT16,
+	SETTING_UINT32,
+	SETTING_STRING,
+};
+
+struct Setting {
+	const char *name;
+	SettingType type;
+	void *value;
+	uint16_t address;	// in the EEPROM
+	uint16_t size;		// in bytes, with a string's terminator
+	uint32_t min, max;	// bounds of a number, or of a string's length
+	uint32_t default_number;
+	const char *default_string;
+	// Printed for an empty string. A secret string prints as "(set)"
+	// otherwise.
+	const char *empty;
+	bool secret;
+	// Checks a string beyond its length, printing why it is rejected.
+	bool (*check)(const char *value);
+	// Applies a new value, e.g. restarts what uses it.
+	void (*apply)();
+};
+
+constexpr Setting settingUint8(const char *name, uint8_t &value, uint16_t address, uint8_t min, uint8_t max,
+			       uint8_t default_value, void (*apply)() = NULL)
+{
+	return { name, SETTING_UINT8, &value, address, 1, min, max, default_value, NULL, NULL, false, NULL, apply };
+}
+
+constexpr Setting settingUint16(const char *name, uint16_t &value, uint16_t address, uint16_t min, uint16_t max,
+				uint16_t default_value, void (*apply)() = NULL)
+{
+	return { name, SETTING_UINT16, &value, address, 2, min, max, default_value, NULL, NULL, false, NULL, apply };
+}
+
+constexpr Setting settingUint32(const char *name, uint32_t &value, uint16_t address, uint32_t min, uint32_t max,
+				uint32_t default_value, void (*apply)() = NULL)
+{
+	return { name, SETTING_UINT32, &value, address, 4, min, max, default_value, NULL, NULL, false, NULL, apply };
+}
+
+// The string's size is that of its buffer.
+template <size_t N>
+constexpr Setting settingString(const char *name, char (&value)[N], uint16_t address, uint16_t min_length,
+				const char *default_value, void (*apply)() = NULL, bool (*check)(const char *) = NULL,
+				const char *empty = "", bool secret = false)
+{
+	return { name, SETTING_STRING, value, address, N, min_length, N - 1, 0, default_value, empty, secret, check, apply };
+}
+
+class Settings {
+	const Setting *settings;
+	uint8_t count;
+
+	void print(const char *tag, const Setting &s, const void *value) const;
+	void store(const Setting &s) const;
+	bool parse(const Setting &s, const char *text, uint32_t &number) const;
+
+    public:
+	constexpr Settings(const Setting *settings, uint8_t count) : settings(settings), count(count)
+	{
+	}
+
+	// Whether any two settings share EEPROM bytes, or one uses the
+	// 'reserved_size' bytes at 'reserved' or reaches 'end'.
+	static constexpr bool overlaps(const Setting *settings, size_t count, uint16_t reserved, uint16_t reserved_size,
+				       uint16_t end)
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (settings[i].address + settings[i].size > end ||
+			    (settings[i].address < reserved + reserved_size &&
+			     reserved < settings[i].address + settings[i].size)) {
+				return true;
+			}
+			for (size_t j = i + 1; j < count; j++) {
+				if (settings[i].address < settings[j].address + settings[j].size &&
+				    settings[j].address < settings[i].address + settings[i].size) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// The setting that 'command', "name value", sets, and its value. A
+	// command without a value sets nothing, so that a mistyped one doesn't
+	// clear a setting: that takes unset().
+	const Setting *find(const char *command, const char *&value) const;
+	const Setting *named(const char *name) const;
+
+	// Parses, checks and stores a value in RAM and the EEPROM, then
+	// applies it. Prints the value written, or why it was rejected.
+	bool set(const Setting &s, const char *value) const;
+	// Sets a string setting to "", if its bounds allow it.
+	bool unset(const Setting &s) const;
+
+	void load() const;	// all settings from the EEPROM
+	void reset() const;	// the defaults to the EEPROM, not to RAM
+
+	// The names, separated by ", ".
+	void printNames(Print &out) const;
+};
+
+#endif // _SETTINGS_h
@@ -0,0 +1,207 @@
+#include "SntpServer.h"
+
+#define NTP_PACKET_SIZE		48
+#define NTP_UNIX_OFFSET		2208988800UL	// seconds from 1900 to 1970
+#define NTP_MODE_CLIENT		3
+#define NTP_MODE_SERVER		4
+#define NTP_LI_ALARM		3
+#define NTP_STRATUM		2
+#define NTP_PRECISION		-10		// about 1 ms, the RTC tick's interrupt latency
+// The upstream sync only has a resolution of one second.
+#define NTP_BASE_DISPERSION_MS	1000
+#define NTP_DRIFT_PPM		15
+
+static void put32(uint8_t *dst, uint32_t v)
+{
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+}
+
+bool SntpServer::begin(uint16_t port)
+{
+	if (pcb != NULL) {
+		return true;
+	}
+	pcb = udp_new();
+	if (pcb == NULL) {
+		return false;
+	}
+	if (udp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK) {
+		udp_remove(pcb);
+		pcb = NULL;
+		return false;
+	}
+	udp_recv(pcb, receive, this);
+	return true;
+}
+
+void SntpServer::end()
+{
+	if (pcb != NULL) {
+		udp_remove(pcb);
+		pcb = NULL;
+	}
+}
+
+bool SntpServer::running()
+{
+	return pcb != NULL;
+}
+
+void SntpServer::setClock(time_t seconds, uint32_t at_us)
+{
+	clock_seconds = seconds;
+	clock_us = at_us;
+}
+
+void SntpServer::setLastSync(time_t t)
+{
+	last_sync = t;
+}
+
+bool SntpServer::synchronized()
+{
+	return last_sync != 0 && clock_seconds >= last_sync && clock_seconds - last_sync < SNTP_MAX_SYNC_AGE;
+}
+
+/*
+ * Write the NTP timestamp of the micros() value 'us' to 'dst'.
+ */
+void SntpServer::timestamp(uint8_t *dst, uint32_t us)
+{
+	uint32_t elapsed = us - clock_us;
+	uint32_t seconds = clock_seconds + NTP_UNIX_OFFSET + elapsed / 1000000;
+	uint32_t fraction = ((uint64_t)(elapsed % 1000000) << 32) / 1000000;
+
+	put32(dst, seconds);
+	put32(dst + 4, fraction);
+}
+
+void SntpServer::receive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+	uint32_t rx_us = micros();
+	(void)pcb;
+
+	((SntpServer *)arg)->handle(p, addr, port, rx_us);
+	pbuf_free(p);
+}
+
+void SntpServer::handle(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us)
+{
+	uint32_t now_ms = millis();
+
+	requests++;
+
+	// The reply is written over the request, so it must be contiguous.
+	if (p->len != p->tot_len || p->len < NTP_PACKET_SIZE) {
+		malformed++;
+		return;
+	}
+	uint8_t *pkt = (uint8_t *)p->payload;
+	uint8_t version = (pkt[0] >> 3) & 0x07;
+	if ((pkt[0] & 0x07) != NTP_MODE_CLIENT || version < 1 || version > 4) {
+		malformed++;
+		return;
+	}
+
+	if (clock_seconds == 0 || !allowGlobal(now_ms)) {
+		dropped++;
+		return;
+	}
+	bool kiss = !allowClient(ip4_addr_get_u32(ip_2_ip4(addr)), now_ms);
+
+	// Drop any extension fields or MAC.
+	pbuf_realloc(p, NTP_PACKET_SIZE);
+
+	// The client's transmit timestamp becomes the originate timestamp.
+	memcpy(pkt + 24, pkt + 40, 8);
+
+	if (kiss) {
+		pkt[0] = NTP_LI_ALARM << 6 | version << 3 | NTP_MODE_SERVER;
+		pkt[1] = 0;
+		memset(pkt + 2, 0, 10);
+		memcpy(pkt + 12, "RATE", 4);
+		memset(pkt + 16, 0, 8);
+		memset(pkt + 32, 0, 16);
+		udp_sendto(pcb, p, addr, port);
+		rate_limited++;
+		return;
+	}
+
+	bool synced = synchronized();
+	uint32_t age = synced ? clock_seconds - last_sync : 0;
+	uint32_t dispersion_ms = NTP_BASE_DISPERSION_MS + (uint64_t)age * NTP_DRIFT_PPM / 1000;
+
+	pkt[0] = (synced ? 0 : NTP_LI_ALARM) << 6 | version << 3 | NTP_MODE_SERVER;
+	pkt[1] = synced ? NTP_STRATUM : 16;
+	// pkt[2], the poll interval, is the client's.
+	pkt[3] = (uint8_t)NTP_PRECISION;
+	put32(pkt + 4, 0);					// root delay
+	put32(pkt + 8, ((uint64_t)dispersion_ms << 16) / 1000);	// root dispersion
+	// The upstream server isn't known, so there is no reference ID.
+	put32(pkt + 12, 0);
+	put32(pkt + 16, synced ? last_sync + NTP_UNIX_OFFSET : 0);	// reference timestamp
+	put32(pkt + 20, 0);
+	timestamp(pkt + 32, rx_us);
+
+	uint32_t tx_us = micros();
+	timestamp(pkt + 40, tx_us);
+	if (udp_sendto(pcb, p, addr, port) == ERR_OK) {
+		responses++;
+	}
+
+	last_service_us = tx_us - rx_us;
+	if (last_service_us > max_service_us) {
+		max_service_us = last_service_us;
+	}
+}
+
+/*
+ * Per-client token bucket. The least recently seen client is forgotten when
+ * a new one arrives and all slots are taken.
+ */
+bool SntpServer::allowClient(uint32_t ip, uint32_t now_ms)
+{
+	static const uint32_t MAX_CREDIT_MS = SNTP_CLIENT_BURST * SNTP_CLIENT_INTERVAL_MS;
+	Client *c = NULL;
+
+	for (uint8_t i = 0; i < SNTP_CLIENT_SLOTS; i++) {
+		if (clients[i].ip == ip) {
+			c = &clients[i];
+			break;
+		}
+		if (c == NULL || now_ms - clients[i].last_ms > now_ms - c->last_ms) {
+			c = &clients[i];
+		}
+	}
+	if (c->ip != ip) {
+		c->ip = ip;
+		c->credit_ms = MAX_CREDIT_MS;
+	} else {
+		uint32_t elapsed = now_ms - c->last_ms;
+		c->credit_ms = elapsed >= MAX_CREDIT_MS - c->credit_ms ? MAX_CREDIT_MS : c->credit_ms + elapsed;
+	}
+	c->last_ms = now_ms;
+
+	if (c->credit_ms < SNTP_CLIENT_INTERVAL_MS) {
+		return false;
+	}
+	c->credit_ms -= SNTP_CLIENT_INTERVAL_MS;
+	return true;
+}
+
+bool SntpServer::allowGlobal(uint32_t now_ms)
+{
+	uint32_t refill = (uint64_t)(now_ms - global_ms) * SNTP_MAX_RATE / 1000;
+	if (refill > 0) {
+		global_tokens = min(global_tokens + refill, (uint32_t)SNTP_MAX_RATE);
+		global_ms = now_ms;
+	}
+	if (global_tokens == 0) {
+		return false;
+	}
+	global_tokens--;
+	return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * SntpServer.h - SNTP server (RFC 4330) answering from the clock's time
+ *
+ * Requests are handled directly in the lwIP receive callback, so the receive
+ * and transmit timestamps don't include the time spent waiting for loop().
+ * The callback runs in the system context, which never preempts loop(), so
+ * the clock state set from loop() is always seen consistently.
+ *
+ * The served time is extrapolated with micros() from the system time at the
+ * last RTC 1 Hz tick. Stratum, leap indicator and root dispersion follow the
+ * last upstream NTP sync: without a sync in the last SNTP_MAX_SYNC_AGE
+ * seconds the server reports itself as unsynchronized.
+ *
+ * Each client may send SNTP_CLIENT_BURST requests in a burst and one per
+ * SNTP_CLIENT_INTERVAL_MS on average; it gets a RATE kiss-o'-death reply
+ * beyond that. All replies together are limited to SNTP_MAX_RATE per second.
+ */
+
+#ifndef _SNTP_SERVER_h /* Include guard */
+#define _SNTP_SERVER_h
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <lwip/udp.h>
+
+#define SNTP_PORT			123
+#define SNTP_MAX_SYNC_AGE		86400
+#define SNTP_CLIENT_SLOTS		8
+#define SNTP_CLIENT_BURST		8
+#define SNTP_CLIENT_INTERVAL_MS		1000
+#define SNTP_MAX_RATE			100
+
+class SntpServer {
+	struct Client {
+		uint32_t ip;
+		uint32_t last_ms;
+		uint32_t credit_ms;	// SNTP_CLIENT_INTERVAL_MS per request allowed
+	};
+
+	struct udp_pcb *pcb = NULL;
+	time_t clock_seconds = 0;
+	uint32_t clock_us = 0;
+	time_t last_sync = 0;
+	Client clients[SNTP_CLIENT_SLOTS] = {};
+	uint32_t global_ms = 0;
+	uint32_t global_tokens = SNTP_MAX_RATE;
+
+	static void receive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+	void handle(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us);
+	bool allowClient(uint32_t ip, uint32_t now_ms);
+	bool allowGlobal(uint32_t now_ms);
+	void timestamp(uint8_t *dst, uint32_t us);
+
+    public:
+	bool begin(uint16_t port = SNTP_PORT);
+	void end();
+	bool running();
+
+	// The system time and the micros() timestamp at which that second
+	// started. Until this is called, requests are ignored.
+	void setClock(time_t seconds, uint32_t at_us);
+	// Time of the last successful upstream sync.
+	void setLastSync(time_t t);
+	bool synchronized();
+
+	uint32_t requests = 0;
+	uint32_t responses = 0;
+	uint32_t rate_limited = 0;	// answered with a RATE kiss-o'-death
+	uint32_t dropped = 0;		// over the global rate, or before the clock was set
+	uint32_t malformed = 0;
+	uint32_t last_service_us = 0;	// receive to transmit timestamp
+	uint32_t max_service_us = 0;
+};
+
+#endif // _SNTP_SERVER_h
@@ -0,0 +1,386 @@
+#include "TickSync.h"
+
+// All packets start with "NT", the version, the type and the leader's epoch,
+// followed by four 32-bit big-endian fields:
+//
+//	SYNC		seconds, edge to transmit
+//	DELAY_REQ	follower transmit time, phase error, round trip
+//	DELAY_RESP	follower transmit time, seconds, edge to receive,
+//			edge to transmit
+#define PACKET_SIZE		24
+#define PACKET_VERSION		1
+#define TYPE_SYNC		1
+#define TYPE_DELAY_REQ		2
+#define TYPE_DELAY_RESP		3
+
+static void put32(uint8_t *dst, uint32_t v)
+{
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+}
+
+static uint32_t get32(const uint8_t *src)
+{
+	return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | src[3];
+}
+
+static void header(uint8_t *pkt, uint8_t type, uint8_t epoch)
+{
+	memset(pkt, 0, PACKET_SIZE);
+	pkt[0] = 'N';
+	pkt[1] = 'T';
+	pkt[2] = PACKET_VERSION;
+	pkt[3] = type;
+	pkt[4] = epoch;
+}
+
+bool TickSync::begin(TickSyncMode mode, uint16_t port)
+{
+	end();
+	if (mode == TICK_SYNC_OFF) {
+		return true;
+	}
+	pcb = udp_new();
+	if (pcb == NULL) {
+		return false;
+	}
+	if (udp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK) {
+		udp_remove(pcb);
+		pcb = NULL;
+		return false;
+	}
+	ip_set_option(pcb, SOF_BROADCAST);
+	udp_recv(pcb, receive, this);
+	role = mode;
+	local_port = port;
+	return true;
+}
+
+void TickSync::end()
+{
+	if (pcb != NULL) {
+		udp_remove(pcb);
+		pcb = NULL;
+	}
+	role = TICK_SYNC_OFF;
+	have_edge = false;
+	leader_ip = 0;
+	request_due = false;
+	request_outstanding = false;
+	unlock();
+}
+
+bool TickSync::running()
+{
+	return pcb != NULL;
+}
+
+TickSyncMode TickSync::mode()
+{
+	return role;
+}
+
+void TickSync::edge(time_t seconds, uint32_t at_us)
+{
+	if (role != TICK_SYNC_LEADER) {
+		return;
+	}
+
+	// Count the seconds at the edges rather than taking the system time,
+	// whose second boundary drifts from the RTC's between NTP syncs. A
+	// missed edge, a moved edge or a time step starts a new epoch.
+	if (have_edge) {
+		uint32_t interval = at_us - edge_us;
+		uint32_t n = (interval + 500000) / 1000000;
+		time_t expected = edge_seconds + n;
+		int32_t jitter = (int32_t)(interval - n * 1000000);
+		if (n != 1 || abs(jitter) > TICK_SYNC_MAX_JITTER_US || seconds < expected - 1 || seconds > expected + 1) {
+			epoch++;
+			epochs++;
+		}
+		edge_seconds = seconds < expected - 1 || seconds > expected + 1 ? seconds : expected;
+	} else {
+		edge_seconds = seconds;
+	}
+	edge_us = at_us;
+	have_edge = true;
+
+	uint8_t pkt[PACKET_SIZE];
+	header(pkt, TYPE_SYNC, epoch);
+	put32(pkt + 8, edge_seconds);
+	put32(pkt + 12, micros() - at_us);
+	send(pkt, IP_ADDR_BROADCAST, local_port);
+}
+
+bool TickSync::poll(uint32_t now_us)
+{
+	if (role != TICK_SYNC_FOLLOWER) {
+		return false;
+	}
+	if (request_due && (int32_t)(now_us - request_at_us) >= 0) {
+		request_due = false;
+		sendRequest();
+	}
+	if (sample_count > 0 && millis() - last_response_ms >= TICK_SYNC_TIMEOUT_MS) {
+		unlock();
+	}
+	if (!locked()) {
+		return false;
+	}
+
+	// The last edge at or before 'now_us', counted from the best estimate.
+	const Sample &b = samples[best];
+	int32_t since = now_us - b.edge_us;
+	int32_t k = since >= 0 ? since / 1000000 : -(int32_t)((999999 - (int64_t)since) / 1000000);
+	time_t s = b.seconds + k;
+	if (ticked && s <= tick_seconds) {
+		return false;
+	}
+	ticked = true;
+	tick_seconds = s;
+	tick_us = now_us;
+	return true;
+}
+
+bool TickSync::locked()
+{
+	return role == TICK_SYNC_FOLLOWER && sample_count >= TICK_SYNC_MIN_SAMPLES;
+}
+
+uint32_t TickSync::leader()
+{
+	return leader_ip;
+}
+
+bool TickSync::ticking()
+{
+	if (role == TICK_SYNC_LEADER) {
+		return have_edge;
+	}
+	return locked() && ticked;
+}
+
+time_t TickSync::seconds()
+{
+	return role == TICK_SYNC_LEADER ? edge_seconds : tick_seconds;
+}
+
+int32_t TickSync::phaseError()
+{
+	return error_us;
+}
+
+uint32_t TickSync::roundTrip()
+{
+	return sample_count > 0 ? samples[best].delay_us : 0;
+}
+
+const TickSync::Follower *TickSync::follower(uint8_t i)
+{
+	if (i >= TICK_SYNC_FOLLOWERS || followers[i].ip == 0 ||
+	    millis() - followers[i].last_ms >= TICK_SYNC_FOLLOWER_TIMEOUT_MS) {
+		return NULL;
+	}
+	return &followers[i];
+}
+
+void TickSync::resetStats()
+{
+	for (uint8_t i = 0; i < TICK_SYNC_FOLLOWERS; i++) {
+		followers[i].reports = 0;
+		followers[i].worst_error_us = 0;
+	}
+	worst_error_us = 0;
+}
+
+void TickSync::unlock()
+{
+	if (locked()) {
+		unlocks++;
+	}
+	sample_count = 0;
+	next_sample = 0;
+	best = 0;
+	ticked = false;
+	error_us = 0;
+}
+
+uint32_t TickSync::estimatedEdge(time_t seconds)
+{
+	const Sample &b = samples[best];
+	return b.edge_us + (int32_t)(seconds - b.seconds) * 1000000;
+}
+
+bool TickSync::send(const uint8_t *pkt, const ip_addr_t *addr, u16_t port)
+{
+	struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, PACKET_SIZE, PBUF_RAM);
+	if (p == NULL) {
+		send_errors++;
+		return false;
+	}
+	memcpy(p->payload, pkt, PACKET_SIZE);
+	bool ok = udp_sendto(pcb, p, addr, port) == ERR_OK;
+	pbuf_free(p);
+	if (ok) {
+		sent++;
+	} else {
+		send_errors++;
+	}
+	return ok;
+}
+
+void TickSync::receive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+	uint32_t rx_us = micros();
+	(void)pcb;
+
+	((TickSync *)arg)->handle(p, addr, port, rx_us);
+	pbuf_free(p);
+}
+
+void TickSync::handle(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us)
+{
+	received++;
+
+	// A reply is written over its request, so it must be contiguous.
+	const uint8_t *pkt = (const uint8_t *)p->payload;
+	if (p->len != p->tot_len || p->len < PACKET_SIZE || pkt[0] != 'N' || pkt[1] != 'T' || pkt[2] != PACKET_VERSION) {
+		malformed++;
+		return;
+	}
+
+	// Packets for the other role, e.g. from a second leader, are ignored.
+	if (pkt[3] == TYPE_SYNC && role == TICK_SYNC_FOLLOWER) {
+		handleSync(pkt, addr, port, rx_us);
+	} else if (pkt[3] == TYPE_DELAY_REQ && role == TICK_SYNC_LEADER) {
+		handleRequest(p, addr, port, rx_us);
+	} else if (pkt[3] == TYPE_DELAY_RESP && role == TICK_SYNC_FOLLOWER) {
+		handleResponse(pkt, addr, rx_us);
+	}
+}
+
+/*
+ * Follow the first leader heard, until it has been silent for
+ * TICK_SYNC_TIMEOUT_MS, and ask it for the delay half way between two of its
+ * edges.
+ */
+void TickSync::handleSync(const uint8_t *pkt, const ip_addr_t *addr, u16_t port, uint32_t rx_us)
+{
+	uint32_t ip = ip4_addr_get_u32(ip_2_ip4(addr));
+	uint32_t now_ms = millis();
+
+	if (ip != leader_ip) {
+		if (leader_ip != 0 && now_ms - last_sync_ms < TICK_SYNC_TIMEOUT_MS) {
+			return;
+		}
+		unlock();
+		leader_ip = ip;
+	}
+	leader_addr = *addr;
+	leader_port = port;
+	last_sync_ms = now_ms;
+
+	request_due = true;
+	request_at_us = rx_us - get32(pkt + 12) + TICK_SYNC_REQUEST_DELAY_US;
+}
+
+void TickSync::sendRequest()
+{
+	uint8_t pkt[PACKET_SIZE];
+
+	header(pkt, TYPE_DELAY_REQ, epoch);
+	put32(pkt + 12, error_us);
+	put32(pkt + 16, roundTrip());
+	request_t1 = micros();
+	put32(pkt + 8, request_t1);
+	request_outstanding = send(pkt, &leader_addr, leader_port);
+}
+
+void TickSync::handleRequest(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us)
+{
+	if (!have_edge) {
+		return;
+	}
+	uint8_t *pkt = (uint8_t *)p->payload;
+	int32_t error = get32(pkt + 12);
+	uint32_t delay_us = get32(pkt + 16);
+
+	// The follower's transmit time stays in place.
+	pbuf_realloc(p, PACKET_SIZE);
+	pkt[3] = TYPE_DELAY_RESP;
+	pkt[4] = epoch;
+	put32(pkt + 12, edge_seconds);
+	put32(pkt + 16, rx_us - edge_us);
+	put32(pkt + 20, micros() - edge_us);
+	if (udp_sendto(pcb, p, addr, port) == ERR_OK) {
+		sent++;
+	} else {
+		send_errors++;
+	}
+
+	// Take the follower's slot, or the one unused for the longest.
+	uint32_t ip = ip4_addr_get_u32(ip_2_ip4(addr));
+	uint32_t now_ms = millis();
+	Follower *f = NULL;
+	for (uint8_t i = 0; i < TICK_SYNC_FOLLOWERS; i++) {
+		if (followers[i].ip == ip) {
+			f = &followers[i];
+			break;
+		}
+		if (f == NULL || now_ms - followers[i].last_ms > now_ms - f->last_ms) {
+			f = &followers[i];
+		}
+	}
+	if (f->ip != ip) {
+		memset(f, 0, sizeof(*f));
+		f->ip = ip;
+	}
+	f->last_ms = now_ms;
+	f->error_us = error;
+	f->delay_us = delay_us;
+	f->reports++;
+	f->worst_error_us = max(f->worst_error_us, (uint32_t)abs(error));
+}
+
+void TickSync::handleResponse(const uint8_t *pkt, const ip_addr_t *addr, uint32_t rx_us)
+{
+	if (!request_outstanding || get32(pkt + 8) != request_t1 || ip4_addr_get_u32(ip_2_ip4(addr)) != leader_ip) {
+		return;
+	}
+	request_outstanding = false;
+
+	if (sample_count > 0 && pkt[4] != epoch) {
+		unlock();
+		epochs++;
+	}
+	epoch = pkt[4];
+
+	// The round trip, less the leader's turnaround, is split evenly
+	// between the two directions.
+	uint32_t rx_phase = get32(pkt + 16);
+	uint32_t tx_phase = get32(pkt + 20);
+	int32_t round_trip = (int32_t)(rx_us - request_t1) - (int32_t)(tx_phase - rx_phase);
+	Sample &s = samples[next_sample];
+	s.delay_us = max(round_trip, (int32_t)0);
+	s.edge_us = request_t1 + s.delay_us / 2 - rx_phase;
+	s.seconds = get32(pkt + 12);
+	next_sample = (next_sample + 1) % TICK_SYNC_FILTER_SIZE;
+	if (sample_count < TICK_SYNC_FILTER_SIZE) {
+		sample_count++;
+	}
+	last_response_ms = millis();
+
+	best = 0;
+	for (uint8_t i = 1; i < sample_count; i++) {
+		if (samples[i].delay_us < samples[best].delay_us) {
+			best = i;
+		}
+	}
+
+	if (ticked && locked()) {
+		error_us = tick_us - estimatedEdge(tick_seconds);
+		worst_error_us = max(worst_error_us, (uint32_t)abs(error_us));
+	}
+}
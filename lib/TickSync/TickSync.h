@@ -0,0 +1,147 @@
+/*
+ * TickSync.h - second edges shared by the clocks on a LAN
+ *
+ * The leader broadcasts a SYNC packet at each of its RTC 1 Hz edges, with
+ * the second starting at the edge and the time from the edge to the
+ * broadcast. Half a second after each SYNC a follower sends the leader a
+ * DELAY_REQ, which the leader answers from its lwIP receive callback with
+ * the receive and transmit times relative to its last edge. As in NTP, the
+ * follower takes the network delay as symmetric, estimates from each
+ * exchange when the leader's edge happened on its own micros() clock, and
+ * uses the estimate of the exchange with the shortest round trip among the
+ * last TICK_SYNC_FILTER_SIZE, which has the least queuing in it. It then
+ * ticks at the estimated leader edges.
+ *
+ * The leader's edges move when its RTC is set, e.g. at an NTP sync. It then
+ * starts a new epoch, and followers drop the exchanges of the old one.
+ *
+ * Each DELAY_REQ carries the follower's phase error, from its last tick to
+ * that edge as estimated by the filter, and the round trip of the estimate.
+ * The leader keeps them for up to TICK_SYNC_FOLLOWERS followers.
+ */
+
+#ifndef _TICK_SYNC_h /* Include guard */
+#define _TICK_SYNC_h
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <lwip/udp.h>
+
+#define TICK_SYNC_PORT			4123
+#define TICK_SYNC_FILTER_SIZE		8
+#define TICK_SYNC_MIN_SAMPLES		3	// exchanges before a follower ticks
+#define TICK_SYNC_TIMEOUT_MS		5000	// without a reply, a follower unlocks
+#define TICK_SYNC_REQUEST_DELAY_US	500000	// from a SYNC to the DELAY_REQ
+#define TICK_SYNC_MAX_JITTER_US		2000	// of a leader edge, before a new epoch
+#define TICK_SYNC_FOLLOWERS		32
+#define TICK_SYNC_FOLLOWER_TIMEOUT_MS	10000
+
+enum TickSyncMode {
+	TICK_SYNC_OFF,
+	TICK_SYNC_LEADER,
+	TICK_SYNC_FOLLOWER,
+};
+
+class TickSync {
+    public:
+	struct Follower {
+		uint32_t ip;
+		uint32_t last_ms;
+		int32_t error_us;	// reported in the last DELAY_REQ
+		uint32_t delay_us;
+		// Since the last resetStats().
+		uint32_t reports;
+		uint32_t worst_error_us;	// largest absolute error
+	};
+
+    private:
+	// The follower's estimate of one leader edge.
+	struct Sample {
+		uint32_t edge_us;	// on the follower's micros() clock
+		time_t seconds;		// starting at the edge
+		uint32_t delay_us;	// round trip, without the leader's turnaround
+	};
+
+	struct udp_pcb *pcb = NULL;
+	uint16_t local_port = 0;
+	TickSyncMode role = TICK_SYNC_OFF;
+	uint8_t epoch = 0;	// the leader's, or the one followed
+
+	// Leader: the last edge.
+	bool have_edge = false;
+	time_t edge_seconds = 0;
+	uint32_t edge_us = 0;
+	Follower followers[TICK_SYNC_FOLLOWERS] = {};
+
+	// Follower: the leader, the exchanges and the last tick.
+	uint32_t leader_ip = 0;
+	ip_addr_t leader_addr;
+	uint16_t leader_port = 0;
+	uint32_t last_sync_ms = 0;
+	uint32_t last_response_ms = 0;
+	bool request_due = false;
+	uint32_t request_at_us = 0;
+	bool request_outstanding = false;
+	uint32_t request_t1 = 0;
+	Sample samples[TICK_SYNC_FILTER_SIZE];
+	uint8_t sample_count = 0;
+	uint8_t next_sample = 0;
+	uint8_t best = 0;
+	bool ticked = false;
+	time_t tick_seconds = 0;
+	uint32_t tick_us = 0;
+	int32_t error_us = 0;
+
+	static void receive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+	void handle(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us);
+	void handleSync(const uint8_t *pkt, const ip_addr_t *addr, u16_t port, uint32_t rx_us);
+	void handleRequest(struct pbuf *p, const ip_addr_t *addr, u16_t port, uint32_t rx_us);
+	void handleResponse(const uint8_t *pkt, const ip_addr_t *addr, uint32_t rx_us);
+	void sendRequest();
+	bool send(const uint8_t *pkt, const ip_addr_t *addr, u16_t port);
+	void unlock();
+	uint32_t estimatedEdge(time_t seconds);
+
+    public:
+	bool begin(TickSyncMode mode, uint16_t port = TICK_SYNC_PORT);
+	void end();
+	bool running();
+	TickSyncMode mode();
+
+	// Leader: an RTC edge at 'at_us', when the system time was 'seconds'.
+	// Broadcasts a SYNC.
+	void edge(time_t seconds, uint32_t at_us);
+
+	// Follower: sends a pending DELAY_REQ, and returns true once for each
+	// leader edge passed while locked.
+	bool poll(uint32_t now_us);
+	bool locked();
+	uint32_t leader();
+
+	// Whether the display follows synchronized edges: the leader's own,
+	// or a locked follower's ticks. seconds() is the second started at the
+	// last one.
+	bool ticking();
+	time_t seconds();
+
+	// Follower: the time from the last tick to the leader edge as now
+	// estimated, positive when late, and the round trip of the estimate.
+	int32_t phaseError();
+	uint32_t roundTrip();
+
+	// Leader: the followers heard from in the last
+	// TICK_SYNC_FOLLOWER_TIMEOUT_MS.
+	const Follower *follower(uint8_t i);
+	void resetStats();
+
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint32_t send_errors = 0;
+	uint32_t malformed = 0;
+	uint32_t epochs = 0;		// leader edge moves, or followed leader epochs
+	uint32_t unlocks = 0;
+	// Follower, since the last resetStats().
+	uint32_t worst_error_us = 0;
+};
+
+#endif // _TICK_SYNC_h
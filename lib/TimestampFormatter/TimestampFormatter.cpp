@@ -0,0 +1,128 @@
+#include <CivilDate.h>
+#include "TimestampFormatter.h"
+
+using namespace ace_time;
+
+// Positions in "YYYY-MM-DDThh:mm:ss".
+#define POS_YEAR	0
+#define POS_MONTH	5
+#define POS_DAY		8
+#define POS_HOUR	11
+#define POS_MINUTE	14
+#define POS_SECOND	17
+
+static void put2(char *p, uint8_t v)
+{
+	p[0] = '0' + v / 10;
+	p[1] = '0' + v % 10;
+}
+
+/*
+ * Render 'zdt' in full with AceTime and check whether later calls can update
+ * its digits in place.
+ */
+void TimestampFormatter::render(const ZonedDateTime &zdt)
+{
+	ace_common::PrintStr<TIMESTAMP_SIZE> out;
+	zdt.printTo(out);
+	len = out.length();
+	memcpy(buf, out.cstr(), len + 1);
+
+	incremental = !zdt.isError() && zdt.timeOffset().toSeconds() % 60 == 0 && len > POS_SECOND + 2 &&
+		      buf[4] == '-' && buf[7] == '-' && buf[10] == 'T' && buf[13] == ':' && buf[16] == ':';
+	full_renders++;
+}
+
+/*
+ * Render the time 't' at 'offset' in full, as AceTime would, with the zone
+ * name 'name'.
+ */
+void TimestampFormatter::render(int64_t t, int32_t offset, const char *name)
+{
+	civil::DateTime local = civil::fromUnix(t + offset);
+	uint32_t abs_offset = offset < 0 ? -offset : offset;
+	int n = snprintf(buf, sizeof(buf), "%04ld-%02u-%02uT%02u:%02u:%02u%c%02lu:%02lu", (long)local.year,
+			 local.month, local.day, local.hour, local.minute, local.second, offset < 0 ? '-' : '+',
+			 (unsigned long)(abs_offset / 3600), (unsigned long)(abs_offset / 60 % 60));
+	if (abs_offset % 60 != 0) {
+		n += snprintf(buf + n, sizeof(buf) - n, ":%02lu", (unsigned long)(abs_offset % 60));
+	}
+	snprintf(buf + n, sizeof(buf) - n, "[%s]", name);
+	len = strlen(buf);
+
+	incremental = offset % 60 == 0 && local.year >= 1000 && local.year <= 9999;
+	full_renders++;
+}
+
+void TimestampFormatter::putDigits(int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute,
+				   uint8_t second)
+{
+	put2(buf + POS_YEAR, year / 100);
+	put2(buf + POS_YEAR + 2, year % 100);
+	put2(buf + POS_MONTH, month);
+	put2(buf + POS_DAY, day);
+	put2(buf + POS_HOUR, hour);
+	put2(buf + POS_MINUTE, minute);
+	put2(buf + POS_SECOND, second);
+	minute_renders++;
+}
+
+const char *TimestampFormatter::format(int64_t t, const TimeZone &tz)
+{
+	int64_t minute = t - ((t % 60) + 60) % 60;
+	uint8_t second = t - minute;
+
+	if (incremental && minute == minute_start && tz.getZoneId() == zone_id) {
+		put2(buf + POS_SECOND, second);
+		second_renders++;
+		return buf;
+	}
+
+	ZonedDateTime zdt = ZonedDateTime::forUnixSeconds64(t, tz);
+	int32_t offset = zdt.timeOffset().toSeconds();
+	if (incremental && !zdt.isError() && tz.getZoneId() == zone_id && offset == offset_s &&
+	    zdt.year() >= 1000 && zdt.year() <= 9999) {
+		putDigits(zdt.year(), zdt.month(), zdt.day(), zdt.hour(), zdt.minute(), zdt.second());
+	} else {
+		render(zdt);
+	}
+
+	minute_start = minute;
+	zone_id = tz.getZoneId();
+	offset_s = offset;
+	return buf;
+}
+
+/*
+ * As above, for a POSIX TZ rule. Its abbreviation changes with the offset, so
+ * a change of either renders in full.
+ */
+const char *TimestampFormatter::format(int64_t t, const PosixTimeZone &tz)
+{
+	int64_t minute = t - ((t % 60) + 60) % 60;
+	uint8_t second = t - minute;
+
+	if (incremental && minute == minute_start && tz.id() == zone_id) {
+		put2(buf + POS_SECOND, second);
+		second_renders++;
+		return buf;
+	}
+
+	int32_t offset = tz.offsetAt(t);
+	civil::DateTime local = civil::fromUnix(t + offset);
+	if (incremental && tz.id() == zone_id && offset == offset_s && local.year >= 1000 && local.year <= 9999) {
+		putDigits(local.year, local.month, local.day, local.hour, local.minute, local.second);
+	} else {
+		render(t, offset, tz.nameAt(t));
+	}
+
+	minute_start = minute;
+	zone_id = tz.id();
+	offset_s = offset;
+	return buf;
+}
+
+uint8_t TimestampFormatter::length()
+{
+	return len;
+}
@@ -0,0 +1,51 @@
+/*
+ * TimestampFormatter.h - incremental ISO 8601 rendering of zoned times
+ *
+ * Renders a time as ZonedDateTime::printTo() does, e.g.
+ * "2024-03-01T11:59:52-05:00[America/New_York]", into a buffer kept between
+ * calls. Time zone offsets are whole minutes, so within the minute of the
+ * previous call only the seconds digits change, and they are rewritten
+ * without a time zone lookup. In another minute the zone is looked up once
+ * and the date and time digits are rewritten. The offset and the zone name
+ * are only rendered again, by AceTime, when they change.
+ *
+ * A POSIX TZ rule is rendered the same way, with the abbreviation in effect
+ * as its name, e.g. "2024-03-01T11:59:52+01:00[CET]".
+ */
+
+#ifndef _TIMESTAMP_FORMATTER_h /* Include guard */
+#define _TIMESTAMP_FORMATTER_h
+
+#include <Arduino.h>
+#include <AceTime.h>
+#include <PosixTz.h>
+
+// Holds the longest zone names in the registry.
+#define TIMESTAMP_SIZE			64
+
+class TimestampFormatter {
+	char buf[TIMESTAMP_SIZE] = "";
+	uint8_t len = 0;
+	// Whether 'buf' has the date and time digits at their fixed positions,
+	// a whole-minute offset and no error.
+	bool incremental = false;
+	int64_t minute_start = 0;	// of the last time, in Unix seconds
+	uint32_t zone_id = 0;
+	int32_t offset_s = 0;
+
+	void render(const ace_time::ZonedDateTime &zdt);
+	void render(int64_t t, int32_t offset, const char *name);
+	void putDigits(int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+
+    public:
+	// Returns the rendered time, valid until the next call.
+	const char *format(int64_t t, const ace_time::TimeZone &tz);
+	const char *format(int64_t t, const PosixTimeZone &tz);
+	uint8_t length();
+
+	uint32_t full_renders = 0;	// offset, zone or layout changed
+	uint32_t minute_renders = 0;	// date and time digits rewritten
+	uint32_t second_renders = 0;	// seconds digits rewritten
+};
+
+#endif // _TIMESTAMP_FORMATTER_h
@@ -0,0 +1,169 @@
+#include "Trace.h"
+
+Trace trace;
+
+struct TraceEventInfo {
+	uint8_t category;
+	const char *name;
+};
+
+static const TraceEventInfo EVENTS[] = {
+	{ TRACE_ISR, "second_edge" },
+	{ TRACE_ISR, "touch_edge" },
+	{ TRACE_DISPLAY, "spi_latch" },
+	{ TRACE_LOOP, "accounting" },
+	{ TRACE_LOOP, "events" },
+	{ TRACE_LOOP, "display" },
+	{ TRACE_LOOP, "serial" },
+	{ TRACE_LOOP, "background" },
+	{ TRACE_LOOP, "end" },
+	{ TRACE_NTP, "ntp_sync" },
+	{ TRACE_NTP, "time_step" },
+	{ TRACE_WIFI, "connected" },
+	{ TRACE_WIFI, "disconnected" },
+	{ TRACE_WIFI, "got_ip" },
+	{ TRACE_WIFI, "dhcp_timeout" },
+	{ TRACE_WIFI, "auth_mode_changed" },
+	{ TRACE_EEPROM, "commit" },
+	{ TRACE_WATCHDOG, "loop_overrun" },
+};
+
+static_assert(sizeof(EVENTS) / sizeof(EVENTS[0]) == TRACE_EVENT_COUNT, "a name for every trace event");
+
+static const char *categoryName(uint8_t category)
+{
+	switch (category) {
+	case TRACE_ISR:
+		return "isr";
+	case TRACE_DISPLAY:
+		return "display";
+	case TRACE_LOOP:
+		return "loop";
+	case TRACE_NTP:
+		return "ntp";
+	case TRACE_WIFI:
+		return "wifi";
+	case TRACE_EEPROM:
+		return "eeprom";
+	case TRACE_WATCHDOG:
+		return "watchdog";
+	}
+	return "unknown";
+}
+
+static char *putHex(char *p, uint32_t v, uint8_t digits)
+{
+	static const char HEX_DIGITS[] = "0123456789abcdef";
+	for (int8_t i = digits - 1; i >= 0; i--) {
+		p[i] = HEX_DIGITS[v & 0xf];
+		v >>= 4;
+	}
+	return p + digits;
+}
+
+/*
+ * Interrupts are masked while a record is written, so that a handler
+ * recording in the middle of it takes the next slot.
+ */
+IRAM_ATTR void Trace::record(uint8_t category, uint8_t event, uint16_t arg)
+{
+	if (!(enabled & category) || paused) {
+		return;
+	}
+
+	uint32_t ps = xt_rsil(15);
+	TraceRecord &r = records[head & (TRACE_SIZE - 1)];
+	r.cycles = ESP.getCycleCount();
+	r.event = event;
+	r.reserved = 0;
+	r.arg = arg;
+	head = head + 1;
+	xt_wsr_ps(ps);
+}
+
+void Trace::enable(uint8_t categories)
+{
+	enabled = enabled | (categories & TRACE_CATEGORIES);
+}
+
+void Trace::disable(uint8_t categories)
+{
+	enabled = enabled & ~categories;
+}
+
+uint8_t Trace::categories()
+{
+	return enabled & TRACE_CATEGORIES;
+}
+
+void Trace::clear()
+{
+	uint32_t ps = xt_rsil(15);
+	head = 0;
+	xt_wsr_ps(ps);
+}
+
+uint32_t Trace::count()
+{
+	uint32_t h = head;
+	return min(h, (uint32_t)TRACE_SIZE);
+}
+
+uint32_t Trace::overwritten()
+{
+	return head - count();
+}
+
+const TraceRecord &Trace::recent(uint32_t age)
+{
+	return records[(head - 1 - age) & (TRACE_SIZE - 1)];
+}
+
+const char *Trace::eventName(uint8_t event)
+{
+	return event < TRACE_EVENT_COUNT ? EVENTS[event].name : "unknown";
+}
+
+void Trace::dump(Print &out)
+{
+	paused = true;
+
+	out.print("[Trace] Dump: ");
+	out.print(count());
+	out.print(" records, ");
+	out.print(overwritten());
+	out.print(" overwritten, ");
+	out.print(ESP.getCpuFreqMHz());
+	out.print(" MHz, now ");
+	out.println(ESP.getCycleCount());
+
+	for (uint8_t i = 0; i < TRACE_EVENT_COUNT; i++) {
+		out.print("[Trace] Event ");
+		out.print(i);
+		out.print(' ');
+		out.print(categoryName(EVENTS[i].category));
+		out.print(' ');
+		out.println(EVENTS[i].name);
+	}
+
+	// Eight records per line, each as 8 hex digits of cycles, 2 of event
+	// and 4 of argument.
+	char line[8 * 15 + 1];
+	char *p = line;
+	for (uint32_t i = head - count(); i != head; i++) {
+		const TraceRecord &r = records[i & (TRACE_SIZE - 1)];
+		*p++ = ' ';
+		p = putHex(p, r.cycles, 8);
+		p = putHex(p, r.event, 2);
+		p = putHex(p, r.arg, 4);
+		if (p == line + sizeof(line) - 1 || i + 1 == head) {
+			*p = '\0';
+			out.print("[Trace] Data");
+			out.println(line);
+			p = line;
+		}
+	}
+	out.println("[Trace] End of dump.");
+
+	paused = false;
+}
@@ -0,0 +1,117 @@
+/*
+ * Trace.h - ring of cycle-stamped events for reconstructing glitches
+ *
+ * Trace points record an event, a 16-bit argument and the CPU cycle count in
+ * a ring of TRACE_SIZE 8-byte records, from loop(), the system context and
+ * interrupt handlers alike. dump() prints the event names, the CPU frequency
+ * and the records as hex, and tools/trace2json.py turns that into the Chrome
+ * trace event format for chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each event belongs to a category. Trace points of categories left out of
+ * TRACE_CATEGORIES, e.g. -D TRACE_CATEGORIES=0 in the build flags, compile to
+ * nothing. The loop stages fill the ring fastest, so they are also masked at
+ * run time until enable() turns them on.
+ *
+ * The cycle count wraps every 2^32 cycles, 26.8 seconds at 160 MHz. Records
+ * are in order, so the converter unwraps it as long as no two consecutive
+ * records are further apart than that; the 1 Hz RTC interrupt sees to it.
+ */
+
+#ifndef _TRACE_h /* Include guard */
+#define _TRACE_h
+
+#include <Arduino.h>
+
+#define TRACE_ISR		0x01	// interrupt handler entries
+#define TRACE_DISPLAY		0x02	// SPI frame latches
+#define TRACE_LOOP		0x04	// loop() stage boundaries
+#define TRACE_NTP		0x08	// NTP syncs and time steps
+#define TRACE_WIFI		0x10	// Wi-Fi events
+#define TRACE_EEPROM		0x20	// EEPROM commits
+#define TRACE_WATCHDOG		0x40	// loop() iterations over the budget
+#define TRACE_ALL		0x7f
+
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES	TRACE_ALL
+#endif
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE		(TRACE_CATEGORIES ? 256 : 1)
+#endif
+
+#define TRACE(category, event, arg)						\
+	do {									\
+		if ((TRACE_CATEGORIES) & (category)) {				\
+			trace.record((category), (event), (arg));		\
+		}								\
+	} while (0)
+
+enum TraceEvent : uint8_t {
+	TRACE_EVENT_ISR_SECOND,		// RTC 1 Hz edge
+	TRACE_EVENT_ISR_TOUCH,		// touch sensor edge, the level
+	TRACE_EVENT_SPI_LATCH,		// the four digits, a nibble each
+	// A loop() stage starts at its event and ends at the next one.
+	TRACE_EVENT_LOOP_ACCOUNTING,
+	TRACE_EVENT_LOOP_EVENTS,
+	TRACE_EVENT_LOOP_DISPLAY,
+	TRACE_EVENT_LOOP_SERIAL,
+	TRACE_EVENT_LOOP_BACKGROUND,
+	TRACE_EVENT_LOOP_END,		// the system context until the next iteration
+	TRACE_EVENT_NTP_SYNC,		// the NTPSyncEvent_t
+	TRACE_EVENT_TIME_STEP,		// seconds, clamped to an int16_t
+	TRACE_EVENT_WIFI_CONNECTED,	// the channel
+	TRACE_EVENT_WIFI_DISCONNECTED,	// the reason
+	TRACE_EVENT_WIFI_GOT_IP,
+	TRACE_EVENT_WIFI_DHCP_TIMEOUT,
+	TRACE_EVENT_WIFI_AUTH_MODE_CHANGED,	// old mode << 8 | new mode
+	TRACE_EVENT_EEPROM_COMMIT,
+	TRACE_EVENT_LOOP_OVERRUN,	// longest stage << 12 | milliseconds, up to 4095
+	TRACE_EVENT_COUNT
+};
+
+struct TraceRecord {
+	uint32_t cycles;
+	uint8_t event;
+	uint8_t reserved;
+	uint16_t arg;
+};
+
+class Trace {
+	static_assert((TRACE_SIZE & (TRACE_SIZE - 1)) == 0, "TRACE_SIZE must be a power of 2");
+
+	TraceRecord records[TRACE_SIZE];
+	volatile uint32_t head = 0;	// records written since the last clear()
+	volatile uint8_t enabled = TRACE_ALL & ~TRACE_LOOP;
+	volatile bool paused = false;
+
+    public:
+	IRAM_ATTR void record(uint8_t category, uint8_t event, uint16_t arg);
+
+	// Run-time mask, within TRACE_CATEGORIES.
+	void enable(uint8_t categories);
+	void disable(uint8_t categories);
+	uint8_t categories();
+
+	void clear();
+	uint32_t count();	// records held
+	uint32_t overwritten();
+
+	// The record 'age' records before the latest one, for an age below
+	// count().
+	const TraceRecord &recent(uint32_t age);
+
+	static const char *eventName(uint8_t event);
+
+	// Print the ring, oldest record first. Recording pauses meanwhile.
+	void dump(Print &out);
+};
+
+extern Trace trace;
+
+// Clamp a signed value to a record argument.
+static inline uint16_t traceArg(int32_t v)
+{
+	return (uint16_t)(int16_t)constrain(v, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+}
+
+#endif // _TRACE_h
@@ -0,0 +1,150 @@
+#include "ZoneCache.h"
+
+using namespace ace_time;
+
+static const int64_t DAY = 86400;
+
+/*
+ * The entry of the zone at 'index', marked as the most recently used. A zone
+ * not cached takes the least recently used entry, or a free one, which has
+ * never been used.
+ */
+ZoneCache::Entry &ZoneCache::entryFor(uint16_t index)
+{
+	Entry *lru = &entries[0];
+
+	uses++;
+	for (Entry &e : entries) {
+		if (e.index == index) {
+			e.last_used = uses;
+			return e;
+		}
+		if (e.last_used < lru->last_used) {
+			lru = &e;
+		}
+	}
+
+	if (lru->index != ZONE_CACHE_NONE) {
+		evictions++;
+	}
+	misses++;
+	lru->index = index;
+	lru->last_used = uses;
+	lru->tz = TimeZone::forZoneInfo(registrar.getZoneInfoForIndex(index), &lru->processor);
+	lru->valid_from = 1;
+	lru->valid_until = 0;
+	return *lru;
+}
+
+int32_t ZoneCache::lookup(const Entry &e, int64_t t) const
+{
+	return ZonedDateTime::forUnixSeconds64(t, e.tz).timeOffset().toSeconds();
+}
+
+/*
+ * Find the offset at 't' and how long it holds: probe daily up to the
+ * horizon, and bisect the first day with another offset to the second.
+ */
+void ZoneCache::refresh(Entry &e, int64_t t)
+{
+	int64_t horizon = t + ZONE_CACHE_HORIZON_S;
+	int64_t lo = t, hi = horizon;
+
+	e.offset = lookup(e, t);
+	for (int64_t probe = t + DAY; probe < horizon + DAY; probe += DAY) {
+		if (probe > horizon) {
+			probe = horizon;
+		}
+		if (lookup(e, probe) != e.offset) {
+			hi = probe;
+			while (hi - lo > 1) {
+				int64_t mid = lo + (hi - lo) / 2;
+				if (lookup(e, mid) == e.offset) {
+					lo = mid;
+				} else {
+					hi = mid;
+				}
+			}
+			break;
+		}
+		lo = probe;
+	}
+	e.valid_from = t;
+	e.valid_until = hi;
+}
+
+int32_t ZoneCache::offsetAt(uint16_t index, int64_t t)
+{
+	uint32_t before = misses;
+	Entry &e = entryFor(index);
+
+	if (t >= e.valid_from && t < e.valid_until) {
+		hits++;
+		return e.offset;
+	}
+
+	uint32_t start = micros();
+	refresh(e, t);
+	uint32_t elapsed = micros() - start;
+	if (misses != before) {
+		rebuild_us_last = elapsed;
+		rebuild_us_max = max(rebuild_us_max, elapsed);
+	} else {
+		refreshes++;
+		refresh_us_max = max(refresh_us_max, elapsed);
+	}
+	return e.offset;
+}
+
+const TimeZone &ZoneCache::timeZone(uint16_t index)
+{
+	return entryFor(index).tz;
+}
+
+uint16_t ZoneCache::indexForName(const char *name) const
+{
+	uint16_t index = registrar.findIndexForName(name);
+	return index == ExtendedZoneRegistrar::kInvalidIndex ? ZONE_CACHE_NONE : index;
+}
+
+void ZoneCache::printStats(Print &out) const
+{
+	out.print("[Zones] Cache of ");
+	out.print(TZ_CACHE_SIZE);
+	out.print(" zone processors, ");
+	out.print(sizeof(*this));
+	out.println(" bytes of RAM.");
+	out.print("[Zones] ");
+	out.print(hits);
+	out.print(" lookups cached, ");
+	out.print(refreshes);
+	out.print(" refreshed, ");
+	out.print(misses);
+	out.print(" missed with ");
+	out.print(evictions);
+	out.println(" evictions.");
+	out.print("[Zones] Processor rebuild ");
+	out.print(rebuild_us_last);
+	out.print(" us, worst ");
+	out.print(rebuild_us_max);
+	out.print(" us; refresh worst ");
+	out.print(refresh_us_max);
+	out.println(" us.");
+
+	for (const Entry &e : entries) {
+		if (e.index == ZONE_CACHE_NONE) {
+			continue;
+		}
+		out.print("[Zones] ");
+		e.tz.printTo(out);
+		if (e.valid_until <= e.valid_from) {
+			out.println(": not looked up yet.");
+			continue;
+		}
+		out.print(": offset ");
+		out.print(e.offset);
+		out.print(" s, held for ");
+		out.print((uint32_t)(e.valid_until - e.valid_from));
+		out.println(" s from its last refresh.");
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * ZoneCache.h - offsets of several zones of AceTime's database, kept until
+ * their next transition
+ *
+ * Each cached zone has its own ExtendedZoneProcessor, so switching between
+ * the zones of a world clock doesn't make AceTime rebuild a shared
+ * processor's transitions for every switch. With more zones in use than
+ * TZ_CACHE_SIZE, the least recently used one is evicted.
+ *
+ * On top of the processor, each zone keeps its offset from the time it was
+ * looked up until its next change, at most ZONE_CACHE_HORIZON_S later. A
+ * lookup within that interval compares the time with its bounds and returns,
+ * without calling AceTime. Offsets change at most once a day, so the interval
+ * is found by probing AceTime daily and bisecting a change to the second.
+ */
+
+#ifndef _ZONE_CACHE_h /* Include guard */
+#define _ZONE_CACHE_h
+
+#include <Arduino.h>
+#include <AceTime.h>
+
+// The time zone and the world clock zones. May be set at build time.
+#ifndef TZ_CACHE_SIZE
+#define TZ_CACHE_SIZE			5
+#endif
+
+#define ZONE_CACHE_HORIZON_S		(7 * 86400)
+#define ZONE_CACHE_NONE			0xffff
+
+class ZoneCache {
+	struct Entry {
+		uint16_t index = ZONE_CACHE_NONE;	// in the registry
+		uint32_t last_used = 0;
+		ace_time::ExtendedZoneProcessor processor;
+		ace_time::TimeZone tz;
+		// The offset holds in [valid_from, valid_until).
+		int64_t valid_from = 1;
+		int64_t valid_until = 0;
+		int32_t offset = 0;
+	};
+
+	const ace_time::ExtendedZoneRegistrar &registrar;
+	Entry entries[TZ_CACHE_SIZE];
+	uint32_t uses = 0;
+
+	Entry &entryFor(uint16_t index);
+	int32_t lookup(const Entry &e, int64_t t) const;
+	void refresh(Entry &e, int64_t t);
+
+    public:
+	ZoneCache(const ace_time::ExtendedZoneRegistrar &registrar) : registrar(registrar)
+	{
+	}
+
+	// The offset from UTC of the zone at 'index' in the registry at 't',
+	// in seconds east.
+	int32_t offsetAt(uint16_t index, int64_t t);
+
+	// The zone at 'index', for formatting with AceTime.
+	const ace_time::TimeZone &timeZone(uint16_t index);
+
+	// The registry's index of 'name', or ZONE_CACHE_NONE.
+	uint16_t indexForName(const char *name) const;
+
+	void printStats(Print &out) const;
+
+	uint32_t hits = 0;		// within a zone's cached interval
+	uint32_t refreshes = 0;		// intervals computed with a cached processor
+	uint32_t misses = 0;		// zones given a processor
+	uint32_t evictions = 0;		// of the least recently used zone
+	uint32_t rebuild_us_last = 0;	// interval computed with a new processor
+	uint32_t rebuild_us_max = 0;
+	uint32_t refresh_us_max = 0;
+};
+
+#endif // _ZONE_CACHE_h
@@ -0,0 +1,105 @@
+/*
+ * Arduino.h - minimal Arduino/ESP8266 core API for the native build.
+ *
+ * Only the subset of the core used by the Nixie Tap firmware and its
+ * libraries is provided. Time is virtual, see hal.h.
+ */
+
+#ifndef _NATIVE_ARDUINO_h
+#define _NATIVE_ARDUINO_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "pgmspace.h"
+#include "WString.h"
+#include "Print.h"
+#include "Printable.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+#include "IPAddress.h"
+#include "Esp.h"
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+#define INPUT_PULLDOWN_16 0x04
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// NodeMCU pin names, as GPIO numbers.
+static const uint8_t D0 = 16;
+static const uint8_t D1 = 5;
+static const uint8_t D2 = 4;
+static const uint8_t D3 = 0;
+static const uint8_t D4 = 2;
+static const uint8_t D5 = 14;
+static const uint8_t D6 = 12;
+static const uint8_t D7 = 13;
+static const uint8_t D8 = 15;
+static const uint8_t SS = 15;
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (((p) < 16) ? (p) : NOT_AN_INTERRUPT)
+
+#define bit(b) (1UL << (b))
+#define bitRead(value, b) (((value) >> (b)) & 0x01)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+// Interrupt handlers only run between loop() iterations, so there's nothing
+// to mask.
+static inline uint32_t xt_rsil(uint32_t level)
+{
+	(void)level;
+	return 0;
+}
+static inline void xt_wsr_ps(uint32_t state)
+{
+	(void)state;
+}
+
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long random(long max);
+long random(long min, long max);
+
+void setup();
+void loop();
+
+#endif // _NATIVE_ARDUINO_h
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <EEPROM.h>
+#include "hal.h"
+
+EEPROMClass EEPROM;
+
+void EEPROMClass::begin(size_t size)
+{
+	if (size == 0) {
+		return;
+	}
+	if (_data != NULL && size == _size) {
+		return;
+	}
+	delete[] _data;
+	_data = new uint8_t[size];
+	_size = size;
+	_dirty = false;
+
+	// Erased flash reads as all ones.
+	memset(_data, 0xff, _size);
+	FILE *f = fopen(hal::options.eeprom_path, "rb");
+	if (f != NULL) {
+		size_t n = fread(_data, 1, _size, f);
+		(void)n;
+		fclose(f);
+	}
+}
+
+uint8_t EEPROMClass::read(int const address)
+{
+	if (address < 0 || (size_t)address >= _size) {
+		return 0;
+	}
+	return _data[address];
+}
+
+void EEPROMClass::write(int const address, uint8_t const val)
+{
+	if (address < 0 || (size_t)address >= _size) {
+		return;
+	}
+	if (_data[address] != val) {
+		_data[address] = val;
+		_dirty = true;
+	}
+}
+
+bool EEPROMClass::commit()
+{
+	if (_data == NULL) {
+		return false;
+	}
+	if (!_dirty) {
+		return true;
+	}
+	FILE *f = fopen(hal::options.eeprom_path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fwrite(_data, 1, _size, f) == _size;
+	fclose(f);
+	_dirty = false;
+	return ok;
+}
+
+bool EEPROMClass::end()
+{
+	bool ret = commit();
+	delete[] _data;
+	_data = NULL;
+	_size = 0;
+	return ret;
+}
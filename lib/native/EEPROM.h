@@ -0,0 +1,65 @@
+/*
+ * EEPROM.h - emulated EEPROM for the native build, backed by a file. As on
+ * the ESP8266, changes are kept in RAM until commit() is called.
+ */
+
+#ifndef _NATIVE_EEPROM_h
+#define _NATIVE_EEPROM_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+	uint8_t *_data = NULL;
+	size_t _size = 0;
+	bool _dirty = false;
+
+    public:
+	void begin(size_t size);
+	uint8_t read(int const address);
+	void write(int const address, uint8_t const val);
+	bool commit();
+	bool end();
+
+	uint8_t *getDataPtr()
+	{
+		_dirty = true;
+		return _data;
+	}
+	const uint8_t *getConstDataPtr() const
+	{
+		return _data;
+	}
+	size_t length()
+	{
+		return _size;
+	}
+
+	template <typename T>
+	T &get(int const address, T &t)
+	{
+		if (address < 0 || address + sizeof(T) > _size) {
+			return t;
+		}
+		memcpy((uint8_t *)&t, _data + address, sizeof(T));
+		return t;
+	}
+
+	template <typename T>
+	const T &put(int const address, const T &t)
+	{
+		if (address < 0 || address + sizeof(T) > _size) {
+			return t;
+		}
+		if (memcmp(_data + address, (const uint8_t *)&t, sizeof(T)) != 0) {
+			_dirty = true;
+			memcpy(_data + address, (const uint8_t *)&t, sizeof(T));
+		}
+		return t;
+	}
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // _NATIVE_EEPROM_h
@@ -0,0 +1,385 @@
+#include <ESP8266WiFi.h>
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
+#include <vector>
+#include "hal.h"
+
+ESP8266WiFiClass WiFi;
+
+struct netif *netif_default = NULL;
+
+namespace hal {
+
+// The simulated access point.
+static const uint8_t AP_BSSID[6] = { 0x02, 0x00, 0x5e, 0x10, 0x20, 0x30 };
+static const int32_t AP_CHANNEL = 6;
+static const int32_t AP_RSSI = -58;
+static const IPAddress DHCP_IP(192, 168, 1, 50);
+static const IPAddress DHCP_MASK(255, 255, 255, 0);
+static const IPAddress DHCP_GW(192, 168, 1, 1);
+static const IPAddress DHCP_DNS(192, 168, 1, 1);
+
+// Virtual time taken by each step of a connection.
+static const uint32_t SCAN_US = 1800000;
+static const uint32_t DIRECT_ASSOC_US = 120000;
+static const uint32_t DHCP_US = 900000;
+static const uint32_t STATIC_IP_US = 5000;
+static const uint32_t NO_AP_US = 3000000;
+
+template <typename F>
+struct Handlers {
+	struct Entry {
+		std::weak_ptr<WiFiEventHandlerOpaque> owner;
+		F fn;
+	};
+	std::vector<Entry> entries;
+
+	WiFiEventHandler add(F fn)
+	{
+		WiFiEventHandler handler = std::make_shared<WiFiEventHandlerOpaque>();
+		entries.push_back(Entry { handler, fn });
+		return handler;
+	}
+
+	template <typename... Args>
+	void fire(Args &&... args)
+	{
+		for (auto it = entries.begin(); it != entries.end();) {
+			if (it->owner.expired()) {
+				it = entries.erase(it);
+				continue;
+			}
+			F fn = it->fn;
+			++it;
+			fn(args...);
+		}
+	}
+};
+
+struct Station {
+	WiFiMode_t mode = WIFI_OFF;
+	bool auto_reconnect = true;
+	bool sleeping = false;
+	bool associated = false;
+	wl_status_t status = WL_IDLE_STATUS;
+	uint32_t generation = 0;
+	String ssid;
+	String hostname = "ESP-native";
+	bool static_ip = false;
+	IPAddress ip, mask, gw, dns;
+	int32_t channel = 0;
+	uint8_t bssid[6] = { 0 };
+	struct dhcp dhcp = {};
+	struct netif netif = { &dhcp };
+	// The lease of DHCP_IP, which the server may give to another host once
+	// it has expired.
+	time_t lease_end = 0;
+	bool expired_lease_counted = false;
+	uint32_t expired_lease_uses = 0;
+
+	Handlers<std::function<void(const WiFiEventStationModeConnected &)> > connected;
+	Handlers<std::function<void(const WiFiEventStationModeDisconnected &)> > disconnected;
+	Handlers<std::function<void(const WiFiEventStationModeAuthModeChanged &)> > auth_mode_changed;
+	Handlers<std::function<void(const WiFiEventStationModeGotIP &)> > got_ip;
+	Handlers<std::function<void(void)> > dhcp_timeout;
+};
+
+static Station &sta()
+{
+	static Station s;
+	return s;
+}
+
+static void fire_disconnected(WiFiDisconnectReason reason)
+{
+	WiFiEventStationModeDisconnected event;
+	event.ssid = sta().ssid;
+	memcpy(event.bssid, AP_BSSID, sizeof(event.bssid));
+	event.reason = reason;
+	sta().disconnected.fire(event);
+}
+
+// Count a connection using the address of an expired lease, once.
+static void check_lease()
+{
+	Station &s = sta();
+	if (s.status == WL_CONNECTED && s.static_ip && s.ip == DHCP_IP && wall_time() >= s.lease_end &&
+	    !s.expired_lease_counted) {
+		s.expired_lease_counted = true;
+		s.expired_lease_uses++;
+	}
+}
+
+static void connect(const uint8_t *bssid, int32_t channel)
+{
+	Station &s = sta();
+	uint32_t gen = ++s.generation;
+	s.status = WL_DISCONNECTED;
+
+	if (!options.wifi_available || s.sleeping || (bssid != NULL && memcmp(bssid, AP_BSSID, 6) != 0) || (channel != 0 && channel != AP_CHANNEL)) {
+		schedule(now_us() + NO_AP_US, [gen]() {
+			Station &s = sta();
+			if (gen != s.generation) {
+				return;
+			}
+			s.status = WL_NO_SSID_AVAIL;
+			fire_disconnected(WIFI_DISCONNECT_REASON_NO_AP_FOUND);
+			if (s.auto_reconnect) {
+				connect(NULL, 0);
+			}
+		});
+		return;
+	}
+
+	uint64_t assoc_at = now_us() + (bssid != NULL && channel != 0 ? DIRECT_ASSOC_US : SCAN_US);
+	schedule(assoc_at, [gen]() {
+		Station &s = sta();
+		if (gen != s.generation) {
+			return;
+		}
+		s.associated = true;
+		s.channel = AP_CHANNEL;
+		memcpy(s.bssid, AP_BSSID, sizeof(s.bssid));
+		WiFiEventStationModeConnected event;
+		event.ssid = s.ssid;
+		memcpy(event.bssid, AP_BSSID, sizeof(event.bssid));
+		event.channel = AP_CHANNEL;
+		s.connected.fire(event);
+	});
+
+	schedule(assoc_at + (s.static_ip ? STATIC_IP_US : DHCP_US), [gen]() {
+		Station &s = sta();
+		if (gen != s.generation) {
+			return;
+		}
+		if (!s.static_ip) {
+			s.ip = DHCP_IP;
+			s.mask = DHCP_MASK;
+			s.gw = DHCP_GW;
+			s.dns = DHCP_DNS;
+		}
+		// The DHCP client is stopped with a static configuration.
+		s.dhcp.offered_t0_lease = s.static_ip ? 0 : options.dhcp_lease_s;
+		if (!s.static_ip) {
+			s.lease_end = wall_time() + options.dhcp_lease_s;
+		}
+		s.expired_lease_counted = false;
+		netif_default = &s.netif;
+		s.status = WL_CONNECTED;
+		check_lease();
+		WiFiEventStationModeGotIP event;
+		event.ip = s.ip;
+		event.mask = s.mask;
+		event.gw = s.gw;
+		s.got_ip.fire(event);
+	});
+}
+
+static void drop(WiFiDisconnectReason reason)
+{
+	Station &s = sta();
+	bool was_connected = s.associated;
+	s.associated = false;
+	s.generation++;
+	s.status = WL_DISCONNECTED;
+	netif_default = NULL;
+	if (was_connected) {
+		schedule(now_us(), [reason]() { fire_disconnected(reason); });
+	}
+}
+
+void wifi_poll()
+{
+	check_lease();
+}
+
+uint32_t wifi_expired_lease_uses()
+{
+	return sta().expired_lease_uses;
+}
+
+} // namespace hal
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode)
+{
+	hal::sta().mode = mode;
+	return true;
+}
+
+WiFiMode_t ESP8266WiFiClass::getMode()
+{
+	return hal::sta().mode;
+}
+
+bool ESP8266WiFiClass::hostname(const char *name)
+{
+	hal::sta().hostname = name;
+	return true;
+}
+
+const char *ESP8266WiFiClass::hostname()
+{
+	return hal::sta().hostname.c_str();
+}
+
+void ESP8266WiFiClass::persistent(bool persistent)
+{
+	(void)persistent;
+}
+
+bool ESP8266WiFiClass::setAutoReconnect(bool autoReconnect)
+{
+	hal::sta().auto_reconnect = autoReconnect;
+	return true;
+}
+
+bool ESP8266WiFiClass::getAutoReconnect()
+{
+	return hal::sta().auto_reconnect;
+}
+
+bool ESP8266WiFiClass::setSleepMode(WiFiSleepType_t type, uint8_t listenInterval)
+{
+	(void)type;
+	(void)listenInterval;
+	return true;
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect)
+{
+	(void)passphrase;
+	hal::Station &s = hal::sta();
+	hal::drop(WIFI_DISCONNECT_REASON_ASSOC_LEAVE);
+	s.ssid = ssid;
+	if (connect && ssid != NULL && ssid[0] != '\0') {
+		hal::connect(bssid, channel);
+	}
+	return s.status;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2)
+{
+	(void)dns2;
+	hal::Station &s = hal::sta();
+	s.static_ip = local_ip.isSet();
+	s.ip = local_ip;
+	s.gw = gateway;
+	s.mask = subnet;
+	s.dns = dns1;
+	return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff)
+{
+	(void)wifioff;
+	hal::drop(WIFI_DISCONNECT_REASON_ASSOC_LEAVE);
+	return true;
+}
+
+bool ESP8266WiFiClass::reconnect()
+{
+	hal::connect(NULL, 0);
+	return true;
+}
+
+bool ESP8266WiFiClass::isConnected()
+{
+	return hal::sta().status == WL_CONNECTED;
+}
+
+wl_status_t ESP8266WiFiClass::status()
+{
+	return hal::sta().status;
+}
+
+bool ESP8266WiFiClass::forceSleepBegin(uint32_t sleepUs)
+{
+	(void)sleepUs;
+	hal::drop(WIFI_DISCONNECT_REASON_ASSOC_LEAVE);
+	hal::sta().sleeping = true;
+	return true;
+}
+
+bool ESP8266WiFiClass::forceSleepWake()
+{
+	hal::sta().sleeping = false;
+	return true;
+}
+
+IPAddress ESP8266WiFiClass::localIP()
+{
+	return isConnected() ? hal::sta().ip : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::subnetMask()
+{
+	return isConnected() ? hal::sta().mask : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::gatewayIP()
+{
+	return isConnected() ? hal::sta().gw : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t dns_no)
+{
+	return isConnected() && dns_no == 0 ? hal::sta().dns : IPAddress();
+}
+
+String ESP8266WiFiClass::SSID() const
+{
+	return hal::sta().ssid;
+}
+
+uint8_t *ESP8266WiFiClass::BSSID()
+{
+	return hal::sta().bssid;
+}
+
+String ESP8266WiFiClass::BSSIDstr()
+{
+	char buf[18];
+	const uint8_t *b = hal::sta().bssid;
+	snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+	return String(buf);
+}
+
+int32_t ESP8266WiFiClass::channel()
+{
+	return hal::sta().channel;
+}
+
+int32_t ESP8266WiFiClass::RSSI()
+{
+	return hal::sta().associated ? hal::AP_RSSI : 31;
+}
+
+String ESP8266WiFiClass::macAddress()
+{
+	return String("5C:CF:7F:00:00:01");
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeConnected(std::function<void(const WiFiEventStationModeConnected &)> f)
+{
+	return hal::sta().connected.add(f);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected &)> f)
+{
+	return hal::sta().disconnected.add(f);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeAuthModeChanged(std::function<void(const WiFiEventStationModeAuthModeChanged &)> f)
+{
+	return hal::sta().auth_mode_changed.add(f);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP &)> f)
+{
+	return hal::sta().got_ip.add(f);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDHCPTimeout(std::function<void(void)> f)
+{
+	return hal::sta().dhcp_timeout.add(f);
+}
@@ -0,0 +1,142 @@
+/*
+ * ESP8266WiFi.h - Wi-Fi station for the native build. A single simulated
+ * access point accepts any passphrase for a non-empty SSID; association and
+ * DHCP take representative amounts of virtual time, and the usual station
+ * events are delivered from hal::poll().
+ */
+
+#ifndef _NATIVE_ESP8266WIFI_h
+#define _NATIVE_ESP8266WIFI_h
+
+#include <Arduino.h>
+#include <functional>
+#include <memory>
+
+typedef enum WiFiMode {
+	WIFI_OFF = 0,
+	WIFI_STA = 1,
+	WIFI_AP = 2,
+	WIFI_AP_STA = 3
+} WiFiMode_t;
+
+typedef enum {
+	WL_IDLE_STATUS = 0,
+	WL_NO_SSID_AVAIL = 1,
+	WL_SCAN_COMPLETED = 2,
+	WL_CONNECTED = 3,
+	WL_CONNECT_FAILED = 4,
+	WL_CONNECTION_LOST = 5,
+	WL_WRONG_PASSWORD = 6,
+	WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum WiFiSleepType {
+	WIFI_NONE_SLEEP = 0,
+	WIFI_LIGHT_SLEEP = 1,
+	WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+enum WiFiDisconnectReason {
+	WIFI_DISCONNECT_REASON_UNSPECIFIED = 1,
+	WIFI_DISCONNECT_REASON_AUTH_EXPIRE = 2,
+	WIFI_DISCONNECT_REASON_AUTH_LEAVE = 3,
+	WIFI_DISCONNECT_REASON_ASSOC_EXPIRE = 4,
+	WIFI_DISCONNECT_REASON_ASSOC_TOOMANY = 5,
+	WIFI_DISCONNECT_REASON_NOT_AUTHED = 6,
+	WIFI_DISCONNECT_REASON_NOT_ASSOCED = 7,
+	WIFI_DISCONNECT_REASON_ASSOC_LEAVE = 8,
+	WIFI_DISCONNECT_REASON_ASSOC_NOT_AUTHED = 9,
+	WIFI_DISCONNECT_REASON_DISASSOC_PWRCAP_BAD = 10,
+	WIFI_DISCONNECT_REASON_DISASSOC_SUPCHAN_BAD = 11,
+	WIFI_DISCONNECT_REASON_IE_INVALID = 13,
+	WIFI_DISCONNECT_REASON_MIC_FAILURE = 14,
+	WIFI_DISCONNECT_REASON_4WAY_HANDSHAKE_TIMEOUT = 15,
+	WIFI_DISCONNECT_REASON_GROUP_KEY_UPDATE_TIMEOUT = 16,
+	WIFI_DISCONNECT_REASON_IE_IN_4WAY_DIFFERS = 17,
+	WIFI_DISCONNECT_REASON_GROUP_CIPHER_INVALID = 18,
+	WIFI_DISCONNECT_REASON_PAIRWISE_CIPHER_INVALID = 19,
+	WIFI_DISCONNECT_REASON_AKMP_INVALID = 20,
+	WIFI_DISCONNECT_REASON_UNSUPP_RSN_IE_VERSION = 21,
+	WIFI_DISCONNECT_REASON_INVALID_RSN_IE_CAP = 22,
+	WIFI_DISCONNECT_REASON_802_1X_AUTH_FAILED = 23,
+	WIFI_DISCONNECT_REASON_CIPHER_SUITE_REJECTED = 24,
+	WIFI_DISCONNECT_REASON_BEACON_TIMEOUT = 200,
+	WIFI_DISCONNECT_REASON_NO_AP_FOUND = 201,
+	WIFI_DISCONNECT_REASON_AUTH_FAIL = 202,
+	WIFI_DISCONNECT_REASON_ASSOC_FAIL = 203,
+	WIFI_DISCONNECT_REASON_HANDSHAKE_TIMEOUT = 204,
+};
+
+struct WiFiEventStationModeConnected {
+	String ssid;
+	uint8_t bssid[6];
+	uint8_t channel;
+};
+
+struct WiFiEventStationModeDisconnected {
+	String ssid;
+	uint8_t bssid[6];
+	WiFiDisconnectReason reason;
+};
+
+struct WiFiEventStationModeAuthModeChanged {
+	uint8_t oldMode;
+	uint8_t newMode;
+};
+
+struct WiFiEventStationModeGotIP {
+	IPAddress ip;
+	IPAddress mask;
+	IPAddress gw;
+};
+
+class WiFiEventHandlerOpaque {
+    public:
+	virtual ~WiFiEventHandlerOpaque()
+	{
+	}
+};
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+class ESP8266WiFiClass {
+    public:
+	bool mode(WiFiMode_t mode);
+	WiFiMode_t getMode();
+	bool hostname(const char *name);
+	const char *hostname();
+	void persistent(bool persistent);
+	bool setAutoReconnect(bool autoReconnect);
+	bool getAutoReconnect();
+	bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0);
+
+	wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+	bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+	bool disconnect(bool wifioff = false);
+	bool reconnect();
+	bool isConnected();
+	wl_status_t status();
+
+	bool forceSleepBegin(uint32_t sleepUs = 0);
+	bool forceSleepWake();
+
+	IPAddress localIP();
+	IPAddress subnetMask();
+	IPAddress gatewayIP();
+	IPAddress dnsIP(uint8_t dns_no = 0);
+	String SSID() const;
+	uint8_t *BSSID();
+	String BSSIDstr();
+	int32_t channel();
+	int32_t RSSI();
+	String macAddress();
+
+	WiFiEventHandler onStationModeConnected(std::function<void(const WiFiEventStationModeConnected &)>);
+	WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected &)>);
+	WiFiEventHandler onStationModeAuthModeChanged(std::function<void(const WiFiEventStationModeAuthModeChanged &)>);
+	WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP &)>);
+	WiFiEventHandler onStationModeDHCPTimeout(std::function<void(void)>);
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // _NATIVE_ESP8266WIFI_h
@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <time.h>
+#include "MD5Builder.h"
+#include "hal.h"
+
+EspClass ESP;
+
+static uint8_t rtc_user_memory[512];
+
+void EspClass::restart()
+{
+	Serial.flush();
+	fprintf(stderr, "ESP.restart() called, exiting.\n");
+	exit(0);
+}
+
+void EspClass::reset()
+{
+	restart();
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+	return 40000;
+}
+
+uint8_t EspClass::getHeapFragmentation()
+{
+	return 0;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize()
+{
+	return 40000;
+}
+
+uint32_t EspClass::getChipId()
+{
+	return 0x00abcdef;
+}
+
+String EspClass::getCoreVersion()
+{
+	return String("native");
+}
+
+String EspClass::getFullVersion()
+{
+	return String("native");
+}
+
+const char *EspClass::getSdkVersion()
+{
+	return "native";
+}
+
+uint8_t EspClass::getCpuFreqMHz()
+{
+	return 160;
+}
+
+uint8_t EspClass::getBootMode()
+{
+	return 1;
+}
+
+uint8_t EspClass::getBootVersion()
+{
+	return 0;
+}
+
+String EspClass::getResetReason()
+{
+	return String("External System");
+}
+
+String EspClass::getResetInfo()
+{
+	return String("Native build");
+}
+
+uint32_t EspClass::getSketchSize()
+{
+	return 0;
+}
+
+uint32_t EspClass::getFreeSketchSpace()
+{
+	// As on an ESP-12E with 1 MB of its flash for the sketches.
+	return 0xfb000;
+}
+
+// The MD5 of the program binary, computed once like the core does.
+String EspClass::getSketchMD5()
+{
+	static char md5[33];
+
+	if (md5[0] == '\0') {
+		MD5Builder builder;
+		uint8_t buf[4096];
+		size_t n;
+
+		builder.begin();
+		FILE *f = fopen("/proc/self/exe", "rb");
+		while (f != NULL && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+			builder.add(buf, n);
+		}
+		if (f != NULL) {
+			fclose(f);
+		}
+		builder.calculate();
+		builder.getChars(md5);
+	}
+	return String(md5);
+}
+
+uint32_t EspClass::getFlashChipId()
+{
+	return 0;
+}
+
+uint32_t EspClass::getFlashChipSize()
+{
+	return 4 * 1024 * 1024;
+}
+
+uint32_t EspClass::getFlashChipSpeed()
+{
+	return 40000000;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) * 160 / 1000);
+}
+
+/*
+ * With --rtc-mem the RTC user memory is read from its file at the first
+ * access and written through to it.
+ */
+static void loadRtcUserMemory()
+{
+	static bool loaded = false;
+
+	if (loaded || hal::options.rtc_memory_path == NULL) {
+		return;
+	}
+	loaded = true;
+	FILE *f = fopen(hal::options.rtc_memory_path, "rb");
+	if (f != NULL) {
+		if (fread(rtc_user_memory, 1, sizeof(rtc_user_memory), f) != sizeof(rtc_user_memory)) {
+			memset(rtc_user_memory, 0, sizeof(rtc_user_memory));
+		}
+		fclose(f);
+	}
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+{
+	if (offset * 4 + size > sizeof(rtc_user_memory) || size == 0) {
+		return false;
+	}
+	loadRtcUserMemory();
+	memcpy(data, rtc_user_memory + offset * 4, size);
+	return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+{
+	if (offset * 4 + size > sizeof(rtc_user_memory) || size == 0) {
+		return false;
+	}
+	loadRtcUserMemory();
+	memcpy(rtc_user_memory + offset * 4, data, size);
+	if (hal::options.rtc_memory_path != NULL) {
+		FILE *f = fopen(hal::options.rtc_memory_path, "wb");
+		if (f != NULL) {
+			fwrite(rtc_user_memory, 1, sizeof(rtc_user_memory), f);
+			fclose(f);
+		}
+	}
+	return true;
+}
+
+uint32_t crc32(const void *data, size_t length, uint32_t crc)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	while (length--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return crc;
+}
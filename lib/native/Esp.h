@@ -0,0 +1,51 @@
+/*
+ * Esp.h - the ESP8266 system API for the native build. Heap and flash figures
+ * are fixed stand-in values, the sketch MD5 is that of the program binary, and
+ * RTC user memory lives for the process lifetime, or in a file with --rtc-mem.
+ */
+
+#ifndef _NATIVE_ESP_h
+#define _NATIVE_ESP_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "WString.h"
+
+class EspClass {
+    public:
+	void restart();
+	void reset();
+	void wdtFeed()
+	{
+	}
+
+	uint32_t getFreeHeap();
+	uint8_t getHeapFragmentation();
+	uint32_t getMaxFreeBlockSize();
+	uint32_t getChipId();
+	String getCoreVersion();
+	String getFullVersion();
+	const char *getSdkVersion();
+	uint8_t getCpuFreqMHz();
+	uint8_t getBootMode();
+	uint8_t getBootVersion();
+	String getResetReason();
+	String getResetInfo();
+	uint32_t getSketchSize();
+	uint32_t getFreeSketchSpace();
+	String getSketchMD5();
+	uint32_t getFlashChipId();
+	uint32_t getFlashChipSize();
+	uint32_t getFlashChipSpeed();
+
+	// The host's monotonic clock in units of a 160 MHz CPU cycle.
+	uint32_t getCycleCount();
+
+	bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+	bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+};
+
+extern EspClass ESP;
+
+#endif // _NATIVE_ESP_h
@@ -0,0 +1,39 @@
+/*
+ * HardwareSerial.h - the ESP8266 UART, backed by stdin/stdout or by a
+ * pseudo-terminal when the native program is started with --pty.
+ */
+
+#ifndef _NATIVE_HARDWARESERIAL_h
+#define _NATIVE_HARDWARESERIAL_h
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+    public:
+	HardwareSerial()
+	{
+	}
+
+	void begin(unsigned long baud);
+	void end();
+	int available() override;
+	int read() override;
+	int peek() override;
+	void flush() override;
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+	int availableForWrite() override
+	{
+		return 128;
+	}
+	using Print::write;
+
+	operator bool() const
+	{
+		return true;
+	}
+};
+
+extern HardwareSerial Serial;
+
+#endif // _NATIVE_HARDWARESERIAL_h
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include "Print.h"
+#include "IPAddress.h"
+
+bool IPAddress::fromString(const char *address)
+{
+	unsigned a, b, c, d;
+	char extra;
+	if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+		return false;
+	}
+	*this = IPAddress(a, b, c, d);
+	return true;
+}
+
+String IPAddress::toString() const
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+	return String(buf);
+}
+
+size_t IPAddress::printTo(Print &p) const
+{
+	return p.print(toString());
+}
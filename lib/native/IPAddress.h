@@ -0,0 +1,54 @@
+/*
+ * IPAddress.h - IPv4 address for the native build.
+ */
+
+#ifndef _NATIVE_IPADDRESS_h
+#define _NATIVE_IPADDRESS_h
+
+#include <stdint.h>
+
+#include "Printable.h"
+#include "WString.h"
+
+class IPAddress : public Printable {
+	// Network byte order, as in lwIP.
+	uint32_t addr;
+
+    public:
+	IPAddress()
+		: addr(0)
+	{
+	}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+		: addr((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24)
+	{
+	}
+	IPAddress(uint32_t address)
+		: addr(address)
+	{
+	}
+
+	operator uint32_t() const
+	{
+		return addr;
+	}
+	uint8_t operator[](int index) const
+	{
+		return (addr >> (8 * index)) & 0xff;
+	}
+	bool operator==(const IPAddress &other) const
+	{
+		return addr == other.addr;
+	}
+	bool isSet() const
+	{
+		return addr != 0;
+	}
+	bool fromString(const char *address);
+	String toString() const;
+	size_t printTo(Print &p) const override;
+};
+
+#define INADDR_NONE IPAddress(0, 0, 0, 0)
+
+#endif // _NATIVE_IPADDRESS_h
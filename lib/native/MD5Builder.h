@@ -0,0 +1,32 @@
+/*
+ * MD5Builder.h - incremental MD5 for the native build, with the ESP8266
+ * core's interface. Used by the Updater stand-in and ESP.getSketchMD5().
+ */
+
+#ifndef _NATIVE_MD5_BUILDER_h
+#define _NATIVE_MD5_BUILDER_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "WString.h"
+
+class MD5Builder {
+	uint32_t state[4];
+	uint64_t length;
+	uint8_t block[64];
+	uint8_t digest[16];
+
+	void transform(const uint8_t *data);
+
+    public:
+	void begin(void);
+	void add(const uint8_t *data, const uint16_t len);
+	void add(const char *data);
+	void calculate(void);
+	void getBytes(uint8_t *output) const;
+	void getChars(char *output) const;
+	String toString(void) const;
+};
+
+#endif // _NATIVE_MD5_BUILDER_h
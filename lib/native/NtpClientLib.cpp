@@ -0,0 +1,134 @@
+#include <ESP8266WiFi.h>
+#include <NtpClientLib.h>
+#include "hal.h"
+
+NTPClient NTP;
+
+namespace hal {
+
+// Network round trip of a simulated NTP exchange.
+static const uint32_t NTP_ROUND_TRIP_US = 12000;
+
+struct NtpState {
+	String server;
+	int short_interval = DEFAULT_NTP_SHORTINTERVAL;
+	int long_interval = DEFAULT_NTP_INTERVAL;
+	time_t last_sync = 0;
+	time_t first_sync = 0;
+	bool running = false;
+	bool synced = false;
+	onSyncEvent_t handler;
+};
+
+static NtpState &ntp()
+{
+	static NtpState s;
+	return s;
+}
+
+static time_t ntp_get_time()
+{
+	NtpState &s = ntp();
+	if (!WiFi.isConnected()) {
+		if (s.handler) {
+			s.handler(noResponse);
+		}
+		setSyncInterval(s.short_interval);
+		return 0;
+	}
+
+	// The request and its reply, as the real library reports them.
+	if (s.handler) {
+		s.handler(requestSent);
+	}
+	delayMicroseconds(NTP_ROUND_TRIP_US);
+
+	time_t t = wall_time();
+	s.last_sync = t;
+	if (s.first_sync == 0) {
+		s.first_sync = t;
+	}
+	s.synced = true;
+	setSyncInterval(s.long_interval);
+	if (s.handler) {
+		s.handler(timeSyncd);
+	}
+	return t;
+}
+
+} // namespace hal
+
+bool NTPClient::begin(String ntpServerName, int8_t timeOffset, bool daylight, int8_t minutes)
+{
+	(void)timeOffset;
+	(void)daylight;
+	(void)minutes;
+	hal::NtpState &s = hal::ntp();
+	if (ntpServerName.length() == 0) {
+		return false;
+	}
+	s.server = ntpServerName;
+	s.running = true;
+	s.synced = false;
+	setSyncProvider(hal::ntp_get_time);
+	setSyncInterval(s.short_interval);
+	return true;
+}
+
+bool NTPClient::stop()
+{
+	hal::NtpState &s = hal::ntp();
+	s.running = false;
+	setSyncProvider(NULL);
+	return true;
+}
+
+bool NTPClient::setInterval(int interval)
+{
+	return setInterval(DEFAULT_NTP_SHORTINTERVAL, interval);
+}
+
+bool NTPClient::setInterval(int shortInterval, int longInterval)
+{
+	if (shortInterval < 10 || longInterval < 10) {
+		return false;
+	}
+	hal::ntp().short_interval = shortInterval;
+	hal::ntp().long_interval = longInterval;
+	return true;
+}
+
+int NTPClient::getInterval()
+{
+	return hal::ntp().long_interval;
+}
+
+void NTPClient::onNTPSyncEvent(onSyncEvent_t handler)
+{
+	hal::ntp().handler = handler;
+}
+
+time_t NTPClient::getTime()
+{
+	return hal::ntp_get_time();
+}
+
+time_t NTPClient::getLastNTPSync()
+{
+	return hal::ntp().last_sync;
+}
+
+time_t NTPClient::getFirstSync()
+{
+	return hal::ntp().first_sync;
+}
+
+bool NTPClient::SyncStatus()
+{
+	return hal::ntp().synced;
+}
+
+String NTPClient::getNtpServerName()
+{
+	return hal::ntp().server;
+}
@@ -0,0 +1,47 @@
+/*
+ * NtpClientLib.h - SNTP client for the native build. Instead of querying a
+ * server it serves the virtual wall-clock time through TimeLib's sync
+ * provider, and reports events like the real library does.
+ */
+
+#ifndef _NATIVE_NTPCLIENTLIB_h
+#define _NATIVE_NTPCLIENTLIB_h
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <functional>
+
+#define DEFAULT_NTP_SERVER "pool.ntp.org"
+#define DEFAULT_NTP_INTERVAL 1800
+#define DEFAULT_NTP_SHORTINTERVAL 15
+#define DEFAULT_NTP_TIMEZONE 0
+
+typedef enum {
+	timeSyncd = 0,
+	noResponse = -1,
+	invalidAddress = -2,
+	requestSent = 1,
+	errorSending = -3,
+	responseError = -4,
+} NTPSyncEvent_t;
+
+typedef std::function<void(NTPSyncEvent_t)> onSyncEvent_t;
+
+class NTPClient {
+    public:
+	bool begin(String ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0);
+	bool stop();
+	bool setInterval(int interval);
+	bool setInterval(int shortInterval, int longInterval);
+	int getInterval();
+	void onNTPSyncEvent(onSyncEvent_t handler);
+	time_t getTime();
+	time_t getLastNTPSync();
+	time_t getFirstSync();
+	bool SyncStatus();
+	String getNtpServerName();
+};
+
+extern NTPClient NTP;
+
+#endif // _NATIVE_NTPCLIENTLIB_h
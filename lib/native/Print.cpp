@@ -0,0 +1,247 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Print.h"
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while (size--) {
+		n += write(*buffer++);
+	}
+	return n;
+}
+
+size_t Print::write(const char *str)
+{
+	if (str == NULL) {
+		return 0;
+	}
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	char buf[256];
+	va_list arg;
+	va_start(arg, format);
+	int len = vsnprintf(buf, sizeof(buf), format, arg);
+	va_end(arg);
+	if (len < 0) {
+		return 0;
+	}
+	if ((size_t)len >= sizeof(buf)) {
+		char *big = new char[len + 1];
+		va_start(arg, format);
+		vsnprintf(big, len + 1, format, arg);
+		va_end(arg);
+		size_t n = write((const uint8_t *)big, len);
+		delete[] big;
+		return n;
+	}
+	return write((const uint8_t *)buf, len);
+}
+
+size_t Print::printf_P(const char *format, ...)
+{
+	char buf[256];
+	va_list arg;
+	va_start(arg, format);
+	int len = vsnprintf(buf, sizeof(buf), format, arg);
+	va_end(arg);
+	if (len < 0) {
+		return 0;
+	}
+	return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+size_t Print::printNumber(unsigned long long n, uint8_t base)
+{
+	char buf[8 * sizeof(n) + 1];
+	char *str = &buf[sizeof(buf) - 1];
+
+	*str = '\0';
+	if (base < 2) {
+		base = 10;
+	}
+	do {
+		char c = n % base;
+		n /= base;
+		*--str = c < 10 ? c + '0' : c + 'A' - 10;
+	} while (n);
+
+	return write(str);
+}
+
+size_t Print::printSigned(long long n, int base)
+{
+	if (base == 10 && n < 0) {
+		size_t t = print('-');
+		return printNumber(-(unsigned long long)n, 10) + t;
+	}
+	if (base == 0) {
+		return write((uint8_t)n);
+	}
+	return printNumber((unsigned long long)n, base);
+}
+
+size_t Print::printFloat(double number, uint8_t digits)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", digits, number);
+	return write(buf);
+}
+
+size_t Print::print(const __FlashStringHelper *ifsh)
+{
+	return write(reinterpret_cast<const char *>(ifsh));
+}
+
+size_t Print::print(const String &s)
+{
+	return write((const uint8_t *)s.c_str(), s.length());
+}
+
+size_t Print::print(const char str[])
+{
+	return write(str);
+}
+
+size_t Print::print(char c)
+{
+	return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char b, int base)
+{
+	return print((unsigned long)b, base);
+}
+
+size_t Print::print(int n, int base)
+{
+	return printSigned(n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+	return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+	return printSigned(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+	if (base == 0) {
+		return write((uint8_t)n);
+	}
+	return printNumber(n, base);
+}
+
+size_t Print::print(long long n, int base)
+{
+	return printSigned(n, base);
+}
+
+size_t Print::print(unsigned long long n, int base)
+{
+	if (base == 0) {
+		return write((uint8_t)n);
+	}
+	return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+	return printFloat(n, digits);
+}
+
+size_t Print::print(const Printable &x)
+{
+	return x.printTo(*this);
+}
+
+size_t Print::println(void)
+{
+	return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *ifsh)
+{
+	size_t n = print(ifsh);
+	return n + println();
+}
+
+size_t Print::println(const String &s)
+{
+	size_t n = print(s);
+	return n + println();
+}
+
+size_t Print::println(const char c[])
+{
+	size_t n = print(c);
+	return n + println();
+}
+
+size_t Print::println(char c)
+{
+	size_t n = print(c);
+	return n + println();
+}
+
+size_t Print::println(unsigned char b, int base)
+{
+	size_t n = print(b, base);
+	return n + println();
+}
+
+size_t Print::println(int num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(unsigned int num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(long num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(unsigned long num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(long long num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(unsigned long long num, int base)
+{
+	size_t n = print(num, base);
+	return n + println();
+}
+
+size_t Print::println(double num, int digits)
+{
+	size_t n = print(num, digits);
+	return n + println();
+}
+
+size_t Print::println(const Printable &x)
+{
+	size_t n = print(x);
+	return n + println();
+}
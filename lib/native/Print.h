@@ -0,0 +1,77 @@
+/*
+ * Print.h - Arduino Print class for the native build.
+ */
+
+#ifndef _NATIVE_PRINT_h
+#define _NATIVE_PRINT_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "WString.h"
+#include "Printable.h"
+
+class __FlashStringHelper;
+
+class Print {
+	size_t printNumber(unsigned long long n, uint8_t base);
+	size_t printSigned(long long n, int base);
+	size_t printFloat(double number, uint8_t digits);
+
+    public:
+	virtual ~Print()
+	{
+	}
+
+	virtual size_t write(uint8_t) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual void flush()
+	{
+	}
+	virtual int availableForWrite()
+	{
+		return 0;
+	}
+
+	size_t write(const char *str);
+	size_t write(const char *buffer, size_t size)
+	{
+		return write((const uint8_t *)buffer, size);
+	}
+
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	size_t printf_P(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+	size_t print(const __FlashStringHelper *);
+	size_t print(const String &);
+	size_t print(const char[]);
+	size_t print(char);
+	size_t print(unsigned char, int = DEC_BASE);
+	size_t print(int, int = DEC_BASE);
+	size_t print(unsigned int, int = DEC_BASE);
+	size_t print(long, int = DEC_BASE);
+	size_t print(unsigned long, int = DEC_BASE);
+	size_t print(long long, int = DEC_BASE);
+	size_t print(unsigned long long, int = DEC_BASE);
+	size_t print(double, int = 2);
+	size_t print(const Printable &);
+
+	size_t println(const __FlashStringHelper *);
+	size_t println(const String &s);
+	size_t println(const char[]);
+	size_t println(char);
+	size_t println(unsigned char, int = DEC_BASE);
+	size_t println(int, int = DEC_BASE);
+	size_t println(unsigned int, int = DEC_BASE);
+	size_t println(long, int = DEC_BASE);
+	size_t println(unsigned long, int = DEC_BASE);
+	size_t println(long long, int = DEC_BASE);
+	size_t println(unsigned long long, int = DEC_BASE);
+	size_t println(double, int = 2);
+	size_t println(const Printable &);
+	size_t println(void);
+
+	static const int DEC_BASE = 10;
+};
+
+#endif // _NATIVE_PRINT_h
@@ -0,0 +1,20 @@
+/*
+ * Printable.h - Arduino Printable interface for the native build.
+ */
+
+#ifndef _NATIVE_PRINTABLE_h
+#define _NATIVE_PRINTABLE_h
+
+#include <stddef.h>
+
+class Print;
+
+class Printable {
+    public:
+	virtual ~Printable()
+	{
+	}
+	virtual size_t printTo(Print &p) const = 0;
+};
+
+#endif // _NATIVE_PRINTABLE_h
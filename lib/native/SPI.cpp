@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include "hal.h"
+
+SPIClass SPI;
+
+namespace hal {
+
+static SpiFrame current, last;
+static bool selected = false;
+static uint64_t frame_count = 0;
+static FILE *spi_log = NULL;
+
+static std::function<void(const SpiFrame &)> &listener()
+{
+	static std::function<void(const SpiFrame &)> fn;
+	return fn;
+}
+
+void spi_begin_frame()
+{
+	selected = true;
+	current.length = 0;
+}
+
+void spi_byte(uint8_t b)
+{
+	if (selected && current.length < sizeof(current.data)) {
+		current.data[current.length++] = b;
+	}
+}
+
+void spi_end_frame()
+{
+	if (!selected) {
+		return;
+	}
+	selected = false;
+	current.at_us = now_us();
+	last = current;
+	frame_count++;
+
+	if (options.spi_log_path != NULL) {
+		if (spi_log == NULL) {
+			spi_log = fopen(options.spi_log_path, "w");
+		}
+		if (spi_log != NULL) {
+			fprintf(spi_log, "%llu", (unsigned long long)last.at_us);
+			for (uint8_t i = 0; i < last.length; i++) {
+				fprintf(spi_log, " %02x", last.data[i]);
+			}
+			fputc('\n', spi_log);
+		}
+	}
+
+	if (listener()) {
+		listener()(last);
+	}
+}
+
+uint64_t spi_frame_count()
+{
+	return frame_count;
+}
+
+const SpiFrame &spi_last_frame()
+{
+	return last;
+}
+
+void spi_set_listener(std::function<void(const SpiFrame &)> fn)
+{
+	listener() = fn;
+}
+
+} // namespace hal
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	hal::spi_byte(data);
+	return 0;
+}
+
+void SPIClass::transferBytes(const uint8_t *out, uint8_t *in, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) {
+		uint8_t r = transfer(out ? out[i] : 0xff);
+		if (in) {
+			in[i] = r;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * SPI.h - SPI master for the native build. Bytes sent while the chip select
+ * line is low are captured and latched as a frame when it goes high again,
+ * see hal::spi_last_frame().
+ */
+
+#ifndef _NATIVE_SPI_h
+#define _NATIVE_SPI_h
+
+#include <stdint.h>
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+class SPISettings {
+    public:
+	SPISettings()
+	{
+	}
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode)
+	{
+		(void)clock;
+		(void)bitOrder;
+		(void)dataMode;
+	}
+};
+
+class SPIClass {
+    public:
+	void begin()
+	{
+	}
+	void end()
+	{
+	}
+	void beginTransaction(SPISettings settings)
+	{
+		(void)settings;
+	}
+	void endTransaction()
+	{
+	}
+	uint8_t transfer(uint8_t data);
+	void transferBytes(const uint8_t *out, uint8_t *in, uint32_t size);
+};
+
+extern SPIClass SPI;
+
+#endif // _NATIVE_SPI_h
@@ -0,0 +1,47 @@
+#include "Stream.h"
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+	size_t count = 0;
+	while (count < length && available() > 0) {
+		*buffer++ = (char)read();
+		count++;
+	}
+	return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+	size_t index = 0;
+	while (index < length && available() > 0) {
+		int c = read();
+		if (c == terminator) {
+			break;
+		}
+		*buffer++ = (char)c;
+		index++;
+	}
+	return index;
+}
+
+String Stream::readString()
+{
+	String ret;
+	while (available() > 0) {
+		ret += (char)read();
+	}
+	return ret;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+	String ret;
+	while (available() > 0) {
+		int c = read();
+		if (c == terminator) {
+			break;
+		}
+		ret += (char)c;
+	}
+	return ret;
+}
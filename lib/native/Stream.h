@@ -0,0 +1,33 @@
+/*
+ * Stream.h - Arduino Stream class for the native build.
+ */
+
+#ifndef _NATIVE_STREAM_h
+#define _NATIVE_STREAM_h
+
+#include "Print.h"
+
+class Stream : public Print {
+    protected:
+	unsigned long _timeout = 1000;
+
+    public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout)
+	{
+		_timeout = timeout;
+	}
+
+	// Unlike the Arduino core, these do not wait for further input: they
+	// return what has been received so far. The firmware accumulates
+	// partial lines itself.
+	size_t readBytes(char *buffer, size_t length);
+	size_t readBytesUntil(char terminator, char *buffer, size_t length);
+	String readString();
+	String readStringUntil(char terminator);
+};
+
+#endif // _NATIVE_STREAM_h
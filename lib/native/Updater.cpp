@@ -0,0 +1,151 @@
+#include <Arduino.h>
+#include <string.h>
+
+#include "Updater.h"
+#include "eboot_command.h"
+
+// Typical erase and program time of a 4 KB flash sector.
+#define UPDATE_SECTOR_WRITE_US 50000
+
+UpdaterClass Update;
+
+void UpdaterClass::_reset()
+{
+	_size = 0;
+	_progress = 0;
+	_buffered = 0;
+	_target_md5[0] = '\0';
+}
+
+bool UpdaterClass::begin(size_t size, int command, int ledPin, uint8_t ledOn)
+{
+	(void)ledPin;
+	(void)ledOn;
+	if (_size > 0) {
+		_error = UPDATE_ERROR_BOOTSTRAP;
+		return false;
+	}
+	_reset();
+	_error = UPDATE_ERROR_OK;
+	if (command != U_FLASH || size == 0) {
+		_error = UPDATE_ERROR_SIZE;
+		return false;
+	}
+	if (size > ESP.getFreeSketchSpace()) {
+		_error = UPDATE_ERROR_SPACE;
+		return false;
+	}
+	// At the end of the sketch space, from where eboot copies it over the
+	// running sketch.
+	uint32_t roundedSize = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	_startAddress = ESP.getSketchSize() + ESP.getFreeSketchSpace() - roundedSize;
+	_size = size;
+	_md5.begin();
+	return true;
+}
+
+bool UpdaterClass::setMD5(const char *expected_md5)
+{
+	if (strlen(expected_md5) != 32) {
+		return false;
+	}
+	memcpy(_target_md5, expected_md5, sizeof(_target_md5));
+	return true;
+}
+
+bool UpdaterClass::_flush()
+{
+	delayMicroseconds(UPDATE_SECTOR_WRITE_US);
+	_buffered = 0;
+	return true;
+}
+
+size_t UpdaterClass::write(uint8_t *data, size_t len)
+{
+	if (hasError() || !isRunning()) {
+		return 0;
+	}
+	if (len > remaining()) {
+		_error = UPDATE_ERROR_SPACE;
+		return 0;
+	}
+	if (_progress == 0 && len > 0 && data[0] != 0xe9 && data[0] != 0x1f) {
+		_error = UPDATE_ERROR_MAGIC_BYTE;
+		return 0;
+	}
+
+	for (size_t done = 0; done < len;) {
+		size_t n = len - done;
+		if (n > FLASH_SECTOR_SIZE - _buffered) {
+			n = FLASH_SECTOR_SIZE - _buffered;
+		}
+		_md5.add(data + done, n);
+		_buffered += n;
+		_progress += n;
+		done += n;
+		if ((_buffered == FLASH_SECTOR_SIZE || remaining() == 0) && !_flush()) {
+			return done;
+		}
+	}
+	return len;
+}
+
+bool UpdaterClass::end(bool evenIfRemaining)
+{
+	if (_size == 0) {
+		return false;
+	}
+	if (hasError() || (remaining() > 0 && !evenIfRemaining)) {
+		_reset();
+		return false;
+	}
+	_md5.calculate();
+	if (_target_md5[0] != '\0') {
+		char md5[33];
+		_md5.getChars(md5);
+		if (strcmp(md5, _target_md5) != 0) {
+			_error = UPDATE_ERROR_MD5;
+			_reset();
+			return false;
+		}
+	}
+
+	struct eboot_command ebcmd;
+	memset(&ebcmd, 0, sizeof(ebcmd));
+	ebcmd.action = ACTION_COPY_RAW;
+	ebcmd.args[0] = _startAddress;
+	ebcmd.args[1] = 0x00000;
+	ebcmd.args[2] = _size;
+	eboot_command_write(&ebcmd);
+
+	_reset();
+	return true;
+}
+
+String UpdaterClass::getErrorString() const
+{
+	switch (_error) {
+	case UPDATE_ERROR_OK:
+		return String("No Error");
+	case UPDATE_ERROR_WRITE:
+		return String("Flash Write Failed");
+	case UPDATE_ERROR_ERASE:
+		return String("Flash Erase Failed");
+	case UPDATE_ERROR_READ:
+		return String("Flash Read Failed");
+	case UPDATE_ERROR_SPACE:
+		return String("Not Enough Space");
+	case UPDATE_ERROR_SIZE:
+		return String("Bad Size Given");
+	case UPDATE_ERROR_STREAM:
+		return String("Stream Read Timeout");
+	case UPDATE_ERROR_MD5:
+		return String("MD5 Check Failed");
+	case UPDATE_ERROR_MAGIC_BYTE:
+		return String("Magic byte is wrong, not 0xE9");
+	case UPDATE_ERROR_BOOTSTRAP:
+		return String("Invalid bootstrapping state, reset ESP8266 before updating");
+	default:
+		return String("UNKNOWN");
+	}
+}
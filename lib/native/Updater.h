@@ -0,0 +1,98 @@
+/*
+ * Updater.h - firmware updates for the native build. The image isn't stored;
+ * the stand-in checks it like the ESP8266 core does, the first byte for the
+ * image magic or a gzip header and the MD5 of the whole upload, and spends
+ * the virtual time a flash sector erase and write takes for each 4 KB. A
+ * successful end() leaves eboot the command to copy the image, which
+ * hal::run() consumes at the next boot.
+ */
+
+#ifndef _NATIVE_UPDATER_h
+#define _NATIVE_UPDATER_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MD5Builder.h"
+#include "WString.h"
+
+#define UPDATE_ERROR_OK			(0)
+#define UPDATE_ERROR_WRITE		(1)
+#define UPDATE_ERROR_ERASE		(2)
+#define UPDATE_ERROR_READ		(3)
+#define UPDATE_ERROR_SPACE		(4)
+#define UPDATE_ERROR_SIZE		(5)
+#define UPDATE_ERROR_STREAM		(6)
+#define UPDATE_ERROR_MD5		(7)
+#define UPDATE_ERROR_FLASH_CONFIG	(8)
+#define UPDATE_ERROR_NEW_FLASH_CONFIG	(9)
+#define UPDATE_ERROR_MAGIC_BYTE		(10)
+#define UPDATE_ERROR_BOOTSTRAP		(11)
+#define UPDATE_ERROR_SIGN		(12)
+#define UPDATE_ERROR_NO_DATA		(13)
+
+#define U_FLASH 0
+#define U_FS 100
+
+#define FLASH_SECTOR_SIZE 0x1000
+
+class UpdaterClass {
+	size_t _size = 0;
+	uint32_t _startAddress = 0;
+	size_t _progress = 0;
+	size_t _buffered = 0;
+	uint8_t _error = UPDATE_ERROR_OK;
+	char _target_md5[33] = "";
+	MD5Builder _md5;
+
+	void _reset();
+	bool _flush();
+
+    public:
+	bool begin(size_t size, int command = U_FLASH, int ledPin = -1, uint8_t ledOn = 0);
+	bool setMD5(const char *expected_md5);
+	size_t write(uint8_t *data, size_t len);
+	bool end(bool evenIfRemaining = false);
+
+	uint8_t getError()
+	{
+		return _error;
+	}
+	String getErrorString() const;
+	void clearError()
+	{
+		_error = UPDATE_ERROR_OK;
+	}
+	bool hasError()
+	{
+		return _error != UPDATE_ERROR_OK;
+	}
+	bool isRunning()
+	{
+		return _size > 0;
+	}
+	bool isFinished()
+	{
+		return _size > 0 && _progress == _size;
+	}
+	size_t size()
+	{
+		return _size;
+	}
+	size_t progress()
+	{
+		return _progress;
+	}
+	size_t remaining()
+	{
+		return _size - _progress;
+	}
+	String md5String(void)
+	{
+		return _md5.toString();
+	}
+};
+
+extern UpdaterClass Update;
+
+#endif // _NATIVE_UPDATER_h
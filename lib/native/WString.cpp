@@ -0,0 +1,366 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "WString.h"
+
+static std::string formatInteger(unsigned long long value, bool negative, unsigned char base)
+{
+	char buf[66];
+	int i = sizeof(buf) - 1;
+	buf[i] = '\0';
+	if (base < 2) {
+		base = 10;
+	}
+	do {
+		unsigned digit = value % base;
+		buf[--i] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		value /= base;
+	} while (value != 0);
+	if (negative) {
+		buf[--i] = '-';
+	}
+	return std::string(&buf[i]);
+}
+
+static std::string formatSigned(long long value, unsigned char base)
+{
+	if (value < 0 && base == 10) {
+		return formatInteger(-(unsigned long long)value, true, base);
+	}
+	return formatInteger((unsigned long long)value, false, base);
+}
+
+String::String(const char *cstr)
+	: s(cstr ? cstr : "")
+{
+}
+
+String::String(const __FlashStringHelper *str)
+	: s(str ? reinterpret_cast<const char *>(str) : "")
+{
+}
+
+String::String(char c)
+	: s(1, c)
+{
+}
+
+String::String(unsigned char value, unsigned char base)
+	: s(formatInteger(value, false, base))
+{
+}
+
+String::String(int value, unsigned char base)
+	: s(formatSigned(value, base))
+{
+}
+
+String::String(unsigned int value, unsigned char base)
+	: s(formatInteger(value, false, base))
+{
+}
+
+String::String(long value, unsigned char base)
+	: s(formatSigned(value, base))
+{
+}
+
+String::String(unsigned long value, unsigned char base)
+	: s(formatInteger(value, false, base))
+{
+}
+
+String::String(long long value, unsigned char base)
+	: s(formatSigned(value, base))
+{
+}
+
+String::String(unsigned long long value, unsigned char base)
+	: s(formatInteger(value, false, base))
+{
+}
+
+String::String(double value, unsigned char decimalPlaces)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+	s = buf;
+}
+
+String &String::operator=(const char *cstr)
+{
+	s = cstr ? cstr : "";
+	return *this;
+}
+
+unsigned int String::length() const
+{
+	return s.length();
+}
+
+const char *String::c_str() const
+{
+	return s.c_str();
+}
+
+bool String::reserve(unsigned int size)
+{
+	s.reserve(size);
+	return true;
+}
+
+bool String::concat(const String &str)
+{
+	s += str.s;
+	return true;
+}
+
+bool String::concat(const char *cstr)
+{
+	if (cstr) {
+		s += cstr;
+	}
+	return cstr != NULL;
+}
+
+bool String::concat(const char *cstr, unsigned int length)
+{
+	if (cstr) {
+		s.append(cstr, length);
+	}
+	return cstr != NULL;
+}
+
+bool String::concat(char c)
+{
+	s += c;
+	return true;
+}
+
+bool String::concat(int num)
+{
+	return concat(String(num));
+}
+
+bool String::concat(unsigned int num)
+{
+	return concat(String(num));
+}
+
+bool String::concat(long num)
+{
+	return concat(String(num));
+}
+
+bool String::concat(unsigned long num)
+{
+	return concat(String(num));
+}
+
+String &String::operator+=(const String &rhs)
+{
+	concat(rhs);
+	return *this;
+}
+
+String &String::operator+=(const char *cstr)
+{
+	concat(cstr);
+	return *this;
+}
+
+String &String::operator+=(char c)
+{
+	concat(c);
+	return *this;
+}
+
+bool String::equals(const String &str) const
+{
+	return s == str.s;
+}
+
+bool String::equals(const char *cstr) const
+{
+	return s == (cstr ? cstr : "");
+}
+
+bool String::operator==(const String &rhs) const
+{
+	return equals(rhs);
+}
+
+bool String::operator==(const char *cstr) const
+{
+	return equals(cstr);
+}
+
+bool String::operator!=(const String &rhs) const
+{
+	return !equals(rhs);
+}
+
+bool String::operator!=(const char *cstr) const
+{
+	return !equals(cstr);
+}
+
+bool String::startsWith(const String &prefix) const
+{
+	return s.compare(0, prefix.s.length(), prefix.s) == 0;
+}
+
+bool String::startsWith(const char *prefix) const
+{
+	return startsWith(String(prefix));
+}
+
+bool String::endsWith(const String &suffix) const
+{
+	return s.length() >= suffix.s.length() && s.compare(s.length() - suffix.s.length(), suffix.s.length(), suffix.s) == 0;
+}
+
+bool String::endsWith(const char *suffix) const
+{
+	return endsWith(String(suffix));
+}
+
+char String::charAt(unsigned int index) const
+{
+	return index < s.length() ? s[index] : 0;
+}
+
+char String::operator[](unsigned int index) const
+{
+	return charAt(index);
+}
+
+char &String::operator[](unsigned int index)
+{
+	static char dummy;
+	if (index >= s.length()) {
+		dummy = 0;
+		return dummy;
+	}
+	return s[index];
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+	size_t pos = s.find(ch, fromIndex);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const char *str, unsigned int fromIndex) const
+{
+	size_t pos = s.find(str, fromIndex);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char ch) const
+{
+	size_t pos = s.rfind(ch);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int beginIndex) const
+{
+	return substring(beginIndex, s.length());
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+	String out;
+	if (beginIndex > endIndex) {
+		unsigned int tmp = beginIndex;
+		beginIndex = endIndex;
+		endIndex = tmp;
+	}
+	if (beginIndex >= s.length()) {
+		return out;
+	}
+	if (endIndex > s.length()) {
+		endIndex = s.length();
+	}
+	out.s = s.substr(beginIndex, endIndex - beginIndex);
+	return out;
+}
+
+void String::remove(unsigned int index)
+{
+	if (index < s.length()) {
+		s.erase(index);
+	}
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+	if (index < s.length()) {
+		s.erase(index, count);
+	}
+}
+
+void String::toLowerCase()
+{
+	for (auto &c : s) {
+		c = tolower((unsigned char)c);
+	}
+}
+
+void String::toUpperCase()
+{
+	for (auto &c : s) {
+		c = toupper((unsigned char)c);
+	}
+}
+
+void String::trim()
+{
+	size_t begin = 0, end = s.length();
+	while (begin < end && isspace((unsigned char)s[begin])) {
+		begin++;
+	}
+	while (end > begin && isspace((unsigned char)s[end - 1])) {
+		end--;
+	}
+	s = s.substr(begin, end - begin);
+}
+
+long String::toInt() const
+{
+	return atol(s.c_str());
+}
+
+float String::toFloat() const
+{
+	return atof(s.c_str());
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+	String out(lhs);
+	out.concat(rhs);
+	return out;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+	String out(lhs);
+	out.concat(rhs);
+	return out;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+	String out(lhs);
+	out.concat(rhs);
+	return out;
+}
+
+String operator+(const String &lhs, char rhs)
+{
+	String out(lhs);
+	out.concat(rhs);
+	return out;
+}
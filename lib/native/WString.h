@@ -0,0 +1,84 @@
+/*
+ * WString.h - Arduino String class for the native build, backed by
+ * std::string.
+ */
+
+#ifndef _NATIVE_WSTRING_h
+#define _NATIVE_WSTRING_h
+
+#include <stdint.h>
+#include <string>
+
+class __FlashStringHelper;
+
+class String {
+	std::string s;
+
+    public:
+	String(const char *cstr = "");
+	String(const String &str) = default;
+	String(const __FlashStringHelper *str);
+	explicit String(char c);
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	explicit String(long long value, unsigned char base = 10);
+	explicit String(unsigned long long value, unsigned char base = 10);
+	explicit String(double value, unsigned char decimalPlaces = 2);
+
+	String &operator=(const String &rhs) = default;
+	String &operator=(const char *cstr);
+
+	unsigned int length() const;
+	const char *c_str() const;
+	bool reserve(unsigned int size);
+
+	bool concat(const String &str);
+	bool concat(const char *cstr);
+	bool concat(const char *cstr, unsigned int length);
+	bool concat(char c);
+	bool concat(int num);
+	bool concat(unsigned int num);
+	bool concat(long num);
+	bool concat(unsigned long num);
+	String &operator+=(const String &rhs);
+	String &operator+=(const char *cstr);
+	String &operator+=(char c);
+
+	bool equals(const String &s) const;
+	bool equals(const char *cstr) const;
+	bool operator==(const String &rhs) const;
+	bool operator==(const char *cstr) const;
+	bool operator!=(const String &rhs) const;
+	bool operator!=(const char *cstr) const;
+	bool startsWith(const String &prefix) const;
+	bool startsWith(const char *prefix) const;
+	bool endsWith(const String &suffix) const;
+	bool endsWith(const char *suffix) const;
+
+	char charAt(unsigned int index) const;
+	char operator[](unsigned int index) const;
+	char &operator[](unsigned int index);
+	int indexOf(char ch, unsigned int fromIndex = 0) const;
+	int indexOf(const char *str, unsigned int fromIndex = 0) const;
+	int lastIndexOf(char ch) const;
+	String substring(unsigned int beginIndex) const;
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void remove(unsigned int index);
+	void remove(unsigned int index, unsigned int count);
+	void toLowerCase();
+	void toUpperCase();
+	void trim();
+	long toInt() const;
+	float toFloat() const;
+};
+
+String operator+(const String &lhs, const String &rhs);
+String operator+(const char *lhs, const String &rhs);
+String operator+(const String &lhs, const char *rhs);
+String operator+(const String &lhs, char rhs);
+
+#endif // _NATIVE_WSTRING_h
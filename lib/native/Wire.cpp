@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include "hal.h"
+
+TwoWire Wire;
+
+namespace hal {
+
+struct I2cBus {
+	I2cDevice *devices[128];
+	uint8_t tx_address;
+	uint8_t tx[64];
+	size_t tx_length;
+	uint8_t rx[64];
+	size_t rx_length;
+	size_t rx_index;
+	uint32_t errors;
+};
+
+static I2cBus &bus()
+{
+	static I2cBus b;
+	return b;
+}
+
+void i2c_attach(uint8_t address, I2cDevice *device)
+{
+	bus().devices[address & 0x7f] = device;
+}
+
+uint32_t i2c_error_count()
+{
+	return bus().errors;
+}
+
+} // namespace hal
+
+void TwoWire::begin(int sda, int scl)
+{
+	(void)sda;
+	(void)scl;
+	begin();
+}
+
+void TwoWire::begin()
+{
+	hal::i2c_attach_default_devices();
+}
+
+void TwoWire::setClock(uint32_t frequency)
+{
+	(void)frequency;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	hal::I2cBus &b = hal::bus();
+	b.tx_address = address & 0x7f;
+	b.tx_length = 0;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+	(void)sendStop;
+	hal::I2cBus &b = hal::bus();
+	hal::I2cDevice *dev = b.devices[b.tx_address];
+	if (dev == NULL) {
+		// Address not acknowledged.
+		b.errors++;
+		return 2;
+	}
+	dev->write(b.tx, b.tx_length);
+	b.tx_length = 0;
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool sendStop)
+{
+	(void)sendStop;
+	hal::I2cBus &b = hal::bus();
+	hal::I2cDevice *dev = b.devices[address & 0x7f];
+	b.rx_length = 0;
+	b.rx_index = 0;
+	if (dev == NULL) {
+		b.errors++;
+		return 0;
+	}
+	if (quantity > sizeof(b.rx)) {
+		quantity = sizeof(b.rx);
+	}
+	b.rx_length = dev->read(b.rx, quantity);
+	return b.rx_length;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	hal::I2cBus &b = hal::bus();
+	if (b.tx_length >= sizeof(b.tx)) {
+		return 0;
+	}
+	b.tx[b.tx_length++] = data;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+	size_t n = 0;
+	while (quantity--) {
+		n += write(*data++);
+	}
+	return n;
+}
+
+int TwoWire::available()
+{
+	hal::I2cBus &b = hal::bus();
+	return b.rx_length - b.rx_index;
+}
+
+int TwoWire::read()
+{
+	hal::I2cBus &b = hal::bus();
+	if (b.rx_index >= b.rx_length) {
+		return -1;
+	}
+	return b.rx[b.rx_index++];
+}
+
+int TwoWire::peek()
+{
+	hal::I2cBus &b = hal::bus();
+	if (b.rx_index >= b.rx_length) {
+		return -1;
+	}
+	return b.rx[b.rx_index];
+}
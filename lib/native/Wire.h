@@ -0,0 +1,63 @@
+/*
+ * Wire.h - I2C master for the native build. The bus has a single simulated
+ * BQ32000 real-time clock at address 0x68, see bq32000_sim.cpp.
+ */
+
+#ifndef _NATIVE_WIRE_h
+#define _NATIVE_WIRE_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Stream.h"
+
+class TwoWire : public Stream {
+    public:
+	TwoWire()
+	{
+	}
+
+	void begin(int sda, int scl);
+	void begin();
+	void setClock(uint32_t frequency);
+	void beginTransmission(uint8_t address);
+	void beginTransmission(int address)
+	{
+		beginTransmission((uint8_t)address);
+	}
+	uint8_t endTransmission(uint8_t sendStop = true);
+	uint8_t requestFrom(uint8_t address, size_t quantity, bool sendStop = true);
+	uint8_t requestFrom(int address, int quantity)
+	{
+		return requestFrom((uint8_t)address, (size_t)quantity);
+	}
+	size_t write(uint8_t data) override;
+	size_t write(const uint8_t *data, size_t quantity) override;
+	int available() override;
+	int read() override;
+	int peek() override;
+	using Print::write;
+};
+
+extern TwoWire Wire;
+
+namespace hal {
+
+// Simulated I2C devices.
+struct I2cDevice {
+	virtual ~I2cDevice()
+	{
+	}
+	virtual void write(const uint8_t *data, size_t length) = 0;
+	virtual size_t read(uint8_t *data, size_t length) = 0;
+};
+
+void i2c_attach(uint8_t address, I2cDevice *device);
+void i2c_attach_default_devices();
+
+// Number of transactions that were not acknowledged.
+uint32_t i2c_error_count();
+
+} // namespace hal
+
+#endif // _NATIVE_WIRE_h
@@ -0,0 +1,11 @@
+/*
+ * avr/pgmspace.h - some libraries include the AVR header on platforms they
+ * don't recognize. It maps to the native flash access helpers.
+ */
+
+#ifndef _NATIVE_AVR_PGMSPACE_h
+#define _NATIVE_AVR_PGMSPACE_h
+
+#include "../pgmspace.h"
+
+#endif // _NATIVE_AVR_PGMSPACE_h
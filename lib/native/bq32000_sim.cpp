@@ -0,0 +1,163 @@
+/*
+ * A simulated BQ32000 real-time clock on the native I2C bus. The clock runs
+ * from the virtual clock, starting at the virtual wall-clock time, keeps the register layout of the real chip
+ * and drives the IRQ pin with a 1 Hz square wave when it is enabled via the
+ * CAL_CFG1 and SFR registers.
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <time.h>
+#include "hal.h"
+
+namespace hal {
+
+static const uint8_t BQ32000_ADDR = 0x68;
+static const uint8_t REG_CAL_CFG1 = 0x07;
+static const uint8_t REG_SFR = 0x22;
+static const uint8_t IRQ_PIN = D1;
+
+static uint8_t bcd(uint8_t v)
+{
+	return ((v / 10) << 4) | (v % 10);
+}
+
+static uint8_t unbcd(uint8_t v)
+{
+	return (v >> 4) * 10 + (v & 0x0f);
+}
+
+class Bq32000 : public I2cDevice {
+	uint8_t regs[0x23];
+	uint8_t pointer = 0;
+	// The time at the virtual clock's 'base_us'. Seconds count from there,
+	// as the divider chain restarts when the time is set.
+	time_t base_time = 0;
+	uint64_t base_us = 0;
+	time_t last_second = 0;
+
+	time_t now()
+	{
+		if (base_time == 0) {
+			base_time = wall_time();
+			base_us = now_us();
+		}
+		return base_time + (time_t)((now_us() - base_us) / 1000000);
+	}
+
+	// Refresh the time registers from the running clock. As with the
+	// TimeLib-based driver, the year register counts years since 1970.
+	void latch()
+	{
+		time_t t = now();
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		regs[0] = bcd(tm.tm_sec) | (regs[0] & 0x80);
+		regs[1] = bcd(tm.tm_min);
+		regs[2] = bcd(tm.tm_hour);
+		regs[3] = tm.tm_wday + 1;
+		regs[4] = bcd(tm.tm_mday);
+		regs[5] = bcd(tm.tm_mon + 1);
+		regs[6] = bcd((tm.tm_year + 1900 - 1970) % 100);
+	}
+
+	void set_from_registers()
+	{
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_sec = unbcd(regs[0] & 0x7f);
+		tm.tm_min = unbcd(regs[1] & 0x7f);
+		tm.tm_hour = unbcd(regs[2] & 0x3f);
+		tm.tm_mday = unbcd(regs[4] & 0x3f);
+		tm.tm_mon = unbcd(regs[5] & 0x1f) - 1;
+		tm.tm_year = unbcd(regs[6]) + 1970 - 1900;
+		// Writing the seconds register restarts the divider chain: the
+		// next second starts in one second from now.
+		base_time = timegm(&tm);
+		base_us = now_us();
+		// It also clears the oscillator fail flag, and a time jump
+		// doesn't produce a burst of IRQ edges.
+		regs[0] &= 0x7f;
+		last_second = 0;
+	}
+
+    public:
+	Bq32000()
+	{
+		memset(regs, 0, sizeof(regs));
+		i2c_attach(BQ32000_ADDR, this);
+	}
+
+	void write(const uint8_t *data, size_t length) override
+	{
+		if (length == 0) {
+			return;
+		}
+		pointer = data[0];
+		if (length == 1) {
+			return;
+		}
+		bool time_written = false;
+		latch();
+		for (size_t i = 1; i < length; i++) {
+			if (pointer < sizeof(regs)) {
+				regs[pointer] = data[i];
+				time_written |= pointer <= 6;
+			}
+			pointer++;
+		}
+		if (time_written) {
+			set_from_registers();
+		}
+	}
+
+	size_t read(uint8_t *data, size_t length) override
+	{
+		latch();
+		for (size_t i = 0; i < length; i++) {
+			data[i] = pointer < sizeof(regs) ? regs[pointer] : 0;
+			pointer++;
+		}
+		return length;
+	}
+
+	bool irq_1hz_enabled()
+	{
+		return (regs[REG_CAL_CFG1] & (1 << 6)) && regs[REG_SFR] == 0x01;
+	}
+
+	void poll()
+	{
+		time_t second = now();
+		if (last_second == 0 || second < last_second) {
+			last_second = second;
+			return;
+		}
+		// One falling edge of the square wave per elapsed second.
+		for (time_t missed = second - last_second; missed > 0; missed--) {
+			if (irq_1hz_enabled()) {
+				set_pin(IRQ_PIN, HIGH);
+				set_pin(IRQ_PIN, LOW);
+			}
+		}
+		last_second = second;
+	}
+};
+
+static Bq32000 &rtc()
+{
+	static Bq32000 chip;
+	return chip;
+}
+
+void i2c_attach_default_devices()
+{
+	rtc();
+}
+
+void rtc_poll()
+{
+	rtc().poll();
+}
+
+} // namespace hal
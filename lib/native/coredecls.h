@@ -0,0 +1,17 @@
+/*
+ * coredecls.h - miscellaneous ESP8266 core helpers for the native build.
+ */
+
+#ifndef _NATIVE_COREDECLS_h
+#define _NATIVE_COREDECLS_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff);
+
+// False while interrupt handlers, timers and simulated network callbacks run,
+// which stand in for the system context.
+bool can_yield();
+
+#endif // _NATIVE_COREDECLS_h
@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include <stddef.h>
+
+#include "eboot_command.h"
+
+static_assert(sizeof(struct eboot_command) == 128, "The command takes the first 32 blocks of RTC user memory.");
+
+// eboot's own CRC-32, most significant bit first and without a final XOR.
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+	while (length--) {
+		uint8_t c = *data++;
+		for (uint32_t i = 0x80; i > 0; i >>= 1) {
+			bool bit = crc & 0x80000000;
+			if (c & i) {
+				bit = !bit;
+			}
+			crc <<= 1;
+			if (bit) {
+				crc ^= 0x04c11db7;
+			}
+		}
+	}
+	return crc;
+}
+
+static uint32_t eboot_command_calculate_crc32(const struct eboot_command *cmd)
+{
+	return crc_update(0xffffffff, (const uint8_t *)cmd, offsetof(struct eboot_command, crc32));
+}
+
+int eboot_command_read(struct eboot_command *cmd)
+{
+	if (!ESP.rtcUserMemoryRead(0, (uint32_t *)cmd, sizeof(*cmd))) {
+		return 1;
+	}
+	if ((cmd->magic & EBOOT_MAGIC_MASK) != EBOOT_MAGIC || cmd->crc32 != eboot_command_calculate_crc32(cmd)) {
+		return 1;
+	}
+	return 0;
+}
+
+void eboot_command_write(struct eboot_command *cmd)
+{
+	cmd->magic = EBOOT_MAGIC;
+	cmd->crc32 = eboot_command_calculate_crc32(cmd);
+	ESP.rtcUserMemoryWrite(0, (uint32_t *)cmd, sizeof(*cmd));
+}
+
+void eboot_command_clear()
+{
+	uint32_t zero = 0;
+	ESP.rtcUserMemoryWrite(offsetof(struct eboot_command, magic) / 4, &zero, sizeof(zero));
+	ESP.rtcUserMemoryWrite(offsetof(struct eboot_command, crc32) / 4, &zero, sizeof(zero));
+}
@@ -0,0 +1,32 @@
+/*
+ * eboot_command.h - the command Update.end() leaves the bootloader, eboot,
+ * in the first 128 bytes of RTC user memory, as in the ESP8266 core. The
+ * native build has no bootloader; hal::run() takes its place before setup().
+ */
+
+#ifndef _NATIVE_EBOOT_COMMAND_h
+#define _NATIVE_EBOOT_COMMAND_h
+
+#include <stdint.h>
+
+enum action_t {
+	ACTION_COPY_RAW = 0x00000001,
+	ACTION_LOAD_APP = 0xffffffff,
+};
+
+#define EBOOT_MAGIC		0xeb001000
+#define EBOOT_MAGIC_MASK	0xfffff000
+
+struct eboot_command {
+	uint32_t magic;
+	enum action_t action;
+	uint32_t args[29];	// for ACTION_COPY_RAW: source and destination address, size
+	uint32_t crc32;
+};
+
+// Returns 0 if RTC user memory holds a command with a valid magic and CRC.
+int eboot_command_read(struct eboot_command *cmd);
+void eboot_command_write(struct eboot_command *cmd);
+void eboot_command_clear();
+
+#endif // _NATIVE_EBOOT_COMMAND_h
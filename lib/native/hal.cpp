@@ -0,0 +1,672 @@
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "coredecls.h"
+#include "eboot_command.h"
+#include "hal.h"
+#include "user_interface.h"
+
+// Defined by the firmware, if at all, as on the ESP8266.
+extern "C" void custom_crash_callback(struct rst_info *info, uint32_t stack, uint32_t stack_end) __attribute__((weak));
+
+namespace hal {
+
+Options options;
+
+static uint64_t virtual_us = 0;
+static uint64_t host_base_us = 0;
+static uint64_t virtual_base_us = 0;
+static time_t wall_base = 0;
+static uint64_t wall_base_us = 0;
+static bool in_poll = false;
+static uint64_t fed_us = 0;
+// Only setup() and loop() run under the soft watchdog, not scenarios calling
+// into the firmware directly.
+static bool watchdog_armed = false;
+static uint32_t update_size = 0;
+
+struct Timer {
+	uint64_t at_us;
+	uint64_t seq;
+	std::function<void()> fn;
+};
+
+static std::vector<Timer> &timers()
+{
+	static std::vector<Timer> t;
+	return t;
+}
+
+struct Pin {
+	uint8_t mode = INPUT;
+	int level = LOW;
+	bool driven = false;	// driven by a simulated device, not a pull-up
+	void (*isr)(void) = NULL;
+	int isr_mode = 0;
+};
+
+static Pin &pin(uint8_t n)
+{
+	static Pin pins[17];
+	return pins[n < 17 ? n : 16];
+}
+
+static uint64_t host_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sync_clock()
+{
+	// The clock starts when run() is called; constructors of global
+	// objects see time zero.
+	if (options.speed > 0 && host_base_us != 0) {
+		uint64_t v = virtual_base_us + (uint64_t)((host_us() - host_base_us) * options.speed);
+		if (v > virtual_us) {
+			virtual_us = v;
+		}
+	}
+}
+
+uint64_t now_us()
+{
+	sync_clock();
+	return virtual_us;
+}
+
+void advance(uint64_t us)
+{
+	if (options.speed > 0) {
+		struct timespec ts;
+		uint64_t host = (uint64_t)(us / options.speed);
+		ts.tv_sec = host / 1000000;
+		ts.tv_nsec = (host % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+		sync_clock();
+	} else {
+		virtual_us += us;
+	}
+	poll();
+}
+
+time_t wall_time()
+{
+	return wall_base + (time_t)((now_us() - wall_base_us) / 1000000);
+}
+
+void set_wall_time(time_t t)
+{
+	wall_base = t;
+	wall_base_us = now_us();
+}
+
+void schedule(uint64_t at_us, std::function<void()> fn)
+{
+	static uint64_t seq = 0;
+	timers().push_back(Timer { at_us, seq++, fn });
+}
+
+void poll()
+{
+	// Handlers may call delay() or yield() themselves.
+	if (in_poll) {
+		return;
+	}
+	in_poll = true;
+
+	rtc_poll();
+	wifi_poll();
+	lwip_poll();
+
+	for (;;) {
+		std::vector<Timer> &t = timers();
+		uint64_t now = now_us();
+		auto next = t.end();
+		for (auto it = t.begin(); it != t.end(); ++it) {
+			if (it->at_us <= now && (next == t.end() || it->at_us < next->at_us || (it->at_us == next->at_us && it->seq < next->seq))) {
+				next = it;
+			}
+		}
+		if (next == t.end()) {
+			break;
+		}
+		std::function<void()> fn = next->fn;
+		t.erase(next);
+		fn();
+	}
+
+	in_poll = false;
+}
+
+void set_pin(uint8_t n, int level)
+{
+	Pin &p = pin(n);
+	int old = p.level;
+	p.level = level ? HIGH : LOW;
+	p.driven = true;
+	if (p.isr == NULL || old == p.level) {
+		return;
+	}
+	if (p.isr_mode == CHANGE || (p.isr_mode == RISING && p.level == HIGH) || (p.isr_mode == FALLING && p.level == LOW)) {
+		p.isr();
+	}
+}
+
+int get_pin(uint8_t n)
+{
+	return pin(n).level;
+}
+
+/*
+ * Serial port.
+ */
+
+static int serial_in = -1;
+static int serial_out = -1;
+static bool serial_translate_lf = true;
+
+static std::function<void(const uint8_t *, size_t)> &serial_capture_fn()
+{
+	static std::function<void(const uint8_t *, size_t)> fn;
+	return fn;
+}
+
+static std::deque<uint8_t> &serial_rx()
+{
+	static std::deque<uint8_t> q;
+	return q;
+}
+
+static void serial_open()
+{
+	if (serial_out >= 0) {
+		return;
+	}
+	if (options.pty) {
+		int fd = posix_openpt(O_RDWR | O_NOCTTY);
+		if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+			perror("posix_openpt");
+			exit(1);
+		}
+		struct termios tio;
+		int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+		if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+			cfmakeraw(&tio);
+			tcsetattr(slave, TCSANOW, &tio);
+		}
+		fprintf(stderr, "Serial port: %s\n", ptsname(fd));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		serial_in = serial_out = fd;
+		// A terminal emulator on the other end sends CR itself.
+		serial_translate_lf = false;
+	} else {
+		serial_in = STDIN_FILENO;
+		serial_out = STDOUT_FILENO;
+		fcntl(serial_in, F_SETFL, fcntl(serial_in, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+void serial_capture(std::function<void(const uint8_t *, size_t)> fn)
+{
+	serial_capture_fn() = fn;
+}
+
+void serial_inject(const char *text)
+{
+	while (*text != '\0') {
+		serial_rx().push_back(*text++);
+	}
+}
+
+static void serial_fill()
+{
+	uint8_t buf[256];
+	if (serial_capture_fn()) {
+		return;
+	}
+	serial_open();
+	ssize_t n = ::read(serial_in, buf, sizeof(buf));
+	for (ssize_t i = 0; i < n; i++) {
+		// The firmware expects commands terminated by CR, as sent by a
+		// serial terminal.
+		if (buf[i] == '\n' && serial_translate_lf) {
+			serial_rx().push_back('\r');
+		}
+		serial_rx().push_back(buf[i]);
+	}
+}
+
+/*
+ * Touch sensor, simulated by SIGUSR1 (tap) and SIGUSR2 (long press).
+ */
+
+static volatile sig_atomic_t touch_signal = 0;
+
+static void on_touch_signal(int sig)
+{
+	touch_signal = sig;
+}
+
+static void touch_poll()
+{
+	static const uint8_t TOUCH_PIN = D2;
+	if (touch_signal == 0) {
+		return;
+	}
+	uint32_t hold_ms = touch_signal == SIGUSR2 ? 1500 : 80;
+	touch_signal = 0;
+	set_pin(TOUCH_PIN, HIGH);
+	schedule(now_us() + hold_ms * 1000, []() { set_pin(TOUCH_PIN, LOW); });
+}
+
+struct Scenario {
+	const char *name;
+	const char *description;
+	ScenarioFn fn;
+};
+
+static std::vector<Scenario> &scenarios()
+{
+	static std::vector<Scenario> s;
+	return s;
+}
+
+ScenarioRegistration::ScenarioRegistration(const char *name, const char *description, ScenarioFn fn)
+{
+	scenarios().push_back(Scenario { name, description, fn });
+}
+
+void feed_watchdog()
+{
+	fed_us = now_us();
+}
+
+void reset(uint32_t reason)
+{
+	struct rst_info info = {};
+
+	info.reason = reason;
+	if (custom_crash_callback != NULL) {
+		custom_crash_callback(&info, 0, 0);
+	}
+	Serial.flush();
+	fprintf(stderr, "Reset with reason %u, exiting.\n", reason);
+	exit(EXIT_RESET);
+}
+
+static uint64_t steps = 0;
+
+void step()
+{
+	steps++;
+	watchdog_armed = true;
+	loop();
+	watchdog_armed = false;
+	feed_watchdog();
+	if (options.speed <= 0) {
+		virtual_us += options.step_us;
+	}
+	touch_poll();
+	poll();
+}
+
+uint64_t step_count()
+{
+	return steps;
+}
+
+uint32_t installed_update_size()
+{
+	return update_size;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --speed X        virtual clock speed relative to real time (0: stepped)\n"
+		"  --step-us N      virtual microseconds per loop() in stepped mode\n"
+		"  --loops N        stop after N loop() iterations\n"
+		"  --seconds N      stop after N virtual seconds\n"
+		"  --pty            attach the serial port to a pseudo-terminal\n"
+		"  --eeprom FILE    file backing the EEPROM contents\n"
+		"  --rtc-mem FILE   file backing the ESP8266's RTC user memory\n"
+		"  --spi-log FILE   log every latched SPI frame\n"
+		"  --rtc-time T     initial RTC time in Unix seconds\n"
+		"  --no-wifi        simulate an unreachable access point\n"
+		"  --dhcp-lease S   lease time given by the DHCP server (default 86400)\n"
+		"  --port-offset N  added to bound lwIP ports to get the host port (default 10000)\n"
+		"  --scenario NAME  run a scenario, passing it the arguments after --\n"
+		"\n"
+		"Scenarios:\n",
+		argv0);
+	for (const Scenario &s : scenarios()) {
+		fprintf(stderr, "  %-16s %s\n", s.name, s.description);
+	}
+}
+
+int run(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{ "speed", required_argument, NULL, 's' },
+		{ "step-us", required_argument, NULL, 'u' },
+		{ "loops", required_argument, NULL, 'l' },
+		{ "seconds", required_argument, NULL, 'n' },
+		{ "pty", no_argument, NULL, 'p' },
+		{ "eeprom", required_argument, NULL, 'e' },
+		{ "rtc-mem", required_argument, NULL, 'R' },
+		{ "spi-log", required_argument, NULL, 'S' },
+		{ "rtc-time", required_argument, NULL, 'r' },
+		{ "no-wifi", no_argument, NULL, 'w' },
+		{ "dhcp-lease", required_argument, NULL, 'd' },
+		{ "port-offset", required_argument, NULL, 'o' },
+		{ "scenario", required_argument, NULL, 'x' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			options.speed = atof(optarg);
+			break;
+		case 'u':
+			options.step_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			options.max_loops = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			options.max_seconds = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			options.pty = true;
+			break;
+		case 'e':
+			options.eeprom_path = optarg;
+			break;
+		case 'R':
+			options.rtc_memory_path = optarg;
+			break;
+		case 'S':
+			options.spi_log_path = optarg;
+			break;
+		case 'r':
+			options.rtc_epoch = strtoll(optarg, NULL, 0);
+			break;
+		case 'w':
+			options.wifi_available = false;
+			break;
+		case 'd':
+			options.dhcp_lease_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			options.port_offset = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			options.scenario = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	host_base_us = host_us();
+	set_wall_time(options.rtc_epoch ? options.rtc_epoch : time(NULL));
+
+	// The touch sensor drives its output low when not touched.
+	set_pin(D2, LOW);
+
+	signal(SIGUSR1, on_touch_signal);
+	signal(SIGUSR2, on_touch_signal);
+
+	const Scenario *scenario = NULL;
+	if (options.scenario != NULL) {
+		for (const Scenario &s : scenarios()) {
+			if (strcmp(s.name, options.scenario) == 0) {
+				scenario = &s;
+			}
+		}
+		if (scenario == NULL) {
+			fprintf(stderr, "Unknown scenario: %s\n", options.scenario);
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	struct eboot_command ebcmd;
+	if (eboot_command_read(&ebcmd) == 0 && ebcmd.action == ACTION_COPY_RAW) {
+		update_size = ebcmd.args[2];
+		eboot_command_clear();
+	}
+
+	feed_watchdog();
+	watchdog_armed = true;
+	setup();
+	watchdog_armed = false;
+
+	if (scenario != NULL) {
+		std::vector<char *> args;
+		args.push_back((char *)scenario->name);
+		for (int i = optind; i < argc; i++) {
+			args.push_back(argv[i]);
+		}
+		args.push_back(NULL);
+		// Let the scenario parse its own options.
+		optind = 0;
+		int ret = scenario->fn(args.size() - 1, args.data());
+		Serial.flush();
+		return ret;
+	}
+
+	for (uint64_t loops = 0; options.max_loops == 0 || loops < options.max_loops; loops++) {
+		step();
+		if (options.max_seconds != 0 && now_us() >= options.max_seconds * 1000000) {
+			break;
+		}
+	}
+	Serial.flush();
+	return 0;
+}
+
+} // namespace hal
+
+/*
+ * Arduino core functions.
+ */
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	hal::Pin &p = hal::pin(pin);
+	p.mode = mode;
+	if (mode == INPUT_PULLUP && !p.driven) {
+		p.level = HIGH;
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	hal::Pin &p = hal::pin(pin);
+	int old = p.level;
+	p.level = val ? HIGH : LOW;
+	if (pin == SS && old != p.level) {
+		if (p.level == LOW) {
+			hal::spi_begin_frame();
+		} else {
+			hal::spi_end_frame();
+		}
+	}
+}
+
+int digitalRead(uint8_t pin)
+{
+	return hal::pin(pin).level;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+	hal::Pin &p = hal::pin(pin);
+	p.isr = isr;
+	p.isr_mode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+	hal::Pin &p = hal::pin(pin);
+	p.isr = NULL;
+	p.isr_mode = 0;
+}
+
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(uint32_t)(hal::now_us() / 1000);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)(uint32_t)hal::now_us();
+}
+
+uint64_t micros64()
+{
+	return hal::now_us();
+}
+
+void delay(unsigned long ms)
+{
+	hal::feed_watchdog();
+	hal::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	if (hal::options.speed > 0) {
+		hal::advance(us);
+	} else {
+		// Short busy-waits are not worth a pass through the event queue.
+		hal::virtual_us += us;
+	}
+	if (hal::watchdog_armed && hal::now_us() - hal::fed_us > SOFT_WDT_US) {
+		hal::reset(REASON_SOFT_WDT_RST);
+	}
+}
+
+bool can_yield()
+{
+	return !hal::in_poll;
+}
+
+void yield()
+{
+	hal::feed_watchdog();
+	hal::poll();
+}
+
+long random(long max)
+{
+	return max > 0 ? ::random() % max : 0;
+}
+
+long random(long min, long max)
+{
+	return max > min ? min + random(max - min) : min;
+}
+
+/*
+ * Serial port.
+ */
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud)
+{
+	(void)baud;
+}
+
+void HardwareSerial::end()
+{
+}
+
+int HardwareSerial::available()
+{
+	hal::serial_fill();
+	return hal::serial_rx().size();
+}
+
+int HardwareSerial::read()
+{
+	if (available() == 0) {
+		return -1;
+	}
+	int c = hal::serial_rx().front();
+	hal::serial_rx().pop_front();
+	return c;
+}
+
+int HardwareSerial::peek()
+{
+	if (available() == 0) {
+		return -1;
+	}
+	return hal::serial_rx().front();
+}
+
+void HardwareSerial::flush()
+{
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	size_t done = 0;
+	if (hal::serial_capture_fn()) {
+		hal::serial_capture_fn()(buffer, size);
+		return size;
+	}
+	hal::serial_open();
+	while (done < size) {
+		ssize_t n = ::write(hal::serial_out, buffer + done, size - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Nobody may be attached to the pseudo-terminal; drop the
+			// output rather than stall the firmware.
+			if (errno == EAGAIN && !hal::options.pty) {
+				usleep(100);
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+int main(int argc, char **argv)
+{
+	return hal::run(argc, argv);
+}
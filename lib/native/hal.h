@@ -0,0 +1,143 @@
+/*
+ * hal.h - control interface of the native hardware stand-ins.
+ *
+ * The native build runs the unmodified firmware on a Linux host. Time is
+ * virtual: in real-time mode it follows the host's monotonic clock scaled by
+ * a speed factor, in stepped mode it advances only by a fixed amount per
+ * loop() iteration and by the amount requested in delay() calls, so runs are
+ * deterministic and as fast as the host allows.
+ */
+
+#ifndef _NATIVE_HAL_h
+#define _NATIVE_HAL_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <functional>
+
+namespace hal {
+
+struct Options {
+	// Virtual clock speed relative to the host clock, or 0 for stepped mode.
+	double speed = 1.0;
+	// Virtual microseconds added after each loop() iteration in stepped mode.
+	uint32_t step_us = 1000;
+	// Stop after this many loop() iterations or virtual seconds (0: never).
+	uint64_t max_loops = 0;
+	uint64_t max_seconds = 0;
+	// Serial port on a pseudo-terminal rather than stdin/stdout.
+	bool pty = false;
+	// Files backing the EEPROM and logging the SPI frames.
+	const char *eeprom_path = "nixietap-eeprom.bin";
+	const char *spi_log_path = NULL;
+	// File backing the RTC user memory, which otherwise only lives as long
+	// as the process, so that it survives a simulated reset.
+	const char *rtc_memory_path = NULL;
+	// Wall-clock time of the simulated RTC at start (0: host time).
+	time_t rtc_epoch = 0;
+	// Whether the simulated access point accepts the configured SSID.
+	bool wifi_available = true;
+	// Lease time given by the simulated DHCP server, in seconds.
+	uint32_t dhcp_lease_s = 86400;
+	// Scenario to run instead of the free-running loop, see below.
+	const char *scenario = NULL;
+	// Added to the port of bound lwIP UDP and TCP PCBs to get the host port.
+	uint16_t port_offset = 10000;
+};
+
+extern Options options;
+
+// Virtual clock.
+uint64_t now_us();
+void advance(uint64_t us);
+// Virtual wall-clock time, used by the simulated RTC and NTP server.
+time_t wall_time();
+void set_wall_time(time_t t);
+
+/*
+ * Like the ESP8266's soft watchdog, busy-waiting in delayMicroseconds() for
+ * longer than this since loop() last returned or yielded resets the chip:
+ * the core's crash callback, custom_crash_callback(), runs with the reason
+ * and the program exits with EXIT_RESET.
+ */
+#define SOFT_WDT_US		3200000
+#define EXIT_RESET		2
+
+void reset(uint32_t reason);
+void feed_watchdog();
+
+// Deliver interrupts and events that are due. Called between loop()
+// iterations and from delay() and yield().
+void poll();
+
+// Run a callback once the virtual clock reaches 'at_us'.
+void schedule(uint64_t at_us, std::function<void()> fn);
+
+// Drive an input pin, triggering any attached interrupt handler.
+void set_pin(uint8_t pin, int level);
+int get_pin(uint8_t pin);
+
+// SPI frames latched by a rising edge on the chip select line.
+struct SpiFrame {
+	uint64_t at_us;
+	uint8_t length;
+	uint8_t data[16];
+};
+uint64_t spi_frame_count();
+const SpiFrame &spi_last_frame();
+void spi_set_listener(std::function<void(const SpiFrame &)> fn);
+
+// Connections that kept using, or were statically configured with, the
+// address of a DHCP lease after it had expired, which the DHCP server may
+// have given to another host since.
+uint32_t wifi_expired_lease_uses();
+
+// Hooks for the stand-in implementations.
+void spi_begin_frame();
+void spi_byte(uint8_t b);
+void spi_end_frame();
+void rtc_poll();
+void wifi_poll();
+void lwip_poll();
+
+// Serial port redirection. While a capture function is set, output goes to
+// it instead of stdout or the pseudo-terminal, and input only comes from
+// serial_inject().
+void serial_capture(std::function<void(const uint8_t *, size_t)> fn);
+void serial_inject(const char *text);
+
+// Run one iteration of loop() followed by a virtual clock step in stepped
+// mode and the delivery of due events.
+void step();
+// Number of step() calls so far.
+uint64_t step_count();
+
+/*
+ * Scenarios drive the firmware from host code instead of letting it run
+ * freely, e.g. to sweep a range of times. A scenario registers itself with a
+ * static ScenarioRegistration and is selected with --scenario NAME. It runs
+ * after setup() and receives the arguments following "--" on the command
+ * line, with its name as argv[0]. Its return value is the exit status.
+ */
+typedef int (*ScenarioFn)(int argc, char **argv);
+
+struct ScenarioRegistration {
+	ScenarioRegistration(const char *name, const char *description, ScenarioFn fn);
+};
+
+/*
+ * Before setup() run() stands in for the bootloader, eboot: an update left
+ * by Update.end() in eboot's command in RTC user memory is taken as copied
+ * over the sketch, and the command cleared. This is the update's size, or 0
+ * if the boot found none.
+ */
+uint32_t installed_update_size();
+
+// Run setup() and then loop() until a stop condition is reached, or the
+// selected scenario.
+int run(int argc, char **argv);
+
+} // namespace hal
+
+#endif // _NATIVE_HAL_h
@@ -0,0 +1,43 @@
+/*
+ * Global operator new and delete on top of malloc() and free(), as in the
+ * ESP8266 core. libstdc++'s own operator new calls malloc() from inside the
+ * shared library, where the link-time wrappers used by HeapMonitor would not
+ * see it.
+ */
+
+#include <stdlib.h>
+#include <new>
+
+void *operator new(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
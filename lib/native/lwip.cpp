@@ -0,0 +1,454 @@
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "hal.h"
+
+const ip_addr_t ip_addr_any = { 0 };
+const ip_addr_t ip_addr_broadcast = { IPADDR_BROADCAST };
+
+struct udp_pcb {
+	int fd = -1;
+	u16_t port = 0;
+	udp_recv_fn recv = NULL;
+	void *recv_arg = NULL;
+};
+
+namespace hal {
+
+static std::vector<udp_pcb *> &pcbs()
+{
+	static std::vector<udp_pcb *> v;
+	return v;
+}
+
+static void udp_poll()
+{
+	// Copy, since a callback may remove its PCB.
+	std::vector<udp_pcb *> list = pcbs();
+	for (udp_pcb *pcb : list) {
+		for (;;) {
+			uint8_t buf[1500];
+			struct sockaddr_in from;
+			socklen_t from_len = sizeof(from);
+			if (pcb->fd < 0 || pcb->recv == NULL) {
+				break;
+			}
+			ssize_t n = recvfrom(pcb->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+			if (n < 0) {
+				break;
+			}
+			struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM);
+			memcpy(p->payload, buf, n);
+			ip_addr_t addr = { from.sin_addr.s_addr };
+			// The callback owns the pbuf.
+			pcb->recv(pcb->recv_arg, pcb, p, &addr, ntohs(from.sin_port));
+		}
+	}
+}
+
+} // namespace hal
+
+struct udp_pcb *udp_new(void)
+{
+	udp_pcb *pcb = new udp_pcb;
+	hal::pcbs().push_back(pcb);
+	return pcb;
+}
+
+void udp_remove(struct udp_pcb *pcb)
+{
+	std::vector<udp_pcb *> &v = hal::pcbs();
+	for (auto it = v.begin(); it != v.end(); ++it) {
+		if (*it == pcb) {
+			v.erase(it);
+			break;
+		}
+	}
+	if (pcb->fd >= 0) {
+		close(pcb->fd);
+	}
+	delete pcb;
+}
+
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
+{
+	(void)ipaddr;
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port + hal::options.port_offset);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return ERR_MEM;
+	}
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		fprintf(stderr, "UDP port %u: %s\n", port + hal::options.port_offset, strerror(errno));
+		close(fd);
+		return ERR_USE;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (pcb->fd >= 0) {
+		close(pcb->fd);
+	}
+	pcb->fd = fd;
+	pcb->port = port;
+	return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg)
+{
+	pcb->recv = recv;
+	pcb->recv_arg = recv_arg;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port)
+{
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = dst_ip->addr == IPADDR_BROADCAST ? htonl(INADDR_LOOPBACK) : dst_ip->addr;
+	sa.sin_port = htons(dst_port);
+	if (pcb->fd < 0 || sendto(pcb->fd, p->payload, p->len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		return ERR_RTE;
+	}
+	return ERR_OK;
+}
+
+/*
+ * TCP.
+ */
+
+struct tcp_pcb {
+	int fd = -1;
+	bool listening = false;
+	bool closing = false;		// closed by the application, flushing
+	bool dead = false;		// freed as far as the application knows
+	bool eof = false;
+	uint32_t rcv_unacked = 0;	// delivered, not yet passed to tcp_recved()
+	void *arg = NULL;
+	tcp_accept_fn accept = NULL;
+	tcp_recv_fn recv = NULL;
+	tcp_sent_fn sent = NULL;
+	tcp_poll_fn poll = NULL;
+	tcp_err_fn err = NULL;
+	u8_t poll_interval = 0;
+	uint64_t next_poll_us = 0;
+	std::vector<uint8_t> out;	// written, not yet taken by the host socket
+};
+
+namespace hal {
+
+static std::vector<tcp_pcb *> &tcp_pcbs()
+{
+	static std::vector<tcp_pcb *> v;
+	return v;
+}
+
+static tcp_pcb *tcp_add(int fd)
+{
+	tcp_pcb *pcb = new tcp_pcb;
+	pcb->fd = fd;
+	tcp_pcbs().push_back(pcb);
+	return pcb;
+}
+
+// The connection is gone: tell the application, which must forget the PCB.
+static void tcp_fail(tcp_pcb *pcb, err_t err)
+{
+	if (pcb->fd >= 0) {
+		close(pcb->fd);
+		pcb->fd = -1;
+	}
+	pcb->dead = true;
+	if (pcb->err != NULL) {
+		pcb->err(pcb->arg, err);
+	}
+}
+
+static void tcp_poll_listener(tcp_pcb *pcb)
+{
+	int fd;
+	while (!pcb->dead && (fd = accept4(pcb->fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+		tcp_pcb *conn = tcp_add(fd);
+		conn->arg = pcb->arg;
+		err_t ret = pcb->accept != NULL ? pcb->accept(pcb->arg, conn, ERR_OK) : (err_t)ERR_VAL;
+		if (ret != ERR_OK && ret != ERR_ABRT) {
+			tcp_abort(conn);
+		}
+	}
+}
+
+static void tcp_poll_connection(tcp_pcb *pcb)
+{
+	if (!pcb->out.empty()) {
+		ssize_t n = send(pcb->fd, pcb->out.data(), pcb->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno != EAGAIN) {
+			tcp_fail(pcb, ERR_RST);
+			return;
+		}
+		if (n > 0) {
+			pcb->out.erase(pcb->out.begin(), pcb->out.begin() + n);
+			if (!pcb->closing && pcb->sent != NULL && pcb->sent(pcb->arg, pcb, n) == ERR_ABRT) {
+				return;
+			}
+		}
+	}
+
+	if (pcb->closing) {
+		if (pcb->out.empty()) {
+			close(pcb->fd);
+			pcb->fd = -1;
+			pcb->dead = true;
+		}
+		return;
+	}
+
+	// Deliver at most a window per pass, like lwIP delivering what arrived
+	// between two loop() iterations, and nothing beyond the window that the
+	// application has yet to take with tcp_recved().
+	uint32_t delivered = 0;
+	while (!pcb->dead && !pcb->closing && !pcb->eof && delivered < TCP_WND && pcb->rcv_unacked < TCP_WND) {
+		uint8_t buf[TCP_MSS];
+		size_t want = std::min<size_t>(sizeof(buf), TCP_WND - std::max(delivered, pcb->rcv_unacked));
+		ssize_t n = ::recv(pcb->fd, buf, want, MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno != EAGAIN) {
+				tcp_fail(pcb, ERR_RST);
+			}
+			break;
+		}
+		struct pbuf *p = NULL;
+		if (n == 0) {
+			pcb->eof = true;
+		} else {
+			p = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM);
+			memcpy(p->payload, buf, n);
+			delivered += n;
+			pcb->rcv_unacked += n;
+		}
+		if (pcb->recv != NULL) {
+			// The callback owns the pbuf.
+			pcb->recv(pcb->arg, pcb, p, ERR_OK);
+		} else if (p != NULL) {
+			pbuf_free(p);
+		}
+	}
+
+	// The poll interval is in units of lwIP's 500 ms slow timer.
+	if (!pcb->dead && !pcb->closing && pcb->poll != NULL && now_us() >= pcb->next_poll_us) {
+		pcb->next_poll_us = now_us() + pcb->poll_interval * 500000ULL;
+		pcb->poll(pcb->arg, pcb);
+	}
+}
+
+static void tcp_poll()
+{
+	// Index rather than iterate, since callbacks may add connections.
+	for (size_t i = 0; i < tcp_pcbs().size(); i++) {
+		tcp_pcb *pcb = tcp_pcbs()[i];
+		if (pcb->dead || pcb->fd < 0) {
+			continue;
+		}
+		if (pcb->listening) {
+			tcp_poll_listener(pcb);
+		} else {
+			tcp_poll_connection(pcb);
+		}
+	}
+
+	std::vector<tcp_pcb *> &v = tcp_pcbs();
+	for (auto it = v.begin(); it != v.end();) {
+		if ((*it)->dead) {
+			delete *it;
+			it = v.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void lwip_poll()
+{
+	udp_poll();
+	tcp_poll();
+}
+
+} // namespace hal
+
+struct tcp_pcb *tcp_new(void)
+{
+	return hal::tcp_add(-1);
+}
+
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
+{
+	(void)ipaddr;
+	struct sockaddr_in sa;
+	int one = 1;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port + hal::options.port_offset);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return ERR_MEM;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		fprintf(stderr, "TCP port %u: %s\n", port + hal::options.port_offset, strerror(errno));
+		close(fd);
+		return ERR_USE;
+	}
+	if (pcb->fd >= 0) {
+		close(pcb->fd);
+	}
+	pcb->fd = fd;
+	return ERR_OK;
+}
+
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
+{
+	if (pcb->fd < 0 || listen(pcb->fd, backlog) != 0) {
+		return NULL;
+	}
+	pcb->listening = true;
+	return pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg)
+{
+	pcb->arg = arg;
+}
+
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept)
+{
+	pcb->accept = accept;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv)
+{
+	pcb->recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent)
+{
+	pcb->sent = sent;
+}
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
+{
+	pcb->poll = poll;
+	pcb->poll_interval = interval;
+	pcb->next_poll_us = hal::now_us() + interval * 500000ULL;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err)
+{
+	pcb->err = err;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len)
+{
+	// The host socket manages the advertised window; this only limits
+	// what is delivered.
+	pcb->rcv_unacked -= std::min<uint32_t>(len, pcb->rcv_unacked);
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags)
+{
+	(void)apiflags;
+	if (pcb->dead || pcb->closing || pcb->listening) {
+		return ERR_CONN;
+	}
+	if (len > tcp_sndbuf(pcb)) {
+		return ERR_MEM;
+	}
+	const uint8_t *data = (const uint8_t *)dataptr;
+	pcb->out.insert(pcb->out.end(), data, data + len);
+	return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb)
+{
+	// Sent from hal::poll(), so that the sent callback isn't reentered.
+	(void)pcb;
+	return ERR_OK;
+}
+
+u16_t tcp_sndbuf(struct tcp_pcb *pcb)
+{
+	return pcb->out.size() < TCP_SND_BUF ? TCP_SND_BUF - pcb->out.size() : 0;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb)
+{
+	if (pcb->listening) {
+		close(pcb->fd);
+		pcb->fd = -1;
+		pcb->dead = true;
+	} else {
+		pcb->closing = true;
+	}
+	return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb)
+{
+	// Reset rather than close the host connection.
+	struct linger lg = { 1, 0 };
+	if (pcb->fd >= 0) {
+		setsockopt(pcb->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	}
+	hal::tcp_fail(pcb, ERR_ABRT);
+}
+
+/*
+ * Packet buffers, with the payload in the same allocation.
+ */
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
+{
+	(void)layer;
+	(void)type;
+	struct pbuf *p = (struct pbuf *)malloc(sizeof(struct pbuf) + length);
+	p->next = NULL;
+	p->payload = p + 1;
+	p->tot_len = p->len = length;
+	return p;
+}
+
+void pbuf_realloc(struct pbuf *p, u16_t size)
+{
+	if (size < p->len) {
+		p->tot_len = p->len = size;
+	}
+}
+
+u8_t pbuf_free(struct pbuf *p)
+{
+	free(p);
+	return 1;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset)
+{
+	if (offset >= p->len) {
+		return 0;
+	}
+	if (len > p->len - offset) {
+		len = p->len - offset;
+	}
+	memcpy(dataptr, (const uint8_t *)p->payload + offset, len);
+	return len;
+}
@@ -0,0 +1,17 @@
+/*
+ * lwip/arch.h - lwIP base types for the native build.
+ */
+
+#ifndef _NATIVE_LWIP_ARCH_h
+#define _NATIVE_LWIP_ARCH_h
+
+#include <stdint.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+
+#endif // _NATIVE_LWIP_ARCH_h
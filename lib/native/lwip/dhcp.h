@@ -0,0 +1,16 @@
+/*
+ * lwip/dhcp.h - the state of lwIP's DHCP client for the native build, as far
+ * as the firmware reads it.
+ */
+
+#ifndef _NATIVE_LWIP_DHCP_h
+#define _NATIVE_LWIP_DHCP_h
+
+#include "arch.h"
+
+struct dhcp {
+	// Lease time in seconds offered by the server that gave the address.
+	u32_t offered_t0_lease;
+};
+
+#endif // _NATIVE_LWIP_DHCP_h
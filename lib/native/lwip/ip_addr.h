@@ -0,0 +1,28 @@
+/*
+ * lwip/ip_addr.h - IPv4 addresses as in the ESP8266 core's IPv4-only lwIP
+ * build, where ip_addr_t is ip4_addr_t. Addresses are in network byte order.
+ */
+
+#ifndef _NATIVE_LWIP_IP_ADDR_h
+#define _NATIVE_LWIP_IP_ADDR_h
+
+#include "arch.h"
+
+struct ip4_addr {
+	u32_t addr;
+};
+
+typedef struct ip4_addr ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+extern const ip_addr_t ip_addr_any;
+extern const ip_addr_t ip_addr_broadcast;
+
+#define IPADDR_BROADCAST ((u32_t)0xffffffffUL)
+#define IP_ADDR_ANY (&ip_addr_any)
+#define IP_ADDR_BROADCAST (&ip_addr_broadcast)
+#define IP_ANY_TYPE IP_ADDR_ANY
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+
+#endif // _NATIVE_LWIP_IP_ADDR_h
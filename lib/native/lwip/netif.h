@@ -0,0 +1,20 @@
+/*
+ * lwip/netif.h - lwIP's network interfaces for the native build. There is
+ * only the station's, which is the default interface while it has an
+ * address, and NULL otherwise.
+ */
+
+#ifndef _NATIVE_LWIP_NETIF_h
+#define _NATIVE_LWIP_NETIF_h
+
+struct dhcp;
+
+struct netif {
+	struct dhcp *dhcp;
+};
+
+extern struct netif *netif_default;
+
+#define netif_dhcp_data(netif) ((netif)->dhcp)
+
+#endif // _NATIVE_LWIP_NETIF_h
@@ -0,0 +1,38 @@
+/*
+ * lwip/pbuf.h - packet buffers for the native build. Received packets are
+ * always a single pbuf.
+ */
+
+#ifndef _NATIVE_LWIP_PBUF_h
+#define _NATIVE_LWIP_PBUF_h
+
+#include "arch.h"
+#include "err.h"
+
+typedef enum {
+	PBUF_TRANSPORT,
+	PBUF_IP,
+	PBUF_LINK,
+	PBUF_RAW,
+} pbuf_layer;
+
+typedef enum {
+	PBUF_RAM,
+	PBUF_ROM,
+	PBUF_REF,
+	PBUF_POOL,
+} pbuf_type;
+
+struct pbuf {
+	struct pbuf *next;
+	void *payload;
+	u16_t tot_len;
+	u16_t len;
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+void pbuf_realloc(struct pbuf *p, u16_t size);
+u8_t pbuf_free(struct pbuf *p);
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+
+#endif // _NATIVE_LWIP_PBUF_h
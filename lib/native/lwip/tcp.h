@@ -0,0 +1,56 @@
+/*
+ * lwip/tcp.h - lwIP raw TCP API for the native build. A listening PCB is
+ * backed by a host TCP socket on 127.0.0.1, at the lwIP port plus
+ * --port-offset, and accepted connections by the host's connected sockets.
+ * The callbacks are called from hal::poll(). Data is acknowledged, and the
+ * sent callback called, as soon as the host socket takes it.
+ */
+
+#ifndef _NATIVE_LWIP_TCP_h
+#define _NATIVE_LWIP_TCP_h
+
+#include "arch.h"
+#include "err.h"
+#include "ip_addr.h"
+#include "pbuf.h"
+
+// As in the ESP8266 core's low-memory lwIP build. <netinet/tcp.h> has its
+// own TCP_MSS, which the stand-in doesn't use.
+#undef TCP_MSS
+#define TCP_MSS 536
+#define TCP_SND_BUF (2 * TCP_MSS)
+#define TCP_WND (4 * TCP_MSS)
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+struct tcp_pcb *tcp_new(void);
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog);
+#define tcp_listen(pcb) tcp_listen_with_backlog(pcb, 0xff)
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg);
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept);
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval);
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len);
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb *pcb);
+// A macro in lwIP.
+u16_t tcp_sndbuf(struct tcp_pcb *pcb);
+
+err_t tcp_close(struct tcp_pcb *pcb);
+void tcp_abort(struct tcp_pcb *pcb);
+
+#endif // _NATIVE_LWIP_TCP_h
@@ -0,0 +1,30 @@
+/*
+ * lwip/udp.h - lwIP raw UDP API for the native build. A bound PCB is backed
+ * by a host UDP socket on 127.0.0.1, at the lwIP port plus --port-offset
+ * so that privileged ports can be used, and its receive callback is called
+ * from hal::poll(). Broadcasts are sent to 127.0.0.1.
+ */
+
+#ifndef _NATIVE_LWIP_UDP_h
+#define _NATIVE_LWIP_UDP_h
+
+#include "arch.h"
+#include "err.h"
+#include "ip_addr.h"
+#include "pbuf.h"
+
+struct udp_pcb;
+
+// Host sockets on the loopback interface need no permission to broadcast.
+#define SOF_BROADCAST 0x20
+#define ip_set_option(pcb, opt) ((void)(pcb), (void)(opt))
+
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb *udp_new(void);
+void udp_remove(struct udp_pcb *pcb);
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port);
+
+#endif // _NATIVE_LWIP_UDP_h
@@ -0,0 +1,321 @@
+#include <Arduino.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace ace_time;
+
+namespace scenario {
+
+static std::string serial;
+static std::string serial_line;
+static bool serial_echo = false;
+static std::function<void(const std::string &)> serial_line_fn;
+static uint32_t error_count = 0;
+
+static const uint32_t MAX_REPORTED_ERRORS = 20;
+
+Option::Option(const char *name, const char *help, bool &value)
+	: name(name), arg(NULL), help(help), type(FLAG), value(&value), min(0)
+{
+}
+
+Option::Option(const char *name, const char *arg, const char *help, int &value)
+	: name(name), arg(arg), help(help), type(INT), value(&value), min(INT_MIN)
+{
+}
+
+Option::Option(const char *name, const char *arg, const char *help, uint32_t &value, uint32_t min)
+	: name(name), arg(arg), help(help), type(UINT), value(&value), min(min)
+{
+}
+
+Option::Option(const char *name, const char *arg, const char *help, double &value, double min)
+	: name(name), arg(arg), help(help), type(DOUBLE), value(&value), min(min)
+{
+}
+
+Option::Option(const char *name, const char *arg, const char *help, const char *&value)
+	: name(name), arg(arg), help(help), type(TEXT), value(&value), min(0)
+{
+}
+
+void usage(const char *argv0, const Option *options, size_t count)
+{
+	fprintf(stderr, "Usage: ... --scenario %s -- [options]\n", argv0);
+	for (size_t i = 0; i < count; i++) {
+		const Option &o = options[i];
+		if (o.help == NULL) {
+			continue;
+		}
+		char left[32];
+		snprintf(left, sizeof(left), "--%s%s%s", o.name, o.arg != NULL ? " " : "", o.arg != NULL ? o.arg : "");
+		fprintf(stderr, "  %-16s %s", left, o.help);
+		switch (o.type) {
+		case Option::INT:
+			fprintf(stderr, " (default %d)", *(int *)o.value);
+			break;
+		case Option::UINT:
+			fprintf(stderr, " (default %u)", *(uint32_t *)o.value);
+			break;
+		case Option::DOUBLE:
+			fprintf(stderr, " (default %g)", *(double *)o.value);
+			break;
+		case Option::TEXT:
+			if (*(const char **)o.value != NULL) {
+				const char *text = *(const char **)o.value;
+				fprintf(stderr, strchr(text, ' ') != NULL ? " (default \"%s\")" : " (default %s)", text);
+			}
+			break;
+		case Option::FLAG:
+			break;
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+static bool parse_value(const Option &o, const char *text)
+{
+	char *end;
+	errno = 0;
+	switch (o.type) {
+	case Option::FLAG:
+		*(bool *)o.value = true;
+		return true;
+	case Option::INT: {
+		long v = strtol(text, &end, 0);
+		if (*text == '\0' || *end != '\0' || errno != 0 || v < INT_MIN || v > INT_MAX) {
+			return false;
+		}
+		*(int *)o.value = v;
+		return true;
+	}
+	case Option::UINT: {
+		unsigned long v = strtoul(text, &end, 0);
+		if (*text == '\0' || *text == '-' || *end != '\0' || errno != 0 || v > UINT32_MAX) {
+			return false;
+		}
+		*(uint32_t *)o.value = max((uint32_t)v, (uint32_t)o.min);
+		return true;
+	}
+	case Option::DOUBLE: {
+		double v = strtod(text, &end);
+		if (*text == '\0' || *end != '\0' || errno != 0) {
+			return false;
+		}
+		*(double *)o.value = max(v, o.min);
+		return true;
+	}
+	case Option::TEXT:
+		*(const char **)o.value = text;
+		return true;
+	}
+	return false;
+}
+
+int parse_options(int argc, char **argv, const Option *options, size_t count)
+{
+	// Long options map to 256 + their index in the table.
+	std::vector<struct option> longopts;
+	for (size_t i = 0; i < count; i++) {
+		longopts.push_back({ options[i].name, options[i].arg != NULL ? required_argument : no_argument, NULL,
+				     (int)(256 + i) });
+	}
+	longopts.push_back({ "help", no_argument, NULL, 'h' });
+	longopts.push_back({ NULL, 0, NULL, 0 });
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", longopts.data(), NULL)) != -1) {
+		if (c < 256 || c >= 256 + (int)count) {
+			usage(argv[0], options, count);
+			return c == 'h' ? 0 : 1;
+		}
+		const Option &o = options[c - 256];
+		if (!parse_value(o, optarg)) {
+			fprintf(stderr, "Invalid value for --%s: %s\n", o.name, optarg);
+			usage(argv[0], options, count);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+		usage(argv[0], options, count);
+		return 1;
+	}
+	return -1;
+}
+
+static void serial_output(const uint8_t *buffer, size_t size)
+{
+	if (serial_echo) {
+		fwrite(buffer, 1, size, stdout);
+	}
+	if (serial.size() + size <= serial.capacity()) {
+		serial.append((const char *)buffer, size);
+	}
+	if (!serial_line_fn) {
+		return;
+	}
+	for (size_t i = 0; i < size; i++) {
+		char c = buffer[i];
+		if (c == '\r') {
+			continue;
+		}
+		if (c != '\n') {
+			serial_line += c;
+			continue;
+		}
+		serial_line_fn(serial_line);
+		serial_line.clear();
+	}
+}
+
+void capture_serial(bool echo, size_t capacity, std::function<void(const std::string &line)> line)
+{
+	serial_echo = echo;
+	serial_line_fn = line;
+	serial.reserve(capacity);
+	serial_line.reserve(1024);
+	hal::serial_capture(serial_output);
+}
+
+std::string &serial_text()
+{
+	return serial;
+}
+
+void command(const char *cmd)
+{
+	hal::serial_inject(cmd);
+	hal::serial_inject("\r\n");
+	while (Serial.available() > 0) {
+		hal::step();
+	}
+	hal::step();
+}
+
+void run(uint32_t ms)
+{
+	uint64_t end = hal::now_us() + ms * 1000ULL;
+	while (hal::now_us() < end) {
+		hal::step();
+	}
+}
+
+void error(const char *format, ...)
+{
+	error_count++;
+	if (error_count > MAX_REPORTED_ERRORS) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	printf("ERROR: ");
+	vprintf(format, args);
+	printf(error_count < MAX_REPORTED_ERRORS ? "\n" : " (further errors are only counted)\n");
+	va_end(args);
+}
+
+uint32_t errors()
+{
+	return error_count;
+}
+
+bool expect(const char *cmd, const char *expected)
+{
+	if (serial.find(expected) == std::string::npos) {
+		error("'%s' didn't print '%s'", cmd, expected);
+		return false;
+	}
+	return true;
+}
+
+bool expect_output(const char *cmd, uint32_t ms, const char *expected)
+{
+	serial.clear();
+	command(cmd);
+	run(ms);
+	return expect(cmd, expected);
+}
+
+int reboot(const char *name, const char *const *args)
+{
+	std::vector<const char *> argv = {
+		"/proc/self/exe", "--speed", "0", "--eeprom", hal::options.eeprom_path,
+	};
+	if (hal::options.rtc_memory_path != NULL) {
+		argv.insert(argv.end(), { "--rtc-mem", hal::options.rtc_memory_path });
+	}
+	argv.insert(argv.end(), { "--scenario", name, "--" });
+	for (; *args != NULL; args++) {
+		argv.push_back(*args);
+	}
+	argv.push_back(NULL);
+
+	// The sockets bound by the network stack go with the old program.
+	for (int fd = 3; fd < 1024; fd++) {
+		close(fd);
+	}
+	fflush(stdout);
+	execv(argv[0], (char **)argv.data());
+	perror("execv");
+	return 1;
+}
+
+bool reset_with(const char *what, int status, std::function<void()> fn)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		fn();
+		_exit(100);
+	}
+
+	int wstatus;
+	if (pid < 0 || waitpid(pid, &wstatus, 0) != pid) {
+		perror("fork");
+		error_count++;
+		return false;
+	}
+	if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != status) {
+		error("'%s' exited with status %d, expected %d", what, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1,
+		      status);
+		return false;
+	}
+	return true;
+}
+
+int64_t year_start(int year)
+{
+	struct tm tm = {};
+	tm.tm_year = year - 1900;
+	tm.tm_mday = 1;
+	return timegm(&tm);
+}
+
+int32_t offset_at(int64_t t, const TimeZone &tz)
+{
+	return ZonedDateTime::forUnixSeconds64(t, tz).timeOffset().toSeconds();
+}
+
+int64_t find_transition(int64_t lo, int64_t hi, const TimeZone &tz)
+{
+	int32_t before = offset_at(lo, tz);
+	while (hi - lo > 1) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if (offset_at(mid, tz) == before) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return hi;
+}
+
+} // namespace scenario
@@ -0,0 +1,108 @@
+/*
+ * scenario.h - helpers shared by the scenarios in sim/.
+ *
+ * A scenario describes its options with a table of Option, whose usage text
+ * is generated from it, drives the firmware over its serial port with
+ * command() and run(), and collects what it prints with capture_serial().
+ * Scenarios checking time zones find the UTC offset transitions of a zone
+ * with find_transition().
+ */
+
+#ifndef _NATIVE_SCENARIO_h
+#define _NATIVE_SCENARIO_h
+
+#include <AceTime.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+
+namespace scenario {
+
+/*
+ * A command line option of a scenario, given as --NAME VALUE or, for a flag,
+ * --NAME. The value is parsed into the variable the option refers to, whose
+ * initial value the usage shows as the default. Numbers below 'min' are
+ * raised to it.
+ */
+struct Option {
+	enum Type { FLAG, INT, UINT, DOUBLE, TEXT };
+
+	Option(const char *name, const char *help, bool &value);
+	Option(const char *name, const char *arg, const char *help, int &value);
+	Option(const char *name, const char *arg, const char *help, uint32_t &value, uint32_t min = 0);
+	Option(const char *name, const char *arg, const char *help, double &value, double min = 0);
+	Option(const char *name, const char *arg, const char *help, const char *&value);
+
+	const char *name;
+	const char *arg;	// shown in the usage, NULL for a flag
+	const char *help;
+	Type type;
+	void *value;
+	double min;
+};
+
+/*
+ * Parse the arguments of a scenario. Returns -1 to go on, or the exit status
+ * after --help or an invalid argument, for which the usage was printed.
+ */
+int parse_options(int argc, char **argv, const Option *options, size_t count);
+void usage(const char *argv0, const Option *options, size_t count);
+
+template <size_t N> int parse_options(int argc, char **argv, const Option (&options)[N])
+{
+	return parse_options(argc, argv, options, N);
+}
+
+template <size_t N> void usage(const char *argv0, const Option (&options)[N])
+{
+	usage(argv0, options, N);
+}
+
+/*
+ * Capture the firmware's serial output. It is echoed to stdout if 'echo',
+ * passed to 'line' a line at a time without the line ending, and kept in
+ * serial_text() up to 'capacity' bytes, reserved up front as the firmware
+ * counts the host's allocations between loop() iterations.
+ */
+void capture_serial(bool echo, size_t capacity = 65536,
+		    std::function<void(const std::string &line)> line = nullptr);
+std::string &serial_text();
+
+// Send a serial command and run loop() until it has been handled.
+void command(const char *cmd);
+// Run loop() for 'ms' virtual milliseconds.
+void run(uint32_t ms);
+
+// Count an error, and print it unless many were printed already.
+void error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+uint32_t errors();
+
+// Check that the serial output since it was last cleared contains 'expected'.
+bool expect(const char *cmd, const char *expected);
+// Clear the serial output, send 'cmd', run for 'ms' and check its output.
+bool expect_output(const char *cmd, uint32_t ms, const char *expected);
+
+/*
+ * Run the program again, as the chip boots after a reset, on the same EEPROM
+ * and RTC user memory files, into the scenario 'name' with the arguments
+ * 'args', which end with NULL. Only returns, with 1, if that fails.
+ */
+int reboot(const char *name, const char *const *args);
+/*
+ * Run 'fn' in a child process, which must then reset with exit status
+ * 'status'. Returns false after counting an error otherwise.
+ */
+bool reset_with(const char *what, int status, std::function<void()> fn);
+
+// Unix time of January 1 of 'year', 00:00 UTC.
+int64_t year_start(int year);
+// UTC offset of 'tz' at 't', according to AceTime.
+int32_t offset_at(int64_t t, const ace_time::TimeZone &tz);
+// First second at which the offset differs from the one at 'lo', given that
+// it differs at 'hi'.
+int64_t find_transition(int64_t lo, int64_t hi, const ace_time::TimeZone &tz);
+
+} // namespace scenario
+
+#endif // _NATIVE_SCENARIO_h
@@ -0,0 +1,31 @@
+/*
+ * user_interface.h - the reset information of the ESP8266 SDK for the native
+ * build.
+ */
+
+#ifndef _NATIVE_USER_INTERFACE_h
+#define _NATIVE_USER_INTERFACE_h
+
+#include <stdint.h>
+
+enum rst_reason {
+	REASON_DEFAULT_RST = 0,		// power on
+	REASON_WDT_RST = 1,		// hardware watchdog
+	REASON_EXCEPTION_RST = 2,
+	REASON_SOFT_WDT_RST = 3,
+	REASON_SOFT_RESTART = 4,	// ESP.restart()
+	REASON_DEEP_SLEEP_AWAKE = 5,
+	REASON_EXT_SYS_RST = 6,		// reset pin
+};
+
+struct rst_info {
+	uint32_t reason;
+	uint32_t exccause;
+	uint32_t epc1;
+	uint32_t epc2;
+	uint32_t epc3;
+	uint32_t excvaddr;
+	uint32_t depc;
+};
+
+#endif // _NATIVE_USER_INTERFACE_h
@@ -1,3 +1,5 @@
+#include <CivilDate.h>
+#include <Trace.h>
 #include "nixie.h"
 
 static const uint8_t orderedDigits[10] = { 1, 6, 2, 7, 5, 0, 4, 9, 8, 3 };
@@ -17,6 +19,161 @@ static const uint16_t pinmap[11] = {
 	0b0000000000 // digit off
 };
 
+void CivilTime::set(time_t t)
+{
+	civil::DateTime dt = civil::fromUnix(t);
+	year = dt.year;
+	month = dt.month;
+	day = dt.day;
+	hour = dt.hour;
+	minute = dt.minute;
+	second = dt.second;
+	full_updates++;
+}
+
+void CivilTime::addDays(uint32_t days)
+{
+	while (days-- > 0) {
+		if (++day <= civil::daysInMonth(year, month)) {
+			continue;
+		}
+		day = 1;
+		if (++month > 12) {
+			month = 1;
+			year++;
+		}
+	}
+}
+
+void CivilTime::update(time_t t)
+{
+	if (valid && t == local) {
+		return;
+	}
+	if (!valid || t < local || t - local > SECS_PER_DAY) {
+		set(t);
+	} else {
+		uint32_t s = second + (uint32_t)(t - local);
+		uint32_t m = minute + s / 60;
+		uint32_t h = hour + m / 60;
+		second = s % 60;
+		minute = m % 60;
+		hour = h % 24;
+		addDays(h / 24);
+		incremental_updates++;
+	}
+	local = t;
+	valid = true;
+}
+
+uint8_t CivilTime::hour12() const
+{
+	return hour % 12 == 0 ? 12 : hour % 12;
+}
+
+bool DisplayFormat::fail(const char *message, uint8_t offset)
+{
+	error_message = message;
+	error_offset = offset;
+	return false;
+}
+
+bool DisplayFormat::compile(const char *format, DisplayFormatKind kind)
+{
+	static const char LETTERS[][4] = { "HMS", "YMD" };
+	static const Field LETTER_FIELDS[][3] = {
+		{ FIELD_HOUR, FIELD_MINUTE, FIELD_SECOND },
+		{ FIELD_YEAR, FIELD_MONTH, FIELD_DAY },
+	};
+	static const char *const TUBES_ERRORS[] = {
+		"expected 4 tubes of H, M, S or -",
+		"expected 4 tubes of Y, M, D or -",
+	};
+	Field f[4];
+	uint16_t div[4];
+	uint8_t on = 0, blink = 0;
+	uint8_t i;
+
+	for (i = 0; i < 4; i++) {
+		const char *letter = format[i] != '\0' ? strchr(LETTERS[kind], format[i]) : NULL;
+		if (format[i] == '-') {
+			f[i] = FIELD_OFF;
+		} else if (letter != NULL) {
+			f[i] = LETTER_FIELDS[kind][letter - LETTERS[kind]];
+		} else {
+			return fail(TUBES_ERRORS[kind], i);
+		}
+	}
+	// The last tube of a run shows the field's ones, the one before it its
+	// tens and so on.
+	for (i = 4; i-- > 0;) {
+		div[i] = i < 3 && f[i + 1] == f[i] ? div[i + 1] * 10 : 1;
+	}
+	if (format[i = 4] == ':') {
+		for (i = 5; i < 9; i++) {
+			uint8_t bit = 1 << (i - 4);
+			if (format[i] == '1') {
+				on |= bit;
+			} else if (format[i] == 'b') {
+				blink |= bit;
+			} else if (format[i] != '0') {
+				return fail("expected 4 dots of 0, 1 or b", i);
+			}
+		}
+	}
+	if (format[i] != '\0') {
+		return fail("unexpected text after the format", i);
+	}
+
+	memcpy(fields, f, sizeof(fields));
+	memcpy(divisors, div, sizeof(divisors));
+	dots_on = on;
+	dots_blink = blink;
+	error_message = NULL;
+	error_offset = 0;
+	return true;
+}
+
+/*
+ * Called on every render: each tube takes its digit from its field's value by
+ * the same division, whatever the layout.
+ */
+void DisplayFormat::render(const CivilTime &local, bool hour24, bool dot_state, uint8_t tubes[4], uint8_t &dots) const
+{
+	const uint16_t values[FIELD_COUNT] = {
+		0, hour24 ? local.hour : local.hour12(), local.minute, local.second, local.year, local.month, local.day,
+	};
+	for (uint8_t i = 0; i < 4; i++) {
+		tubes[i] = fields[i] == FIELD_OFF ? 10 : values[fields[i]] / divisors[i] % 10;
+	}
+	dots = dots_on | (dot_state ? dots_blink : 0);
+}
+
+bool DisplayFormat::hasSeconds() const
+{
+	for (uint8_t i = 0; i < 4; i++) {
+		if (fields[i] == FIELD_SECOND) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DisplayFormat::blinks() const
+{
+	return dots_blink != 0;
+}
+
+const char *DisplayFormat::error() const
+{
+	return error_message;
+}
+
+uint8_t DisplayFormat::errorOffset() const
+{
+	return error_offset;
+}
+
 Nixie::Nixie()
 {
 	begin();
@@ -44,23 +201,7 @@ void Nixie::begin()
 
 uint8_t Nixie::checkDate(uint16_t y, uint8_t m, uint8_t d, uint8_t h, uint8_t mm)
 {
-	if (y >= 1971 && y <= 9999) { // Check year.
-		if (m >= 1 && m <= 12) { // Check month.
-			// Check days.
-			if ((d >= 1 && d <= 31) && (m == 1 || m == 3 || m == 5 || m == 7 || m == 8 || m == 10 || m == 12) && (h >= 0 && h <= 23) && (mm >= 0 && mm <= 59))
-				return 1;
-			else if ((d >= 1 && d <= 30) && (m == 4 || m == 6 || m == 9 || m == 11) && (h >= 0 && h <= 23) && (mm >= 0 && mm <= 59))
-				return 1;
-			else if ((d >= 1 && d <= 28) && (m == 2))
-				return 1;
-			else if (d == 29 && m == 2 && (y % 400 == 0 || (y % 4 == 0 && y % 100 != 0)) && (h >= 0 && h <= 23) && (mm >= 0 && mm <= 59))
-				return 1;
-			else
-				return 0;
-		} else
-			return 0;
-	} else
-		return 0;
+	return y >= 1971 && y <= 9999 && civil::isValid(y, m, d, h, mm);
 }
 
 /*                                                                          *
@@ -99,33 +240,34 @@ void Nixie::writeLowLevel(uint8_t digit1, uint8_t digit2, uint8_t digit3, uint8_
 	SPI.transfer(part5);
 	SPI.transfer(part6);
 	digitalWrite(SPI_CS, HIGH);
+	TRACE(TRACE_DISPLAY, TRACE_EVENT_SPI_LATCH, digit1 << 12 | digit2 << 8 | digit3 << 4 | digit4);
 	SPI.endTransaction();
 }
 
 /*                                                         *
  * With this function, time is displayed on a nixie tubes. *
  *                                                         */
-void Nixie::writeTime(time_t local, bool dot_state, bool timeFormat)
+void Nixie::writeTime(const CivilTime &local, const DisplayFormat &format, bool dot_state, bool timeFormat)
 {
-	antiPoison(local, timeFormat);
-	if (timeFormat) {
-		write(hour(local) / 10, hour(local) % 10, minute(local) / 10, minute(local) % 10, dot_state * 0b1000);
-	} else {
-		write(hourFormat12(local) / 10, hourFormat12(local) % 10, minute(local) / 10, minute(local) % 10, dot_state * 0b1000);
+	uint8_t tubes[4], dots;
+
+	if (antiPoisonEnabled) {
+		antiPoison(local, timeFormat);
 	}
+	format.render(local, timeFormat, dot_state, tubes, dots);
+	write(tubes[0], tubes[1], tubes[2], tubes[3], dots);
 	k = 0; // Reset the number position in the writeNumber function.
 }
 
 /*                                                         *
  * With this function, date is displayed on a nixie tubes. *
  *                                                         */
-void Nixie::writeDate(time_t local, bool dot_state)
+void Nixie::writeDate(const CivilTime &local, const DisplayFormat &format, bool dot_state)
 {
-	write(month(local) / 10,
-	      month(local) % 10,
-	      day(local) / 10,
-	      day(local) % 10,
-	      dot_state * 0b1000);
+	uint8_t tubes[4], dots;
+
+	format.render(local, true, dot_state, tubes, dots);
+	write(tubes[0], tubes[1], tubes[2], tubes[3], dots);
 	k = 0; // Reset the number position in the writeNumber function.
 }
 
@@ -136,33 +278,45 @@ void Nixie::writeDate(time_t local, bool dot_state)
  * Max size number, including integer and decimal part, is 100 digits. If you need to display longer number,                         *
  * you can easily modify number Array size in Nixie.h file.                                                                          *
  *                                                                                                                                   */
-void Nixie::writeNumber(String newNumber, unsigned int movingSpeed)
+void Nixie::writeNumber(const char *newNumber, unsigned int movingSpeed)
 {
-	if (newNumber != oldNumber) {
+	if (strncmp(newNumber, oldNumber, sizeof(oldNumber)) != 0) {
 		k = 0; // Reset the number position.
-		oldNumber = newNumber;
-		String number = newNumber;
+		strncpy(oldNumber, newNumber, sizeof(oldNumber) - 1);
 #ifdef DEBUG
 		Serial.println("---------------------------------------------------------------------------------------------");
-		Serial.println("Number to display is: " + number);
+		Serial.print("Number to display is: ");
+		Serial.println(newNumber);
 #endif // DEBUG
-		number.trim(); // Get a version of the string with any leading and trailing whitespace removed.
-		if (number.startsWith("-")) {
+		// Work on the number in place, without the leading and trailing whitespace.
+		const char *number = newNumber;
+		while (isspace(*number))
+			number++;
+		int length = strlen(number);
+		while (length > 0 && isspace(number[length - 1]))
+			length--;
+		if (*number == '-') {
 			numIsNeg = 1;
-			number.remove(0, 1); // Remove minus from string.
+			number++; // Skip the minus.
+			length--;
 #ifdef DEBUG
 			Serial.println("Number is negative!");
 #endif // DEBUG
 		} else
 			numIsNeg = 0;
-		numberSize = number.length() + 8; // For a simplicity of showing numbers on Nixies, we add four NULL(number 10 in this case) numbers before and after the real number.
-		dotPos = number.indexOf('.');
+		if (length > (int)sizeof(numberArray) - 8)
+			length = sizeof(numberArray) - 8; // Leave room for the padding below.
+		numberSize = length + 8; // For a simplicity of showing numbers on Nixies, we add four NULL(number 10 in this case) numbers before and after the real number.
+		const char *dot = (const char *)memchr(number, '.', length);
+		dotPos = dot != NULL ? dot - number : -1;
 		if (dotPos != -1) { // If the number is float type, we will replace the dot with the following number. So the whole size of the number will be reduced by one. Example: 1.23 -> 123
 			numberSize = numberSize - 1;
 			dotPos = dotPos + 4; // But we will remember the exact position where the point was.
 		}
 #ifdef DEBUG
-		Serial.println("Number after trimming: " + number);
+		Serial.print("Number after trimming: ");
+		Serial.write((const uint8_t *)number, length);
+		Serial.println();
 		Serial.printf("Size of a number(including dot(if exists) and 8 added numbers) is: %d", numberSize);
 		Serial.printf("\nDot position is(-1 = dot does not exists): %d\n", dotPos);
 #endif // DEBUG
@@ -170,11 +324,11 @@ void Nixie::writeNumber(String newNumber, unsigned int movingSpeed)
 			if (i >= 0 && i < 4) {
 				numberArray[i] = 10;
 			} else if (i >= 4 && i < numberSize - 4) {
-				if ((int(number.charAt(i - 4)) >= 48 && int(number.charAt(i - 4)) <= 57) || int(number.charAt(i - 4)) == 46) {
+				if ((int(number[i - 4]) >= 48 && int(number[i - 4]) <= 57) || int(number[i - 4]) == 46) {
 					if ((i < dotPos) || dotPos == -1) {
-						numberArray[i] = int(number.charAt(i - 4)) - 48;
+						numberArray[i] = int(number[i - 4]) - 48;
 					} else if (i >= dotPos) {
-						numberArray[i] = int(number.charAt(i - 3)) - 48; // this way we skip the dot place and replace it with the next number.
+						numberArray[i] = int(number[i - 3]) - 48; // this way we skip the dot place and replace it with the next number.
 					}
 				} else {
 #ifdef DEBUG
@@ -226,25 +380,21 @@ void Nixie::writeNumber(String newNumber, unsigned int movingSpeed)
 		k = 0;
 }
 
-void Nixie::antiPoison(time_t local, bool timeFormat)
+void Nixie::antiPoison(const CivilTime &local, bool timeFormat)
 {
 	uint8_t stopH1 = 0, stopH0 = 0, stopM1 = 0, stopM0 = 0;
 
-	stopM0 = minute(local) % 10;
-	stopM1 = minute(local) / 10;
+	stopM0 = local.minute % 10;
+	stopM1 = local.minute / 10;
 
 	if (stopM0 == autoPoisonDoneOnMinute) {
 		return;
 	}
 	autoPoisonDoneOnMinute = stopM0;
 
-	if (timeFormat) {
-		stopH1 = hour(local) / 10;
-		stopH0 = hour(local) % 10;
-	} else {
-		stopH1 = hourFormat12(local) / 10;
-		stopH0 = hourFormat12(local) % 10;
-	}
+	uint8_t h = timeFormat ? local.hour : local.hour12();
+	stopH1 = h / 10;
+	stopH0 = h % 10;
 
 #if 0
 	// Animate one digit at a time
@@ -573,6 +723,11 @@ void Nixie::setAnimation(bool animate)
 	animate = animate;
 }
 
+void Nixie::setAntiPoison(bool enabled)
+{
+	antiPoisonEnabled = enabled;
+}
+
 void Nixie::write(uint8_t digit1, uint8_t digit2, uint8_t digit3, uint8_t digit4, uint8_t dots)
 {
 	uint8_t H1 = 0, H0 = 0, M1 = 0, M0 = 0;
@@ -17,26 +17,103 @@
 #define DEBUG
 #endif // DEBUG
 
+/*
+ * Local civil time, broken down for the display. update() advances it from
+ * the time it holds by carrying seconds into minutes, hours and days, so the
+ * once-a-second display path only adds and compares. Only a step back, a step
+ * of more than a day or the first update convert the time in full.
+ */
+class CivilTime {
+	time_t local = 0;	// the time held, in local seconds since the epoch
+	bool valid = false;
+
+	void set(time_t local);
+	void addDays(uint32_t days);
+
+    public:
+	void update(time_t local);
+	uint8_t hour12() const;
+
+	uint16_t year = 1970;
+	uint8_t month = 1, day = 1, hour = 0, minute = 0, second = 0;
+
+	uint32_t full_updates = 0;	// converted with civil::fromUnix()
+	uint32_t incremental_updates = 0;	// advanced from the previous time
+};
+
+#define DISPLAY_FORMAT_SIZE	10	// longest format, with its terminator
+
+enum DisplayFormatKind {
+	DISPLAY_FORMAT_TIME,	// fields H, M and S
+	DISPLAY_FORMAT_DATE,	// fields Y, M and D
+};
+
+/*
+ * A layout of the tubes, e.g. "HHMM:00b0". The four tubes from the left are
+ * each a field letter or '-' for off. A run of one letter shows that many of
+ * the field's last digits, so "YYYY" is the year and "MMSS" the minutes and
+ * seconds of a time. The tubes may be followed by ':' and the four dots from
+ * the left as '0' for off, '1' for on or 'b' to blink with the seconds.
+ *
+ * compile() parses a layout once into a field and a divisor per tube, so
+ * render() takes every layout's digits the same way.
+ */
+class DisplayFormat {
+	enum Field : uint8_t {
+		FIELD_OFF,
+		FIELD_HOUR,
+		FIELD_MINUTE,
+		FIELD_SECOND,
+		FIELD_YEAR,
+		FIELD_MONTH,
+		FIELD_DAY,
+		FIELD_COUNT,
+	};
+
+	Field fields[4] = { FIELD_OFF, FIELD_OFF, FIELD_OFF, FIELD_OFF };
+	uint16_t divisors[4] = { 1, 1, 1, 1 };
+	uint8_t dots_on = 0, dots_blink = 0;	// as Nixie::write() takes them
+	const char *error_message = NULL;
+	uint8_t error_offset = 0;
+
+	bool fail(const char *message, uint8_t offset);
+
+    public:
+	// On a syntax error, returns false and keeps the layout compiled before.
+	bool compile(const char *format, DisplayFormatKind kind);
+	void render(const CivilTime &local, bool hour24, bool dot_state, uint8_t tubes[4], uint8_t &dots) const;
+
+	bool hasSeconds() const;	// changes every second
+	bool blinks() const;	// has a blinking dot
+
+	// Why and where, as an offset into the format, compile() failed.
+	const char *error() const;
+	uint8_t errorOffset() const;
+};
+
 class Nixie {
 	// Initialize the display. This function configures pinModes based on .h file.
-	String oldNumber = "";
+	char oldNumber[93] = ""; // Longest number that fits numberArray, see writeNumber().
 	uint8_t numberArray[100], numIsNeg;
 	int dotPos, numberSize, k = 0;
 	unsigned long previousMillis = 0;
 	uint8_t autoPoisonDoneOnMinute = 0;
 	uint8_t oldDigit1, oldDigit2, oldDigit3, oldDigit4;
 	bool animate = false;
+	bool antiPoisonEnabled = true;
 
     public:
 	Nixie();
 	void begin();
 	void write(uint8_t digit1, uint8_t digit2, uint8_t digit3, uint8_t digit4, uint8_t dots);
-	void writeNumber(String newNumber, unsigned int movingSpeed);
-	void writeTime(time_t local, bool dot_state, bool timeFormat);
-	void writeDate(time_t local, bool dot_state);
+	void writeNumber(const char *newNumber, unsigned int movingSpeed);
+	void writeTime(const CivilTime &local, const DisplayFormat &format, bool dot_state, bool timeFormat);
+	void writeDate(const CivilTime &local, const DisplayFormat &format, bool dot_state);
 	uint8_t checkDate(uint16_t y, uint8_t m, uint8_t d, uint8_t h, uint8_t mm);
-	void antiPoison(time_t local, bool timeFormat);
+	void antiPoison(const CivilTime &local, bool timeFormat);
 	void setAnimation(bool animate);
+	// Whether writeTime() plays the anti-poisoning animation.
+	void setAntiPoison(bool enabled);
 
     private:
 	void writeLowLevel(uint8_t digit1, uint8_t digit2, uint8_t digit3, uint8_t digit4, uint8_t dots);
@@ -0,0 +1,258 @@
+/*
+ * animation_script.cpp - check the keyframe animation compiler and player.
+ *
+ * First compiles scripts on the host and checks the frames, and the error
+ * offsets of malformed scripts. Then sets a script over serial, sets the time
+ * just before a minute change and checks the SPI frames that follow: the
+ * compiled frames, with 't' tubes showing the new time, each shown for its
+ * time, then the time. loop() must keep running between frames. Finally the
+ * script is removed and the built-in animation must play again.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/animation.bin --scenario animation -- [options]
+ */
+
+#include <Arduino.h>
+#include <Animation.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+namespace {
+
+struct Options {
+	const char *script = "0000/40 ~ 9999 tttt:0100/300 -tt-/100 tttt";
+	uint32_t step_ms = 1;
+	bool verbose = false;
+};
+
+struct Frame {
+	uint64_t at_us;
+	uint64_t step;
+	uint8_t tubes[4];
+	uint8_t dots;
+};
+
+Options opts;
+std::vector<Frame> frames;
+Animation compiled;
+
+void spiFrame(const hal::SpiFrame &f)
+{
+	static const uint16_t pinmap[] = { 16, 32, 64, 128, 256, 512, 1, 2, 4, 8, 0 };
+
+	if (f.length != 6 || frames.size() == frames.capacity()) {
+		return;
+	}
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < 5; i++) {
+		bits = bits << 8 | (uint8_t)~f.data[i];
+	}
+	Frame frame = { f.at_us, hal::step_count(), {}, f.data[5] };
+	for (uint8_t d = 0; d < 4; d++) {
+		uint16_t tube = bits >> (30 - 10 * d) & 0x3ff;
+		frame.tubes[d] = ANIMATION_OFF;
+		for (uint8_t j = 0; j < 10; j++) {
+			if (pinmap[j] == tube) {
+				frame.tubes[d] = j;
+			}
+		}
+	}
+	frames.push_back(frame);
+}
+
+std::string tubes(const uint8_t t[4])
+{
+	std::string s;
+	for (uint8_t i = 0; i < 4; i++) {
+		s += t[i] <= 9 ? '0' + t[i] : t[i] == ANIMATION_TARGET ? 't' : '-';
+	}
+	return s;
+}
+
+void checkCompile(const char *script, const char *expected, uint32_t duration_ms)
+{
+	Animation a;
+	if (!a.compile(script)) {
+		error("'%s' failed to compile", script);
+		return;
+	}
+	std::string shown;
+	for (uint8_t i = 0; i < a.length(); i++) {
+		const AnimationFrame &f = a.frame(i);
+		shown += (i > 0 ? " " : "") + tubes(f.tubes);
+		if (f.dots != 0) {
+			char dots[8];
+			snprintf(dots, sizeof(dots), ":%02x", f.dots);
+			shown += dots;
+		}
+	}
+	if (shown != expected || a.duration() != duration_ms) {
+		error("'%s' compiled to '%s', %u ms, expected '%s', %u ms", script, shown.c_str(), a.duration(), expected,
+		      duration_ms);
+	}
+}
+
+void checkError(const char *script, uint16_t offset)
+{
+	Animation a;
+	if (a.compile(script)) {
+		error("'%s' compiled", script);
+	} else if (a.errorOffset() != offset || a.length() != 0) {
+		error("'%s' failed at offset %u (%s), expected %u", script, a.errorOffset(), a.error(), offset);
+	}
+}
+
+void compilerChecks()
+{
+	checkCompile("1234", "1234", ANIMATION_DEFAULT_MS);
+	checkCompile("0-t9:1001/20 tttt", "0-t9:12 tttt", 40);
+	checkCompile("0000/10 ~ 0300", "0000 0100 0200 0300", 40);
+	checkCompile("1290/5 ~ 0921/7", "1290 0381 0471 0561 0651 0741 0831 0921", 42);
+	checkCompile("12-t/5~98-t", "12-t 23-t 34-t 45-t 56-t 67-t 78-t 88-t 98-t", 45);
+	checkCompile("  0000  ", "0000", ANIMATION_DEFAULT_MS);
+
+	checkError("123", 3);
+	checkError("12345", 4);
+	checkError("12a4", 2);
+	checkError("0000:12", 6);
+	checkError("0000/0", 5);
+	checkError("0000/", 5);
+	checkError("0000/70000", 5);
+	checkError("~ 0000", 0);
+	checkError("0000 ~ ~ 1111", 7);
+	checkError("0000 ~", 6);
+	checkError("0000 ~ 9999 0000 ~ 9999 0000 ~ 9999 0000 ~ 9999 0000 ~ 9999 0000 ~ 9999 0000 ~ 9999", 83);
+
+	// No frames, for the built-in animation.
+	Animation empty;
+	if (!empty.compile(" ") || empty.length() != 0) {
+		error("an empty script didn't compile to no frames");
+	}
+	printf("Compiler checks: %u errors\n", errors());
+}
+
+/*
+ * Set the time two seconds before 12:34 UTC and check the frames from the
+ * minute change on.
+ */
+void playerChecks()
+{
+	uint32_t before = errors();
+
+	if (!compiled.compile(opts.script)) {
+		error("the script doesn't compile: %s at offset %u", compiled.error(), compiled.errorOffset());
+		return;
+	}
+	std::string cmd = std::string("set animation ") + opts.script;
+	command(cmd.c_str());
+	run(compiled.duration() + 1000);
+
+	command("set time 2024-01-01T12:33:58+00:00");
+	run(1000);
+	frames.clear();
+	uint64_t start_step = hal::step_count();
+	run(compiled.duration() + 2000);
+
+	// Until the minute changes, the dot blinks on 12:33.
+	const uint8_t before_tubes[4] = { 1, 2, 3, 3 };
+	size_t first = 0;
+	while (first < frames.size() && memcmp(frames[first].tubes, before_tubes, 4) == 0) {
+		first++;
+	}
+	const uint8_t target[4] = { 1, 2, 3, 4 };
+	int64_t due_us = first < frames.size() ? frames[first].at_us : 0;
+	for (uint8_t i = 0; i <= compiled.length(); i++) {
+		if (first + i >= frames.size()) {
+			error("%u of %u frames played", i, compiled.length());
+			break;
+		}
+		const Frame &f = frames[first + i];
+		if (i == compiled.length()) {
+			// The time, once the last frame has been shown.
+			if (memcmp(f.tubes, target, 4) != 0) {
+				error("%s shown after the animation", tubes(f.tubes).c_str());
+			}
+		} else {
+			const AnimationFrame &e = compiled.frame(i);
+			uint8_t expected[4];
+			for (uint8_t d = 0; d < 4; d++) {
+				expected[d] = e.tubes[d] == ANIMATION_TARGET ? target[d] : e.tubes[d];
+			}
+			if (memcmp(f.tubes, expected, 4) != 0 || f.dots != e.dots) {
+				error("frame %u shows %s dots %02x, expected %s dots %02x", i, tubes(f.tubes).c_str(), f.dots,
+				      tubes(expected).c_str(), e.dots);
+			}
+		}
+		if (i > 0) {
+			// Each frame is due when the ones before it have been shown
+			// for their time, and is shown within a loop() step.
+			due_us += compiled.frame(i - 1).ms * 1000;
+			int64_t late_us = f.at_us - due_us;
+			if (late_us < 0 || late_us > 2 * opts.step_ms * 1000) {
+				error("frame %u shown %lld us after it was due", i, (long long)late_us);
+			}
+			if (f.step == frames[first + i - 1].step) {
+				error("frames %u and %u written in the same loop() iteration", i - 1, i);
+			}
+		}
+	}
+	printf("Player: %u frames after the minute change from step %llu, %u errors\n", compiled.length(),
+	       (unsigned long long)(frames.empty() ? 0 : frames[first].step - start_step), errors() - before);
+}
+
+// Without a script the built-in animation blocks in delay(), so all of its
+// frames are written in one loop() iteration.
+void builtinChecks()
+{
+	command("unset animation");
+	command("set time 2024-01-01T12:35:58+00:00");
+	frames.clear();
+	run(3000);
+
+	size_t most = 0;
+	for (size_t i = 0, n = 0; i < frames.size(); i++) {
+		n = i > 0 && frames[i].step == frames[i - 1].step ? n + 1 : 1;
+		most = max(most, n);
+	}
+	if (most < 10) {
+		error("the built-in animation wrote at most %zu frames in an iteration", most);
+	}
+	printf("Built-in: %zu frames in one loop() iteration\n", most);
+}
+
+const Option OPTIONS[] = {
+	{ "script", "TEXT", "animation script to play", opts.script },
+	{ "step-ms", "N", "virtual time per loop() iteration", opts.step_ms, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int animationScript(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	compilerChecks();
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	capture_serial(opts.verbose);
+	frames.reserve(100000);
+	hal::spi_set_listener(spiFrame);
+
+	command("set ntp_enabled 0");
+	command("set 24hr_enabled 1");
+	command("set time_zone Etc/UTC");
+	playerChecks();
+	builtinChecks();
+	return errors() == 0 ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("animation", "check the keyframe animation compiler and player", animationScript);
+
+} // namespace
@@ -0,0 +1,293 @@
+/*
+ * bench.cpp - microbenchmarks of the display and time hot paths.
+ *
+ * Times the firmware's own code against the hardware stand-ins, in the manner
+ * of Google Benchmark: each benchmark runs a growing number of iterations
+ * until a run takes at least --min-time seconds, and reports the wall-clock
+ * and CPU time per iteration of that run.
+ *
+ *	Nixie::write		  encode and latch a frame (writeLowLevel)
+ *	Nixie::writeNumber/parse  parse a new number and show it
+ *	Nixie::writeNumber/scroll scroll a long number by one digit
+ *	Nixie::antiPoison	  generate the anti-poisoning animation frames
+ *	localTime		  the zone offset computed on every render, for
+ *				  consecutive and for random times
+ *	CivilTime::update/second  advance the broken-down local time
+ *	printTime		  format a ticker line
+ *	BQ32000RTC::read/write	  a time read and write, with their BCD
+ *				  conversions
+ *
+ * Stand-in costs are included: the SPI and I2C transfers, and the virtual
+ * clock steps of delay() and of the scrolling. The results are printed as a
+ * table and, with --output FILE, written as Google Benchmark JSON, which its
+ * tools/compare.py can compare between firmware versions.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/bench.bin --scenario bench -- [options]
+ */
+
+#include <Arduino.h>
+#include <nixie.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+time_t localTime(time_t);
+void printTime(time_t);
+extern time_t last_printed_time;
+
+namespace {
+
+struct Options {
+	double min_time_s = 0.5;
+	const char *filter = NULL;
+	const char *zone = "America/New_York";
+	const char *output = NULL;
+};
+
+struct Benchmark {
+	const char *name;
+	void (*fn)(uint64_t iterations);
+};
+
+struct Result {
+	const char *name;
+	uint64_t iterations;
+	double real_ns;
+	double cpu_ns;
+};
+
+Options opts;
+std::vector<Result> results;
+
+// Keeps results from being optimized away, like benchmark::DoNotOptimize().
+volatile int64_t sink;
+
+// Times spread over the years the clock may show, for cache-missing runs.
+const size_t RANDOM_TIMES = 4096;
+std::vector<time_t> randomTimes;
+const time_t START_TIME = 1700000000;
+
+void benchWrite(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		uint8_t d = i % 10;
+		nixieTap.write(d, 9 - d, d, 9 - d, 0);
+	}
+}
+
+void benchWriteNumberParse(uint64_t n)
+{
+	static const char *const NUMBERS[] = { "3.14159", "-2718.28" };
+	for (uint64_t i = 0; i < n; i++) {
+		nixieTap.writeNumber(NUMBERS[i & 1], 0);
+	}
+}
+
+void benchWriteNumberScroll(uint64_t n)
+{
+	nixieTap.writeNumber("-1234567.891", 1);
+	for (uint64_t i = 0; i < n; i++) {
+		hal::advance(1000);
+		nixieTap.writeNumber("-1234567.891", 1);
+	}
+}
+
+void benchAntiPoison(uint64_t n)
+{
+	CivilTime local;
+	local.update(localTime(START_TIME));
+	for (uint64_t i = 0; i < n; i++) {
+		// The animation runs when the minute's last digit changes.
+		local.minute = i % 60;
+		nixieTap.antiPoison(local, true);
+	}
+}
+
+void benchLocalTime(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		sink = sink + localTime(START_TIME + i);
+	}
+}
+
+void benchLocalTimeRandom(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		sink = sink + localTime(randomTimes[i % RANDOM_TIMES]);
+	}
+}
+
+void benchCivilTimeUpdate(uint64_t n)
+{
+	CivilTime local;
+	for (uint64_t i = 0; i < n; i++) {
+		local.update(START_TIME + i);
+		sink = sink + local.second;
+	}
+}
+
+void benchPrintTime(uint64_t n)
+{
+	last_printed_time = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		printTime(START_TIME + i);
+	}
+}
+
+void benchRtcRead(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		tmElements_t tm;
+		RTC.read(tm);
+		sink = sink + tm.Second;
+	}
+}
+
+void benchRtcWrite(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		tmElements_t tm;
+		breakTime(START_TIME + i, tm);
+		RTC.write(tm);
+	}
+}
+
+const Benchmark BENCHMARKS[] = {
+	{ "Nixie::write", benchWrite },
+	{ "Nixie::writeNumber/parse", benchWriteNumberParse },
+	{ "Nixie::writeNumber/scroll", benchWriteNumberScroll },
+	{ "Nixie::antiPoison", benchAntiPoison },
+	{ "localTime/consecutive", benchLocalTime },
+	{ "localTime/random", benchLocalTimeRandom },
+	{ "CivilTime::update/second", benchCivilTimeUpdate },
+	{ "printTime/consecutive", benchPrintTime },
+	{ "BQ32000RTC::read", benchRtcRead },
+	{ "BQ32000RTC::write", benchRtcWrite },
+};
+
+double seconds(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * As Google Benchmark does, grow the iteration count by up to 10 times the
+ * ratio to the minimum time until a run reaches it.
+ */
+Result runBenchmark(const Benchmark &b)
+{
+	uint64_t n = 1;
+	for (;;) {
+		double real0 = seconds(CLOCK_MONOTONIC);
+		double cpu0 = seconds(CLOCK_PROCESS_CPUTIME_ID);
+		b.fn(n);
+		double real = seconds(CLOCK_MONOTONIC) - real0;
+		double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu0;
+		if (real >= opts.min_time_s || n >= 1000000000) {
+			return { b.name, n, real * 1e9 / n, cpu * 1e9 / n };
+		}
+		double multiplier = real > 0 ? min(opts.min_time_s * 1.4 / real, 10.0) : 10.0;
+		n = max((uint64_t)(n * multiplier), n + 1);
+	}
+}
+
+void writeJson(FILE *f, const char *executable)
+{
+	char date[32], host[64] = "";
+	time_t t = ::time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+	gethostname(host, sizeof(host) - 1);
+
+	fprintf(f, "{\n  \"context\": {\n");
+	fprintf(f, "    \"date\": \"%s\",\n", date);
+	fprintf(f, "    \"host_name\": \"%s\",\n", host);
+	fprintf(f, "    \"executable\": \"%s\",\n", executable);
+	fprintf(f, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(f, "    \"time_zone\": \"%s\",\n", opts.zone);
+#ifdef __OPTIMIZE__
+	fprintf(f, "    \"library_build_type\": \"release\"\n");
+#else
+	fprintf(f, "    \"library_build_type\": \"debug\"\n");
+#endif
+	fprintf(f, "  },\n  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"name\": \"%s\",\n", r.name);
+		fprintf(f, "      \"family_index\": %zu,\n", i);
+		fprintf(f, "      \"per_family_instance_index\": 0,\n");
+		fprintf(f, "      \"run_name\": \"%s\",\n", r.name);
+		fprintf(f, "      \"run_type\": \"iteration\",\n");
+		fprintf(f, "      \"repetitions\": 1,\n");
+		fprintf(f, "      \"repetition_index\": 0,\n");
+		fprintf(f, "      \"threads\": 1,\n");
+		fprintf(f, "      \"iterations\": %llu,\n", (unsigned long long)r.iterations);
+		fprintf(f, "      \"real_time\": %.3f,\n", r.real_ns);
+		fprintf(f, "      \"cpu_time\": %.3f,\n", r.cpu_ns);
+		fprintf(f, "      \"time_unit\": \"ns\"\n");
+		fprintf(f, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+const Option OPTIONS[] = {
+	{ "min-time", "S", "seconds each benchmark runs for at least", opts.min_time_s, 0.001 },
+	{ "filter", "TEXT", "only run the benchmarks whose name contains TEXT", opts.filter },
+	{ "zone", "ZONE", "time zone for the time benchmarks", opts.zone },
+	{ "output", "FILE", "write the results to FILE as Google Benchmark JSON", opts.output },
+};
+
+int bench(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	hal::options.speed = 0;
+	std::string zone = std::string("set time_zone ") + opts.zone;
+	command(zone.c_str());
+
+	// The benchmarks print, as the firmware does; drop the output.
+	capture_serial(false, 0);
+
+	srandom(1);
+	randomTimes.resize(RANDOM_TIMES);
+	for (time_t &t : randomTimes) {
+		t = START_TIME + random() % (20 * 365 * 86400L);
+	}
+
+	printf("%-28s %13s %13s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+	printf("%s\n", std::string(69, '-').c_str());
+	for (const Benchmark &b : BENCHMARKS) {
+		if (opts.filter != NULL && strstr(b.name, opts.filter) == NULL) {
+			continue;
+		}
+		Result r = runBenchmark(b);
+		results.push_back(r);
+		printf("%-28s %10.1f ns %10.1f ns %12llu\n", r.name, r.real_ns, r.cpu_ns, (unsigned long long)r.iterations);
+	}
+
+	if (opts.output != NULL) {
+		FILE *f = fopen(opts.output, "w");
+		if (f == NULL) {
+			perror(opts.output);
+			return 1;
+		}
+		writeJson(f, program_invocation_name);
+		fclose(f);
+	}
+	return results.empty() ? 1 : 0;
+}
+
+hal::ScenarioRegistration registration("bench", "time the display and time hot paths", bench);
+
+} // namespace
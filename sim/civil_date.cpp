@@ -0,0 +1,167 @@
+/*
+ * civil_date.cpp - check and time the CivilDate conversions against TimeLib.
+ *
+ * TimeLib keeps times in 32 unsigned bits, from 1970-01-01 to
+ * 2106-02-07T06:28:15. Over that range the scenario compares, for every
+ * day, civil::fromUnix() with breakTime() and civil::toUnix() with
+ * makeTime() at the first and last second of the day and at every
+ * --step seconds in between, so that every second of the minute and every
+ * minute of the day is covered. It also checks civil::isValid() and
+ * Nixie::checkDate() against a makeTime()/breakTime() round trip for every
+ * year, month and day, including out-of-range months and days. Then it
+ * converts a run of random times with both and reports the time per
+ * conversion.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/civil.bin --scenario civil -- [options]
+ */
+
+#include <Arduino.h>
+#include <CivilDate.h>
+#include <TimeLib.h>
+#include <nixie.h>
+#include <chrono>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// The conversions are usable at compile time.
+static_assert(civil::daysFromCivil(1970, 1, 1) == 0, "epoch");
+static_assert(civil::daysFromCivil(2000, 3, 1) == 11017, "2000-03-01");
+static_assert(civil::civilFromDays(-1).year == 1969, "1969-12-31");
+static_assert(civil::fromUnix(951782400).day == 29, "2000-02-29");
+static_assert(!civil::isLeapYear(1900) && civil::isLeapYear(2000) && !civil::isLeapYear(2100), "leap years");
+
+namespace {
+
+const uint64_t TIMELIB_END = 0xffffffffULL;	// last second TimeLib represents
+
+struct Options {
+	uint32_t step_s = 61;
+	uint32_t bench_count = 1000000;
+};
+
+struct Stats {
+	uint64_t checks = 0;
+	uint64_t mismatches = 0;
+};
+
+Options opts;
+Stats stats;
+
+const uint8_t MAX_REPORTED_MISMATCHES = 20;
+
+void mismatch(const char *what, uint64_t t)
+{
+	stats.mismatches++;
+	if (stats.mismatches <= MAX_REPORTED_MISMATCHES) {
+		printf("MISMATCH in %s at %llu\n", what, (unsigned long long)t);
+	}
+}
+
+void check(uint64_t t)
+{
+	tmElements_t tm;
+	breakTime(t, tm);
+	civil::DateTime dt = civil::fromUnix(t);
+
+	stats.checks++;
+	if (dt.year != tmYearToCalendar(tm.Year) || dt.month != tm.Month || dt.day != tm.Day || dt.hour != tm.Hour ||
+	    dt.minute != tm.Minute || dt.second != tm.Second || dt.weekday != tm.Wday) {
+		mismatch("fromUnix", t);
+	}
+	if (civil::toUnix(dt) != (int64_t)(uint32_t)makeTime(tm) || civil::toUnix(dt) != (int64_t)t) {
+		mismatch("toUnix", t);
+	}
+}
+
+// Whether TimeLib gives the date back unchanged after a round trip.
+bool roundTrips(uint16_t year, uint8_t month, uint8_t day)
+{
+	tmElements_t tm = {};
+	tm.Year = CalendarYrToTm(year);
+	tm.Month = month;
+	tm.Day = day;
+	tmElements_t back;
+	breakTime(makeTime(tm), back);
+	return back.Year == tm.Year && back.Month == month && back.Day == day;
+}
+
+void checkValidation()
+{
+	// The last year TimeLib's arithmetic doesn't wrap around in.
+	for (uint16_t year = 1970; year <= 2105; year++) {
+		for (uint8_t month = 0; month <= 13; month++) {
+			for (uint8_t day = 0; day <= 32; day++) {
+				bool expected = month >= 1 && month <= 12 && day >= 1 && roundTrips(year, month, day);
+				stats.checks++;
+				if (civil::isValid(year, month, day) != expected) {
+					mismatch("isValid", year * 10000 + month * 100 + day);
+				}
+				if (nixieTap.checkDate(year, month, day, 23, 59) != (expected && year >= 1971)) {
+					mismatch("checkDate", year * 10000 + month * 100 + day);
+				}
+			}
+		}
+	}
+}
+
+void bench()
+{
+	std::vector<uint32_t> times(opts.bench_count);
+	for (uint32_t &t : times) {
+		t = random() % TIMELIB_END;
+	}
+	volatile int64_t sink = 0;
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint32_t t : times) {
+		tmElements_t tm;
+		breakTime(t, tm);
+		sink = sink + makeTime(tm);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	for (uint32_t t : times) {
+		sink = sink + civil::toUnix(civil::fromUnix(t));
+	}
+	auto t2 = std::chrono::steady_clock::now();
+
+	double timelib_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / opts.bench_count;
+	double civil_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / opts.bench_count;
+	printf("%u random times: TimeLib %.1f ns, CivilDate %.1f ns per breakTime and makeTime round trip (%.1fx)\n",
+	       opts.bench_count, timelib_ns, civil_ns, timelib_ns / civil_ns);
+}
+
+const Option OPTIONS[] = {
+	{ "step", "N", "seconds between the checked times within a day", opts.step_s, 1 },
+	{ "bench-count", "N", "conversions in the timing run", opts.bench_count, 1 },
+};
+
+int civilDate(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	for (uint64_t day = 0; day * 86400 <= TIMELIB_END; day++) {
+		uint64_t start = day * 86400;
+		uint64_t end = min(start + 86399, TIMELIB_END);
+		for (uint64_t t = start; t < end; t += opts.step_s) {
+			check(t);
+		}
+		check(end);
+	}
+	checkValidation();
+	printf("Checks: %llu, mismatches: %llu\n", (unsigned long long)stats.checks, (unsigned long long)stats.mismatches);
+
+	srandom(1);
+	bench();
+	return stats.mismatches == 0 ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("civil", "check and time the CivilDate conversions against TimeLib", civilDate);
+
+} // namespace
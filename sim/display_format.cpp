@@ -0,0 +1,222 @@
+/*
+ * display_format.cpp - check the compiled time and date display formats.
+ *
+ * First compiles formats on the host and checks the tubes and dots they
+ * render for a fixed time, and the error offsets of malformed formats. Then
+ * sets formats over serial and checks the SPI frames the time and date modes
+ * write: a format with seconds must be rendered every second, and one that
+ * doesn't compile must leave the format in use.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/format.bin --scenario format -- [options]
+ */
+
+#include <Arduino.h>
+#include <nixie.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+namespace {
+
+struct Options {
+	bool verbose = false;
+};
+
+struct Frame {
+	uint64_t at_us;
+	uint8_t tubes[4];
+	uint8_t dots;
+};
+
+Options opts;
+std::vector<Frame> frames;
+std::string shownText;
+
+void spiFrame(const hal::SpiFrame &f)
+{
+	static const uint16_t pinmap[] = { 16, 32, 64, 128, 256, 512, 1, 2, 4, 8, 0 };
+
+	if (f.length != 6 || frames.size() == frames.capacity()) {
+		return;
+	}
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < 5; i++) {
+		bits = bits << 8 | (uint8_t)~f.data[i];
+	}
+	Frame frame = { f.at_us, {}, f.data[5] };
+	for (uint8_t d = 0; d < 4; d++) {
+		uint16_t tube = bits >> (30 - 10 * d) & 0x3ff;
+		frame.tubes[d] = 10;
+		for (uint8_t j = 0; j < 10; j++) {
+			if (pinmap[j] == tube) {
+				frame.tubes[d] = j;
+			}
+		}
+	}
+	frames.push_back(frame);
+}
+
+std::string tubes(const uint8_t t[4])
+{
+	std::string s;
+	for (uint8_t i = 0; i < 4; i++) {
+		s += t[i] <= 9 ? '0' + t[i] : '-';
+	}
+	return s;
+}
+
+void checkRender(const char *format, DisplayFormatKind kind, const CivilTime &local, bool hour24, bool dot_state,
+		 const char *expected, uint8_t expected_dots)
+{
+	DisplayFormat f;
+	if (!f.compile(format, kind)) {
+		error("'%s' failed to compile: %s", format, f.error());
+		return;
+	}
+	uint8_t t[4], dots;
+	f.render(local, hour24, dot_state, t, dots);
+	if (tubes(t) != expected || dots != expected_dots) {
+		error("'%s' rendered %s dots %02x, expected %s dots %02x", format, tubes(t).c_str(), dots, expected,
+		      expected_dots);
+	}
+}
+
+void checkError(const char *format, DisplayFormatKind kind, uint8_t offset)
+{
+	DisplayFormat f;
+	f.compile("HHMM", DISPLAY_FORMAT_TIME);
+	if (f.compile(format, kind)) {
+		error("'%s' compiled", format);
+	} else if (f.errorOffset() != offset) {
+		error("'%s' failed at offset %u (%s), expected %u", format, f.errorOffset(), f.error(), offset);
+	}
+}
+
+void compilerChecks()
+{
+	CivilTime local;
+	local.update(1709816742); // 2024-03-07 13:05:42
+
+	checkRender("HHMM:00b0", DISPLAY_FORMAT_TIME, local, true, false, "1305", 0);
+	checkRender("HHMM:00b0", DISPLAY_FORMAT_TIME, local, true, true, "1305", 0b1000);
+	checkRender("HHMM", DISPLAY_FORMAT_TIME, local, false, true, "0105", 0);
+	checkRender("MMSS:0100", DISPLAY_FORMAT_TIME, local, true, false, "0542", 0b100);
+	checkRender("-HMM", DISPLAY_FORMAT_TIME, local, false, false, "-105", 0);
+	checkRender("SSSS:b11b", DISPLAY_FORMAT_TIME, local, true, true, "0042", 0b11110);
+	checkRender("MMDD:0010", DISPLAY_FORMAT_DATE, local, true, true, "0307", 0b1000);
+	checkRender("DDMM", DISPLAY_FORMAT_DATE, local, true, false, "0703", 0);
+	checkRender("YYYY", DISPLAY_FORMAT_DATE, local, true, false, "2024", 0);
+	checkRender("-YY-", DISPLAY_FORMAT_DATE, local, true, false, "-24-", 0);
+
+	checkError("YYYY", DISPLAY_FORMAT_TIME, 0);
+	checkError("HHMM", DISPLAY_FORMAT_DATE, 0);
+	checkError("HHM", DISPLAY_FORMAT_TIME, 3);
+	checkError("", DISPLAY_FORMAT_TIME, 0);
+	checkError("HHMMSS", DISPLAY_FORMAT_TIME, 4);
+	checkError("HHMM:01x0", DISPLAY_FORMAT_TIME, 7);
+	checkError("HHMM:010", DISPLAY_FORMAT_TIME, 8);
+	checkError("HHMM:01000", DISPLAY_FORMAT_TIME, 9);
+
+	// A failed compile keeps the format compiled before.
+	DisplayFormat f;
+	uint8_t t[4], dots;
+	f.compile("MMSS", DISPLAY_FORMAT_TIME);
+	f.compile("MMXX", DISPLAY_FORMAT_TIME);
+	f.render(local, true, false, t, dots);
+	if (tubes(t) != "0542") {
+		error("a failed compile changed the format, %s shown", tubes(t).c_str());
+	}
+	printf("Compiler checks: %u errors\n", errors());
+}
+
+// The distinct frames written after 'cmd', for 'ms' milliseconds, space
+// separated. Built in a string reserved up front, as the firmware counts
+// allocations between loop() iterations.
+const char *shownAfter(const char *cmd, uint32_t ms)
+{
+	frames.clear();
+	command(cmd);
+	run(ms);
+	shownText.clear();
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (i > 0 && memcmp(frames[i].tubes, frames[i - 1].tubes, 4) == 0) {
+			continue;
+		}
+		if (!shownText.empty()) {
+			shownText += ' ';
+		}
+		shownText += tubes(frames[i].tubes);
+	}
+	return shownText.c_str();
+}
+
+void expectShown(const char *cmd, uint32_t ms, const char *expected, uint8_t expected_dots)
+{
+	const char *s = shownAfter(cmd, ms);
+	if (strcmp(s, expected) != 0) {
+		error("'%s' showed '%s', expected '%s'", cmd, s, expected);
+		return;
+	}
+	// A blinking dot is on in some of the frames.
+	for (const Frame &f : frames) {
+		if (f.dots == expected_dots) {
+			return;
+		}
+	}
+	error("'%s' never showed dots %02x", cmd, expected_dots);
+}
+
+void displayChecks()
+{
+	uint32_t before = errors();
+
+	// Past the anti-poisoning animation of the time step.
+	command("set time 2024-03-07T13:05:40+00:00");
+	run(3000);
+
+	expectShown("set time_format MMSS", 1500, "0542 0543", 0);
+	expectShown("set time_format MMXX", 1000, "0544", 0);
+	expectShown("set time_format -HMM:000b", 1000, "-305", 0b10000);
+	expectShown("set date_format YYYY", 100, "-305", 0);
+	expectShown("display date", 1000, "2024", 0);
+	expectShown("set date_format DDMM:0100", 1000, "0703", 0b100);
+	expectShown("display time", 100, "-305", 0);
+
+	command("set time_format HHMM:00b0");
+	command("set date_format MMDD:0010");
+	printf("Display: %u errors\n", errors() - before);
+}
+
+const Option OPTIONS[] = {
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int displayFormat(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	compilerChecks();
+
+	hal::options.speed = 0;
+	capture_serial(opts.verbose);
+	frames.reserve(100000);
+	shownText.reserve(4096);
+	hal::spi_set_listener(spiFrame);
+
+	command("set ntp_enabled 0");
+	command("set 24hr_enabled 1");
+	command("set time_zone Etc/UTC");
+	displayChecks();
+	return errors() == 0 ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("format", "check the compiled time and date display formats", displayFormat);
+
+} // namespace
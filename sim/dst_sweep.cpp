@@ -0,0 +1,287 @@
+/*
+ * dst_sweep.cpp - sweep the firmware's time display across DST transitions.
+ *
+ * For every zone in the AceTime registry, finds the UTC offset transitions in
+ * a range of years and, for each of them, sets the firmware's clock a few
+ * seconds before the transition and runs it in stepped virtual time until a
+ * few seconds after. After every loop() iteration the digits latched into the
+ * nixie driver are decoded and compared with the local time computed by
+ * AceTime, and so are the timestamps printed by the serial ticker. This
+ * exercises the offset calculation in loop(), Nixie::writeTime(),
+ * Nixie::antiPoison() and printTime() together.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/dst.bin --scenario dst -- [options]
+ */
+
+#include <Arduino.h>
+#include <AceTime.h>
+#include <string>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace ace_time;
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern time_t current_time;
+extern uint8_t cfg_24hr_enabled;
+extern uint8_t displayMode;
+extern bool systemTimeValid;
+
+namespace {
+
+struct Options {
+	int from_year = 2000;
+	int to_year = 2050;
+	const char *zone = NULL;
+	bool hour12 = false;
+	uint32_t step_ms = 50;
+	uint32_t window_s = 3;
+	bool verbose = false;
+};
+
+struct Stats {
+	uint32_t zones = 0;
+	uint32_t transitions = 0;
+	uint64_t display_checks = 0;
+	uint64_t print_checks = 0;
+	uint64_t mismatches = 0;
+};
+
+Options opts;
+Stats stats;
+
+// The harness has its own zone manager, so its lookups don't evict the
+// firmware's cached zone.
+ExtendedZoneProcessorCache<1> zoneProcessorCache;
+ExtendedZoneManager zoneManager(
+	zonedbx::kZoneAndLinkRegistrySize,
+	zonedbx::kZoneAndLinkRegistry,
+	zoneProcessorCache);
+TimeZone zone;
+std::string zoneName;
+// Ticker lines printed while a command changes the zone or the time are not
+// checked, since the harness can't tell which zone they were printed in.
+bool checkTicker = false;
+
+const uint8_t MAX_REPORTED_MISMATCHES = 20;
+
+void mismatch(const char *what, time_t t, const char *expected, const char *shown)
+{
+	stats.mismatches++;
+	if (stats.mismatches <= MAX_REPORTED_MISMATCHES) {
+		printf("MISMATCH %s %s at %lld: expected %s, shown %s\n",
+		       zoneName.c_str(), what, (long long)t, expected, shown);
+	}
+}
+
+/*
+ * Decode the digits of a frame sent by Nixie::writeLowLevel(): four inverted
+ * 10-bit cathode masks followed by the dots. Returns the digits as "HHMM",
+ * with '-' for a blank tube and '?' for an invalid mask.
+ */
+std::string decodeFrame(const hal::SpiFrame &frame)
+{
+	static const uint16_t pinmap[10] = {
+		0b0000010000, 0b0000100000, 0b0001000000, 0b0010000000, 0b0100000000,
+		0b1000000000, 0b0000000001, 0b0000000010, 0b0000000100, 0b0000001000,
+	};
+	std::string digits;
+	uint64_t bits = 0;
+
+	if (frame.length < 5) {
+		return "????";
+	}
+	for (uint8_t i = 0; i < 5; i++) {
+		bits = (bits << 8) | (uint8_t)~frame.data[i];
+	}
+	for (int shift = 30; shift >= 0; shift -= 10) {
+		uint16_t mask = (bits >> shift) & 0x3ff;
+		char c = mask == 0 ? '-' : '?';
+		for (uint8_t d = 0; d < 10; d++) {
+			if (pinmap[d] == mask) {
+				c = '0' + d;
+			}
+		}
+		digits += c;
+	}
+	return digits;
+}
+
+void checkDisplay()
+{
+	if (displayMode != 0 || hal::spi_frame_count() == 0) {
+		return;
+	}
+
+	ZonedDateTime zdt = ZonedDateTime::forUnixSeconds64(current_time, zone);
+	int h = zdt.hour();
+	if (!cfg_24hr_enabled) {
+		h = h % 12 == 0 ? 12 : h % 12;
+	}
+	char expected[8];
+	snprintf(expected, sizeof(expected), "%02d%02d", h, zdt.minute());
+
+	std::string shown = decodeFrame(hal::spi_last_frame());
+	stats.display_checks++;
+	if (shown != expected) {
+		mismatch("display", current_time, expected, shown.c_str());
+	}
+}
+
+/*
+ * Compare a "[Time] The time is now: <zoned time> @ <unix time>" line printed
+ * by printTime() with AceTime's rendering of the same instant.
+ */
+void checkTickerLine(const std::string &line)
+{
+	static const char prefix[] = "[Time] The time is now: ";
+	size_t at = line.rfind(" @ ");
+
+	if (line.compare(0, sizeof(prefix) - 1, prefix) != 0 || at == std::string::npos) {
+		return;
+	}
+	time_t t = strtoll(line.c_str() + at + 3, NULL, 10);
+	std::string shown = line.substr(sizeof(prefix) - 1, at - (sizeof(prefix) - 1));
+
+	ace_common::PrintStr<64> expected;
+	ZonedDateTime::forUnixSeconds64(t, zone).printTo(expected);
+	stats.print_checks++;
+	if (shown != expected.cstr()) {
+		mismatch("printTime", t, expected.cstr(), shown.c_str());
+	}
+}
+
+// Send a serial command and run loop() until it has been handled and its
+// effect rendered.
+void command(const char *cmd)
+{
+	checkTicker = false;
+	scenario::command(cmd);
+	checkTicker = true;
+}
+
+/*
+ * Set the clock 'window_s' seconds before 't' and run until as long after
+ * it, checking the display after every iteration.
+ */
+void sweepAround(time_t t)
+{
+	char cmd[64];
+	time_t start = t - opts.window_s;
+	struct tm tm;
+
+	gmtime_r(&start, &tm);
+	snprintf(cmd, sizeof(cmd), "set time %04d-%02d-%02dT%02d:%02d:%02d+00:00",
+		 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	command(cmd);
+
+	while (current_time < t + (time_t)opts.window_s) {
+		hal::step();
+		checkDisplay();
+	}
+}
+
+void sweepZone(uint16_t index, time_t from, time_t to)
+{
+	static const time_t DAY = 86400;
+	ace_common::PrintStr<64> name;
+
+	TimeZone tz = zoneManager.createForZoneIndex(index);
+	tz.printTo(name);
+	if (opts.zone != NULL && strstr(name.cstr(), opts.zone) == NULL) {
+		return;
+	}
+	stats.zones++;
+
+	std::string cmd = std::string("set time_zone ") + name.cstr();
+	command(cmd.c_str());
+	zone = tz;
+	zoneName = name.cstr();
+
+	// Every zone is rendered at least once, even without transitions.
+	sweepAround(from + DAY / 2);
+
+	// Offsets never change more than once a day, so probe daily and
+	// bisect to the exact second.
+	uint32_t transitions = 0;
+	int32_t offset = offset_at(from, zone);
+	for (time_t t = from + DAY; t < to; t += DAY) {
+		int32_t next = offset_at(t, zone);
+		if (next == offset) {
+			continue;
+		}
+		sweepAround(find_transition(t - DAY, t, zone));
+		offset = next;
+		transitions++;
+	}
+	stats.transitions += transitions;
+
+	if (opts.verbose) {
+		printf("%s: %u transitions\n", zoneName.c_str(), transitions);
+	}
+}
+
+const Option OPTIONS[] = {
+	{ "from", "YEAR", "first year to sweep", opts.from_year },
+	{ "to", "YEAR", "last year to sweep", opts.to_year },
+	{ "zone", "TEXT", "only zones whose name contains TEXT", opts.zone },
+	{ "12h", "use the 12 hour format", opts.hour12 },
+	{ "step-ms", "N", "virtual milliseconds per loop() iteration", opts.step_ms, 1 },
+	{ "window", "N", "seconds run before and after each transition", opts.window_s },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int dstSweep(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	// Stepped mode, so the sweep runs as fast as the host allows.
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	capture_serial(opts.verbose, 0, [](const std::string &line) {
+		if (checkTicker) {
+			checkTickerLine(line);
+		}
+	});
+
+	while (!systemTimeValid) {
+		hal::step();
+	}
+	command("set ntp_enabled 0");
+	command(opts.hour12 ? "set 24hr_enabled 0" : "set 24hr_enabled 1");
+	command("display time");
+	command("ticker");
+
+	uint64_t virtual_start = hal::now_us();
+	struct timespec wall_start, wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	time_t from = year_start(opts.from_year);
+	time_t to = year_start(opts.to_year + 1);
+	for (uint16_t i = 0; i < zoneManager.zoneRegistrySize(); i++) {
+		sweepZone(i, from, to);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	double simulated = (hal::now_us() - virtual_start) / 1e6;
+
+	printf("Zones:            %u\n", stats.zones);
+	printf("Transitions:      %u (%d-%d)\n", stats.transitions, opts.from_year, opts.to_year);
+	printf("Display checks:   %llu\n", (unsigned long long)stats.display_checks);
+	printf("printTime checks: %llu\n", (unsigned long long)stats.print_checks);
+	printf("Mismatches:       %llu\n", (unsigned long long)stats.mismatches);
+	printf("Simulated:        %.0f s in %.2f s wall clock, %.0fx real time\n",
+	       simulated, wall, wall > 0 ? simulated / wall : 0);
+
+	return stats.mismatches == 0 && stats.display_checks > 0 ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("dst", "sweep the time display across DST transitions", dstSweep);
+
+} // namespace
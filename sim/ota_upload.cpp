@@ -0,0 +1,288 @@
+/*
+ * ota_upload.cpp - upload firmware images to the OTA server from a host
+ * socket while the clock keeps running.
+ *
+ * Sets an OTA password and, once the system time is valid, uploads a
+ * gzip-compressed stand-in image over HTTP three times:
+ *
+ *	password  a wrong password; must get 403 without touching the flash
+ *	md5	  a wrong MD5; the whole image is written and must get 500
+ *	upload	  a correct upload; must get 200 with the image's MD5 verified
+ *
+ * For each upload it reports the virtual time taken, the longest interval
+ * between two loop() iterations and the longest interval between two frames
+ * sent to the display, which must stay within about one RTC tick. The clock
+ * is set so that the last upload spans a minute change, when the display
+ * runs its anti-poisoning cycle and the flash writes happen in its delays.
+ *
+ * The last upload runs in a forked child, which must restart. The program
+ * then runs again on the same RTC user memory file, where the bootloader's
+ * stand-in must find eboot's command to copy the whole image intact.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/ota.bin --rtc-mem /tmp/ota.rtc --scenario ota -- [options]
+ */
+
+#include <Arduino.h>
+#include <MD5Builder.h>
+#include <OtaServer.h>
+#include <Updater.h>
+#include <eboot_command.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern bool systemTimeValid;
+extern OtaServer otaServer;
+
+namespace {
+
+const char *PASSWORD = "nixietap-sim";
+
+// Local time at the start of the uploads.
+const char *START_TIME = "2024-03-01T11:59:52-05:00";
+
+// Display updates are due on every RTC tick, and may each be held up by two
+// flash sector writes.
+const uint64_t MAX_DISPLAY_INTERVAL_US = 1100000;
+
+struct Options {
+	const char *phase = "upload";	// set for the program run after the restart
+	uint32_t size_kb = 400;
+	uint32_t step_ms = 1;
+	bool verbose = false;
+};
+
+struct Result {
+	int status = 0;
+	std::string body;
+	uint64_t duration_us = 0;
+	uint64_t max_loop_us = 0;
+	uint64_t max_display_us = 0;
+};
+
+Options opts;
+
+// Longest time between two frames latched by the display driver, measured
+// while 'measuring' is set.
+bool measuring = false;
+uint64_t lastFrameUs = 0;
+uint64_t maxFrameIntervalUs = 0;
+
+void frameLatched(const hal::SpiFrame &frame)
+{
+	if (measuring) {
+		maxFrameIntervalUs = max(maxFrameIntervalUs, frame.at_us - lastFrameUs);
+	}
+	lastFrameUs = frame.at_us;
+}
+
+/*
+ * Upload 'image' and run the firmware until the server has closed the
+ * connection, or for at most a minute of virtual time.
+ */
+Result upload(const std::vector<uint8_t> &image, const char *md5, const char *password)
+{
+	Result result;
+	struct sockaddr_in to = {};
+	char header[256];
+
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	to.sin_port = htons(OTA_PORT + hal::options.port_offset);
+
+	// The listening socket completes the connection before it is
+	// accepted, so a blocking connect doesn't need the firmware to run.
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&to, sizeof(to)) != 0) {
+		perror("connect");
+		return result;
+	}
+
+	int n = snprintf(header, sizeof(header),
+			 "PUT /update?md5=%s&password=%s HTTP/1.1\r\n"
+			 "Host: nixietap\r\n"
+			 "Content-Length: %zu\r\n"
+			 "\r\n", md5, password, image.size());
+	std::vector<uint8_t> request(header, header + n);
+	request.insert(request.end(), image.begin(), image.end());
+
+	size_t offset = 0;
+	std::string response;
+	uint64_t start = hal::now_us();
+	bool closed = false;
+
+	measuring = true;
+	maxFrameIntervalUs = 0;
+
+	while (!closed && hal::now_us() - start < 60 * 1000000ULL) {
+		if (offset < request.size()) {
+			ssize_t sent = send(fd, request.data() + offset, request.size() - offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (sent > 0) {
+				offset += sent;
+			}
+		}
+
+		uint64_t before = hal::now_us();
+		hal::step();
+		result.max_loop_us = max(result.max_loop_us, hal::now_us() - before);
+
+		char buf[512];
+		ssize_t got;
+		while ((got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			response.append(buf, got);
+		}
+		closed = got == 0 || (got < 0 && errno != EAGAIN);
+	}
+	result.duration_us = hal::now_us() - start;
+	result.max_display_us = maxFrameIntervalUs;
+	measuring = false;
+	close(fd);
+
+	if (sscanf(response.c_str(), "HTTP/1.1 %d", &result.status) != 1) {
+		result.status = 0;
+	}
+	size_t body = response.find("\r\n\r\n");
+	if (body != std::string::npos) {
+		result.body = response.substr(body + 4);
+		while (!result.body.empty() && result.body.back() == '\n') {
+			result.body.pop_back();
+		}
+	}
+	return result;
+}
+
+void report(const char *phase, const Result &r)
+{
+	double seconds = r.duration_us / 1e6;
+	printf("%-9s status %d (%s), %u bytes written in %.2f s, %.0f KB/s, longest loop() interval %.1f ms, display frame interval %.3f s\n",
+	       phase, r.status, r.body.c_str(), otaServer.received, seconds, seconds > 0 ? otaServer.received / 1024.0 / seconds : 0,
+	       r.max_loop_us / 1e3, r.max_display_us / 1e6);
+}
+
+bool smooth(const Result &r)
+{
+	return r.max_display_us <= MAX_DISPLAY_INTERVAL_US;
+}
+
+const Option OPTIONS[] = {
+	{ "phase", "NAME", NULL, opts.phase },
+	{ "size", "N", "image size in KB", opts.size_kb, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+/*
+ * After the restart, the bootloader must have found its command to copy the
+ * image, which the firmware must have left alone while restarting.
+ */
+int installedPhase()
+{
+	uint32_t size = hal::installed_update_size();
+	printf("Installed an update of %u bytes\n", size);
+	if (size != opts.size_kb * 1024) {
+		error("eboot's command copies %u bytes, expected %u", size, opts.size_kb * 1024);
+	}
+	struct eboot_command ebcmd;
+	if (eboot_command_read(&ebcmd) == 0) {
+		error("eboot's command wasn't cleared");
+	}
+	return errors() == 0 ? 0 : 1;
+}
+
+int otaUpload(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (hal::options.rtc_memory_path == NULL) {
+		fprintf(stderr, "eboot's command is kept in the RTC user memory, which needs --rtc-mem FILE.\n");
+		return 1;
+	}
+	if (strcmp(opts.phase, "installed") == 0) {
+		return installedPhase();
+	}
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	capture_serial(opts.verbose);
+	hal::spi_set_listener(frameLatched);
+
+	char set_password[64];
+	snprintf(set_password, sizeof(set_password), "set ota_password %s", PASSWORD);
+	command(set_password);
+	uint64_t deadline = hal::now_us() + 60 * 1000000ULL;
+	while (!systemTimeValid && hal::now_us() < deadline) {
+		hal::step();
+	}
+	if (!otaServer.running() || !systemTimeValid) {
+		printf("OTA server not running or system time not valid\n");
+		return 1;
+	}
+	char set_time[64];
+	snprintf(set_time, sizeof(set_time), "set time %s", START_TIME);
+	command(set_time);
+
+	// A gzip header followed by incompressible data, as the bootloader
+	// would get it.
+	std::vector<uint8_t> image(opts.size_kb * 1024);
+	srandom(1);
+	for (uint8_t &b : image) {
+		b = random(256);
+	}
+	image[0] = 0x1f;
+	image[1] = 0x8b;
+	image[2] = 0x08;
+
+	MD5Builder md5;
+	char md5_hex[33];
+	md5.begin();
+	for (size_t i = 0; i < image.size(); i += 0x8000) {
+		md5.add(image.data() + i, min(image.size() - i, (size_t)0x8000));
+	}
+	md5.calculate();
+	md5.getChars(md5_hex);
+
+	Result r = upload(image, md5_hex, "wrong");
+	report("password", r);
+	bool ok = r.status == 403 && otaServer.failures == 1 && otaServer.received == 0;
+
+	r = upload(image, "00000000000000000000000000000000", PASSWORD);
+	report("md5", r);
+	ok = ok && r.status == 500 && otaServer.failures == 2 && otaServer.received == image.size() && smooth(r);
+	if (!ok) {
+		return 1;
+	}
+
+	// The firmware restarts once the response has been sent.
+	if (!reset_with("upload", 0, [&] {
+		    Result r = upload(image, md5_hex, PASSWORD);
+		    report("upload", r);
+		    printf("Server: %u updates, %u failures, %u rejected connections\n",
+			   otaServer.updates, otaServer.failures, otaServer.rejected);
+		    fflush(stdout);
+		    if (r.status != 200 || otaServer.updates != 1 || Update.md5String() != md5_hex || !smooth(r)) {
+			    _exit(1);
+		    }
+		    run(10000);
+	    })) {
+		return 1;
+	}
+
+	char size[16];
+	snprintf(size, sizeof(size), "%u", opts.size_kb);
+	const char *args[] = { "--phase", "installed", "--size", size, opts.verbose ? "--verbose" : NULL, NULL };
+	return reboot("ota", args);
+}
+
+hal::ScenarioRegistration registration("ota", "upload firmware images over HTTP while the clock runs", otaUpload);
+
+} // namespace
@@ -0,0 +1,336 @@
+/*
+ * posix_tz.cpp - check POSIX TZ rules against AceTime's zone database.
+ *
+ * First parses rules on the host and checks their offsets at a few times,
+ * including rules crossing the new year, DST all year and the leap day, and
+ * the error offsets of malformed rules. Then, for each zone whose current
+ * rules a POSIX TZ rule describes, probes both daily over a range of years,
+ * bisects each change of AceTime's offset to the second, and compares the
+ * offsets of the seconds around it and the timestamps the formatter renders
+ * for them. It sets a rule over serial and checks the time the firmware
+ * prints, and that an invalid one is rejected. Finally it times offset
+ * lookups for consecutive seconds, as the display does, and for random times,
+ * with both.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/posixtz.bin --scenario posixtz -- [options]
+ */
+
+#include <Arduino.h>
+#include <AceTime.h>
+#include <CivilDate.h>
+#include <PosixTz.h>
+#include <TimestampFormatter.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace ace_time;
+using namespace scenario;
+
+namespace {
+
+struct Options {
+	int from_year = 2000;
+	int to_year = 2040;
+	const char *zone = NULL;
+	uint32_t window_s = 3;
+	uint32_t bench_count = 1000000;
+	bool verbose = false;
+};
+
+struct Stats {
+	uint32_t zones = 0;
+	uint32_t transitions = 0;
+	uint64_t checks = 0;
+	uint64_t mismatches = 0;
+};
+
+// A zone and the rule of its current time, which it has followed since
+// 'since'.
+struct ZoneRule {
+	const char *name;
+	const char *rule;
+	int since;
+};
+
+const ZoneRule ZONES[] = {
+	{ "Etc/UTC", "UTC0", 1970 },
+	{ "America/New_York", "EST5EDT,M3.2.0,M11.1.0", 2007 },
+	{ "America/Denver", "MST7MDT,M3.2.0,M11.1.0", 2007 },
+	{ "America/Los_Angeles", "PST8PDT,M3.2.0,M11.1.0", 2007 },
+	{ "Europe/Amsterdam", "CET-1CEST,M3.5.0,M10.5.0/3", 1996 },
+	{ "Europe/London", "GMT0BST,M3.5.0/1,M10.5.0", 1996 },
+	{ "Australia/Sydney", "AEST-10AEDT,M10.1.0,M4.1.0/3", 2008 },
+	{ "Australia/Lord_Howe", "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0", 2008 },
+	{ "Asia/Tokyo", "JST-9", 1952 },
+	{ "Asia/Kolkata", "IST-5:30", 1946 },
+};
+
+Options opts;
+Stats stats;
+
+ExtendedZoneProcessorCache<1> zoneProcessorCache;
+ExtendedZoneManager zoneManager(
+	zonedbx::kZoneAndLinkRegistrySize,
+	zonedbx::kZoneAndLinkRegistry,
+	zoneProcessorCache);
+
+const uint8_t MAX_REPORTED_MISMATCHES = 20;
+
+void checkOffset(const char *rule, const char *utc, int32_t expected, const char *name)
+{
+	PosixTimeZone tz;
+	if (!tz.parse(rule)) {
+		error("'%s' failed to parse: %s at offset %u", rule, tz.error(), tz.errorOffset());
+		return;
+	}
+	int year, month, day, hour, minute, second;
+	sscanf(utc, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
+	int64_t t = civil::toUnix(year, month, day, hour, minute, second);
+	if (tz.offsetAt(t) != expected || strcmp(tz.nameAt(t), name) != 0) {
+		error("'%s' at %s is %ld s %s, expected %ld s %s", rule, utc, (long)tz.offsetAt(t), tz.nameAt(t),
+		      (long)expected, name);
+	}
+}
+
+void checkError(const char *rule, uint8_t offset)
+{
+	PosixTimeZone tz;
+	tz.parse("JST-9");
+	if (tz.parse(rule)) {
+		error("'%s' parsed", rule);
+	} else if (tz.errorOffset() != offset) {
+		error("'%s' failed at offset %u (%s), expected %u", rule, tz.errorOffset(), tz.error(), offset);
+	} else if (tz.offsetAt(0) != 9 * 3600) {
+		error("'%s' changed the zone parsed before", rule);
+	}
+}
+
+void parserChecks()
+{
+	checkOffset("UTC0", "2024-07-01T00:00:00", 0, "UTC");
+	checkOffset("<-03>3", "2024-07-01T00:00:00", -3 * 3600, "-03");
+	checkOffset("IST-5:30", "2024-07-01T00:00:00", 19800, "IST");
+	// Without a rule, the US rules.
+	checkOffset("EST5EDT", "2024-03-10T06:59:59", -5 * 3600, "EST");
+	checkOffset("EST5EDT", "2024-03-10T07:00:00", -4 * 3600, "EDT");
+	checkOffset("CET-1CEST,M3.5.0,M10.5.0/3", "2024-03-31T00:59:59", 3600, "CET");
+	checkOffset("CET-1CEST,M3.5.0,M10.5.0/3", "2024-03-31T01:00:00", 7200, "CEST");
+	checkOffset("CET-1CEST,M3.5.0,M10.5.0/3", "2024-10-27T00:59:59", 7200, "CEST");
+	checkOffset("CET-1CEST,M3.5.0,M10.5.0/3", "2024-10-27T01:00:00", 3600, "CET");
+	// Southern hemisphere: DST across the new year.
+	checkOffset("AEST-10AEDT,M10.1.0,M4.1.0/3", "2024-01-01T00:00:00", 11 * 3600, "AEDT");
+	checkOffset("AEST-10AEDT,M10.1.0,M4.1.0/3", "2024-07-01T00:00:00", 10 * 3600, "AEST");
+	checkOffset("AEST-10AEDT,M10.1.0,M4.1.0/3", "2024-12-31T23:59:59", 11 * 3600, "AEDT");
+	// DST all year.
+	checkOffset("EST5EDT,0/0,J365/25", "2024-01-01T05:00:00", -4 * 3600, "EDT");
+	checkOffset("EST5EDT,0/0,J365/25", "2024-12-31T23:00:00", -4 * 3600, "EDT");
+	// Jn skips February 29, n doesn't.
+	checkOffset("XXX0YYY,J60/0,J61/0", "2024-03-01T00:00:00", 3600, "YYY");
+	checkOffset("XXX0YYY,59/0,60/0", "2024-02-29T00:00:00", 3600, "YYY");
+	checkOffset("XXX0YYY,59/0,60/0", "2024-03-01T00:00:00", 0, "XXX");
+	// Negative and extended transition times (RFC 8536).
+	checkOffset("<-02>2<-01>,M3.5.0/-1,M10.5.0/0", "2024-03-30T23:59:59", -7200, "-02");
+	checkOffset("<-02>2<-01>,M3.5.0/-1,M10.5.0/0", "2024-03-31T01:00:00", -3600, "-01");
+	checkOffset("XXX0YYY,M3.1.0/167,M10.1.0", "2024-03-09T22:59:59", 0, "XXX");
+	checkOffset("XXX0YYY,M3.1.0/167,M10.1.0", "2024-03-09T23:00:00", 3600, "YYY");
+
+	checkError("", 0);
+	checkError("Europe/Amsterdam", 6);
+	checkError("CE1", 0);
+	checkError("CET", 3);
+	checkError("CET25", 3);
+	checkError("CET-1CEST,M3.5.0", 16);
+	checkError("CET-1CEST,M13.5.0,M10.5.0/3", 11);
+	checkError("CET-1CEST,M3.6.0,M10.5.0/3", 13);
+	checkError("CET-1CEST,M3.5.0,M10.5.0/168", 25);
+	checkError("CET-1CEST,J0,J365", 11);
+	checkError("<+0530-5:30", 8);
+	checkError("LONGNAME0", 0);
+	checkError("CET-1CEST,M3.5.0,M10.5.0/3x", 26);
+	printf("Parser checks: %u errors\n", errors());
+}
+
+void mismatch(const ZoneRule &z, const char *what, int64_t t, const char *expected, const char *shown)
+{
+	stats.mismatches++;
+	if (stats.mismatches <= MAX_REPORTED_MISMATCHES) {
+		printf("MISMATCH %s %s at %lld: expected %s, POSIX %s\n", z.name, what, (long long)t, expected, shown);
+	}
+}
+
+/*
+ * Compare the offset at 't', and the timestamp rendered for it up to the zone
+ * name, which is the abbreviation for a rule.
+ */
+void check(const ZoneRule &z, int64_t t, const TimeZone &tz, const PosixTimeZone &posix, TimestampFormatter &f)
+{
+	int32_t expected = offset_at(t, tz);
+	int32_t offset = posix.offsetAt(t);
+	stats.checks++;
+	if (offset != expected) {
+		char e[16], s[16];
+		snprintf(e, sizeof(e), "%ld", (long)expected);
+		snprintf(s, sizeof(s), "%ld", (long)offset);
+		mismatch(z, "offset", t, e, s);
+		return;
+	}
+
+	ace_common::PrintStr<TIMESTAMP_SIZE> timestamp;
+	ZonedDateTime::forUnixSeconds64(t, tz).printTo(timestamp);
+	const char *shown = f.format(t, posix);
+	const char *bracket = strchr(timestamp.cstr(), '[');
+	size_t n = bracket != NULL ? bracket - timestamp.cstr() : timestamp.length();
+	if (strncmp(shown, timestamp.cstr(), n) != 0 || shown[n] != '[') {
+		mismatch(z, "timestamp", t, timestamp.cstr(), shown);
+	}
+}
+
+void checkZone(const ZoneRule &z)
+{
+	static const int64_t DAY = 86400;
+
+	if (opts.zone != NULL && strstr(z.name, opts.zone) == NULL) {
+		return;
+	}
+	TimeZone tz = zoneManager.createForZoneName(z.name);
+	PosixTimeZone posix;
+	TimestampFormatter f;
+	if (tz.isError() || !posix.parse(z.rule)) {
+		error("%s or %s failed to load", z.name, z.rule);
+		return;
+	}
+	stats.zones++;
+
+	int64_t from = year_start(max(opts.from_year, z.since));
+	int64_t to = year_start(opts.to_year + 1);
+	uint32_t transitions = 0;
+	int32_t offset = offset_at(from, tz);
+	for (int64_t t = from; t < to; t += DAY) {
+		check(z, t, tz, posix, f);
+		int32_t next = offset_at(t, tz);
+		if (next == offset) {
+			continue;
+		}
+		int64_t at = find_transition(t - DAY, t, tz);
+		for (int64_t s = at - opts.window_s; s < at + (int64_t)opts.window_s; s++) {
+			check(z, s, tz, posix, f);
+		}
+		offset = next;
+		transitions++;
+	}
+	stats.transitions += transitions;
+
+	if (opts.verbose) {
+		printf("%s, %s: %u transitions, %u lookups cached, %u computed\n", z.name, z.rule, transitions,
+		       posix.hits, posix.misses);
+	}
+}
+
+void firmwareChecks()
+{
+	uint32_t before = errors();
+
+	command("set ntp_enabled 0");
+	command("set time 2024-07-01T12:00:00+00:00");
+	run(1100);
+	expect_output("set time_zone CET-1CEST,M3.5.0,M10.5.0/3", 1100, "Loaded POSIX TZ rule");
+	expect_output("time", 1100, "+02:00[CEST]");
+	expect_output("set time_zone Europe/Foo", 100, "not a POSIX TZ rule: expected a number at offset 6");
+	expect_output("time", 1100, "+02:00[CEST]");
+	expect_output("set time_zone <+1030>-10:30<+11>-11,M10.1.0,M4.1.0", 100, "Loaded POSIX TZ rule");
+	expect_output("time", 1100, "+10:30[+1030]");
+	expect_output("set time_zone Europe/Amsterdam", 100, "Loaded time zone: Europe/Amsterdam");
+	expect_output("time", 1100, "+02:00[Europe/Amsterdam]");
+	printf("Firmware: %u errors\n", errors() - before);
+}
+
+/*
+ * Time lookups in one zone, for consecutive seconds and random times, with
+ * AceTime and the rule. Returns false if the offsets differ.
+ */
+bool bench(const ZoneRule &z)
+{
+	int64_t from = year_start(max(opts.from_year, z.since));
+	int64_t to = year_start(opts.to_year + 1);
+	TimeZone tz = zoneManager.createForZoneName(z.name);
+	PosixTimeZone posix;
+	posix.parse(z.rule);
+
+	std::vector<int64_t> random_times;
+	random_times.reserve(opts.bench_count);
+	for (uint32_t i = 0; i < opts.bench_count; i++) {
+		random_times.push_back(from + random() % (to - from));
+	}
+
+	bool same = true;
+	for (int pass = 0; pass < 2; pass++) {
+		auto time = [&](int i) { return pass == 0 ? from + i : random_times[i]; };
+		int64_t acetime_sum = 0, posix_sum = 0;
+
+		auto t0 = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < opts.bench_count; i++) {
+			acetime_sum += offset_at(time(i), tz);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		uint32_t hits = posix.hits, misses = posix.misses;
+		for (uint32_t i = 0; i < opts.bench_count; i++) {
+			posix_sum += posix.offsetAt(time(i));
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		double acetime_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / opts.bench_count;
+		double posix_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / opts.bench_count;
+		printf("%s lookups in %s, %u times: AceTime %.1f ns, POSIX rule %.1f ns per lookup (%.1fx); "
+		       "%u cached, %u computed; offsets %s\n",
+		       pass == 0 ? "Consecutive" : "Random", z.name, opts.bench_count, acetime_ns, posix_ns,
+		       acetime_ns / posix_ns, posix.hits - hits, posix.misses - misses,
+		       acetime_sum == posix_sum ? "identical" : "DIFFERENT");
+		same = same && acetime_sum == posix_sum;
+	}
+	return same;
+}
+
+const Option OPTIONS[] = {
+	{ "from", "YEAR", "first year to check", opts.from_year },
+	{ "to", "YEAR", "last year to check", opts.to_year },
+	{ "zone", "TEXT", "only check zones whose name contains TEXT", opts.zone },
+	{ "window", "N", "seconds checked before and after each transition", opts.window_s, 1 },
+	{ "bench-count", "N", "lookups in each timing run", opts.bench_count, 1 },
+	{ "verbose", "print the transitions in each zone and the serial output", opts.verbose },
+};
+
+int posixTz(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (opts.to_year < opts.from_year) {
+		usage(argv[0], OPTIONS);
+		return 1;
+	}
+
+	parserChecks();
+
+	for (const ZoneRule &z : ZONES) {
+		checkZone(z);
+	}
+	printf("Zones: %u, transitions: %u, offsets checked: %llu, mismatches: %llu\n", stats.zones,
+	       stats.transitions, (unsigned long long)stats.checks, (unsigned long long)stats.mismatches);
+
+	hal::options.speed = 0;
+	capture_serial(opts.verbose);
+	firmwareChecks();
+
+	srandom(1);
+	bool same = bench(ZONES[1]);
+	return errors() == 0 && stats.mismatches == 0 && same ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("posixtz", "check POSIX TZ rules against AceTime and time their lookups", posixTz);
+
+} // namespace
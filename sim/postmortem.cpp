@@ -0,0 +1,248 @@
+/*
+ * postmortem.cpp - check the loop watchdog and the post-mortem kept across
+ * resets.
+ *
+ * Sets a loop budget over serial, stalls one loop() iteration past it with
+ * 'watchdog stall' and checks the warning and the counters. Then, in a
+ * forked child, stalls the main loop past the soft watchdog, which resets
+ * the simulated chip, and runs the program again on the same RTC user memory
+ * file. After this reset 'postmortem' must show the soft watchdog reset in
+ * the serial stage, the overrun and the last trace events, ending in the
+ * stage executing. The same is done for a 'restart'.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/pm.bin --rtc-mem /tmp/pm.rtc --scenario postmortem -- [options]
+ */
+
+#include <Arduino.h>
+#include <Trace.h>
+#include <limits.h>
+#include <string>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+extern bool systemTimeValid;
+
+namespace {
+
+enum Phase {
+	PHASE_STALL,		// before any reset
+	PHASE_AFTER_CRASH,
+	PHASE_AFTER_RESTART,
+};
+
+struct Options {
+	const char *phase = "stall";	// set for the program run after a reset
+	uint32_t budget_ms = 50;
+	uint32_t stall_ms = 200;
+	bool verbose = false;
+};
+
+const char *const PHASE_NAMES[] = { "stall", "crash", "restart" };
+
+// Set in each phase, so that no minute change runs the anti-poisoning
+// animation, which blocks the loop past the budget, during the checks.
+const char *START_TIME = "2024-03-01T12:00:05-05:00";
+
+Options opts;
+
+void commandOutput(const char *cmd, uint32_t ms)
+{
+	serial_text().clear();
+	command(cmd);
+	run(ms);
+}
+
+// Run the program again as the chip would boot after a reset, continuing
+// with 'phase'.
+int reboot(Phase phase)
+{
+	char budget[16], stall[16];
+	snprintf(budget, sizeof(budget), "%u", opts.budget_ms);
+	snprintf(stall, sizeof(stall), "%u", opts.stall_ms);
+	const char *args[] = {
+		"--phase", PHASE_NAMES[phase], "--budget", budget, "--stall", stall,
+		opts.verbose ? "--verbose" : NULL, NULL,
+	};
+	return scenario::reboot("postmortem", args);
+}
+
+/*
+ * Send 'cmd' in a child process, which must reset with 'status', and boot
+ * again into 'next'.
+ */
+int resetWith(const char *cmd, int status, Phase next)
+{
+	if (!reset_with(cmd, status, [cmd] {
+		    command(cmd);
+		    run(1000);
+	    })) {
+		return 1;
+	}
+	printf("'%s' reset the chip\n", cmd);
+	return reboot(next);
+}
+
+/*
+ * The trace events of a post-mortem must count down to the save, end in the
+ * stage executing and hold the overrun of the stalled iteration.
+ */
+void checkEvents(const char *last_stage)
+{
+	static const char PREFIX[] = "[Postmortem] ";
+	size_t pos = 0;
+	uint32_t events = 0, overruns = 0;
+	long prev_ms = LONG_MAX;
+	char last[32] = "";
+
+	// Scanned in place, so that no allocation is counted against loop().
+	const std::string &text = serial_text();
+	while ((pos = text.find(PREFIX, pos)) != std::string::npos) {
+		// The prefix is followed by ' ', or '<' for a bound.
+		const char *l = text.c_str() + pos + strlen(PREFIX) + 1;
+		pos++;
+
+		long ms;
+		char name[32];
+		unsigned arg;
+		if (sscanf(l, "-%ld %31s 0x%x", &ms, name, &arg) != 3) {
+			continue;
+		}
+		events++;
+		if (ms > prev_ms) {
+			error("event %u at -%ld ms after one at -%ld ms", events, ms, prev_ms);
+		}
+		prev_ms = ms;
+		strcpy(last, name);
+		if (strcmp(name, "loop_overrun") == 0 && arg >> 12 == 3 && (arg & 0xfff) >= opts.stall_ms) {
+			overruns++;
+		}
+	}
+
+	if (events == 0 || strcmp(last, last_stage) != 0) {
+		error("%u events, the last '%s', expected '%s'", events, last, last_stage);
+	}
+	if (overruns != 1) {
+		error("%u overruns of %u ms in the serial stage, expected 1", overruns, opts.stall_ms);
+	}
+	printf("Post-mortem: %u trace events, %u overrun\n", events, overruns);
+}
+
+int stallPhase()
+{
+	char cmd[64], warning[128];
+
+	// Past the blocking transitions of the display at boot.
+	command("set ntp_enabled 0");
+	run(2000);
+	snprintf(cmd, sizeof(cmd), "set loop_budget_ms %u", opts.budget_ms);
+	command(cmd);
+	run(2000);
+
+	commandOutput("watchdog", 100);
+	expect("watchdog", " 0 over the budget.");
+
+	snprintf(cmd, sizeof(cmd), "watchdog stall %u", opts.stall_ms);
+	commandOutput(cmd, 100);
+	snprintf(warning, sizeof(warning), "WARNING! 1 loop iteration(s) over the budget of %u ms", opts.budget_ms);
+	expect(cmd, warning);
+	expect(cmd, "ms in the serial stage.");
+
+	commandOutput("watchdog", 100);
+	expect("watchdog", " 1 over the budget, the longest");
+	expect("watchdog", "serial 1 ");
+	run(1000);
+
+	printf("Before the reset: %u errors\n", errors());
+	if (errors() > 0) {
+		return 1;
+	}
+	// Record the loop stages up to the stall, past the soft watchdog. The
+	// post-mortem holds too few records for more than a few iterations.
+	command("trace loop");
+	return resetWith("watchdog stall 5000", EXIT_RESET, PHASE_AFTER_CRASH);
+}
+
+int afterCrashPhase()
+{
+	commandOutput("postmortem", 100);
+	expect("postmortem", "at a soft watchdog reset, ");
+	expect("postmortem", " ms into the serial stage.");
+	expect("postmortem", " 1 over the budget, the longest ");
+	expect("postmortem", "mostly in the serial stage.");
+	expect("postmortem", " trace events, in milliseconds before the save:");
+	checkEvents("serial");
+
+	// Kept until the next reset.
+	commandOutput("postmortem", 100);
+	expect("postmortem", "at a soft watchdog reset, ");
+
+	printf("After the soft watchdog reset: %u errors\n", errors());
+	if (errors() > 0) {
+		return 1;
+	}
+	return resetWith("restart", 0, PHASE_AFTER_RESTART);
+}
+
+int afterRestartPhase()
+{
+	commandOutput("postmortem", 100);
+	expect("postmortem", "at a restart, 0 ms into the serial stage.");
+	expect("postmortem", " 0 over the budget.");
+	printf("After the restart: %u errors\n", errors());
+	return errors() == 0 ? 0 : 1;
+}
+
+const Option OPTIONS[] = {
+	{ "phase", "NAME", NULL, opts.phase },
+	{ "budget", "MS", "loop budget to set", opts.budget_ms },
+	{ "stall", "MS", "length of the stalled iteration", opts.stall_ms },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int postmortem(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	uint8_t phase = 0;
+	while (phase < sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) && strcmp(opts.phase, PHASE_NAMES[phase]) != 0) {
+		phase++;
+	}
+	if (hal::options.rtc_memory_path == NULL) {
+		fprintf(stderr, "The post-mortem is kept in the RTC user memory, which needs --rtc-mem FILE.\n");
+		return 1;
+	}
+	// The stall must be over the budget and short of the soft watchdog.
+	if (phase == sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) || opts.stall_ms <= opts.budget_ms ||
+	    opts.stall_ms * 1000 >= SOFT_WDT_US) {
+		usage(argv[0], OPTIONS);
+		return 1;
+	}
+
+	hal::options.speed = 0;
+	capture_serial(opts.verbose);
+	while (!systemTimeValid) {
+		hal::step();
+	}
+	char set_time[64];
+	snprintf(set_time, sizeof(set_time), "set time %s", START_TIME);
+	command(set_time);
+
+	switch (phase) {
+	case PHASE_AFTER_CRASH:
+		return afterCrashPhase();
+	case PHASE_AFTER_RESTART:
+		return afterRestartPhase();
+	default:
+		return stallPhase();
+	}
+}
+
+hal::ScenarioRegistration registration("postmortem", "check the loop watchdog and the post-mortem kept across resets",
+				       postmortem);
+
+} // namespace
@@ -0,0 +1,187 @@
+/*
+ * radio_duty.cpp - compare the Wi-Fi radio-on time with and without
+ * wifi_sleep_enabled.
+ *
+ * Connects to the simulated access point and runs the firmware for a number
+ * of virtual hours twice: first with the radio always on, then with
+ * wifi_sleep_enabled, when the radio is only on around each NTP sync. For
+ * each phase it reports the radio-on percentage, the number of NTP syncs and
+ * the longest time between two of them. With the radio duty cycled, the syncs
+ * must still happen every ntp_sync_interval, the radio must be on for less
+ * than 1% of the time, and turning it off must not be logged as a
+ * disconnection, an NTP error or a steady-state allocation.
+ *
+ * The DHCP leases are shorter than a phase, so that the radio wakes with the
+ * cached lease due for renewal several times. Those wakes must use DHCP, in
+ * time for the sync, and the address of an expired lease must never be used.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/radio.bin --scenario radio -- [options]
+ */
+
+#include <Arduino.h>
+#include <NtpClientLib.h>
+#include <string>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern bool systemTimeValid;
+extern uint32_t cfg_ntp_sync_interval;
+uint64_t radioOnMs();
+
+namespace {
+
+// The radio is turned on shortly before a sync is due, and the sync follows
+// a fast reconnect.
+const uint32_t MAX_SYNC_LATENESS_S = 2;
+const double MAX_RADIO_ON_PERCENT = 1.0;
+
+struct Options {
+	uint32_t hours = 12;
+	uint32_t lease_s = 4 * 3600;
+	uint32_t step_ms = 10;
+	bool verbose = false;
+};
+
+struct Result {
+	double radio_on_percent = 0;
+	uint32_t syncs = 0;
+	uint32_t max_sync_interval_s = 0;
+	uint32_t disconnects = 0;	// lines logged during the phase
+	uint32_t ntp_errors = 0;
+	uint32_t heap_warnings = 0;
+	uint32_t renewals = 0;		// reconnects with DHCP for a lease due for renewal
+	uint32_t expired_leases = 0;
+};
+
+Options opts;
+
+// Counts of serial output lines, scanned as they are printed.
+uint32_t disconnectLines = 0;
+uint32_t ntpErrorLines = 0;
+uint32_t heapWarningLines = 0;
+uint32_t renewalLines = 0;
+
+void countLine(const std::string &line)
+{
+	if (line.find("[Wi-Fi] Station disconnected") != std::string::npos) {
+		disconnectLines++;
+	} else if (line.find("[NTP] Time sync error") != std::string::npos) {
+		ntpErrorLines++;
+	} else if (line.find("[Heap] WARNING") != std::string::npos) {
+		heapWarningLines++;
+	} else if (line.find("[Wi-Fi] The cached IP address is due for renewal") != std::string::npos) {
+		renewalLines++;
+	}
+}
+
+/*
+ * Run the firmware for the given number of virtual hours, following the NTP
+ * syncs and the radio-on time.
+ */
+Result runPhase(uint32_t hours)
+{
+	Result result;
+	uint64_t start = hal::now_us();
+	uint64_t end = start + hours * 3600 * 1000000ULL;
+	uint64_t radio_start = radioOnMs();
+	uint32_t disconnects = disconnectLines;
+	uint32_t ntp_errors = ntpErrorLines;
+	uint32_t heap_warnings = heapWarningLines;
+	uint32_t renewals = renewalLines;
+	uint32_t expired_leases = hal::wifi_expired_lease_uses();
+	time_t last_sync = NTP.getLastNTPSync();
+
+	while (hal::now_us() < end) {
+		hal::step();
+		time_t sync = NTP.getLastNTPSync();
+		if (sync != last_sync) {
+			result.syncs++;
+			result.max_sync_interval_s = max(result.max_sync_interval_s, (uint32_t)(sync - last_sync));
+			last_sync = sync;
+		}
+	}
+	// The time since the last sync counts too, unless one is still due.
+	result.max_sync_interval_s = max(result.max_sync_interval_s,
+					 min((uint32_t)(hal::wall_time() - last_sync), cfg_ntp_sync_interval));
+
+	double elapsed_ms = (hal::now_us() - start) / 1e3;
+	result.radio_on_percent = 100.0 * (radioOnMs() - radio_start) / elapsed_ms;
+	result.disconnects = disconnectLines - disconnects;
+	result.ntp_errors = ntpErrorLines - ntp_errors;
+	result.heap_warnings = heapWarningLines - heap_warnings;
+	result.renewals = renewalLines - renewals;
+	result.expired_leases = hal::wifi_expired_lease_uses() - expired_leases;
+	return result;
+}
+
+void report(const char *phase, const Result &r)
+{
+	printf("%-10s radio on %7.3f%%, %u NTP syncs, longest interval %u s, %u disconnections, %u NTP errors, %u heap warnings, %u lease renewals, %u expired leases used\n",
+	       phase, r.radio_on_percent, r.syncs, r.max_sync_interval_s, r.disconnects, r.ntp_errors, r.heap_warnings,
+	       r.renewals, r.expired_leases);
+}
+
+const Option OPTIONS[] = {
+	{ "hours", "N", "virtual hours per phase", opts.hours, 1 },
+	{ "lease", "S", "DHCP lease time in seconds", opts.lease_s, 60 },
+	{ "step-ms", "N", "virtual time per loop() iteration", opts.step_ms, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int radioDuty(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	hal::options.dhcp_lease_s = opts.lease_s;
+	capture_serial(opts.verbose, 0, countLine);
+
+	command("set ssid nixietap-sim");
+	command("set password nixietap-sim");
+	command("set ntp_enabled 1");
+	command("set wifi_sleep_enabled 0");
+	uint64_t deadline = hal::now_us() + 120 * 1000000ULL;
+	while (!(systemTimeValid && NTP.getLastNTPSync() != 0) && hal::now_us() < deadline) {
+		hal::step();
+	}
+	if (NTP.getLastNTPSync() == 0) {
+		printf("No NTP sync\n");
+		return 1;
+	}
+
+	// At least this many syncs are due in each phase.
+	uint32_t expected = opts.hours * 3600 / cfg_ntp_sync_interval;
+
+	Result on = runPhase(opts.hours);
+	report("always-on", on);
+	bool ok = on.syncs >= expected && on.expired_leases == 0;
+
+	command("set wifi_sleep_enabled 1");
+	Result sleep = runPhase(opts.hours);
+	report("sleep", sleep);
+	ok = ok && sleep.syncs >= expected &&
+	     sleep.max_sync_interval_s <= cfg_ntp_sync_interval + MAX_SYNC_LATENESS_S &&
+	     sleep.radio_on_percent < MAX_RADIO_ON_PERCENT &&
+	     sleep.disconnects == 0 && sleep.ntp_errors == 0 && sleep.heap_warnings == 0 &&
+	     sleep.expired_leases == 0;
+	// Half way through each lease the cached address is due for renewal.
+	if (opts.lease_s / 2 < opts.hours * 3600) {
+		ok = ok && sleep.renewals > 0;
+	}
+
+	command("set wifi_sleep_enabled 0");
+	command("wifi");
+	return ok ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("radio", "compare the Wi-Fi radio-on time with and without wifi_sleep_enabled", radioDuty);
+
+} // namespace
@@ -0,0 +1,349 @@
+/*
+ * sntp_load.cpp - exercise the SNTP server with requests from host sockets.
+ *
+ * Enables the server, lets the native NTP stand-in synchronize the clock and
+ * then sends SNTP requests from UDP sockets bound to different loopback
+ * addresses, so each one is a separate client to the server's rate limiter.
+ * Every reply is checked: mode, version, stratum and leap indicator, the
+ * echoed originate timestamp, and receive and transmit timestamps against
+ * the virtual wall clock. The run has three phases:
+ *
+ *	load	  requests spread over many clients, within all limits; every
+ *		  request must be answered
+ *	burst	  one client exceeding its burst; the excess must get RATE
+ *		  kiss-o'-death replies
+ *	overload  more requests than the global limit; the excess must be
+ *		  dropped
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/sntp.bin --scenario sntp -- [options]
+ */
+
+#include <Arduino.h>
+#include <SntpServer.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern bool systemTimeValid;
+extern SntpServer sntpServer;
+
+namespace {
+
+const uint32_t NTP_UNIX_OFFSET = 2208988800UL;
+
+struct Options {
+	uint32_t clients = 100;
+	uint32_t rate = 50;
+	uint32_t seconds = 10;
+	uint32_t step_ms = 1;
+	bool verbose = false;
+};
+
+struct Client {
+	int fd;
+	uint32_t sent = 0;
+	// Transmit timestamps of the requests in flight, oldest first.
+	std::vector<uint64_t> pending;
+	std::vector<uint64_t> sent_host_us;
+};
+
+struct Stats {
+	uint32_t sent = 0;
+	uint32_t replies = 0;
+	uint32_t kisses = 0;
+	uint32_t errors = 0;	// scenario::error() calls during the phase
+	uint64_t rtt_total_us = 0;
+	uint64_t rtt_max_us = 0;
+};
+
+Options opts;
+std::vector<Client> clients;
+uint64_t requestCounter = 0;
+
+uint64_t hostMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+uint64_t get64(const uint8_t *p)
+{
+	return (uint64_t)get32(p) << 32 | get32(p + 4);
+}
+
+void put64(uint8_t *p, uint64_t v)
+{
+	for (int8_t i = 7; i >= 0; i--) {
+		p[i] = v;
+		v >>= 8;
+	}
+}
+
+// NTP timestamp as Unix seconds.
+double unixTime(uint64_t ts)
+{
+	return (double)(ts >> 32) - NTP_UNIX_OFFSET + (double)(ts & 0xffffffff) / 4294967296.0;
+}
+
+bool openClients(uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		struct sockaddr_in addr = {};
+		Client c;
+
+		c.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		addr.sin_family = AF_INET;
+		// 127.0.1.x upwards; all of 127/8 is local on Linux.
+		addr.sin_addr.s_addr = htonl(0x7f000100 + i);
+		if (c.fd < 0 || bind(c.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			perror("client socket");
+			return false;
+		}
+		clients.push_back(c);
+	}
+	return true;
+}
+
+void send(uint32_t index)
+{
+	Client &c = clients[index];
+	struct sockaddr_in to = {};
+	uint8_t pkt[48] = {};
+
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	to.sin_port = htons(SNTP_PORT + hal::options.port_offset);
+
+	// Version 4, client mode. The transmit timestamp only has to be
+	// unique, the server echoes it back.
+	pkt[0] = 4 << 3 | 3;
+	uint64_t tx = ++requestCounter;
+	put64(pkt + 40, tx);
+
+	sendto(c.fd, pkt, sizeof(pkt), 0, (struct sockaddr *)&to, sizeof(to));
+	c.pending.push_back(tx);
+	c.sent_host_us.push_back(hostMicros());
+	c.sent++;
+}
+
+/*
+ * Read and check every reply that has arrived. 'last_tx' is the latest
+ * server transmit timestamp seen, which must never go backwards.
+ */
+void receive(Stats &stats, const char *phase, uint64_t &last_tx)
+{
+	// The server answers in the order the requests were sent, but the
+	// clients are read one after the other, so the order is restored by
+	// the request number before checking the transmit timestamps.
+	std::vector<std::pair<uint64_t, uint64_t>> served;
+
+	for (uint32_t i = 0; i < clients.size(); i++) {
+		Client &c = clients[i];
+		uint8_t pkt[64];
+		ssize_t n;
+
+		while ((n = recv(c.fd, pkt, sizeof(pkt), 0)) >= 0) {
+			if (n != 48) {
+				error("%s client %u: reply of %zd bytes", phase, i, n);
+				continue;
+			}
+			// Requests before this one were dropped by the server.
+			uint64_t origin = get64(pkt + 24);
+			while (!c.pending.empty() && c.pending.front() != origin) {
+				c.pending.erase(c.pending.begin());
+				c.sent_host_us.erase(c.sent_host_us.begin());
+			}
+			if (c.pending.empty()) {
+				error("%s client %u: unexpected originate timestamp %llu", phase, i, (unsigned long long)origin);
+				continue;
+			}
+			uint64_t rtt = hostMicros() - c.sent_host_us.front();
+			c.pending.erase(c.pending.begin());
+			c.sent_host_us.erase(c.sent_host_us.begin());
+			stats.rtt_total_us += rtt;
+			stats.rtt_max_us = max(stats.rtt_max_us, rtt);
+
+			uint8_t li = pkt[0] >> 6;
+			uint8_t version = (pkt[0] >> 3) & 0x07;
+			uint8_t mode = pkt[0] & 0x07;
+			if (version != 4 || mode != 4) {
+				error("%s client %u: version %u, mode %u", phase, i, version, mode);
+				continue;
+			}
+			if (pkt[1] == 0) {
+				if (memcmp(pkt + 12, "RATE", 4) != 0) {
+					error("%s client %u: kiss-o'-death without RATE code", phase, i);
+				}
+				stats.kisses++;
+				continue;
+			}
+			if (li != 0 || pkt[1] != 2) {
+				error("%s client %u: leap indicator %u, stratum %u", phase, i, li, pkt[1]);
+			}
+
+			uint64_t rx = get64(pkt + 32);
+			uint64_t tx = get64(pkt + 40);
+			double wall = hal::wall_time();
+			if (rx > tx) {
+				error("%s client %u: receive timestamp after transmit timestamp", phase, i);
+			}
+			served.push_back(std::make_pair(origin, tx));
+			// The upstream time has a resolution of one second.
+			if (fabs(unixTime(tx) - wall) > 1.5) {
+				error("%s client %u: served %.3f, wall clock %.0f", phase, i, unixTime(tx), wall);
+			}
+			stats.replies++;
+		}
+	}
+
+	std::sort(served.begin(), served.end());
+	for (auto &s : served) {
+		if (s.second < last_tx) {
+			error("%s: transmit timestamp of request %llu went back %.6f s", phase, (unsigned long long)s.first,
+			      unixTime(last_tx) - unixTime(s.second));
+		}
+		last_tx = max(last_tx, s.second);
+	}
+}
+
+/*
+ * Send 'count' requests, spread evenly over 'seconds' of virtual time and
+ * round robin over the first 'nclients' clients, then run until every reply
+ * has had time to arrive.
+ */
+Stats runPhase(const char *phase, uint32_t nclients, uint32_t count, uint32_t seconds, uint64_t &last_tx)
+{
+	Stats stats;
+	uint32_t errors_before = errors();
+	uint64_t start = hal::now_us();
+	uint64_t duration = (uint64_t)seconds * 1000000;
+	uint32_t next = 0;
+
+	while (stats.sent < count) {
+		uint64_t elapsed = hal::now_us() - start;
+		while (stats.sent < count && elapsed >= duration * stats.sent / count) {
+			send(next);
+			next = (next + 1) % nclients;
+			stats.sent++;
+		}
+		hal::step();
+		receive(stats, phase, last_tx);
+	}
+	for (uint16_t i = 0; i < 100; i++) {
+		hal::step();
+		receive(stats, phase, last_tx);
+	}
+
+	for (Client &c : clients) {
+		c.pending.clear();
+		c.sent_host_us.clear();
+	}
+	stats.errors = errors() - errors_before;
+	return stats;
+}
+
+void report(const char *phase, const Stats &stats, uint32_t dropped)
+{
+	printf("%-9s sent %5u, answered %5u, rate limited %4u, dropped %4u, errors %u, round trip avg %llu us, max %llu us\n",
+	       phase, stats.sent, stats.replies, stats.kisses, dropped, stats.errors,
+	       (unsigned long long)(stats.replies + stats.kisses > 0 ? stats.rtt_total_us / (stats.replies + stats.kisses) : 0),
+	       (unsigned long long)stats.rtt_max_us);
+}
+
+const Option OPTIONS[] = {
+	{ "clients", "N", "number of client addresses", opts.clients, 1 },
+	{ "rate", "N", "requests per virtual second in the load phase", opts.rate, 1 },
+	{ "seconds", "N", "length of the load phase in virtual seconds", opts.seconds, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int sntpLoad(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (!openClients(opts.clients)) {
+		return 1;
+	}
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	capture_serial(opts.verbose);
+
+	command("set ssid nixietap-sim");
+	command("set password nixietap-sim");
+	command("set ntp_enabled 1");
+	command("set sntp_server_enabled 1");
+	uint64_t deadline = hal::now_us() + 120 * 1000000ULL;
+	while (!(systemTimeValid && sntpServer.synchronized()) && hal::now_us() < deadline) {
+		hal::step();
+	}
+	if (!sntpServer.running() || !sntpServer.synchronized()) {
+		printf("SNTP server not running or not synchronized\n");
+		return 1;
+	}
+
+	uint64_t last_tx = 0;
+	uint32_t dropped = sntpServer.dropped;
+	uint64_t wall_start = hostMicros();
+
+	// Within the per-client and global limits: all answered.
+	uint32_t count = opts.rate * opts.seconds;
+	Stats load = runPhase("load", opts.clients, count, opts.seconds, last_tx);
+	double wall = (hostMicros() - wall_start) / 1e6;
+	report("load", load, sntpServer.dropped - dropped);
+	bool ok = load.errors == 0 && load.replies == count && sntpServer.dropped == dropped;
+
+	// Let the per-client and global buckets fill up again.
+	for (uint32_t i = 0; i < SNTP_CLIENT_BURST * SNTP_CLIENT_INTERVAL_MS / opts.step_ms; i++) {
+		hal::step();
+	}
+
+	// One client, twice its burst at once: the second half is kissed.
+	dropped = sntpServer.dropped;
+	Stats burst = runPhase("burst", 1, 2 * SNTP_CLIENT_BURST, 0, last_tx);
+	report("burst", burst, sntpServer.dropped - dropped);
+	ok = ok && burst.errors == 0 && burst.replies == SNTP_CLIENT_BURST && burst.kisses == SNTP_CLIENT_BURST;
+
+	for (uint32_t i = 0; i < SNTP_CLIENT_BURST * SNTP_CLIENT_INTERVAL_MS / opts.step_ms; i++) {
+		hal::step();
+	}
+
+	// Three times the global rate for two seconds from all clients.
+	dropped = sntpServer.dropped;
+	Stats overload = runPhase("overload", opts.clients, 6 * SNTP_MAX_RATE, 2, last_tx);
+	uint32_t overload_dropped = sntpServer.dropped - dropped;
+	report("overload", overload, overload_dropped);
+	ok = ok && overload.errors == 0 && overload_dropped > 0 &&
+	     overload.replies + overload.kisses + overload_dropped == overload.sent &&
+	     overload.replies + overload.kisses <= 3 * SNTP_MAX_RATE;
+
+	printf("Throughput: %.0f requests/s wall clock in the load phase\n", wall > 0 ? load.sent / wall : 0);
+	printf("Server: %u requests, %u responses, %u rate limited, %u dropped, %u malformed\n",
+	       sntpServer.requests, sntpServer.responses, sntpServer.rate_limited, sntpServer.dropped, sntpServer.malformed);
+
+	for (Client &c : clients) {
+		close(c.fd);
+	}
+	return ok ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("sntp", "send SNTP requests from host sockets and check the replies", sntpLoad);
+
+} // namespace
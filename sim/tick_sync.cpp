@@ -0,0 +1,426 @@
+/*
+ * tick_sync.cpp - measure how closely the display follows a tick sync leader.
+ *
+ * The host plays a leader whose second edges are offset from the simulated
+ * RTC's and drift against it. It sends the firmware a SYNC after each edge
+ * and answers its DELAY_REQs, with one-way delays that include random
+ * queuing in each direction. The true phase error is the time from each
+ * leader edge to the next SPI frame that changes the display. The run has
+ * three phases:
+ *
+ *	free	  tick_sync_mode 0: the display follows its own RTC
+ *	follower  tick_sync_mode 2: once locked, every tick must be within
+ *		  MAX_PHASE_ERROR_US of the leader's edge
+ *	leader	  tick_sync_mode 1: the host plays a follower, checks the
+ *		  broadcast SYNCs and the replies to its DELAY_REQs against
+ *		  the display, and that 'ticksync measure' reports its error
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/ticksync.bin --scenario ticksync -- [options]
+ */
+
+#include <Arduino.h>
+#include <TickSync.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern bool systemTimeValid;
+extern TickSync tickSync;
+
+namespace {
+
+const uint32_t MAX_PHASE_ERROR_US = 10000;
+
+struct Options {
+	uint32_t seconds = 60;
+	uint32_t phase_us = 370000;	// leader edges after the RTC's
+	double drift_ppm = 20;
+	uint32_t delay_us = 2000;	// one-way delay without queuing
+	uint32_t jitter_us = 20000;	// largest queuing delay
+	uint32_t step_us = 100;
+	bool verbose = false;
+};
+
+struct Packet {
+	uint64_t at_us;
+	uint8_t data[24];
+};
+
+struct Result {
+	uint32_t ticks = 0;
+	double mean_error_us = 0;
+	double max_error_us = 0;
+	int32_t max_reported_us = 0;	// by the firmware in its DELAY_REQs
+	uint32_t exchanges = 0;
+};
+
+// The host's side runs between loop() iterations, so it must not allocate
+// either: the containers are reserved up front.
+Options opts;
+int fd = -1;
+std::vector<Packet> outgoing;
+std::vector<uint64_t> edges;
+std::vector<uint64_t> frames;		// times of the frames that changed the display
+hal::SpiFrame lastFrame = {};
+
+// Serial output lines, scanned as they are printed.
+uint32_t heapWarningLines = 0;
+uint32_t reportLines = 0;
+uint32_t wrongReportLines = 0;
+
+uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void header(uint8_t *pkt, uint8_t type)
+{
+	memset(pkt, 0, 24);
+	pkt[0] = 'N';
+	pkt[1] = 'T';
+	pkt[2] = 1;
+	pkt[3] = type;
+}
+
+// One-way delay: a fixed part and, for a third of the packets, queuing.
+uint64_t oneWayDelay()
+{
+	uint64_t d = opts.delay_us;
+	if (random() % 3 == 0) {
+		d += random() % (opts.jitter_us + 1);
+	}
+	return d;
+}
+
+void countLine(const std::string &line)
+{
+	if (line.find("[Heap] WARNING") != std::string::npos) {
+		heapWarningLines++;
+	} else if (line.find("[Tick Sync] 127.0.0.1: phase error") != std::string::npos) {
+		reportLines++;
+		if (line.find("phase error -1234 us") == std::string::npos) {
+			wrongReportLines++;
+		}
+	}
+}
+
+void spiFrame(const hal::SpiFrame &f)
+{
+	if (f.length != lastFrame.length || memcmp(f.data, lastFrame.data, f.length) != 0) {
+		frames.push_back(f.at_us);
+	}
+	lastFrame = f;
+}
+
+bool openSocket()
+{
+	struct sockaddr_in addr = {};
+
+	// The firmware's broadcasts go to the tick sync port itself.
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(TICK_SYNC_PORT);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("tick sync socket");
+		return false;
+	}
+	return true;
+}
+
+void sendNow(const uint8_t *pkt)
+{
+	struct sockaddr_in to = {};
+
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	to.sin_port = htons(TICK_SYNC_PORT + hal::options.port_offset);
+	sendto(fd, pkt, 24, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+void sendDue()
+{
+	while (!outgoing.empty() && outgoing.front().at_us <= hal::now_us()) {
+		sendNow(outgoing.front().data);
+		outgoing.erase(outgoing.begin());
+	}
+}
+
+// Packets are queued in the order they are due.
+void sendAt(uint64_t at_us, const uint8_t *pkt)
+{
+	Packet p;
+	p.at_us = at_us;
+	memcpy(p.data, pkt, sizeof(p.data));
+	auto it = outgoing.end();
+	while (it != outgoing.begin() && (it - 1)->at_us > at_us) {
+		--it;
+	}
+	outgoing.insert(it, p);
+}
+
+struct Leader {
+	uint64_t first_edge_us;
+	double period_us;
+	time_t first_second;
+	uint64_t next = 0;
+
+	uint64_t edge(uint64_t k)
+	{
+		return first_edge_us + (uint64_t)(k * period_us + 0.5);
+	}
+};
+
+/*
+ * Play the leader for 'seconds', answering DELAY_REQs, and compare the
+ * display changes after the first 'settle_s' seconds with the edges.
+ */
+Result lead(Leader &leader, uint32_t seconds, uint32_t settle_s)
+{
+	Result result;
+	uint64_t end = hal::now_us() + seconds * 1000000ULL;
+	uint64_t measure_from = hal::now_us() + settle_s * 1000000ULL;
+
+	edges.clear();
+	frames.clear();
+	while (hal::now_us() < end) {
+		uint64_t now = hal::now_us();
+		while (leader.edge(leader.next) <= now) {
+			uint64_t e = leader.edge(leader.next);
+			uint64_t d = oneWayDelay();
+			uint8_t pkt[24];
+			header(pkt, 1);
+			put32(pkt + 8, leader.first_second + leader.next);
+			put32(pkt + 12, 50);
+			sendAt(e + 50 + d, pkt);
+			edges.push_back(e);
+			leader.next++;
+		}
+		sendDue();
+
+		uint8_t pkt[64];
+		ssize_t n;
+		while ((n = recv(fd, pkt, sizeof(pkt), 0)) >= 0) {
+			if (n != 24 || pkt[3] != 2) {
+				continue;
+			}
+			// The request arrives at the leader after the uplink delay
+			// and is answered 100 us later.
+			uint64_t rx = now + oneWayDelay();
+			uint64_t tx = rx + 100;
+			uint64_t k = leader.next - 1;
+			while (k > 0 && leader.edge(k) > rx) {
+				k--;
+			}
+			if (now >= measure_from && tickSync.locked()) {
+				int32_t reported = get32(pkt + 12);
+				if (abs(reported) > abs(result.max_reported_us)) {
+					result.max_reported_us = reported;
+				}
+			}
+			pkt[3] = 3;
+			put32(pkt + 12, leader.first_second + k);
+			put32(pkt + 16, rx - leader.edge(k));
+			put32(pkt + 20, tx - leader.edge(k));
+			sendAt(tx + oneWayDelay(), pkt);
+			result.exchanges++;
+		}
+		hal::step();
+	}
+
+	// Each edge after the settling time is matched with the first change
+	// of the display within half a second either way.
+	double total = 0;
+	size_t f = 0;
+	for (uint64_t e : edges) {
+		if (e < measure_from || e + 500000 > end) {
+			continue;
+		}
+		while (f < frames.size() && frames[f] + 500000 < e) {
+			f++;
+		}
+		if (f == frames.size()) {
+			break;
+		}
+		double error = (double)frames[f] - (double)e;
+		total += fabs(error);
+		result.max_error_us = max(result.max_error_us, fabs(error));
+		result.ticks++;
+		f++;
+	}
+	result.mean_error_us = result.ticks > 0 ? total / result.ticks : 0;
+	return result;
+}
+
+void report(const char *phase, const Result &r)
+{
+	printf("%-9s %3u ticks, phase error mean %7.0f us, max %7.0f us; %u exchanges, largest reported error %d us\n",
+	       phase, r.ticks, r.mean_error_us, r.max_error_us, r.exchanges, r.max_reported_us);
+}
+
+/*
+ * With the firmware as the leader, follow its SYNCs for 'seconds' and send a
+ * DELAY_REQ half a second after each, reporting 'reported_us' as the phase
+ * error. Each SYNC must carry the next second and be sent at an edge, i.e.
+ * with a display change, and each reply must give the times from that edge.
+ */
+bool follow(uint32_t seconds, int32_t reported_us)
+{
+	uint64_t end = hal::now_us() + seconds * 1000000ULL;
+	uint32_t syncs = 0, replies = 0, errors = 0;
+	uint64_t edge = 0, request_at = 0, request_sent = 0;
+	time_t last_second = 0;
+
+	frames.clear();
+	while (hal::now_us() < end) {
+		uint64_t now = hal::now_us();
+		uint8_t pkt[64];
+		ssize_t n;
+		while ((n = recv(fd, pkt, sizeof(pkt), 0)) >= 0) {
+			if (n != 24) {
+				errors++;
+				continue;
+			}
+			if (pkt[3] == 1) {
+				time_t s = get32(pkt + 8);
+				edge = now - get32(pkt + 12);
+				if (syncs > 0 && s != last_second + 1) {
+					printf("ERROR SYNC for second %ld after %ld\n", (long)s, (long)last_second);
+					errors++;
+				}
+				if (frames.empty() || llabs((int64_t)(edge - frames.back())) > opts.step_us) {
+					printf("ERROR SYNC edge at %llu, last display change at %llu\n",
+					       (unsigned long long)edge, (unsigned long long)(frames.empty() ? 0 : frames.back()));
+					errors++;
+				}
+				last_second = s;
+				request_at = now + 500000;
+				syncs++;
+			} else if (pkt[3] == 3 && get32(pkt + 8) == (uint32_t)request_sent) {
+				uint32_t rx_phase = get32(pkt + 16);
+				// The host sees each packet up to a step late.
+				int64_t expected = request_sent - edge;
+				if (get32(pkt + 12) != (uint32_t)last_second ||
+				    rx_phase < expected || rx_phase > expected + 2 * opts.step_us) {
+					printf("ERROR DELAY_RESP for second %u, receive phase %u us, expected %ld, %lld us\n",
+					       get32(pkt + 12), rx_phase, (long)last_second, (long long)expected);
+					errors++;
+				}
+				replies++;
+			}
+		}
+		if (request_at != 0 && now >= request_at) {
+			header(pkt, 2);
+			request_sent = now;
+			put32(pkt + 8, request_sent);
+			put32(pkt + 12, reported_us);
+			put32(pkt + 16, 4000);
+			sendNow(pkt);
+			request_at = 0;
+		}
+		hal::step();
+	}
+	printf("leader    %u SYNCs, %u replies, %u errors\n", syncs, replies, errors);
+	return errors == 0 && syncs + 1 >= seconds && replies + 2 >= seconds;
+}
+
+const Option OPTIONS[] = {
+	{ "seconds", "N", "virtual seconds per phase", opts.seconds, 20 },
+	{ "phase-us", "N", "leader edges after the RTC's", opts.phase_us },
+	{ "drift-ppm", "X", "leader clock rate error", opts.drift_ppm, -1e6 },
+	{ "delay-us", "N", "one-way network delay", opts.delay_us },
+	{ "jitter-us", "N", "largest queuing delay per direction", opts.jitter_us },
+	{ "step-us", "N", "virtual time per loop() iteration", opts.step_us, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int tickSyncScenario(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	opts.phase_us %= 1000000;
+	if (!openSocket()) {
+		return 1;
+	}
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_us;
+	capture_serial(opts.verbose, 0, countLine);
+	hal::spi_set_listener(spiFrame);
+	srandom(1);
+	outgoing.reserve(64);
+	edges.reserve(opts.seconds + 2);
+	frames.reserve(4 * opts.seconds + 16);
+
+	// The display follows the RTC, which isn't set again.
+	command("set ntp_enabled 0");
+	command("set tick_sync_mode 0");
+	command("display seconds");
+	uint64_t deadline = hal::now_us() + 10 * 1000000ULL;
+	while (!systemTimeValid && hal::now_us() < deadline) {
+		hal::step();
+	}
+	if (!systemTimeValid) {
+		printf("System time not valid\n");
+		return 1;
+	}
+
+	// The leader's edges are 'phase_us' after the RTC's, which are at
+	// the last display change.
+	frames.clear();
+	for (uint32_t i = 0; i < 1200000 / opts.step_us; i++) {
+		hal::step();
+	}
+	Leader leader;
+	leader.first_edge_us = frames.back() + 1000000 + opts.phase_us;
+	leader.period_us = 1000000 * (1 + opts.drift_ppm / 1e6);
+	leader.first_second = hal::wall_time() + 2;
+	while (hal::now_us() < leader.first_edge_us - 1000) {
+		hal::step();
+	}
+
+	uint32_t heap_warnings = heapWarningLines;
+	Result free = lead(leader, opts.seconds, 2);
+	report("free", free);
+
+	command("set tick_sync_mode 2");
+	Result synced = lead(leader, opts.seconds, 10);
+	report("follower", synced);
+	command("ticksync");
+	bool ok = synced.ticks + 12 >= opts.seconds && synced.max_error_us < MAX_PHASE_ERROR_US &&
+		  (uint32_t)abs(synced.max_reported_us) < MAX_PHASE_ERROR_US && tickSync.unlocks == 0;
+
+	command("set tick_sync_mode 1");
+	command("ticksync measure");
+	ok = follow(opts.seconds, -1234) && ok;
+	command("ticksync measure");
+	bool reported = reportLines > 0 && wrongReportLines == 0;
+	printf("leader    %u measurement reports, %u wrong\n", reportLines, wrongReportLines);
+
+	command("set tick_sync_mode 0");
+	printf("Heap warnings: %u\n", heapWarningLines - heap_warnings);
+	return ok && reported && heapWarningLines == heap_warnings ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("ticksync", "measure how closely the display follows a tick sync leader", tickSyncScenario);
+
+} // namespace
@@ -0,0 +1,198 @@
+/*
+ * timestamp_bench.cpp - check and time TimestampFormatter against AceTime.
+ *
+ * For every zone in the AceTime registry, formats every second around each
+ * UTC offset transition in a range of years, plus a jump to an unrelated time
+ * after each transition, with the TimestampFormatter that printTime() uses,
+ * and compares the result with ZonedDateTime::printTo(). One formatter is
+ * used for all zones, so zone changes are covered too. Then it formats a run
+ * of consecutive seconds, as the serial ticker does, in one zone with both and
+ * reports the time per timestamp.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/timestamp.bin --scenario timestamp -- [options]
+ */
+
+#include <Arduino.h>
+#include <AceTime.h>
+#include <TimestampFormatter.h>
+#include <chrono>
+#include <string>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace ace_time;
+using namespace scenario;
+
+namespace {
+
+struct Options {
+	int from_year = 2000;
+	int to_year = 2040;
+	const char *zone = NULL;
+	uint32_t window_s = 90;
+	const char *bench_zone = "America/New_York";
+	uint32_t bench_seconds = 86400;
+	bool verbose = false;
+};
+
+struct Stats {
+	uint32_t zones = 0;
+	uint32_t transitions = 0;
+	uint64_t checks = 0;
+	uint64_t mismatches = 0;
+};
+
+Options opts;
+Stats stats;
+
+ExtendedZoneProcessorCache<1> zoneProcessorCache;
+ExtendedZoneManager zoneManager(
+	zonedbx::kZoneAndLinkRegistrySize,
+	zonedbx::kZoneAndLinkRegistry,
+	zoneProcessorCache);
+TimestampFormatter formatter;
+
+const uint8_t MAX_REPORTED_MISMATCHES = 20;
+
+void check(int64_t t, const TimeZone &tz)
+{
+	ace_common::PrintStr<TIMESTAMP_SIZE> expected;
+	ZonedDateTime::forUnixSeconds64(t, tz).printTo(expected);
+	const char *shown = formatter.format(t, tz);
+
+	stats.checks++;
+	if (strcmp(shown, expected.cstr()) != 0 || formatter.length() != expected.length()) {
+		stats.mismatches++;
+		if (stats.mismatches <= MAX_REPORTED_MISMATCHES) {
+			printf("MISMATCH at %lld: expected %s, formatted %s\n", (long long)t, expected.cstr(), shown);
+		}
+	}
+}
+
+/*
+ * Format each second around 't', then a time far from it, which can't reuse
+ * the rendered minute.
+ */
+void checkAround(int64_t t, const TimeZone &tz, int64_t from, int64_t to)
+{
+	for (int64_t s = t - opts.window_s; s < t + (int64_t)opts.window_s; s++) {
+		check(s, tz);
+	}
+	check(from + random() % (to - from), tz);
+}
+
+void checkZone(uint16_t index, int64_t from, int64_t to)
+{
+	static const int64_t DAY = 86400;
+	ace_common::PrintStr<TIMESTAMP_SIZE> name;
+
+	TimeZone tz = zoneManager.createForZoneIndex(index);
+	tz.printTo(name);
+	if (opts.zone != NULL && strstr(name.cstr(), opts.zone) == NULL) {
+		return;
+	}
+	stats.zones++;
+
+	// Every zone is checked at least once, even without transitions.
+	checkAround(from + DAY / 2, tz, from, to);
+
+	// Offsets never change more than once a day, so probe daily and
+	// bisect to the exact second.
+	uint32_t transitions = 0;
+	int32_t offset = offset_at(from, tz);
+	for (int64_t t = from + DAY; t < to; t += DAY) {
+		int32_t next = offset_at(t, tz);
+		if (next == offset) {
+			continue;
+		}
+		checkAround(find_transition(t - DAY, t, tz), tz, from, to);
+		offset = next;
+		transitions++;
+	}
+	stats.transitions += transitions;
+
+	if (opts.verbose) {
+		printf("%s: %u transitions\n", name.cstr(), transitions);
+	}
+}
+
+/*
+ * Time consecutive seconds in one zone, formatted by AceTime and by the
+ * formatter. Returns false if the outputs differ.
+ */
+bool bench(int64_t start)
+{
+	TimeZone tz = zoneManager.createForZoneName(opts.bench_zone);
+	if (tz.isError()) {
+		printf("Unknown zone: %s\n", opts.bench_zone);
+		return false;
+	}
+
+	std::string acetime, formatted;
+	acetime.reserve(opts.bench_seconds * 48);
+	formatted.reserve(opts.bench_seconds * 48);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < opts.bench_seconds; i++) {
+		ace_common::PrintStr<TIMESTAMP_SIZE> out;
+		ZonedDateTime::forUnixSeconds64(start + i, tz).printTo(out);
+		acetime.append(out.cstr(), out.length());
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	TimestampFormatter f;
+	for (uint32_t i = 0; i < opts.bench_seconds; i++) {
+		const char *s = f.format(start + i, tz);
+		formatted.append(s, f.length());
+	}
+	auto t2 = std::chrono::steady_clock::now();
+
+	double acetime_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / opts.bench_seconds;
+	double formatter_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / opts.bench_seconds;
+	printf("Ticker in %s, %u seconds: AceTime %.0f ns, formatter %.0f ns per timestamp (%.1fx); "
+	       "%u full, %u minute and %u seconds renders; output %s\n",
+	       opts.bench_zone, opts.bench_seconds, acetime_ns, formatter_ns, acetime_ns / formatter_ns,
+	       f.full_renders, f.minute_renders, f.second_renders, acetime == formatted ? "identical" : "DIFFERENT");
+	return acetime == formatted;
+}
+
+const Option OPTIONS[] = {
+	{ "from", "YEAR", "first year to check", opts.from_year },
+	{ "to", "YEAR", "last year to check", opts.to_year },
+	{ "zone", "TEXT", "only check zones whose name contains TEXT", opts.zone },
+	{ "window", "N", "seconds formatted before and after each transition", opts.window_s, 1 },
+	{ "bench-zone", "Z", "zone of the timing run", opts.bench_zone },
+	{ "bench-seconds", "N", "seconds formatted in the timing run", opts.bench_seconds, 1 },
+	{ "verbose", "print the transitions found in each zone", opts.verbose },
+};
+
+int timestampBench(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (opts.to_year < opts.from_year) {
+		usage(argv[0], OPTIONS);
+		return 1;
+	}
+
+	int64_t from = year_start(opts.from_year);
+	int64_t to = year_start(opts.to_year + 1);
+	srandom(1);
+	for (uint16_t i = 0; i < zoneManager.zoneRegistrySize(); i++) {
+		checkZone(i, from, to);
+	}
+	printf("Zones: %u, transitions: %u, timestamps checked: %llu, mismatches: %llu\n",
+	       stats.zones, stats.transitions, (unsigned long long)stats.checks, (unsigned long long)stats.mismatches);
+	printf("Formatter: %u full, %u minute and %u seconds renders\n",
+	       formatter.full_renders, formatter.minute_renders, formatter.second_renders);
+
+	bool identical = bench(from);
+	return stats.mismatches == 0 && identical ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("timestamp", "check and time the incremental timestamp formatter against AceTime", timestampBench);
+
+} // namespace
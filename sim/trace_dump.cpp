@@ -0,0 +1,321 @@
+/*
+ * trace_dump.cpp - check the event trace and its dump.
+ *
+ * Connects to the simulated access point, waits for the first NTP sync and
+ * runs two phases, each started with 'trace clear' and ended with
+ * 'trace dump', whose output is parsed back into records:
+ *
+ *	events	  without loop stages, over a clock set and an EEPROM commit:
+ *		  one second_edge per second, one spi_latch per SPI frame with
+ *		  its digits, the time_step of 'set time' and the commit
+ *	loop	  with 'trace loop': a full ring of loop stages, each iteration
+ *		  going through them in order
+ *
+ * In both, the record count must match the header and the cycle stamps must
+ * never go back. Tracing mustn't allocate. --output FILE writes the serial output, dumps included, for
+ * tools/trace2json.py.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/trace.bin --scenario trace -- [options]
+ */
+
+#include <Arduino.h>
+#include <NtpClientLib.h>
+#include <Trace.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace scenario;
+
+namespace {
+
+const time_t TIME_STEP_S = 100;
+
+struct Options {
+	uint32_t seconds = 10;
+	uint32_t step_ms = 10;
+	const char *output = NULL;
+	bool verbose = false;
+};
+
+// Filled in place, so that parsing doesn't allocate inside loop().
+struct Dump {
+	uint32_t count = 0;
+	char names[TRACE_EVENT_COUNT][32];
+	uint8_t name_count = 0;
+	std::vector<TraceRecord> records;
+	bool complete = false;
+};
+
+Options opts;
+FILE *output = NULL;
+// Serial output lines, scanned as they are printed. The SPI frames are
+// counted between "[Trace] Cleared." and the dump.
+bool counting = false;
+std::vector<uint16_t> frameDigits;
+Dump dump;
+uint32_t heapWarnings = 0;
+
+void parseLine(const std::string &l)
+{
+	unsigned count, overwritten, mhz, now, id;
+	char category[16], name[32];
+
+	if (sscanf(l.c_str(), "[Trace] Dump: %u records, %u overwritten, %u MHz, now %u",
+		   &count, &overwritten, &mhz, &now) == 4) {
+		counting = false;
+		dump.count = count;
+		dump.name_count = 0;
+		dump.records.clear();
+		dump.complete = false;
+	} else if (sscanf(l.c_str(), "[Trace] Event %u %15s %31s", &id, category, name) == 3) {
+		if (id < TRACE_EVENT_COUNT) {
+			strcpy(dump.names[id], name);
+			dump.name_count = max(dump.name_count, (uint8_t)(id + 1));
+		}
+	} else if (l.compare(0, 12, "[Trace] Data") == 0) {
+		for (size_t i = 12; i + 15 <= l.size(); i += 15) {
+			TraceRecord r = {};
+			r.cycles = strtoul(l.substr(i + 1, 8).c_str(), NULL, 16);
+			r.event = strtoul(l.substr(i + 9, 2).c_str(), NULL, 16);
+			r.arg = strtoul(l.substr(i + 11, 4).c_str(), NULL, 16);
+			dump.records.push_back(r);
+		}
+	} else if (l == "[Trace] End of dump.") {
+		dump.complete = true;
+	} else if (l.compare(0, 15, "[Heap] WARNING!") == 0) {
+		heapWarnings++;
+	} else if (l == "[Trace] Cleared.") {
+		counting = true;
+		frameDigits.clear();
+	}
+}
+
+void serialLine(const std::string &l)
+{
+	if (output != NULL) {
+		fprintf(output, "%s\n", l.c_str());
+	}
+	parseLine(l);
+}
+
+// The digits of a frame, as the spi_latch argument holds them.
+uint16_t frameToDigits(const hal::SpiFrame &f)
+{
+	static const uint16_t pinmap[] = { 16, 32, 64, 128, 256, 512, 1, 2, 4, 8, 0 };
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < 5; i++) {
+		bits = bits << 8 | (uint8_t)~f.data[i];
+	}
+	uint16_t digits = 0;
+	for (uint8_t d = 0; d < 4; d++) {
+		uint16_t tube = bits >> (30 - 10 * d) & 0x3ff;
+		uint8_t v = 10;
+		for (uint8_t j = 0; j < 11; j++) {
+			if (pinmap[j] == tube) {
+				v = j;
+				break;
+			}
+		}
+		digits = digits << 4 | v;
+	}
+	return digits;
+}
+
+void spiFrame(const hal::SpiFrame &f)
+{
+	if (counting && f.length == 6 && frameDigits.size() < frameDigits.capacity()) {
+		frameDigits.push_back(frameToDigits(f));
+	}
+}
+
+uint8_t eventId(const char *name)
+{
+	for (uint8_t i = 0; i < dump.name_count; i++) {
+		if (strcmp(dump.names[i], name) == 0) {
+			return i;
+		}
+	}
+	return 0xff;
+}
+
+uint32_t countEvents(const char *name)
+{
+	uint8_t id = eventId(name);
+	uint32_t n = 0;
+	for (const TraceRecord &r : dump.records) {
+		n += r.event == id;
+	}
+	return n;
+}
+
+// Checks common to every dump.
+void checkDump(const char *phase)
+{
+	if (!dump.complete || dump.records.size() != dump.count || dump.count == 0) {
+		error("%s: %zu records in the dump, header says %u", phase, dump.records.size(), dump.count);
+		return;
+	}
+	if (dump.name_count != TRACE_EVENT_COUNT) {
+		error("%s: %u event names, expected %u", phase, dump.name_count, (unsigned)TRACE_EVENT_COUNT);
+	}
+	for (size_t i = 1; i < dump.records.size(); i++) {
+		// The native cycle count follows the host clock, which doesn't
+		// wrap within a run.
+		if (dump.records[i].cycles < dump.records[i - 1].cycles) {
+			error("%s: record %zu stamped before the one before it", phase, i);
+		}
+	}
+}
+
+bool eventsPhase()
+{
+	command("trace clear");
+	run(opts.seconds * 1000);
+
+	char cmd[64];
+	time_t t = now() + TIME_STEP_S;
+	snprintf(cmd, sizeof(cmd), "set time %04d-%02d-%02dT%02d:%02d:%02d+00:00", year(t), month(t), day(t), hour(t), minute(t),
+		 second(t));
+	command(cmd);
+	command("write");
+	run(2000);
+	command("trace dump");
+
+	const char *phase = "events";
+	checkDump(phase);
+	uint32_t seconds = countEvents("second_edge");
+	uint32_t latches = countEvents("spi_latch");
+	if (seconds < opts.seconds + 1 || seconds > opts.seconds + 3) {
+		error("%s: %u second_edge records in %u s", phase, seconds, opts.seconds + 2);
+	}
+	if (latches != frameDigits.size() || latches == 0) {
+		error("%s: %u spi_latch records, %zu SPI frames", phase, latches, frameDigits.size());
+	} else {
+		uint8_t id = eventId("spi_latch");
+		size_t f = 0;
+		for (const TraceRecord &r : dump.records) {
+			if (r.event == id && r.arg != frameDigits[f++]) {
+				error("%s: spi_latch %04x, frame %04x", phase, r.arg, frameDigits[f - 1]);
+			}
+		}
+	}
+	bool stepped = false;
+	for (const TraceRecord &r : dump.records) {
+		stepped = stepped || (r.event == eventId("time_step") && (int16_t)r.arg >= TIME_STEP_S - 1 &&
+				      (int16_t)r.arg <= TIME_STEP_S + 1);
+	}
+	if (!stepped) {
+		error("%s: no time_step of %ld s", phase, (long)TIME_STEP_S);
+	}
+	if (countEvents("commit") != 1) {
+		error("%s: %u EEPROM commits", phase, countEvents("commit"));
+	}
+	if (countEvents("accounting") != 0) {
+		error("%s: loop stages traced while off", phase);
+	}
+	printf("%-7s %3zu records: %u second edges, %u SPI latches of %zu frames, %u time steps, %u commits\n",
+	       phase, dump.records.size(), seconds, latches, frameDigits.size(), countEvents("time_step"),
+	       countEvents("commit"));
+	return errors() == 0;
+}
+
+bool loopPhase()
+{
+	static const char *const STAGES[] = { "accounting", "events", "display", "serial", "background", "end" };
+	const uint8_t STAGE_COUNT = sizeof(STAGES) / sizeof(STAGES[0]);
+	const char *phase = "loop";
+
+	command("trace clear");
+	command("trace loop");
+	run(2000);
+	command("trace dump");
+	command("trace loop");
+
+	checkDump(phase);
+	if (dump.count != TRACE_SIZE) {
+		error("%s: %u records, expected a full ring of %d", phase, dump.count, TRACE_SIZE);
+	}
+
+	// Every stage follows the one before it in loop(). The boot progress
+	// path and the early return aren't taken once the time is valid.
+	uint8_t ids[STAGE_COUNT];
+	for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+		ids[i] = eventId(STAGES[i]);
+	}
+	int8_t last = -1;
+	uint32_t iterations = 0;
+	for (const TraceRecord &r : dump.records) {
+		int8_t stage = -1;
+		for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+			if (r.event == ids[i]) {
+				stage = i;
+			}
+		}
+		if (stage < 0) {
+			continue;
+		}
+		if (last >= 0 && stage != (last + 1) % STAGE_COUNT) {
+			error("%s: stage %d after stage %d", phase, stage, last);
+		}
+		iterations += stage == 0;
+		last = stage;
+	}
+	printf("%-7s %3zu records: %u loop iterations\n", phase, dump.records.size(), iterations);
+	return errors() == 0 && iterations > 0;
+}
+
+const Option OPTIONS[] = {
+	{ "seconds", "N", "virtual seconds traced in the events phase", opts.seconds, 1 },
+	{ "step-ms", "N", "virtual time per loop() iteration", opts.step_ms, 1 },
+	{ "output", "FILE", "write the serial output, with the dumps, to FILE", opts.output },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int traceDump(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (opts.output != NULL && (output = fopen(opts.output, "w")) == NULL) {
+		perror(opts.output);
+		return 1;
+	}
+
+	hal::options.speed = 0;
+	hal::options.step_us = opts.step_ms * 1000;
+	frameDigits.reserve(100000);
+	dump.records.reserve(TRACE_SIZE);
+	capture_serial(opts.verbose, 0, serialLine);
+	hal::spi_set_listener(spiFrame);
+
+	command("set ssid nixietap-sim");
+	command("set password nixietap-sim");
+	command("set ntp_enabled 1");
+	uint64_t deadline = hal::now_us() + 120 * 1000000ULL;
+	while (NTP.getLastNTPSync() == 0 && hal::now_us() < deadline) {
+		hal::step();
+	}
+	if (NTP.getLastNTPSync() == 0) {
+		printf("No NTP sync\n");
+		return 1;
+	}
+
+	bool ok = eventsPhase();
+	ok = loopPhase() && ok;
+	if (heapWarnings > 0) {
+		error("%u heap warnings", heapWarnings);
+		ok = false;
+	}
+	if (output != NULL) {
+		fclose(output);
+	}
+	return ok ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("trace", "check the event trace and its dump", traceDump);
+
+} // namespace
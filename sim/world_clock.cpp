@@ -0,0 +1,316 @@
+/*
+ * world_clock.cpp - check the zone cache and the world clock display mode.
+ *
+ * First checks the cache's eviction order with more zones than it holds.
+ * Then, for every zone in the registry, looks up a range of years through
+ * the cache as the display does, in steps and second by second around each
+ * of AceTime's transitions, and compares each offset with AceTime's. Next
+ * it sets world clock zones over serial, selects the world clock mode and
+ * runs the firmware across DST transitions, checking that every SPI frame
+ * shows the time of the zone due at that second with its dot. Finally it
+ * times lookups that switch between the zones each second through the cache
+ * and through a single shared zone processor, and a processor rebuild.
+ *
+ * Run with:
+ *	program --speed 0 --eeprom /tmp/world.bin --scenario world -- [options]
+ */
+
+#include <Arduino.h>
+#include <AceTime.h>
+#include <CivilDate.h>
+#include <PosixTz.h>
+#include <ZoneCache.h>
+#include <chrono>
+#include <string>
+#include "hal.h"
+#include "scenario.h"
+
+using namespace ace_time;
+using namespace scenario;
+
+// Firmware state, from NixieTap.cpp.
+extern time_t current_time;
+extern bool systemTimeValid;
+
+namespace {
+
+struct Options {
+	int from_year = 2000;
+	int to_year = 2040;
+	uint32_t step_s = 3571;
+	uint32_t bench_count = 1000000;
+	bool verbose = false;
+};
+
+// The world clock zones set over serial, and how to look them up on the
+// host.
+const char WORLD_CLOCK_ZONES_SETTING[] =
+	"Europe/Amsterdam Asia/Kolkata Australia/Lord_Howe AEST-10AEDT,M10.1.0,M4.1.0/3";
+const char *const WORLD_CLOCK_ZONE_NAMES[] = {
+	"Europe/Amsterdam", "Asia/Kolkata", "Australia/Lord_Howe", "Australia/Sydney",
+};
+const uint8_t WORLD_CLOCK_ZONE_COUNT = 4;
+const uint8_t DWELL_S = 3;
+
+Options opts;
+uint64_t checks = 0;
+uint64_t frameChecks = 0;
+
+const ExtendedZoneRegistrar registrar(zonedbx::kZoneAndLinkRegistrySize, zonedbx::kZoneAndLinkRegistry);
+ExtendedZoneProcessorCache<1> zoneProcessorCache;
+ExtendedZoneManager zoneManager(
+	zonedbx::kZoneAndLinkRegistrySize,
+	zonedbx::kZoneAndLinkRegistry,
+	zoneProcessorCache);
+
+void checkEviction()
+{
+	ZoneCache cache(registrar);
+	const uint16_t zones = TZ_CACHE_SIZE + 1;
+
+	if (registrar.zoneRegistrySize() < zones) {
+		printf("Eviction: skipped, the registry has fewer than %u zones\n", zones);
+		return;
+	}
+	// Fill the cache, use the first zone again, then one more zone: the
+	// second zone is the least recently used and is evicted.
+	for (uint16_t i = 0; i < TZ_CACHE_SIZE; i++) {
+		cache.offsetAt(i, 0);
+	}
+	cache.offsetAt(0, 0);
+	cache.offsetAt(TZ_CACHE_SIZE, 0);
+	uint32_t misses = cache.misses;
+	cache.offsetAt(0, 0);
+	if (cache.misses != misses || cache.evictions != 1) {
+		error("the most recently used zone was evicted");
+	}
+	cache.offsetAt(1, 0);
+	if (cache.misses != misses + 1) {
+		error("the least recently used zone was kept");
+	}
+	printf("Eviction: %u misses, %u evictions\n", cache.misses, cache.evictions);
+}
+
+void checkLookup(ZoneCache &cache, uint16_t index, const TimeZone &tz, int64_t t)
+{
+	int32_t expected = offset_at(t, tz);
+	int32_t offset = cache.offsetAt(index, t);
+	checks++;
+	if (offset != expected) {
+		ace_common::PrintStr<64> name;
+		tz.printTo(name);
+		error("%s at %lld: offset %ld, expected %ld", name.cstr(), (long long)t, (long)offset,
+		      (long)expected);
+	}
+}
+
+/*
+ * Look up every zone through one cache in steps, as the display does, and
+ * each second around every transition.
+ */
+void checkOffsets()
+{
+	static const int64_t DAY = 86400;
+	ZoneCache cache(registrar);
+	int64_t from = year_start(opts.from_year);
+	int64_t to = year_start(opts.to_year + 1);
+	uint32_t transitions = 0;
+
+	for (uint16_t index = 0; index < registrar.zoneRegistrySize(); index++) {
+		TimeZone tz = zoneManager.createForZoneIndex(index);
+		for (int64_t t = from; t < to; t += opts.step_s) {
+			checkLookup(cache, index, tz, t);
+		}
+		int32_t offset = offset_at(from, tz);
+		for (int64_t t = from + DAY; t < to; t += DAY) {
+			int32_t next = offset_at(t, tz);
+			if (next == offset) {
+				continue;
+			}
+			int64_t at = find_transition(t - DAY, t, tz);
+			for (int64_t s = at - 3; s < at + 3; s++) {
+				checkLookup(cache, index, tz, s);
+			}
+			offset = next;
+			transitions++;
+		}
+	}
+	printf("Offsets: %u zones, %u transitions, %llu lookups checked; %u cached, %u refreshed, %u missed\n",
+	       registrar.zoneRegistrySize(), transitions, (unsigned long long)checks, cache.hits, cache.refreshes,
+	       cache.misses);
+}
+
+/*
+ * The digits and dots of a frame sent by Nixie::writeLowLevel(), with 10 for
+ * a blank tube and 11 for an invalid one.
+ */
+void decodeFrame(const hal::SpiFrame &f, uint8_t tubes[4], uint8_t &dots)
+{
+	static const uint16_t pinmap[] = { 16, 32, 64, 128, 256, 512, 1, 2, 4, 8, 0 };
+	uint64_t bits = 0;
+
+	for (uint8_t i = 0; i < 5; i++) {
+		bits = bits << 8 | (uint8_t)~f.data[i];
+	}
+	for (uint8_t d = 0; d < 4; d++) {
+		uint16_t tube = bits >> (30 - 10 * d) & 0x3ff;
+		tubes[d] = 11;
+		for (uint8_t j = 0; j <= 10; j++) {
+			if (pinmap[j] == tube) {
+				tubes[d] = j;
+			}
+		}
+	}
+	dots = f.data[5];
+}
+
+/*
+ * Run from 'seconds' before 't' to as long after it, checking each frame
+ * against the zone due at the second it was sent.
+ */
+void runAround(int64_t t, uint32_t seconds)
+{
+	char cmd[64];
+	civil::DateTime start = civil::fromUnix(t - seconds);
+	snprintf(cmd, sizeof(cmd), "set time %04ld-%02u-%02uT%02u:%02u:%02u+00:00", (long)start.year, start.month,
+		 start.day, start.hour, start.minute, start.second);
+	command(cmd);
+
+	TimeZone zones[WORLD_CLOCK_ZONE_COUNT];
+	for (uint8_t i = 0; i < WORLD_CLOCK_ZONE_COUNT; i++) {
+		zones[i] = zoneManager.createForZoneName(WORLD_CLOCK_ZONE_NAMES[i]);
+	}
+
+	uint64_t frames = hal::spi_frame_count();
+	while (current_time < t + seconds) {
+		hal::step();
+		if (hal::spi_frame_count() == frames) {
+			continue;
+		}
+		frames = hal::spi_frame_count();
+
+		uint8_t tubes[4], dots;
+		decodeFrame(hal::spi_last_frame(), tubes, dots);
+		uint8_t zone = current_time / DWELL_S % WORLD_CLOCK_ZONE_COUNT;
+		civil::DateTime local = civil::fromUnix(current_time + offset_at(current_time, zones[zone]));
+		uint8_t expected[4] = { (uint8_t)(local.hour / 10), (uint8_t)(local.hour % 10),
+					(uint8_t)(local.minute / 10), (uint8_t)(local.minute % 10) };
+		frameChecks++;
+		if (memcmp(tubes, expected, 4) != 0 || dots != (0b10 << zone)) {
+			error("at %lld showed %u%u%u%u dots %02x, expected %u%u%u%u dots %02x (%s)",
+			      (long long)current_time, tubes[0], tubes[1], tubes[2], tubes[3], dots, expected[0],
+			      expected[1], expected[2], expected[3], 0b10 << zone, WORLD_CLOCK_ZONE_NAMES[zone]);
+		}
+	}
+}
+
+void checkDisplay()
+{
+	uint32_t before = errors();
+	while (!systemTimeValid) {
+		hal::step();
+	}
+	std::string set = std::string("set world_clock_zones ") + WORLD_CLOCK_ZONES_SETTING;
+
+	command("set ntp_enabled 0");
+	command("set 24hr_enabled 1");
+	command(set.c_str());
+	command("display world");
+
+	// Europe/Amsterdam's DST starts, Australia/Lord_Howe's half hour and
+	// Australia/Sydney's hour of DST end.
+	runAround(civil::toUnix(2024, 3, 31, 1, 0, 0), 30);
+	runAround(civil::toUnix(2024, 4, 6, 15, 0, 0), 30);
+	runAround(civil::toUnix(2024, 4, 6, 16, 0, 0), 30);
+	printf("Display: %llu frames checked, %u errors\n", (unsigned long long)frameChecks, errors() - before);
+
+	// Each zone is named in 'zones'. A word too long for a zone name is
+	// rejected rather than cut, and the zones stay as they were.
+	before = errors();
+	expect_output("zones", 100, "[Zones] World clock zone 1, Europe/Amsterdam: offset 7200 s");
+	expect("zones", "[Zones] World clock zone 4, AEST-10AEDT,M10.1.0,M4.1.0/3: offset 36000 s");
+	expect("zones", " zone processors, ");
+	char cmd[128];
+	snprintf(cmd, sizeof(cmd), "set world_clock_zones Asia/Tokyo %s", std::string(50, 'X').c_str());
+	expect_output(cmd, 100, "A world clock zone may be at most 49 characters long.");
+	expect_output("zones", 100, "[Zones] World clock zone 1, Europe/Amsterdam: offset 7200 s");
+	printf("Zones command: %u errors\n", errors() - before);
+	command("display time");
+}
+
+/*
+ * Time lookups for consecutive seconds, each in the next world clock zone,
+ * through the cache and through one shared processor, which is rebuilt for
+ * each switch.
+ */
+void bench()
+{
+	ZoneCache cache(registrar);
+	uint16_t indexes[WORLD_CLOCK_ZONE_COUNT];
+	TimeZone shared[WORLD_CLOCK_ZONE_COUNT];
+	int64_t start = year_start(2024);
+	int64_t cache_sum = 0, shared_sum = 0;
+
+	for (uint8_t i = 0; i < WORLD_CLOCK_ZONE_COUNT; i++) {
+		indexes[i] = cache.indexForName(WORLD_CLOCK_ZONE_NAMES[i]);
+		shared[i] = zoneManager.createForZoneName(WORLD_CLOCK_ZONE_NAMES[i]);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	cache.offsetAt(indexes[0], start);
+	auto t1 = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < opts.bench_count; i++) {
+		cache_sum += cache.offsetAt(indexes[i % WORLD_CLOCK_ZONE_COUNT], start + i);
+	}
+	auto t2 = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < opts.bench_count; i++) {
+		shared_sum += offset_at(start + i, shared[i % WORLD_CLOCK_ZONE_COUNT]);
+	}
+	auto t3 = std::chrono::steady_clock::now();
+
+	double rebuild_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+	double cache_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / opts.bench_count;
+	double shared_ns = std::chrono::duration<double, std::nano>(t3 - t2).count() / opts.bench_count;
+	printf("Switching between %u zones, %u lookups: cache %.1f ns, shared processor %.1f ns per lookup "
+	       "(%.1fx); %u cached, %u refreshed, %u missed; first lookup %.1f us; offsets %s\n",
+	       WORLD_CLOCK_ZONE_COUNT, opts.bench_count, cache_ns, shared_ns, shared_ns / cache_ns, cache.hits,
+	       cache.refreshes, cache.misses, rebuild_us, cache_sum == shared_sum ? "identical" : "DIFFERENT");
+	if (cache_sum != shared_sum) {
+		error("the cache's offsets differ from the shared processor's");
+	}
+}
+
+const Option OPTIONS[] = {
+	{ "from", "YEAR", "first year to check", opts.from_year },
+	{ "to", "YEAR", "last year to check", opts.to_year },
+	{ "step", "N", "seconds between the lookups checked", opts.step_s, 1 },
+	{ "bench-count", "N", "lookups in each timing run", opts.bench_count, 1 },
+	{ "verbose", "show the firmware's serial output", opts.verbose },
+};
+
+int worldClock(int argc, char **argv)
+{
+	int ret = parse_options(argc, argv, OPTIONS);
+	if (ret >= 0) {
+		return ret;
+	}
+	if (opts.to_year < opts.from_year) {
+		usage(argv[0], OPTIONS);
+		return 1;
+	}
+
+	checkEviction();
+	checkOffsets();
+
+	hal::options.speed = 0;
+	hal::options.step_us = 50000;
+	capture_serial(opts.verbose);
+	checkDisplay();
+
+	bench();
+	return errors() == 0 ? 0 : 1;
+}
+
+hal::ScenarioRegistration registration("world", "check the zone cache and the world clock display mode", worldClock);
+
+} // namespace
@@ -1,166 +1,783 @@
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <AceTime.h>
+#include <Animation.h>
 #include <nixie.h>
 #include <BQ32000RTC.h>
 #include <NtpClientLib.h>
 #include <TimeLib.h>
 #include <EEPROM.h>
+#include <coredecls.h>
+#include <Updater.h>
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
+#include <EventQueue.h>
+#include <HeapMonitor.h>
+#include <LoopWatchdog.h>
+#include <MetricsServer.h>
+#include <OtaServer.h>
+#include <PosixTz.h>
+#include <Settings.h>
+#include <SntpServer.h>
+#include <TickSync.h>
+#include <TimestampFormatter.h>
+#include <Trace.h>
+#include <ZoneCache.h>
 
 using namespace ace_time;
 
 // Interrupt function for changing the dot state every 1 second.
 IRAM_ATTR void irq_1Hz_int();
 
-// Interrupt function when button is pressed.
-IRAM_ATTR void touchButtonPressed();
+// Interrupt function when the touch sensor is touched or released.
+IRAM_ATTR void touchButtonChanged();
 
 const char *wifiDisconnectReasonStr(const enum WiFiDisconnectReason);
+void bootPhaseBegin(uint8_t);
+void bootPhaseEnd(uint8_t);
+bool checkAnimation(const char *);
+void checkBootProgress();
+bool checkDisplayFormat(const char *, DisplayFormatKind);
+void checkHeapActivity();
+void checkLoopTiming();
+void checkOtaResult();
+void checkRadioDutyCycle();
+void checkTickSyncReport();
+bool checkTimeZone(const char *);
+bool checkWorldClockZones(const char *);
+void checkWiFiFastConnect();
+void checkWiFiLease();
 void connectWiFi();
 void enableSecDot();
 void firstRunInit();
+const char *formatTime(time_t);
+void invalidateWiFiCache();
+bool loadWiFiCache(struct WiFiCache *);
+void loadAnimation();
+void loadDisplayFormats();
 void loadTimeZone();
-void parseSerialSet(String);
+void loadWorldClockZones();
+time_t localTime(time_t);
+void parseSerialCommand(const char *);
+void parseSerialSet(const char *);
+void playAnimation();
+void printBootReport();
+void printEventStats();
+void printHeapStats();
+void printMetrics();
+void printOtaStats();
+void printPostmortem();
+void printSntpStats();
+void printTickSyncStats();
 void printESPInfo();
 void printTime(time_t);
-void processSyncEvent(NTPSyncEvent_t);
+void printTouchStats();
+void printTraceStats();
+void printWatchdogStats();
+void printWiFiStats();
+void printZoneStats();
+void processEvents();
+void processOtaEvent(uint8_t, int8_t);
+void processSyncEvent(NTPSyncEvent_t, uint32_t);
+void processTouch();
+void radioOff(uint32_t);
+void radioOn();
+uint64_t radioOnMs();
 void readAndParseSerial();
 void readConfigButton();
+void printDisplayStats();
 void readParameters();
+void renderDisplay(time_t);
+time_t renderDateMode(time_t);
+time_t renderSecondsMode(time_t);
+time_t renderSyncAgeMode(time_t);
+time_t renderTimeMode(time_t);
+time_t renderUptimeMode(time_t);
+time_t renderWorldClockMode(time_t);
+time_t renderYearMode(time_t);
 void resetEepromToDefault();
+void runBenchmarks();
+void savePostmortem(uint32_t);
+void saveWiFiCache();
+void selectDisplayMode(const char *);
 void setSystemTimeFromRTC();
 void setupWiFi();
+void startMetricsServer();
 void startNTPClient();
+void startOtaServer();
+void startSntpServer();
+void startTickSync();
+void stopMetricsServer();
 void stopNTPClient();
-
-volatile bool dot_state = LOW;
-volatile bool touch_button_pressed = false;
+void stopOtaServer();
+void stopSntpServer();
+void stopTickSync();
+void touchEdge(bool, uint32_t);
+void touchGesture(uint8_t, uint32_t);
+void touchTransition(bool, uint32_t);
+void wifiAuthModeChanged(uint8_t, uint8_t);
+void wifiConnected(uint8_t);
+void wifiDisconnected(enum WiFiDisconnectReason);
+void wifiGotIP();
+uint32_t wifiCredentialsCrc();
+bool wifiCacheUsableAt(time_t);
+time_t wifiLeaseClock();
+time_t wifiRenewAtFromDhcp();
+
+bool dot_state = LOW;
 bool stopDef = false, secDotDef = false;
 bool serialTicker = false;
+bool tickSyncMeasure = false;
 bool ntpInitialized = false;
-bool syncEventTriggered = false;
+bool wifiFastConnect = false;
+bool wifiFastConnectFailed = false;
+time_t wifiRenewAt = 0;			// of the cached address in use
+bool systemTimeValid = false;
 
 time_t current_time;
 time_t last_printed_time;
 
 uint8_t configButton = 0;
 uint32_t buttonCounter;
-volatile uint8_t state = 0, dotPosition = 0b10;
-NTPSyncEvent_t ntpEvent;
-String serialCommand = "";
+uint8_t displayMode = 0;
+bool displayDirty = true;
+time_t displayNextUpdate = 0;
+uint8_t animatedMinute = 0xff;
+volatile uint8_t dotPosition = 0b10;
+uint32_t wifiConnectStartMs = 0;
+uint32_t wifiGotIpMs = 0;
+uint32_t wifiDownSinceMs = 0;
+uint32_t tickSyncReportMs = 0;
+uint8_t bootProgressDots = 0;
+char serialCommand[192];
+uint8_t serialCommandLength = 0;
+bool serialCommandOverflow = false;
 
 char cfg_ssid[50] = "\0";
 char cfg_password[50] = "\0";
 char cfg_ntp_server[50] = "\0";
 char cfg_time_zone[50] = "\0";
+char cfg_ota_password[OTA_PASSWORD_SIZE] = "\0";
+char cfg_animation[150] = "\0";
+char cfg_world_clock_zones[200] = "\0";
+char cfg_time_format[DISPLAY_FORMAT_SIZE] = "HHMM:00b0";
+char cfg_date_format[DISPLAY_FORMAT_SIZE] = "MMDD:0010";
 uint8_t cfg_24hr_enabled = 1;
 uint8_t cfg_ntp_enabled = 1;
+uint8_t cfg_wifi_fast_connect = 1;
+uint8_t cfg_sntp_server_enabled = 0;
+uint8_t cfg_metrics_enabled = 0;
+uint8_t cfg_wifi_sleep_enabled = 0;
+uint8_t cfg_tick_sync_mode = 0;
+uint16_t cfg_touch_debounce_ms = 30;
+uint16_t cfg_touch_double_tap_ms = 250;
+uint16_t cfg_touch_long_press_ms = 800;
+uint16_t cfg_loop_budget_ms = 2000;
 uint32_t cfg_ntp_sync_interval = 3671;
 
-#define DEFAULT__24HR_ENABLED		1
-#define DEFAULT__NTP_ENABLED		1
-#define DEFAULT__NTP_SERVER		"time.google.com"
-#define DEFAULT__NTP_SYNC_INTERVAL	3671
-#define DEFAULT__TIME_ZONE		"America/New_York"
-
-#define EEPROM_ADDR__24HR_ENABLED	10	// 1 byte
-#define EEPROM_ADDR__NTP_ENABLED	11	// 1 byte
-#define EEPROM_ADDR__NTP_SYNC_INTERVAL	50	// 4 bytes
-#define EEPROM_ADDR__SSID		100	// 50 bytes
-#define EEPROM_ADDR__PASSWORD		150	// 50 bytes
-#define EEPROM_ADDR__NTP_SERVER		200	// 50 bytes
-#define EEPROM_ADDR__TIME_ZONE		250	// 50 bytes
+#define EEPROM_SIZE			1024
 #define EEPROM_ADDR__MAGIC		500	// 8 bytes
 
 #define EEPROM_MAGIC			0x4e49584945544150
 
-static const int TZ_CACHE_SIZE = 1;
-static ExtendedZoneProcessorCache<TZ_CACHE_SIZE> zoneProcessorCache;
-static ExtendedZoneManager zoneManager(
+// RTC user memory offsets, in 4-byte blocks. RTC user memory survives warm
+// restarts and watchdog resets, but not a loss of power. The bootloader,
+// eboot, keeps its command to install an update in the first 32 blocks.
+#define RTCMEM_EBOOT_BLOCKS		32
+#define RTCMEM_ADDR__POSTMORTEM		32	// POSTMORTEM_BLOCKS blocks
+#define RTCMEM_ADDR__OTA_PENDING	107	// 10 blocks
+#define RTCMEM_ADDR__WIFI_CACHE		117	// 9 blocks
+
+static_assert(RTCMEM_ADDR__POSTMORTEM >= RTCMEM_EBOOT_BLOCKS, "The post-mortem leaves eboot's command alone.");
+static_assert(RTCMEM_ADDR__POSTMORTEM + POSTMORTEM_BLOCKS <= 128, "The post-mortem fits in RTC user memory.");
+
+// "To ensure that the correct time is read after backup mode, the host should
+// wait longer than 1 second after the main supply is greater than 2.8 V and
+// VBACK" -- bq32000. millis() starts counting after the supply is up, so
+// this is measured from boot.
+#define RTC_SETTLE_MS			1000
+
+// How often the heap state is sampled, and how often a steady-state loop()
+// iteration that allocated may be reported.
+#define HEAP_SAMPLE_INTERVAL_MS		10000
+#define HEAP_WARNING_INTERVAL_MS	60000
+
+// The longest loop() interval is tracked over windows of this length.
+#define LOOP_STATS_WINDOW_MS		10000
+
+// Iterations over loop_budget_ms are reported at most this often.
+#define LOOP_WARNING_INTERVAL_MS	10000
+
+// 'watchdog stall' stalls loop() for at most this long, past the soft
+// watchdog's 3.2 seconds, to check the post-mortem.
+#define WATCHDOG_STALL_MAX_MS		10000
+
+// How long a reconnect using the cached BSSID, channel and IP configuration
+// may take before falling back to a full scan and DHCP.
+#define WIFI_FAST_CONNECT_TIMEOUT_MS	4000
+
+// With wifi_sleep_enabled the radio is turned on this long before the next
+// NTP sync is due; a fast reconnect usually takes a fraction of it. When the
+// cached lease will be due for renewal, the full scan and DHCP take a few
+// seconds, and it's turned on WIFI_SLEEP_DHCP_WAKE_LEAD_MS before. If no
+// sync succeeds within WIFI_SLEEP_SYNC_TIMEOUT_MS the radio is turned off
+// again and the sync retried after WIFI_SLEEP_RETRY_S. The radio is never off
+// for longer than WIFI_SLEEP_MAX_S.
+#define WIFI_SLEEP_WAKE_LEAD_MS		1000
+#define WIFI_SLEEP_DHCP_WAKE_LEAD_MS	5000
+#define WIFI_SLEEP_SYNC_TIMEOUT_MS	60000
+#define WIFI_SLEEP_RETRY_S		300
+#define WIFI_SLEEP_MAX_S		86400
+
+// With 'ticksync measure' the phase errors are printed this often.
+#define TICK_SYNC_REPORT_INTERVAL_MS	10000
+
+// The world clock display mode shows each of its zones for this long.
+#define WORLD_CLOCK_ZONES		4
+#define WORLD_CLOCK_DWELL_S		3
+
+// Built with POSIX_TZ_ONLY, time zones are only given as POSIX TZ rules, and
+// AceTime's zone database and zone processor are left out of the firmware.
+#ifdef POSIX_TZ_ONLY
+#define TIME_ZONE_DEFAULT		"EST5EDT,M3.2.0,M11.1.0"
+#else
+#define TIME_ZONE_DEFAULT		"America/New_York"
+#endif
+
+/*
+ * Association and DHCP lease data from the last successful Wi-Fi connection.
+ * The 'crc' field covers the rest of the structure and 'credentials_crc'
+ * ties the cached data to the configured SSID and passphrase. The address is
+ * only reused until 'renew_at', half way through the lease, when a DHCP
+ * client would renew it; 0 if the lease or the time wasn't known.
+ */
+struct WiFiCache {
+	uint32_t crc;
+	uint32_t credentials_crc;
+	uint32_t ip;
+	uint32_t gateway;
+	uint32_t subnet;
+	uint32_t dns;
+	uint8_t bssid[6];
+	uint8_t channel;
+	uint8_t reserved;
+	uint32_t renew_at;		// UTC
+};
+
+/*
+ * Written before restarting into a firmware update, so that the next boot can
+ * check that the update was installed. 'sketch_md5' is the expected
+ * ESP.getSketchMD5(), or empty if it isn't known.
+ */
+struct OtaPending {
+	uint32_t crc;
+	char sketch_md5[33];
+	uint8_t reserved[3];
+};
+
+// Written after Update.end() has left eboot its command, which it must not
+// overwrite.
+static_assert(RTCMEM_ADDR__OTA_PENDING >= RTCMEM_EBOOT_BLOCKS, "The OTA record leaves eboot's command alone.");
+static_assert(RTCMEM_ADDR__OTA_PENDING >= RTCMEM_ADDR__POSTMORTEM + POSTMORTEM_BLOCKS, "The OTA record follows the post-mortem.");
+static_assert(RTCMEM_ADDR__OTA_PENDING + sizeof(struct OtaPending) / 4 <= 128, "The OTA record fits in RTC user memory.");
+// Likewise a reconnect while an update waits for the restart.
+static_assert(RTCMEM_ADDR__WIFI_CACHE >= RTCMEM_ADDR__OTA_PENDING + sizeof(struct OtaPending) / 4, "The Wi-Fi cache follows the OTA record.");
+static_assert(RTCMEM_ADDR__WIFI_CACHE + sizeof(struct WiFiCache) / 4 <= 128, "The Wi-Fi cache fits in RTC user memory.");
+
+/*
+ * Boot is split into phases that overlap where they can: the Wi-Fi connection
+ * and the time zone load proceed while the RTC settles, and the display shows
+ * the time as soon as the system time is valid. The start and end of each
+ * phase are recorded in milliseconds since boot for the 'boot' command.
+ */
+enum BootPhase {
+	BOOT_PHASE_EEPROM,
+	BOOT_PHASE_ZONE_LOAD,
+	BOOT_PHASE_RTC_SETTLE,
+	BOOT_PHASE_FIRST_DISPLAY,
+	BOOT_PHASE_WIFI_ASSOC,
+	BOOT_PHASE_WIFI_IP,
+	BOOT_PHASE_NTP_SYNC,
+	BOOT_PHASE_COUNT
+};
+
+struct BootPhaseTiming {
+	const char *name;
+	uint32_t start_ms;
+	uint32_t end_ms;
+	bool started;
+	bool ended;
+};
+
+struct BootPhaseTiming bootPhases[BOOT_PHASE_COUNT] = {
+	{ "eeprom", 0, 0, false, false },
+	{ "zone_load", 0, 0, false, false },
+	{ "rtc_settle", 0, 0, false, false },
+	{ "first_display", 0, 0, false, false },
+	{ "wifi_assoc", 0, 0, false, false },
+	{ "wifi_ip", 0, 0, false, false },
+	{ "ntp_sync", 0, 0, false, false },
+};
+
+/*
+ * Interrupt handlers and the NTP and Wi-Fi callbacks don't act on anything
+ * themselves. They post timestamped events that loop() drains in order, see
+ * processEvents(). Interrupts can preempt the callbacks, so each context
+ * posts to its own single-producer queue.
+ */
+enum EventType {
+	EVENT_SECOND_TICK,		// RTC 1 Hz edge
+	EVENT_TOUCH_EDGE,		// arg: sensor level after the edge
+	EVENT_NTP_SYNC,			// arg: NTPSyncEvent_t
+	EVENT_WIFI_CONNECTED,		// arg: channel
+	EVENT_WIFI_DISCONNECTED,	// arg: WiFiDisconnectReason
+	EVENT_WIFI_GOT_IP,
+	EVENT_WIFI_DHCP_TIMEOUT,
+	EVENT_WIFI_AUTH_MODE_CHANGED,	// arg: old mode << 8 | new mode
+	EVENT_OTA,			// arg: OtaEvent << 8 | event argument
+};
+
+EventQueue<32> isrEvents;	// posted from interrupt handlers
+EventQueue<16> systemEvents;	// posted from NTP, Wi-Fi and OTA callbacks
+
+enum TouchGesture {
+	TOUCH_TAP,
+	TOUCH_DOUBLE_TAP,
+	TOUCH_LONG_PRESS,
+	TOUCH_GESTURE_COUNT
+};
+
+const char * const TOUCH_GESTURE_NAMES[TOUCH_GESTURE_COUNT] = {
+	"tap",
+	"double_tap",
+	"long_press",
+};
+
+struct TouchState {
+	bool raw_level;			// level after the last queued edge
+	uint32_t raw_edge_us;		// time of the last queued edge
+	bool level;			// debounced level
+	uint32_t level_since_us;	// time of the last debounced transition
+	uint32_t down_us;		// start of the current press
+	uint32_t up_us;			// end of the last press
+	uint8_t taps;			// releases not yet turned into a gesture
+	bool long_press_fired;
+	uint32_t gestures[TOUCH_GESTURE_COUNT];
+	uint32_t bounces;
+	uint32_t last_latency_us;
+	uint32_t max_latency_us;
+};
+
+struct TouchState touch = {};
+
+/*
+ * Heap activity of loop(). An iteration is in steady state when the system
+ * time is valid and it handled no serial input and no Wi-Fi or NTP events.
+ * Steady-state iterations should never allocate: over months of uptime even
+ * short-lived allocations fragment the small heap.
+ */
+struct HeapActivity {
+	uint32_t loop_start_allocations;	// allocation count when the last iteration started
+	uint32_t loop_start_events;		// systemEvents.posted when it started
+	uint32_t loop_start_packets;		// tick sync packets sent and received by then
+	bool steady;				// whether the last iteration was in steady state
+	uint32_t steady_loops;
+	uint32_t allocating_loops;		// steady-state iterations that allocated
+	uint32_t allocations;			// allocations made by those
+	uint32_t unreported_loops;		// allocating iterations since the last warning
+	uint32_t last_warning_ms;
+	uint32_t last_sample_ms;
+};
+
+struct HeapActivity heapActivity = {};
+HeapMonitor heapMonitor;
+LoopWatchdog loopWatchdog;
+
+/*
+ * Timing of loop(), measured between the starts of successive iterations so
+ * that the time spent in the system context in between counts too. That is
+ * how late the display can be updated.
+ */
+struct LoopStats {
+	uint64_t iterations;
+	uint32_t last_start_us;
+	uint32_t max_us;		// longest interval in the current window
+	uint32_t prev_max_us;		// longest interval in the previous window
+	uint32_t window_start_ms;
+	uint32_t unreported_overruns;	// iterations over the budget since the last warning
+	uint32_t last_warning_ms;
+};
+
+struct LoopStats loopStats = {};
+
+/*
+ * NTP sync statistics. NtpClientLib reports the time only to the second, so
+ * the offset is in whole seconds; it is the NTP time minus the RTC time at
+ * the sync. The delay is the time from sending the request to the sync.
+ */
+struct NtpStats {
+	uint32_t syncs;
+	uint32_t errors;
+	bool request_pending;
+	uint32_t request_us;
+	bool delay_valid;
+	uint32_t delay_us;
+	bool offset_valid;
+	int32_t offset_s;
+};
+
+struct NtpStats ntpStats = {};
+
+struct WiFiStats {
+	uint32_t connects;
+	uint32_t disconnects;
+};
+
+struct WiFiStats wifiStats = {};
+
+/*
+ * Radio duty cycle with wifi_sleep_enabled. The radio is turned off after
+ * each NTP sync and back on shortly before the next one is due, when the
+ * station reconnects with the cached association data. 'on_ms' is the
+ * radio-on time up to 'on_since_ms', when the radio was last turned on.
+ */
+struct RadioState {
+	bool off;
+	uint32_t on_since_ms;
+	uint64_t on_ms;
+	uint32_t wake_at_ms;		// when to turn the radio on while it's off
+	bool sync_pending;		// turned on for a sync that hasn't happened yet
+	uint32_t wakes;
+	uint32_t missed_syncs;		// wakes that timed out without a sync
+};
+
+struct RadioState radio = {};
+
+SntpServer sntpServer;
+TickSync tickSync;
+MetricsServer metricsServer;
+OtaServer otaServer;
+TimestampFormatter timestampFormatter;
+Animation animation;
+AnimationPlayer animationPlayer;
+DisplayFormat timeDisplayFormat;
+DisplayFormat dateDisplayFormat;
+
+/*
+ * Display modes, cycled through by tapping the touch sensor. A mode's render
+ * function writes the display and returns the system time at which its output
+ * next changes. loop() only calls the active mode again after that time, or
+ * when the display has been marked dirty (mode switch, time or setting
+ * change). Modes with 'uses_dot' are also rendered on each RTC 1 Hz tick to
+ * blink the dot. Render times are checked against the mode's budget.
+ */
+struct DisplayMode {
+	const char *name;
+	time_t (*render)(time_t);
+	bool uses_dot;
+	uint32_t budget_us;
+	uint32_t renders;
+	uint32_t over_budget;
+	uint32_t last_us;
+	uint32_t max_us;
+};
+
+struct DisplayMode displayModes[] = {
+	{ "time", renderTimeMode, true, 5000, 0, 0, 0, 0 },
+	{ "date", renderDateMode, false, 5000, 0, 0, 0, 0 },
+	{ "seconds", renderSecondsMode, true, 5000, 0, 0, 0, 0 },
+	{ "year", renderYearMode, false, 5000, 0, 0, 0, 0 },
+	{ "uptime", renderUptimeMode, false, 5000, 0, 0, 0, 0 },
+	{ "sync_age", renderSyncAgeMode, false, 5000, 0, 0, 0, 0 },
+	{ "world", renderWorldClockMode, false, 5000, 0, 0, 0, 0 },
+};
+
+#define DISPLAY_MODE_COUNT (sizeof(displayModes) / sizeof(displayModes[0]))
+
+/*
+ * Metrics served at /metrics in the Prometheus text format. The read
+ * functions are called from the network stack's callbacks while a scrape is
+ * written out, so they must be quick and must not allocate.
+ */
+const Metric METRICS[] = {
+	{ "nixietap_uptime_seconds", "Time since boot.", METRIC_GAUGE, 3,
+	  [](int64_t &v) { v = micros64() / 1000; return true; } },
+	{ "nixietap_heap_free_bytes", "Free heap.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = ESP.getFreeHeap(); return true; } },
+	{ "nixietap_heap_free_min_bytes", "Lowest sampled free heap since boot.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = heapMonitor.min_free_heap; return heapMonitor.samples > 0; } },
+	{ "nixietap_heap_max_block_bytes", "Largest free heap block.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = ESP.getMaxFreeBlockSize(); return true; } },
+	{ "nixietap_heap_fragmentation_ratio", "Heap fragmentation.", METRIC_GAUGE, 2,
+	  [](int64_t &v) { v = ESP.getHeapFragmentation(); return true; } },
+	{ "nixietap_heap_allocating_loops_total", "Steady-state loop iterations that allocated memory.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = heapActivity.allocating_loops; return true; } },
+	{ "nixietap_loop_iterations_total", "Main loop iterations.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = loopStats.iterations; return true; } },
+	{ "nixietap_loop_overruns_total", "Main loop iterations over loop_budget_ms.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = loopWatchdog.overruns; return true; } },
+	{ "nixietap_loop_interval_max_seconds", "Longest time between main loop iterations in the last 10 to 20 seconds.", METRIC_GAUGE, 6,
+	  [](int64_t &v) { v = max(loopStats.max_us, loopStats.prev_max_us); return true; } },
+	{ "nixietap_events_dropped_total", "Interrupt and callback events dropped because a queue was full.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = (int64_t)isrEvents.dropped + systemEvents.dropped; return true; } },
+	{ "nixietap_ntp_syncs_total", "Successful NTP syncs.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = ntpStats.syncs; return true; } },
+	{ "nixietap_ntp_errors_total", "Failed NTP syncs.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = ntpStats.errors; return true; } },
+	{ "nixietap_ntp_last_sync_age_seconds", "Time since the last successful NTP sync.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = now() - NTP.getLastNTPSync(); return NTP.getLastNTPSync() != 0 && v >= 0; } },
+	{ "nixietap_ntp_offset_seconds", "NTP time minus RTC time at the last sync, to the second.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = ntpStats.offset_s; return ntpStats.offset_valid; } },
+	{ "nixietap_ntp_delay_seconds", "Time from sending the last NTP request to the sync.", METRIC_GAUGE, 6,
+	  [](int64_t &v) { v = ntpStats.delay_us; return ntpStats.delay_valid; } },
+	{ "nixietap_wifi_connected", "Whether the Wi-Fi station is connected.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = WiFi.isConnected(); return true; } },
+	{ "nixietap_wifi_rssi_dbm", "Signal strength of the access point.", METRIC_GAUGE, 0,
+	  [](int64_t &v) { v = WiFi.RSSI(); return WiFi.isConnected(); } },
+	{ "nixietap_wifi_connects_total", "Wi-Fi associations.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = wifiStats.connects; return true; } },
+	{ "nixietap_wifi_disconnects_total", "Wi-Fi disconnections.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = wifiStats.disconnects; return true; } },
+	{ "nixietap_wifi_radio_on_seconds_total", "Time the Wi-Fi radio was on.", METRIC_COUNTER, 3,
+	  [](int64_t &v) { v = radioOnMs(); return true; } },
+	{ "nixietap_rtc_i2c_errors_total", "Failed I2C transfers to the RTC.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = RTC.i2cErrors(); return true; } },
+	{ "nixietap_metrics_scrapes_total", "Completed scrapes of this endpoint.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = metricsServer.scrapes; return true; } },
+	{ "nixietap_ota_failures_total", "Failed or rejected firmware uploads.", METRIC_COUNTER, 0,
+	  [](int64_t &v) { v = otaServer.failures; return otaServer.running(); } },
+};
+
+#define METRIC_COUNT (sizeof(METRICS) / sizeof(METRICS[0]))
+
+static void applyNtpEnabled()
+{
+	// Stop or start the NTP client.
+	if (cfg_ntp_enabled == 0 && ntpInitialized) {
+		stopNTPClient();
+	} else if (cfg_ntp_enabled == 1 && !ntpInitialized) {
+		startNTPClient();
+	}
+}
+
+static void restartNTPClient()
+{
+	if (cfg_ntp_enabled && ntpInitialized) {
+		startNTPClient();
+	}
+}
+
+static void applyWiFiSleep()
+{
+	// Turn the radio off until the next sync, or back on.
+	if (cfg_wifi_sleep_enabled == 1 && WiFi.isConnected() && NTP.getLastNTPSync() != 0) {
+		radioOff(max((int32_t)(NTP.getLastNTPSync() + cfg_ntp_sync_interval - now()), (int32_t)0));
+	} else if (cfg_wifi_sleep_enabled != 1 && radio.off) {
+		connectWiFi();
+	}
+}
+
+static void applySntpServer()
+{
+	if (cfg_sntp_server_enabled == 1) {
+		startSntpServer();
+	} else {
+		stopSntpServer();
+	}
+}
+
+static void applyTickSyncMode()
+{
+	// Restart tick sync in the new mode. It needs the radio on.
+	stopTickSync();
+	startTickSync();
+	if (cfg_tick_sync_mode != 0 && radio.off) {
+		connectWiFi();
+	}
+}
+
+static void applyMetricsServer()
+{
+	if (cfg_metrics_enabled == 1) {
+		startMetricsServer();
+	} else {
+		stopMetricsServer();
+	}
+}
+
+static void restartOtaServer()
+{
+	// Restart the update server with the new password, or stop it.
+	stopOtaServer();
+	startOtaServer();
+}
+
+static void applyAnimation()
+{
+	loadAnimation();
+	animatedMinute = 0xff;
+}
+
+/*
+ * Settings kept in the EEPROM, changed with 'set NAME VALUE'. Settings
+ * added to an EEPROM initialized by an older firmware version read as unset
+ * and take their defaults. Free EEPROM bytes: 0-9, 23, 46-49, 54-99, 508-511
+ * and 712-1023.
+ */
+constexpr Setting SETTINGS[] = {
+	settingUint8("24hr_enabled", cfg_24hr_enabled, 10, 0, 1, 1),
+	settingString("time_format", cfg_time_format, 24, 4, "HHMM:00b0", loadDisplayFormats,
+		      [](const char *v) { return checkDisplayFormat(v, DISPLAY_FORMAT_TIME); }),
+	settingString("date_format", cfg_date_format, 34, 4, "MMDD:0010", loadDisplayFormats,
+		      [](const char *v) { return checkDisplayFormat(v, DISPLAY_FORMAT_DATE); }),
+	settingUint8("ntp_enabled", cfg_ntp_enabled, 11, 0, 1, 1, applyNtpEnabled),
+	settingUint32("ntp_sync_interval", cfg_ntp_sync_interval, 50, 15, 604800, 3671, restartNTPClient),
+	settingString("ntp_server", cfg_ntp_server, 200, 1, "time.google.com", restartNTPClient),
+	settingString("time_zone", cfg_time_zone, 250, 1, TIME_ZONE_DEFAULT, loadTimeZone, checkTimeZone),
+	settingString("ssid", cfg_ssid, 100, 0, "", connectWiFi),
+	settingString("password", cfg_password, 150, 0, "", connectWiFi),
+	settingUint8("wifi_fast_connect", cfg_wifi_fast_connect, 12, 0, 1, 1),
+	settingUint8("wifi_sleep_enabled", cfg_wifi_sleep_enabled, 21, 0, 1, 0, applyWiFiSleep),
+	settingUint8("sntp_server_enabled", cfg_sntp_server_enabled, 13, 0, 1, 0, applySntpServer),
+	settingUint8("tick_sync_mode", cfg_tick_sync_mode, 22, TICK_SYNC_OFF, TICK_SYNC_FOLLOWER, TICK_SYNC_OFF,
+		     applyTickSyncMode),
+	settingUint8("metrics_enabled", cfg_metrics_enabled, 20, 0, 1, 0, applyMetricsServer),
+	settingString("ota_password", cfg_ota_password, 300, 0, "", restartOtaServer, NULL, "(not set)", true),
+	settingString("animation", cfg_animation, 350, 0, "", applyAnimation, checkAnimation, "(built-in)"),
+	settingString("world_clock_zones", cfg_world_clock_zones, 512, 0, "", loadWorldClockZones,
+		      checkWorldClockZones, "(none)"),
+	settingUint16("touch_debounce_ms", cfg_touch_debounce_ms, 14, 0, 1000, 30),
+	settingUint16("touch_double_tap_ms", cfg_touch_double_tap_ms, 16, 0, 2000, 250),
+	settingUint16("touch_long_press_ms", cfg_touch_long_press_ms, 18, 0, 10000, 800),
+	settingUint16("loop_budget_ms", cfg_loop_budget_ms, 44, 0, 10000, 2000),
+};
+
+#define SETTING_COUNT (sizeof(SETTINGS) / sizeof(SETTINGS[0]))
+
+static_assert(!Settings::overlaps(SETTINGS, SETTING_COUNT, EEPROM_ADDR__MAGIC, sizeof(EEPROM_MAGIC), EEPROM_SIZE),
+	      "Settings overlap in the EEPROM.");
+
+Settings settings(SETTINGS, SETTING_COUNT);
+
+#ifndef POSIX_TZ_ONLY
+static const ExtendedZoneRegistrar zoneRegistrar(
 	zonedbx::kZoneAndLinkRegistrySize,
-	zonedbx::kZoneAndLinkRegistry,
-	zoneProcessorCache);
-TimeZone time_zone;
+	zonedbx::kZoneAndLinkRegistry);
+ZoneCache zoneCache(zoneRegistrar);
+#endif
+
+// A zone of the database, by its index in the registry, or else a POSIX TZ
+// rule.
+struct ClockZone {
+	uint16_t index = ZONE_CACHE_NONE;
+	PosixTimeZone posix;
+};
+
+ClockZone localZone;
+ClockZone worldClockZones[WORLD_CLOCK_ZONES];
+uint8_t worldClockZoneCount = 0;
+CivilTime localCivil;
 
 void setup()
 {
 	Serial.println("\33[2K\r\nNixie Tap is booting!");
+	if (loopWatchdog.load(RTCMEM_ADDR__POSTMORTEM)) {
+		Serial.println("[Postmortem] Saved before the last reset, see 'postmortem'.");
+	}
 
-	// Progress bar: 25%.
-	nixieTap.write(10, 10, 10, 10, 0b10);
+	// The RTC was started by the Nixie constructor. Its settling time runs
+	// from power-up and overlaps the rest of the boot sequence.
+	bootPhaseBegin(BOOT_PHASE_RTC_SETTLE);
+	bootPhases[BOOT_PHASE_RTC_SETTLE].start_ms = 0;
+	bootPhaseBegin(BOOT_PHASE_FIRST_DISPLAY);
+	bootPhases[BOOT_PHASE_FIRST_DISPLAY].start_ms = 0;
 
 	// Touch button interrupt.
-	attachInterrupt(digitalPinToInterrupt(TOUCH_BUTTON), touchButtonPressed, RISING);
-
-	// Progress bar: 50%.
-	nixieTap.write(10, 10, 10, 10, 0b110);
+	touch.raw_level = touch.level = digitalRead(TOUCH_BUTTON) == HIGH;
+	attachInterrupt(digitalPinToInterrupt(TOUCH_BUTTON), touchButtonChanged, CHANGE);
 
-	// Reset EEPROM if uninitialized.
+	// Reset EEPROM if uninitialized, and read all stored parameters.
+	bootPhaseBegin(BOOT_PHASE_EEPROM);
 	firstRunInit();
-
-	// Read all stored parameters from EEPROM.
 	readParameters();
+	loadAnimation();
+	loadDisplayFormats();
+	bootPhaseEnd(BOOT_PHASE_EEPROM);
 
-	// Setup WiFi station mode settings and begin connection attempt.
+	// Setup WiFi station mode settings and begin connection attempt. The
+	// connection completes in the background.
 	setupWiFi();
 	connectWiFi();
 
 	// Load time zone.
+	bootPhaseBegin(BOOT_PHASE_ZONE_LOAD);
 	loadTimeZone();
-
-	// Progress bar: 75%.
-	nixieTap.write(10, 10, 10, 10, 0b1110);
-
-	// Set the system time from the on-board RTC.
-	RTC.begin(D3, D4);
-	RTC.setCharger(2);
-	// "To ensure that the correct time is read after backup mode, the host
-	// should wait longer than 1 second after the main supply is greater
-	// than 2.8 V and VBACK" -- bq32000
-	delay(1000);
-	setSystemTimeFromRTC();
-	printTime(now());
+	loadWorldClockZones();
+	bootPhaseEnd(BOOT_PHASE_ZONE_LOAD);
 
 	enableSecDot();
 
-	// Progress bar: 100%.
-	nixieTap.write(10, 10, 10, 10, 0b11110);
+	// Serve time to the LAN if enabled. Requests are ignored until the
+	// system time is valid.
+	startSntpServer();
+	startTickSync();
+	startMetricsServer();
+	startOtaServer();
+	checkOtaResult();
+
+	// The system time is set from the RTC by checkBootProgress() once the
+	// RTC has settled, unless an NTP sync arrives first.
+	checkBootProgress();
 }
 
 void loop()
 {
-	// Handle an event triggered from the NTP client.
-	if (syncEventTriggered) {
-		processSyncEvent(ntpEvent);
-		syncEventTriggered = false;
+	// Account the timing and heap activity of the previous iteration.
+	loopWatchdog.stage(TRACE_EVENT_LOOP_ACCOUNTING);
+	checkLoopTiming();
+	checkHeapActivity();
+
+	// Handle events posted by interrupt handlers and callbacks.
+	loopWatchdog.stage(TRACE_EVENT_LOOP_EVENTS);
+	processEvents();
+
+	// Show boot progress until the system time is valid.
+	if (!systemTimeValid) {
+		checkBootProgress();
+		if (!systemTimeValid) {
+			readAndParseSerial();
+			checkWiFiFastConnect();
+			loopWatchdog.stage(TRACE_EVENT_LOOP_END);
+			return;
+		}
 	}
 
-	// Get the current time and calculate its offset from UTC.
+	loopWatchdog.stage(TRACE_EVENT_LOOP_DISPLAY);
 	current_time = now();
-	int32_t offset = ZonedDateTime::forUnixSeconds64(current_time, time_zone).timeOffset().toSeconds();
-
-	// State machine.
-	if (state > 1) {
-		state = 0;
-	}
 
-	// Slot 0 - time
-	if (state == 0) {
-		nixieTap.writeTime(current_time + offset, dot_state, cfg_24hr_enabled);
+	// A tick sync follower locked to its leader ticks at the leader's
+	// edges instead of its own RTC's.
+	if (tickSync.poll(micros())) {
+		dot_state = !dot_state;
+		if (displayModes[displayMode].uses_dot) {
+			displayDirty = true;
+		}
 	}
 
-	// Slot 1 - date
-	if (state == 1) {
-		nixieTap.writeDate(current_time + offset, 1);
-	}
+	// Turn touch sensor edges into gestures and act on them.
+	processTouch();
 
-	// Print the current time if the touch sensor was pressed.
-	if (touch_button_pressed) {
-		touch_button_pressed = false;
-		printTime(current_time);
+	// Render the active display mode if its output may have changed. With
+	// tick sync the display shows the second started at the last
+	// synchronized edge.
+	time_t display_time = tickSync.ticking() ? tickSync.seconds() : current_time;
+	if (displayDirty || display_time >= displayNextUpdate) {
+		renderDisplay(display_time);
 	}
+	playAnimation();
 
 	// Print the current time if the serial ticker is enabled.
+	loopWatchdog.stage(TRACE_EVENT_LOOP_SERIAL);
 	if (serialTicker) {
 		printTime(current_time);
 	}
@@ -169,7 +786,20 @@ void loop()
 	readAndParseSerial();
 
 	// Handle config button presses.
+	loopWatchdog.stage(TRACE_EVENT_LOOP_BACKGROUND);
 	readConfigButton();
+
+	// Fall back to a full scan if a fast Wi-Fi reconnect did not succeed,
+	// and stop reusing its address when the lease is due for renewal.
+	checkWiFiFastConnect();
+	checkWiFiLease();
+
+	// Turn the radio on when the next NTP sync is due.
+	checkRadioDutyCycle();
+
+	// Print the tick sync phase errors if measuring.
+	checkTickSyncReport();
+	loopWatchdog.stage(TRACE_EVENT_LOOP_END);
 }
 
 void setupWiFi()
@@ -182,148 +812,1301 @@ void setupWiFi()
 	static WiFiEventHandler eh_sta_dhcp_timeout =
 		WiFi.onStationModeDHCPTimeout([](void)
 	{
-		Serial.println("[Wi-Fi] DHCP timeout");
+		TRACE(TRACE_WIFI, TRACE_EVENT_WIFI_DHCP_TIMEOUT, 0);
+		systemEvents.post(EVENT_WIFI_DHCP_TIMEOUT);
 	});
 
 	static WiFiEventHandler eh_sta_got_ip =
 		WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP& event)
 	{
-		Serial.print("[Wi-Fi] DHCP succeeded, IP address ");
-		Serial.print(WiFi.localIP());
-		Serial.print(", subnet mask ");
-		Serial.print(WiFi.subnetMask());
-		Serial.print(", gateway ");
-		Serial.print(WiFi.gatewayIP());
-		Serial.print(", DNS ");
-		Serial.println(WiFi.dnsIP());
-
-		// Start the NTP client if enabled.
-		startNTPClient();
+		TRACE(TRACE_WIFI, TRACE_EVENT_WIFI_GOT_IP, 0);
+		systemEvents.post(EVENT_WIFI_GOT_IP);
 	});
 
 	static WiFiEventHandler eh_sta_auth_mode_changed =
 		WiFi.onStationModeAuthModeChanged([](const WiFiEventStationModeAuthModeChanged& event)
 	{
-		static const char * const AUTH_MODE_NAMES[] {
-			"AUTH_OPEN",
-			"AUTH_WEP",
-			"AUTH_WPA_PSK",
-			"AUTH_WPA2_PSK",
-			"AUTH_WPA_WPA2_PSK",
-			"AUTH_MAX"
-		};
-		Serial.print("[Wi-Fi] Authentication mode changed, old mode ");
-		Serial.print(AUTH_MODE_NAMES[event.oldMode]);
-		Serial.print(", new mode ");
-		Serial.println(AUTH_MODE_NAMES[event.newMode]);
+		TRACE(TRACE_WIFI, TRACE_EVENT_WIFI_AUTH_MODE_CHANGED, event.oldMode << 8 | event.newMode);
+		systemEvents.post(EVENT_WIFI_AUTH_MODE_CHANGED, event.oldMode << 8 | event.newMode);
 	});
 
 	static WiFiEventHandler eh_sta_connected =
 		WiFi.onStationModeConnected([](const WiFiEventStationModeConnected& event)
 	{
-		Serial.print("[Wi-Fi] Station connected, SSID \"");
-		Serial.print(WiFi.SSID());
-		Serial.print("\", channel ");
-		Serial.print(event.channel);
-		Serial.print(", RSSI ");
-		Serial.print(WiFi.RSSI());
-		Serial.print(" dBm, BSSID ");
-		Serial.println(WiFi.BSSIDstr());
+		TRACE(TRACE_WIFI, TRACE_EVENT_WIFI_CONNECTED, event.channel);
+		systemEvents.post(EVENT_WIFI_CONNECTED, event.channel);
 	});
 
 	static WiFiEventHandler eh_sta_disconnected =
 		WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected& event)
 	{
-		Serial.print("[Wi-Fi] Station disconnected, reason: ");
-		Serial.print(wifiDisconnectReasonStr(event.reason));
-		Serial.print(" (");
-		Serial.print((unsigned)event.reason);
-		Serial.println(")");
+		TRACE(TRACE_WIFI, TRACE_EVENT_WIFI_DISCONNECTED, event.reason);
+		systemEvents.post(EVENT_WIFI_DISCONNECTED, event.reason);
+	});
+}
+
+void wifiGotIP()
+{
+	wifiGotIpMs = millis();
+	bootPhaseEnd(BOOT_PHASE_WIFI_IP);
+	bootPhaseBegin(BOOT_PHASE_NTP_SYNC);
+
+	if (wifiFastConnect) {
+		Serial.print("[Wi-Fi] Reused cached IP configuration, IP address ");
+	} else {
+		Serial.print("[Wi-Fi] DHCP succeeded, IP address ");
+	}
+	Serial.print(WiFi.localIP());
+	Serial.print(", subnet mask ");
+	Serial.print(WiFi.subnetMask());
+	Serial.print(", gateway ");
+	Serial.print(WiFi.gatewayIP());
+	Serial.print(", DNS ");
+	Serial.print(WiFi.dnsIP());
+	Serial.print(" (");
+	Serial.print(wifiGotIpMs - wifiDownSinceMs);
+	Serial.println(" ms to connect)");
+	wifiDownSinceMs = 0;
+
+	// Remember this association and lease for the next reconnect.
+	saveWiFiCache();
+
+	// Start the NTP client if enabled.
+	startNTPClient();
+}
+
+void wifiAuthModeChanged(uint8_t old_mode, uint8_t new_mode)
+{
+	static const char * const AUTH_MODE_NAMES[] {
+		"AUTH_OPEN",
+		"AUTH_WEP",
+		"AUTH_WPA_PSK",
+		"AUTH_WPA2_PSK",
+		"AUTH_WPA_WPA2_PSK",
+		"AUTH_MAX"
+	};
+	Serial.print("[Wi-Fi] Authentication mode changed, old mode ");
+	Serial.print(AUTH_MODE_NAMES[old_mode]);
+	Serial.print(", new mode ");
+	Serial.println(AUTH_MODE_NAMES[new_mode]);
+}
+
+void wifiConnected(uint8_t channel)
+{
+	bootPhaseEnd(BOOT_PHASE_WIFI_ASSOC);
+	bootPhaseBegin(BOOT_PHASE_WIFI_IP);
+
+	Serial.print("[Wi-Fi] Station connected, SSID \"");
+	Serial.print(WiFi.SSID());
+	Serial.print("\", channel ");
+	Serial.print(channel);
+	Serial.print(", RSSI ");
+	Serial.print(WiFi.RSSI());
+	Serial.print(" dBm, BSSID ");
+	Serial.println(WiFi.BSSIDstr());
+
+	wifiStats.connects++;
+}
+
+void wifiDisconnected(enum WiFiDisconnectReason reason)
+{
+	// The result of radioOff(), which has already stopped the NTP client.
+	if (radio.off) {
+		return;
+	}
+
+	Serial.print("[Wi-Fi] Station disconnected, reason: ");
+	Serial.print(wifiDisconnectReasonStr(reason));
+	Serial.print(" (");
+	Serial.print((unsigned)reason);
+	Serial.println(")");
+
+	wifiStats.disconnects++;
+	if (wifiDownSinceMs == 0) {
+		wifiDownSinceMs = millis();
+	}
+
+	// The cached BSSID or channel may be stale. Let the main loop
+	// retry with a full scan, unless this is the result of our own
+	// WiFi.disconnect().
+	if (wifiFastConnect && reason != WIFI_DISCONNECT_REASON_ASSOC_LEAVE) {
+		wifiFastConnectFailed = true;
+	}
+
+	// Stop the NTP client if it's running.
+	stopNTPClient();
+}
+
+void connectWiFi()
+{
+	radioOn();
+	WiFi.disconnect();
+
+	if (cfg_ssid[0] == '\0' || cfg_password[0] == '\0') {
+		return;
+	}
+
+	wifiConnectStartMs = millis();
+	wifiDownSinceMs = wifiConnectStartMs;
+	bootPhaseBegin(BOOT_PHASE_WIFI_ASSOC);
+	wifiFastConnectFailed = false;
+
+	struct WiFiCache cache;
+	bool cached = cfg_wifi_fast_connect == 1 && loadWiFiCache(&cache);
+	if (cached && (time_t)cache.renew_at <= wifiLeaseClock()) {
+		Serial.println("[Wi-Fi] The cached IP address is due for renewal, using DHCP.");
+		cached = false;
+	}
+	if (cached) {
+		// Skip the scan and DHCP by reusing the last association and lease.
+		WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+		WiFi.begin(cfg_ssid, cfg_password, cache.channel, cache.bssid);
+		wifiFastConnect = true;
+		wifiRenewAt = cache.renew_at;
+
+		Serial.print("[Wi-Fi] Fast reconnect to access point: ");
+		Serial.print(cfg_ssid);
+		Serial.print(", channel ");
+		Serial.print(cache.channel);
+		Serial.print(", BSSID ");
+		for (int i = 0; i < 6; i++) {
+			if (i > 0) {
+				Serial.print(":");
+			}
+			if (cache.bssid[i] < 0x10) {
+				Serial.print("0");
+			}
+			Serial.print(cache.bssid[i], HEX);
+		}
+		Serial.println();
+		return;
+	}
+
+	// Full scan, and use DHCP rather than any previous static configuration.
+	WiFi.config(IPAddress(), IPAddress(), IPAddress());
+	WiFi.begin(cfg_ssid, cfg_password);
+	wifiFastConnect = false;
+
+	Serial.print("[Wi-Fi] Connecting to access point: ");
+	Serial.println(cfg_ssid);
+}
+
+/*
+ * Abandon a fast reconnect that has failed or is taking too long, forget the
+ * cached association data, and retry with a full scan and DHCP.
+ */
+void checkWiFiFastConnect()
+{
+	if (!wifiFastConnect || wifiDownSinceMs == 0) {
+		return;
+	}
+
+	if (wifiFastConnectFailed || millis() - wifiDownSinceMs > WIFI_FAST_CONNECT_TIMEOUT_MS) {
+		Serial.println("[Wi-Fi] Fast reconnect failed, falling back to a full scan.");
+		invalidateWiFiCache();
+		connectWiFi();
+	}
+}
+
+/*
+ * A reused address isn't renewed by the DHCP client, which is stopped, so
+ * reconnect with DHCP when the client would have renewed the lease.
+ */
+void checkWiFiLease()
+{
+	if (!wifiFastConnect || !WiFi.isConnected() || !systemTimeValid || now() < wifiRenewAt) {
+		return;
+	}
+	connectWiFi();
+}
+
+/*
+ * Whether a reconnect at 't' can reuse the cached address, rather than scan
+ * and ask the DHCP server.
+ */
+bool wifiCacheUsableAt(time_t t)
+{
+	struct WiFiCache cache;
+	return cfg_wifi_fast_connect == 1 && loadWiFiCache(&cache) && (time_t)cache.renew_at > t;
+}
+
+/*
+ * The time against which the cached lease is checked. After power-up the
+ * system time is only set once the RTC has settled, but a valid cache means
+ * there was no loss of power, and the RTC can be read at once.
+ */
+time_t wifiLeaseClock()
+{
+	return systemTimeValid ? now() : RTC.get();
+}
+
+/*
+ * When the DHCP client would renew the lease it just obtained, or 0 if the
+ * lease or the time isn't known.
+ */
+time_t wifiRenewAtFromDhcp()
+{
+	struct dhcp *dhcp = netif_default != NULL ? netif_dhcp_data(netif_default) : NULL;
+	if (dhcp == NULL || dhcp->offered_t0_lease == 0 || !systemTimeValid) {
+		return 0;
+	}
+	return now() + dhcp->offered_t0_lease / 2;
+}
+
+uint32_t wifiCredentialsCrc()
+{
+	uint32_t crc = crc32(cfg_ssid, strlen(cfg_ssid));
+	return crc32(cfg_password, strlen(cfg_password), crc);
+}
+
+bool loadWiFiCache(struct WiFiCache *cache)
+{
+	if (!ESP.rtcUserMemoryRead(RTCMEM_ADDR__WIFI_CACHE, (uint32_t *)cache, sizeof(*cache))) {
+		return false;
+	}
+	if (cache->crc != crc32((uint8_t *)cache + sizeof(cache->crc), sizeof(*cache) - sizeof(cache->crc))) {
+		return false;
+	}
+	return cache->credentials_crc == wifiCredentialsCrc() && cache->channel != 0;
+}
+
+void saveWiFiCache()
+{
+	struct WiFiCache cache, old;
+	memset(&cache, 0, sizeof(cache));
+	cache.credentials_crc = wifiCredentialsCrc();
+	cache.ip = WiFi.localIP();
+	cache.gateway = WiFi.gatewayIP();
+	cache.subnet = WiFi.subnetMask();
+	cache.dns = WiFi.dnsIP();
+	memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+	cache.channel = WiFi.channel();
+	// A reused address keeps the lease it was obtained with.
+	cache.renew_at = wifiFastConnect ? wifiRenewAt : wifiRenewAtFromDhcp();
+	cache.crc = crc32((uint8_t *)&cache + sizeof(cache.crc), sizeof(cache) - sizeof(cache.crc));
+
+	// Avoid rewriting RTC memory when nothing has changed.
+	if (ESP.rtcUserMemoryRead(RTCMEM_ADDR__WIFI_CACHE, (uint32_t *)&old, sizeof(old)) && memcmp(&old, &cache, sizeof(cache)) == 0) {
+		return;
+	}
+	ESP.rtcUserMemoryWrite(RTCMEM_ADDR__WIFI_CACHE, (uint32_t *)&cache, sizeof(cache));
+}
+
+void invalidateWiFiCache()
+{
+	struct WiFiCache cache;
+	memset(&cache, 0, sizeof(cache));
+	ESP.rtcUserMemoryWrite(RTCMEM_ADDR__WIFI_CACHE, (uint32_t *)&cache, sizeof(cache));
+}
+
+/*
+ * Turn the radio off until 'seconds' before the next NTP sync is due. The
+ * disconnect this causes is ignored by wifiDisconnected().
+ */
+void radioOff(uint32_t seconds)
+{
+	seconds = min(seconds, (uint32_t)WIFI_SLEEP_MAX_S);
+	// The reconnect needs DHCP if the lease is due for renewal by then.
+	uint32_t lead_ms = wifiCacheUsableAt(now() + seconds) ? WIFI_SLEEP_WAKE_LEAD_MS : WIFI_SLEEP_DHCP_WAKE_LEAD_MS;
+	// Tick sync exchanges packets every second, so the radio stays on.
+	if (radio.off || seconds * 1000 <= lead_ms || cfg_tick_sync_mode != 0) {
+		return;
+	}
+
+	uint32_t on_ms = millis() - radio.on_since_ms;
+	radio.off = true;
+	radio.on_ms += on_ms;
+	radio.wake_at_ms = millis() + seconds * 1000 - lead_ms;
+
+	// Turning the radio off and on may allocate.
+	heapActivity.steady = false;
+	stopNTPClient();
+	WiFi.disconnect();
+	WiFi.forceSleepBegin();
+
+	Serial.print("[Wi-Fi] Radio off after ");
+	Serial.print(on_ms);
+	Serial.print(" ms, next NTP sync in ");
+	Serial.print(seconds);
+	Serial.println(" s");
+}
+
+void radioOn()
+{
+	if (!radio.off) {
+		return;
+	}
+	radio.off = false;
+	radio.on_since_ms = millis();
+	heapActivity.steady = false;
+	WiFi.forceSleepWake();
+	WiFi.mode(WIFI_STA);
+}
+
+uint64_t radioOnMs()
+{
+	return radio.on_ms + (radio.off ? 0 : millis() - radio.on_since_ms);
+}
+
+/*
+ * Turn the radio on and reconnect when the next NTP sync is due. If the sync
+ * doesn't succeed in time, turn the radio off and retry later.
+ */
+void checkRadioDutyCycle()
+{
+	if (radio.off) {
+		if ((int32_t)(millis() - radio.wake_at_ms) >= 0) {
+			Serial.println("[Wi-Fi] Radio on for the next NTP sync.");
+			radio.wakes++;
+			radio.sync_pending = true;
+			connectWiFi();
+		}
+		return;
+	}
+
+	if (radio.sync_pending && cfg_wifi_sleep_enabled == 1 && cfg_ntp_enabled == 1 &&
+	    millis() - radio.on_since_ms > WIFI_SLEEP_SYNC_TIMEOUT_MS) {
+		Serial.println("[Wi-Fi] No NTP sync since the radio was turned on, retrying later.");
+		radio.sync_pending = false;
+		radio.missed_syncs++;
+		radioOff(WIFI_SLEEP_RETRY_S);
+	}
+}
+
+void printWiFiStats()
+{
+	Serial.print("[Wi-Fi] ");
+	if (WiFi.isConnected()) {
+		Serial.print("Connected to \"");
+		Serial.print(WiFi.SSID());
+		Serial.print("\", RSSI ");
+		Serial.print(WiFi.RSSI());
+		Serial.println(" dBm");
+	} else if (radio.off) {
+		Serial.print("Radio off, on again in ");
+		Serial.print((radio.wake_at_ms - millis()) / 1000);
+		Serial.println(" s");
+	} else {
+		Serial.println("Not connected");
+	}
+
+	Serial.print("[Wi-Fi] Connects: ");
+	Serial.print(wifiStats.connects);
+	Serial.print(", disconnects: ");
+	Serial.println(wifiStats.disconnects);
+
+	uint64_t on_ms = radioOnMs();
+	uint64_t uptime_ms = micros64() / 1000;
+	Serial.print("[Wi-Fi] Radio on ");
+	Serial.print((uint32_t)(on_ms / 1000));
+	Serial.print(" s of ");
+	Serial.print((uint32_t)(uptime_ms / 1000));
+	Serial.print(" s (");
+	Serial.print(uptime_ms > 0 ? 100.0 * on_ms / uptime_ms : 100.0, 2);
+	Serial.print("%), turned on ");
+	Serial.print(radio.wakes);
+	Serial.print(" times for an NTP sync, ");
+	Serial.print(radio.missed_syncs);
+	Serial.println(" without one");
+}
+
+/*
+ * A time zone is a name in the zone database, or else a POSIX TZ rule such as
+ * "CET-1CEST,M3.5.0,M10.5.0/3". Returns false, printing why and keeping
+ * 'zone', if 'name' is neither.
+ */
+static bool loadZone(const char *name, ClockZone &zone)
+{
+#ifndef POSIX_TZ_ONLY
+	uint16_t index = zoneCache.indexForName(name);
+	if (index != ZONE_CACHE_NONE) {
+		zone.index = index;
+		return true;
+	}
+#endif
+	if (zone.posix.parse(name)) {
+		zone.index = ZONE_CACHE_NONE;
+		return true;
+	}
+	Serial.print("[Time] Unknown time zone, and not a POSIX TZ rule: ");
+	Serial.print(zone.posix.error());
+	Serial.print(" at offset ");
+	Serial.print(zone.posix.errorOffset());
+	Serial.print(" of ");
+	Serial.print(name);
+	Serial.println(".");
+	return false;
+}
+
+static int32_t zoneOffsetAt(const ClockZone &zone, time_t t)
+{
+#ifndef POSIX_TZ_ONLY
+	if (zone.index != ZONE_CACHE_NONE) {
+		return zoneCache.offsetAt(zone.index, t);
+	}
+#endif
+	return zone.posix.offsetAt(t);
+}
+
+bool checkTimeZone(const char *value)
+{
+	ClockZone zone;
+	return loadZone(value, zone);
+}
+
+void loadTimeZone()
+{
+	if (!loadZone(cfg_time_zone, localZone)) {
+		Serial.println("[Time] Unable to load time zone, using UTC.");
+		localZone.index = ZONE_CACHE_NONE;
+		localZone.posix.parse("UTC0");
+		return;
+	}
+	Serial.print(localZone.index != ZONE_CACHE_NONE ? "[Time] Loaded time zone: " : "[Time] Loaded POSIX TZ rule: ");
+	Serial.println(cfg_time_zone);
+}
+
+/*
+ * Load the space separated zones of 'value' into 'zones', or only check them
+ * without. Returns their count, or -1 after printing why one was rejected.
+ */
+static int8_t parseWorldClockZones(const char *value, ClockZone *zones)
+{
+	char name[sizeof(cfg_time_zone)];
+	ClockZone zone;
+	uint8_t count = 0;
+
+	while (*value != '\0') {
+		size_t n = strcspn(value, " ");
+		if (n == 0) {
+			value++;
+			continue;
+		}
+		if (count == WORLD_CLOCK_ZONES) {
+			Serial.print("[Time] At most ");
+			Serial.print(WORLD_CLOCK_ZONES);
+			Serial.println(" world clock zones may be set.");
+			return -1;
+		}
+		if (n >= sizeof(name)) {
+			Serial.print("[Time] A world clock zone may be at most ");
+			Serial.print(sizeof(name) - 1);
+			Serial.println(" characters long.");
+			return -1;
+		}
+		memcpy(name, value, n);
+		name[n] = '\0';
+		if (!loadZone(name, zones != NULL ? zones[count] : zone)) {
+			return -1;
+		}
+		count++;
+		value += n;
+	}
+	return count;
+}
+
+bool checkWorldClockZones(const char *value)
+{
+	return parseWorldClockZones(value, NULL) >= 0;
+}
+
+void loadWorldClockZones()
+{
+	worldClockZoneCount = max(parseWorldClockZones(cfg_world_clock_zones, worldClockZones), (int8_t)0);
+}
+
+void printZoneStats()
+{
+	time_t t = now();
+	const char *name = cfg_world_clock_zones;
+
+	if (worldClockZoneCount == 0) {
+		Serial.println("[Zones] World clock: (none)");
+	}
+	// The zones were loaded from the setting's words, in order.
+	for (uint8_t i = 0; i < worldClockZoneCount; i++) {
+		name += strspn(name, " ");
+		size_t n = strcspn(name, " ");
+		Serial.print("[Zones] World clock zone ");
+		Serial.print(i + 1);
+		Serial.print(", ");
+		Serial.write(name, n);
+		Serial.print(": offset ");
+		Serial.print(zoneOffsetAt(worldClockZones[i], t));
+		Serial.println(" s");
+		name += n;
+	}
+#ifndef POSIX_TZ_ONLY
+	zoneCache.printStats(Serial);
+#endif
+}
+
+/*
+ * Compile the animation script. Without one, writeTime() plays the built-in
+ * anti-poisoning animation.
+ */
+void loadAnimation()
+{
+	animationPlayer.stop();
+	if (cfg_animation[0] == '\0') {
+		animation.clear();
+	} else if (animation.compile(cfg_animation)) {
+		Serial.print("[Animation] Compiled ");
+		Serial.print(animation.length());
+		Serial.print(" frames, ");
+		Serial.print(animation.duration());
+		Serial.println(" ms.");
+	} else {
+		Serial.print("[Animation] Error at offset ");
+		Serial.print(animation.errorOffset());
+		Serial.print(": ");
+		Serial.println(animation.error());
+	}
+	nixieTap.setAntiPoison(animation.length() == 0);
+}
+
+/*
+ * Compile the time and date display formats, which were checked when they
+ * were set or loaded.
+ */
+void loadDisplayFormats()
+{
+	timeDisplayFormat.compile(cfg_time_format, DISPLAY_FORMAT_TIME);
+	dateDisplayFormat.compile(cfg_date_format, DISPLAY_FORMAT_DATE);
+	displayModes[0].uses_dot = timeDisplayFormat.blinks();
+	displayModes[1].uses_dot = dateDisplayFormat.blinks();
+}
+
+/*
+ * Whether a display format compiles, printing where it doesn't.
+ */
+bool checkDisplayFormat(const char *format, DisplayFormatKind kind)
+{
+	DisplayFormat compiled;
+	if (compiled.compile(format, kind)) {
+		return true;
+	}
+	Serial.print("[Display] Error at offset ");
+	Serial.print(compiled.errorOffset());
+	Serial.print(": ");
+	Serial.println(compiled.error());
+	return false;
+}
+
+/*
+ * Whether an animation script compiles, printing where it doesn't. The
+ * script in use is kept if it doesn't.
+ */
+bool checkAnimation(const char *script)
+{
+	// Compiled aside, as the player may be reading the live animation.
+	Animation compiled;
+	if (script[0] == '\0' || compiled.compile(script)) {
+		return true;
+	}
+	Serial.print("[Animation] Error at offset ");
+	Serial.print(compiled.errorOffset());
+	Serial.print(": ");
+	Serial.println(compiled.error());
+	return false;
+}
+
+/*
+ * Show the next frame of the animation started by renderTimeMode() if it is
+ * due, and the display mode's output again once the animation has ended.
+ */
+void playAnimation()
+{
+	uint8_t tubes[4], dots;
+
+	if (!animationPlayer.running()) {
+		return;
+	}
+	if (animationPlayer.poll(millis(), tubes, dots)) {
+		nixieTap.write(tubes[0], tubes[1], tubes[2], tubes[3], dots);
+	} else if (!animationPlayer.running()) {
+		displayDirty = true;
+	}
+}
+
+/*
+ * Render the active display mode and account its render time.
+ */
+void renderDisplay(time_t t)
+{
+	struct DisplayMode &mode = displayModes[displayMode];
+
+	// Only the time mode plays animations.
+	if (displayMode != 0) {
+		animationPlayer.stop();
+	}
+
+	uint32_t start = micros();
+	displayNextUpdate = mode.render(t);
+	uint32_t elapsed = micros() - start;
+
+	displayDirty = false;
+	mode.renders++;
+	mode.last_us = elapsed;
+	if (elapsed > mode.max_us) {
+		mode.max_us = elapsed;
+	}
+	if (elapsed > mode.budget_us) {
+		mode.over_budget++;
+	}
+
+	bootPhaseEnd(BOOT_PHASE_FIRST_DISPLAY);
+}
+
+/*
+ * Time zone offsets are whole minutes, so the local minute boundary is the
+ * same instant in every zone.
+ */
+static time_t nextMinute(time_t t)
+{
+	return t - t % 60 + 60;
+}
+
+time_t localTime(time_t t)
+{
+	return t + zoneOffsetAt(localZone, t);
+}
+
+// The time in ISO 8601 format with the zone, valid until the next call.
+const char *formatTime(time_t t)
+{
+#ifndef POSIX_TZ_ONLY
+	if (localZone.index != ZONE_CACHE_NONE) {
+		return timestampFormatter.format(t, zoneCache.timeZone(localZone.index));
+	}
+#endif
+	return timestampFormatter.format(t, localZone.posix);
+}
+
+/*
+ * The local time broken down for the display. Renders follow the RTC ticks,
+ * so it is usually advanced by a second; a time step or a time zone change
+ * moves the local time and breaks it down in full.
+ */
+static const CivilTime &localCivilTime(time_t t)
+{
+	localCivil.update(localTime(t));
+	return localCivil;
+}
+
+time_t renderTimeMode(time_t t)
+{
+	const CivilTime &local = localCivilTime(t);
+
+	// A scripted animation replaces the built-in one when the minute's last
+	// digit changes. It is played from loop() and ends on the time shown
+	// by then.
+	if (animation.length() > 0) {
+		uint8_t target[4], dots;
+		timeDisplayFormat.render(local, cfg_24hr_enabled, dot_state, target, dots);
+		if (local.minute % 10 != animatedMinute) {
+			animatedMinute = local.minute % 10;
+			animationPlayer.start(animation, target, millis());
+		} else {
+			animationPlayer.setTarget(target);
+		}
+		if (animationPlayer.running()) {
+			return nextMinute(t);
+		}
+	}
+
+	nixieTap.writeTime(local, timeDisplayFormat, dot_state, cfg_24hr_enabled);
+	return timeDisplayFormat.hasSeconds() ? t + 1 : nextMinute(t);
+}
+
+time_t renderDateMode(time_t t)
+{
+	nixieTap.writeDate(localCivilTime(t), dateDisplayFormat, dot_state);
+	// The date changes at local midnight, which may move with a DST
+	// transition, so check again every minute.
+	return nextMinute(t);
+}
+
+time_t renderSecondsMode(time_t t)
+{
+	const CivilTime &local = localCivilTime(t);
+	nixieTap.write(local.minute / 10, local.minute % 10, local.second / 10, local.second % 10, dot_state * 0b1000);
+	return t + 1;
+}
+
+time_t renderYearMode(time_t t)
+{
+	int y = localCivilTime(t).year;
+	nixieTap.write(y / 1000, y / 100 % 10, y / 10 % 10, y % 10, 0);
+	return nextMinute(t);
+}
+
+/*
+ * Hours and minutes since boot, or whole days once that no longer fits.
+ */
+time_t renderUptimeMode(time_t t)
+{
+	uint32_t up = micros64() / 1000000;
+	uint32_t hours = up / 3600;
+
+	if (hours < 100) {
+		uint32_t minutes = up / 60 % 60;
+		nixieTap.write(hours / 10, hours % 10, minutes / 10, minutes % 10, 0b1000);
+	} else {
+		uint32_t days = min(up / 86400, (uint32_t)9999);
+		nixieTap.write(days / 1000, days / 100 % 10, days / 10 % 10, days % 10, 0);
+	}
+	return t + 60 - up % 60;
+}
+
+/*
+ * Minutes since the last successful NTP sync, blank if there hasn't been one.
+ */
+time_t renderSyncAgeMode(time_t t)
+{
+	time_t last_sync = NTP.getLastNTPSync();
+
+	if (last_sync == 0 || last_sync > t) {
+		nixieTap.write(10, 10, 10, 10, 0);
+		return t + 1;
+	}
+
+	uint32_t age = t - last_sync;
+	uint32_t minutes = min(age / 60, (uint32_t)9999);
+	nixieTap.write(minutes / 1000, minutes / 100 % 10, minutes / 10 % 10, minutes % 10, 0);
+	return t + 60 - age % 60;
+}
+
+/*
+ * The time in each world clock zone in turn, with the dot of the tube
+ * numbered as the zone, or the local time without zones.
+ */
+time_t renderWorldClockMode(time_t t)
+{
+	static CivilTime local;
+	uint8_t tubes[4], dots;
+
+	if (worldClockZoneCount == 0) {
+		nixieTap.writeTime(localCivilTime(t), timeDisplayFormat, false, cfg_24hr_enabled);
+		return timeDisplayFormat.hasSeconds() ? t + 1 : nextMinute(t);
+	}
+
+	uint8_t zone = t / WORLD_CLOCK_DWELL_S % worldClockZoneCount;
+	local.update(t + zoneOffsetAt(worldClockZones[zone], t));
+	timeDisplayFormat.render(local, cfg_24hr_enabled, false, tubes, dots);
+	nixieTap.write(tubes[0], tubes[1], tubes[2], tubes[3], 0b10 << zone);
+
+	time_t next = t - t % WORLD_CLOCK_DWELL_S + WORLD_CLOCK_DWELL_S;
+	return timeDisplayFormat.hasSeconds() ? t + 1 : min(next, nextMinute(t));
+}
+
+void selectDisplayMode(const char *name)
+{
+	for (uint8_t i = 0; i < DISPLAY_MODE_COUNT; i++) {
+		if (strcmp(name, displayModes[i].name) == 0) {
+			displayMode = i;
+			displayDirty = true;
+			return;
+		}
+	}
+	Serial.print("Unknown display mode: ");
+	Serial.println(name);
+}
+
+void printDisplayStats()
+{
+	for (uint8_t i = 0; i < DISPLAY_MODE_COUNT; i++) {
+		const struct DisplayMode &mode = displayModes[i];
+		Serial.print("[Display] ");
+		Serial.print(i == displayMode ? "* " : "  ");
+		Serial.print(mode.name);
+		Serial.print(": ");
+		Serial.print(mode.renders);
+		Serial.print(" renders, last ");
+		Serial.print(mode.last_us);
+		Serial.print(" us, max ");
+		Serial.print(mode.max_us);
+		Serial.print(" us, ");
+		Serial.print(mode.over_budget);
+		Serial.print(" over the ");
+		Serial.print(mode.budget_us);
+		Serial.println(" us budget");
+	}
+	Serial.print("[Display] Local time: ");
+	Serial.print(localCivil.incremental_updates);
+	Serial.print(" incremental and ");
+	Serial.print(localCivil.full_updates);
+	Serial.println(" full updates");
+}
+
+/*
+ * Record the start and end of a boot phase. Only the first occurrence of each
+ * phase is recorded; later reconnects and syncs don't count as boot.
+ */
+void bootPhaseBegin(uint8_t phase)
+{
+	if (!bootPhases[phase].started) {
+		bootPhases[phase].started = true;
+		bootPhases[phase].start_ms = millis();
+	}
+}
+
+void bootPhaseEnd(uint8_t phase)
+{
+	if (bootPhases[phase].started && !bootPhases[phase].ended) {
+		bootPhases[phase].ended = true;
+		bootPhases[phase].end_ms = millis();
+	}
+}
+
+/*
+ * Drive the progress bar while the RTC settles, then set the system time
+ * from the RTC.
+ */
+void checkBootProgress()
+{
+	uint32_t elapsed = millis();
+
+	if (elapsed < RTC_SETTLE_MS) {
+		// One more dot for each quarter of the settling time.
+		uint8_t dots = (0b11110 >> (3 - elapsed * 4 / RTC_SETTLE_MS)) & 0b11110;
+		if (dots != bootProgressDots) {
+			bootProgressDots = dots;
+			nixieTap.write(10, 10, 10, 10, dots);
+		}
+		return;
+	}
+
+	bootPhaseEnd(BOOT_PHASE_RTC_SETTLE);
+	if (!systemTimeValid) {
+		setSystemTimeFromRTC();
+		printTime(now());
+	}
+}
+
+void printBootReport()
+{
+	for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+		const struct BootPhaseTiming &p = bootPhases[i];
+		Serial.print("[Boot] ");
+		Serial.print(p.name);
+		if (!p.started) {
+			Serial.println(": not started");
+		} else if (!p.ended) {
+			Serial.print(": started at ");
+			Serial.print(p.start_ms);
+			Serial.println(" ms, not finished");
+		} else {
+			Serial.print(": ");
+			Serial.print(p.end_ms - p.start_ms);
+			Serial.print(" ms (");
+			Serial.print(p.start_ms);
+			Serial.print(" ms to ");
+			Serial.print(p.end_ms);
+			Serial.println(" ms after boot)");
+		}
+	}
+}
+
+void setSystemTimeFromRTC()
+{
+	setTime(RTC.get());
+	sntpServer.setClock(now(), micros());
+	systemTimeValid = true;
+	displayDirty = true;
+	Serial.println("[Time] System time has been set from the on-board RTC.");
+}
+
+void startNTPClient()
+{
+	if (cfg_ntp_enabled != 1) {
+		return;
+	}
+
+	if (ntpInitialized) {
+		Serial.println("[NTP] Restarting NTP client.");
+		NTP.stop();
+		ntpInitialized = false;
+	} else {
+		Serial.println("[NTP] Starting NTP client.");
+	}
+
+	NTP.onNTPSyncEvent([](NTPSyncEvent_t event) {
+		TRACE(TRACE_NTP, TRACE_EVENT_NTP_SYNC, event);
+		systemEvents.post(EVENT_NTP_SYNC, event);
+	});
+
+	if (!NTP.setInterval(cfg_ntp_sync_interval)) {
+		Serial.println("[NTP] Failed to set sync interval!");
+	}
+
+	if (NTP.begin(cfg_ntp_server)) {
+		ntpInitialized = true;
+	} else {
+		Serial.println("[NTP] Failed to start NTP client!");
+	}
+}
+
+void stopNTPClient()
+{
+	if (ntpInitialized) {
+		Serial.println("[NTP] Stopping NTP client.");
+		NTP.stop();
+		ntpInitialized = false;
+	}
+}
+
+void startSntpServer()
+{
+	if (cfg_sntp_server_enabled != 1 || sntpServer.running()) {
+		return;
+	}
+
+	if (sntpServer.begin()) {
+		Serial.print("[SNTP] Serving time on UDP port ");
+		Serial.println(SNTP_PORT);
+	} else {
+		Serial.println("[SNTP] Failed to start SNTP server!");
+	}
+}
+
+void stopSntpServer()
+{
+	if (sntpServer.running()) {
+		Serial.println("[SNTP] Stopping SNTP server.");
+		sntpServer.end();
+	}
+}
+
+void printSntpStats()
+{
+	Serial.print("[SNTP] Server ");
+	if (!sntpServer.running()) {
+		Serial.println("not running.");
+		return;
+	}
+	Serial.println(sntpServer.synchronized() ? "running, synchronized." : "running, not synchronized.");
+
+	Serial.print("[SNTP] Requests: ");
+	Serial.print(sntpServer.requests);
+	Serial.print(", responses: ");
+	Serial.print(sntpServer.responses);
+	Serial.print(", rate limited: ");
+	Serial.print(sntpServer.rate_limited);
+	Serial.print(", dropped: ");
+	Serial.print(sntpServer.dropped);
+	Serial.print(", malformed: ");
+	Serial.println(sntpServer.malformed);
+
+	Serial.print("[SNTP] Receive to transmit: last ");
+	Serial.print(sntpServer.last_service_us);
+	Serial.print(" us, max ");
+	Serial.print(sntpServer.max_service_us);
+	Serial.println(" us");
+}
+
+void startTickSync()
+{
+	if (cfg_tick_sync_mode == 0 || tickSync.running()) {
+		return;
+	}
+
+	TickSyncMode mode = cfg_tick_sync_mode == 1 ? TICK_SYNC_LEADER : TICK_SYNC_FOLLOWER;
+	if (!tickSync.begin(mode)) {
+		Serial.println("[Tick Sync] Failed to start tick sync!");
+		return;
+	}
+	// Modem sleep would hold the broadcasts and replies for up to a beacon
+	// interval.
+	WiFi.setSleepMode(WIFI_NONE_SLEEP);
+	Serial.print("[Tick Sync] Running as ");
+	Serial.print(mode == TICK_SYNC_LEADER ? "leader" : "follower");
+	Serial.print(" on UDP port ");
+	Serial.println(TICK_SYNC_PORT);
+}
+
+void stopTickSync()
+{
+	if (tickSync.running()) {
+		Serial.println("[Tick Sync] Stopping tick sync.");
+		tickSync.end();
+		WiFi.setSleepMode(WIFI_MODEM_SLEEP);
+		displayDirty = true;
+	}
+}
+
+void printTickSyncStats()
+{
+	Serial.print("[Tick Sync] ");
+	if (!tickSync.running()) {
+		Serial.println("Not running.");
+		return;
+	}
+	if (tickSync.mode() == TICK_SYNC_LEADER) {
+		Serial.println("Running as leader.");
+	} else if (tickSync.locked()) {
+		Serial.print("Running as follower, locked to ");
+		Serial.print(IPAddress(tickSync.leader()));
+		Serial.print(", phase error ");
+		Serial.print(tickSync.phaseError());
+		Serial.print(" us, round trip ");
+		Serial.print(tickSync.roundTrip());
+		Serial.println(" us");
+	} else {
+		Serial.println("Running as follower, not locked.");
+	}
+
+	Serial.print("[Tick Sync] Sent: ");
+	Serial.print(tickSync.sent);
+	Serial.print(", received: ");
+	Serial.print(tickSync.received);
+	Serial.print(", send errors: ");
+	Serial.print(tickSync.send_errors);
+	Serial.print(", malformed: ");
+	Serial.print(tickSync.malformed);
+	Serial.print(", epochs: ");
+	Serial.print(tickSync.epochs);
+	Serial.print(", unlocks: ");
+	Serial.println(tickSync.unlocks);
+
+	for (uint8_t i = 0; i < TICK_SYNC_FOLLOWERS; i++) {
+		const TickSync::Follower *f = tickSync.follower(i);
+		if (f == NULL) {
+			continue;
+		}
+		Serial.print("[Tick Sync] Follower ");
+		Serial.print(IPAddress(f->ip));
+		Serial.print(": phase error ");
+		Serial.print(f->error_us);
+		Serial.print(" us, round trip ");
+		Serial.print(f->delay_us);
+		Serial.println(" us");
+	}
+}
+
+/*
+ * With 'ticksync measure', print each follower's phase error as reported to
+ * the leader, or the follower's own, with the largest since the last report.
+ */
+void checkTickSyncReport()
+{
+	if (!tickSyncMeasure || millis() - tickSyncReportMs < TICK_SYNC_REPORT_INTERVAL_MS) {
+		return;
+	}
+	tickSyncReportMs = millis();
 
-		// Stop the NTP client if it's running.
-		stopNTPClient();
-	});
+	if (tickSync.mode() == TICK_SYNC_LEADER) {
+		for (uint8_t i = 0; i < TICK_SYNC_FOLLOWERS; i++) {
+			const TickSync::Follower *f = tickSync.follower(i);
+			if (f == NULL || f->reports == 0) {
+				continue;
+			}
+			Serial.print("[Tick Sync] ");
+			Serial.print(IPAddress(f->ip));
+			Serial.print(": phase error ");
+			Serial.print(f->error_us);
+			Serial.print(" us, worst ");
+			Serial.print(f->worst_error_us);
+			Serial.print(" us over ");
+			Serial.print(f->reports);
+			Serial.println(" reports");
+		}
+	} else if (tickSync.locked()) {
+		Serial.print("[Tick Sync] Phase error ");
+		Serial.print(tickSync.phaseError());
+		Serial.print(" us, worst ");
+		Serial.print(tickSync.worst_error_us);
+		Serial.print(" us, round trip ");
+		Serial.print(tickSync.roundTrip());
+		Serial.println(" us");
+	} else {
+		Serial.println("[Tick Sync] Not locked.");
+	}
+	tickSync.resetStats();
 }
 
-void connectWiFi()
+void startOtaServer()
 {
-	WiFi.disconnect();
-
-	if (cfg_ssid[0] == '\0' || cfg_password[0] == '\0') {
+	if (cfg_ota_password[0] == '\0' || otaServer.running()) {
 		return;
 	}
 
-	WiFi.begin(cfg_ssid, cfg_password);
-
-	Serial.print("[Wi-Fi] Connecting to access point: ");
-	Serial.println(cfg_ssid);
+	otaServer.onEvent([](OtaEvent event, int16_t arg)
+	{
+		systemEvents.post(EVENT_OTA, event << 8 | (uint8_t)arg);
+	});
+	if (otaServer.begin(cfg_ota_password)) {
+		Serial.print("[OTA] Accepting firmware updates on TCP port ");
+		Serial.println(OTA_PORT);
+	} else {
+		Serial.println("[OTA] Failed to start update server!");
+	}
 }
 
-void loadTimeZone()
+void stopOtaServer()
 {
-	time_zone = zoneManager.createForZoneName(cfg_time_zone);
-	if (!time_zone.isError()) {
-		Serial.print("[Time] Loaded time zone: ");
-		Serial.println(cfg_time_zone);
-	} else {
-		Serial.println("[Time] Unable to load time zone, using UTC.");
+	if (otaServer.running()) {
+		Serial.println("[OTA] Stopping update server.");
+		otaServer.end();
+	}
+}
 
-		// Use UTC instead.
-		time_zone = zoneManager.createForZoneInfo(&zonedbx::kZoneEtc_UTC);
-		if (time_zone.isError()) {
-			Serial.println("[Time] WARNING! Unable to load UTC time zone.");
+void processOtaEvent(uint8_t event, int8_t arg)
+{
+	if (event == OTA_STARTED) {
+		Serial.print("[OTA] Receiving a ");
+		Serial.print(otaServer.size);
+		Serial.println(arg ? " byte gzip-compressed image." : " byte image.");
+	} else if (event == OTA_FAILED) {
+		Serial.print("[OTA] Update failed: ");
+		if (arg == OTA_ERROR_AUTH) {
+			Serial.println("wrong password.");
+		} else if (arg == OTA_ERROR_REQUEST) {
+			Serial.println("no Content-Length or MD5 given.");
+		} else if (arg == OTA_ERROR_ABORTED) {
+			Serial.println("connection lost or timed out.");
+		} else {
+			Serial.println(Update.getErrorString());
 		}
+	} else if (event == OTA_COMPLETED) {
+		struct OtaPending pending;
+
+		Serial.print("[OTA] Received ");
+		Serial.print(otaServer.received);
+		Serial.print(" bytes in ");
+		Serial.print(otaServer.duration_ms);
+		Serial.println(" ms, MD5 verified.");
+
+		// Let the next boot check the installed sketch.
+		memset(&pending, 0, sizeof(pending));
+		memcpy(pending.sketch_md5, otaServer.sketchMD5(), sizeof(pending.sketch_md5));
+		pending.crc = crc32((uint8_t *)&pending + sizeof(pending.crc), sizeof(pending) - sizeof(pending.crc));
+		ESP.rtcUserMemoryWrite(RTCMEM_ADDR__OTA_PENDING, (uint32_t *)&pending, sizeof(pending));
+
+		Serial.println("Nixie Tap is restarting!");
+		TRACE(TRACE_EEPROM, TRACE_EVENT_EEPROM_COMMIT, 0);
+		EEPROM.commit();
+		ESP.restart();
 	}
 }
 
-void setSystemTimeFromRTC()
+/*
+ * Report whether a firmware update made before the last restart is running.
+ */
+void checkOtaResult()
 {
-	setTime(RTC.get());
-	Serial.println("[Time] System time has been set from the on-board RTC.");
+	struct OtaPending pending;
+
+	if (!ESP.rtcUserMemoryRead(RTCMEM_ADDR__OTA_PENDING, (uint32_t *)&pending, sizeof(pending)) ||
+	    pending.crc != crc32((uint8_t *)&pending + sizeof(pending.crc), sizeof(pending) - sizeof(pending.crc))) {
+		return;
+	}
+	pending.sketch_md5[sizeof(pending.sketch_md5) - 1] = '\0';
+
+	String md5 = ESP.getSketchMD5();
+	if (pending.sketch_md5[0] == '\0') {
+		Serial.print("[OTA] Restarted after an update, sketch MD5 ");
+		Serial.println(md5);
+	} else if (md5 == pending.sketch_md5) {
+		Serial.print("[OTA] Update installed, sketch MD5 ");
+		Serial.println(md5);
+	} else {
+		Serial.print("[OTA] Update not installed! Sketch MD5 ");
+		Serial.print(md5);
+		Serial.print(", expected ");
+		Serial.println(pending.sketch_md5);
+	}
+
+	memset(&pending, 0, sizeof(pending));
+	ESP.rtcUserMemoryWrite(RTCMEM_ADDR__OTA_PENDING, (uint32_t *)&pending, sizeof(pending));
 }
 
-void startNTPClient()
+void printOtaStats()
 {
-	if (cfg_ntp_enabled != 1) {
+	Serial.print("[OTA] Server ");
+	if (!otaServer.running()) {
+		Serial.println("not running, set ota_password to enable it.");
 		return;
 	}
-
-	if (ntpInitialized) {
-		Serial.println("[NTP] Restarting NTP client.");
-		NTP.stop();
-		ntpInitialized = false;
-	} else {
-		Serial.println("[NTP] Starting NTP client.");
+	Serial.print("running, ");
+	Serial.print(otaServer.updates);
+	Serial.print(" updates, ");
+	Serial.print(otaServer.failures);
+	Serial.print(" failures, ");
+	Serial.print(otaServer.rejected);
+	Serial.println(" rejected connections");
+
+	if (otaServer.size > 0) {
+		Serial.print("[OTA] Last upload: ");
+		Serial.print(otaServer.received);
+		Serial.print(" of ");
+		Serial.print(otaServer.size);
+		Serial.println(otaServer.gzip ? " bytes, gzip-compressed" : " bytes");
 	}
 
-	NTP.onNTPSyncEvent([](NTPSyncEvent_t event) {
-		ntpEvent = event;
-		syncEventTriggered = true;
-	});
+	Serial.print("[OTA] Sketch MD5: ");
+	Serial.println(ESP.getSketchMD5());
+}
 
-	if (!NTP.setInterval(cfg_ntp_sync_interval)) {
-		Serial.println("[NTP] Failed to set sync interval!");
+void startMetricsServer()
+{
+	if (cfg_metrics_enabled != 1 || metricsServer.running()) {
+		return;
 	}
 
-	if (NTP.begin(cfg_ntp_server)) {
-		ntpInitialized = true;
+	if (metricsServer.begin(METRICS, METRIC_COUNT)) {
+		Serial.print("[Metrics] Serving metrics on TCP port ");
+		Serial.println(METRICS_PORT);
 	} else {
-		Serial.println("[NTP] Failed to start NTP client!");
+		Serial.println("[Metrics] Failed to start metrics server!");
 	}
 }
 
-void stopNTPClient()
+void stopMetricsServer()
 {
-	if (ntpInitialized) {
-		Serial.println("[NTP] Stopping NTP client.");
-		NTP.stop();
-		ntpInitialized = false;
+	if (metricsServer.running()) {
+		Serial.println("[Metrics] Stopping metrics server.");
+		metricsServer.end();
+	}
+}
+
+/*
+ * Print the metrics as served at /metrics, followed by the server's own
+ * counters.
+ */
+void printMetrics()
+{
+	MetricsWriter writer;
+	char buf[METRICS_BUFFER_SIZE];
+	size_t len;
+
+	writer.begin(METRICS, METRIC_COUNT);
+	while ((len = writer.next(buf, sizeof(buf))) > 0) {
+		Serial.write((const uint8_t *)buf, len);
 	}
+
+	Serial.print("[Metrics] Server ");
+	Serial.print(metricsServer.running() ? "running" : "not running");
+	Serial.print(", ");
+	Serial.print(metricsServer.scrapes);
+	Serial.print(" scrapes, ");
+	Serial.print(metricsServer.not_found);
+	Serial.print(" not found, ");
+	Serial.print(metricsServer.rejected);
+	Serial.print(" rejected, ");
+	Serial.print(metricsServer.aborted);
+	Serial.print(" aborted, scrape time last ");
+	Serial.print(metricsServer.last_scrape_us);
+	Serial.print(" us, max ");
+	Serial.print(metricsServer.max_scrape_us);
+	Serial.println(" us");
 }
 
-void processSyncEvent(NTPSyncEvent_t ntpEvent)
+void processSyncEvent(NTPSyncEvent_t ntpEvent, uint32_t t)
 {
 	if (ntpEvent < 0) {
+		ntpStats.errors++;
+		ntpStats.request_pending = false;
 		Serial.print("[NTP] Time sync error: ");
 		if (ntpEvent == noResponse) {
 			Serial.println("NTP server not reachable.");
@@ -336,13 +2119,289 @@ void processSyncEvent(NTPSyncEvent_t ntpEvent)
 		} else {
 			Serial.println("Unknown event.");
 		}
+	} else if (ntpEvent == requestSent) {
+		ntpStats.request_pending = true;
+		ntpStats.request_us = t;
 	} else {
 		if (ntpEvent == timeSyncd && NTP.SyncStatus()) {
 			time_t ntp_time = NTP.getLastNTPSync();
+			time_t rtc_time = RTC.get();
+
+			ntpStats.syncs++;
+			if (ntpStats.request_pending) {
+				ntpStats.request_pending = false;
+				ntpStats.delay_valid = true;
+				ntpStats.delay_us = t - ntpStats.request_us;
+			}
+			if (rtc_time != 0) {
+				ntpStats.offset_valid = true;
+				ntpStats.offset_s = ntp_time - rtc_time;
+				TRACE(TRACE_NTP, TRACE_EVENT_TIME_STEP, traceArg(ntpStats.offset_s));
+			}
+
 			RTC.set(ntp_time);
+			sntpServer.setClock(now(), micros());
+			sntpServer.setLastSync(ntp_time);
 			printTime(ntp_time);
+
+			// The NTP client has set the system time, so there's no
+			// need to wait for the RTC.
+			systemTimeValid = true;
+			displayDirty = true;
+
+			if (!bootPhases[BOOT_PHASE_NTP_SYNC].ended) {
+				bootPhaseEnd(BOOT_PHASE_NTP_SYNC);
+				Serial.print("[NTP] First time sync ");
+				Serial.print(bootPhases[BOOT_PHASE_NTP_SYNC].end_ms);
+				Serial.print(" ms after boot (Wi-Fi associated at ");
+				Serial.print(bootPhases[BOOT_PHASE_WIFI_ASSOC].end_ms);
+				Serial.print(" ms, IP configured at ");
+				Serial.print(bootPhases[BOOT_PHASE_WIFI_IP].end_ms);
+				Serial.print(" ms, ");
+				Serial.println(wifiFastConnect ? "fast reconnect)" : "full scan)");
+			}
+
+			// Turn the radio off until the next sync is due.
+			radio.sync_pending = false;
+			if (cfg_wifi_sleep_enabled == 1) {
+				radioOff(cfg_ntp_sync_interval);
+			}
+		}
+	}
+}
+
+/*
+ * Drain both event queues in timestamp order.
+ */
+void processEvents()
+{
+	Event isr_event, system_event;
+
+	for (;;) {
+		bool have_isr = isrEvents.peek(isr_event);
+		bool have_system = systemEvents.peek(system_event);
+		Event e;
+
+		if (have_isr && (!have_system || (int32_t)(isr_event.time_us - system_event.time_us) <= 0)) {
+			e = isr_event;
+			isrEvents.pop();
+		} else if (have_system) {
+			e = system_event;
+			systemEvents.pop();
+			// Wi-Fi and NTP event handlers may allocate.
+			heapActivity.steady = false;
+		} else {
+			break;
+		}
+
+		switch (e.type) {
+		case EVENT_SECOND_TICK:
+			if (systemTimeValid) {
+				sntpServer.setClock(now(), e.time_us);
+				tickSync.edge(now(), e.time_us);
+			}
+			// A locked follower ticks in loop() instead.
+			if (tickSync.locked()) {
+				break;
+			}
+			dot_state = !dot_state;
+			if (displayModes[displayMode].uses_dot) {
+				displayDirty = true;
+			}
+			break;
+		case EVENT_TOUCH_EDGE:
+			touchEdge(e.arg, e.time_us);
+			break;
+		case EVENT_NTP_SYNC:
+			processSyncEvent((NTPSyncEvent_t)e.arg, e.time_us);
+			break;
+		case EVENT_WIFI_CONNECTED:
+			wifiConnected(e.arg);
+			break;
+		case EVENT_WIFI_DISCONNECTED:
+			wifiDisconnected((enum WiFiDisconnectReason)e.arg);
+			break;
+		case EVENT_WIFI_GOT_IP:
+			wifiGotIP();
+			break;
+		case EVENT_WIFI_DHCP_TIMEOUT:
+			Serial.println("[Wi-Fi] DHCP timeout");
+			break;
+		case EVENT_WIFI_AUTH_MODE_CHANGED:
+			wifiAuthModeChanged(e.arg >> 8, e.arg & 0xff);
+			break;
+		case EVENT_OTA:
+			processOtaEvent(e.arg >> 8, (int8_t)(e.arg & 0xff));
+			break;
+		}
+	}
+}
+
+void printEventStats()
+{
+	Serial.print("[Events] Interrupt queue: ");
+	Serial.print(isrEvents.posted);
+	Serial.print(" posted, ");
+	Serial.print(isrEvents.dropped);
+	Serial.print(" dropped, high water mark ");
+	Serial.println(isrEvents.high_water);
+
+	Serial.print("[Events] Callback queue: ");
+	Serial.print(systemEvents.posted);
+	Serial.print(" posted, ");
+	Serial.print(systemEvents.dropped);
+	Serial.print(" dropped, high water mark ");
+	Serial.println(systemEvents.high_water);
+}
+
+/*
+ * Called at the start of each loop() iteration. Accounts the time since the
+ * start of the previous one.
+ */
+void checkLoopTiming()
+{
+	uint32_t start = micros();
+
+	if (loopStats.iterations > 0) {
+		uint32_t interval = start - loopStats.last_start_us;
+		if (interval > loopStats.max_us) {
+			loopStats.max_us = interval;
+		}
+	}
+	loopStats.iterations++;
+	loopStats.last_start_us = start;
+
+	if (millis() - loopStats.window_start_ms >= LOOP_STATS_WINDOW_MS) {
+		loopStats.window_start_ms = millis();
+		loopStats.prev_max_us = loopStats.max_us;
+		loopStats.max_us = 0;
+	}
+
+	if (loopWatchdog.check(cfg_loop_budget_ms * 1000)) {
+		loopStats.unreported_overruns++;
+		if (loopWatchdog.overruns == 1 || millis() - loopStats.last_warning_ms >= LOOP_WARNING_INTERVAL_MS) {
+			Serial.print("[Watchdog] WARNING! ");
+			Serial.print(loopStats.unreported_overruns);
+			Serial.print(" loop iteration(s) over the budget of ");
+			Serial.print(cfg_loop_budget_ms);
+			Serial.print(" ms since the last report, the last one ");
+			Serial.print(loopWatchdog.last_us / 1000);
+			Serial.print(" ms with ");
+			Serial.print(loopWatchdog.last_stage_us / 1000);
+			Serial.print(" ms in the ");
+			Serial.print(LoopWatchdog::stageName(loopWatchdog.last_stage));
+			Serial.println(" stage.");
+			loopStats.unreported_overruns = 0;
+			loopStats.last_warning_ms = millis();
+		}
+	}
+}
+
+void printWatchdogStats()
+{
+	loopWatchdog.printStats(Serial, cfg_loop_budget_ms * 1000);
+}
+
+void printPostmortem()
+{
+	loopWatchdog.printPostmortem(Serial);
+}
+
+/*
+ * Keep the trace and the loop counters in RTC memory for 'postmortem' after
+ * the coming reset.
+ */
+void savePostmortem(uint32_t reason)
+{
+	struct rst_info info = {};
+
+	info.reason = reason;
+	loopWatchdog.save(RTCMEM_ADDR__POSTMORTEM, info);
+}
+
+/*
+ * Called by the core on an exception or a soft watchdog reset, before it
+ * prints the stack and resets.
+ */
+extern "C" void custom_crash_callback(struct rst_info *info, uint32_t /* stack */, uint32_t /* stack_end */)
+{
+	loopWatchdog.save(RTCMEM_ADDR__POSTMORTEM, *info);
+}
+
+/*
+ * Called at the start of each loop() iteration. Checks whether the previous
+ * iteration allocated in steady state and samples the heap state.
+ */
+void checkHeapActivity()
+{
+	uint32_t allocations = HeapMonitor::allocations();
+	uint32_t count = allocations - heapActivity.loop_start_allocations;
+
+	// Callbacks run from within loop(), like an NTP sync started by now(),
+	// post an event and may allocate. Tick sync packets are allocated by
+	// the network stack.
+	uint32_t packets = tickSync.sent + tickSync.received;
+	if (heapActivity.steady && systemEvents.posted == heapActivity.loop_start_events &&
+	    packets == heapActivity.loop_start_packets) {
+		heapActivity.steady_loops++;
+		if (count > 0) {
+			heapActivity.allocating_loops++;
+			heapActivity.allocations += count;
+			heapActivity.unreported_loops++;
+			if (heapActivity.allocating_loops == 1 || millis() - heapActivity.last_warning_ms >= HEAP_WARNING_INTERVAL_MS) {
+				Serial.print("[Heap] WARNING! ");
+				Serial.print(heapActivity.unreported_loops);
+				Serial.print(" steady-state loop iteration(s) allocated memory since the last report, ");
+				Serial.print(count);
+				Serial.println(" allocation(s) in the last one.");
+				heapActivity.unreported_loops = 0;
+				heapActivity.last_warning_ms = millis();
+			}
 		}
 	}
+
+	heapActivity.loop_start_allocations = allocations;
+	heapActivity.loop_start_events = systemEvents.posted;
+	heapActivity.loop_start_packets = packets;
+	heapActivity.steady = systemTimeValid;
+
+	if (heapMonitor.samples == 0 || millis() - heapActivity.last_sample_ms >= HEAP_SAMPLE_INTERVAL_MS) {
+		heapActivity.last_sample_ms = millis();
+		heapMonitor.sample();
+	}
+}
+
+void printHeapStats()
+{
+	heapMonitor.sample();
+
+	Serial.print("[Heap] Free: ");
+	Serial.print(heapMonitor.free_heap);
+	Serial.print(" bytes, minimum ");
+	Serial.print(heapMonitor.min_free_heap);
+	Serial.println(" bytes");
+
+	Serial.print("[Heap] Largest free block: ");
+	Serial.print(heapMonitor.max_block);
+	Serial.print(" bytes, minimum ");
+	Serial.print(heapMonitor.min_max_block);
+	Serial.println(" bytes");
+
+	Serial.print("[Heap] Fragmentation: ");
+	Serial.print(heapMonitor.fragmentation);
+	Serial.print("%, maximum ");
+	Serial.print(heapMonitor.max_fragmentation);
+	Serial.print("% over ");
+	Serial.print(heapMonitor.samples);
+	Serial.println(" samples");
+
+	Serial.print("[Heap] Steady-state loop iterations: ");
+	Serial.print(heapActivity.steady_loops);
+	Serial.print(", ");
+	Serial.print(heapActivity.allocating_loops);
+	Serial.print(" allocated memory (");
+	Serial.print(heapActivity.allocations);
+	Serial.println(" allocations)");
 }
 
 /*
@@ -364,162 +2423,501 @@ void enableSecDot()
  */
 void irq_1Hz_int()
 {
-	dot_state = !dot_state;
+	TRACE(TRACE_ISR, TRACE_EVENT_ISR_SECOND, 0);
+	isrEvents.post(EVENT_SECOND_TICK);
+}
+
+/*
+ * An interrupt function for the touch sensor when it is touched or released.
+ * It only queues the edge; everything else happens in the loop.
+ */
+void touchButtonChanged()
+{
+	bool level = digitalRead(TOUCH_BUTTON) == HIGH;
+	TRACE(TRACE_ISR, TRACE_EVENT_ISR_TOUCH, level);
+	isrEvents.post(EVENT_TOUCH_EDGE, level);
+}
+
+/*
+ * Debounce the touch sensor edges and classify them into gestures.
+ *
+ * An edge that changes the debounced level is accepted immediately unless it
+ * follows the previous accepted transition by less than touch_debounce_ms, in
+ * which case it is counted as a bounce. If the sensor settles at a level
+ * different from the debounced one, the transition is accepted once it has
+ * been stable for touch_debounce_ms.
+ *
+ * A release is a tap, or the second half of a double tap if it follows the
+ * previous release within touch_double_tap_ms. Holding the sensor for
+ * touch_long_press_ms is a long press and the following release is ignored.
+ * With touch_double_tap_ms set to 0 taps are reported on release.
+ */
+void touchEdge(bool level, uint32_t t)
+{
+	touch.raw_level = level;
+	touch.raw_edge_us = t;
+	if (level == touch.level) {
+		return;
+	}
+	if (t - touch.level_since_us < (uint32_t)cfg_touch_debounce_ms * 1000) {
+		touch.bounces++;
+		return;
+	}
+	touchTransition(level, t);
+}
+
+void processTouch()
+{
+	uint32_t debounce_us = (uint32_t)cfg_touch_debounce_ms * 1000;
+	uint32_t now_us = micros();
+
+	if (touch.raw_level != touch.level && now_us - touch.raw_edge_us >= debounce_us) {
+		touchTransition(touch.raw_level, touch.raw_edge_us);
+	}
+
+	if (touch.level && !touch.long_press_fired) {
+		uint32_t long_press_us = (uint32_t)cfg_touch_long_press_ms * 1000;
+		if (now_us - touch.down_us >= long_press_us) {
+			touch.long_press_fired = true;
+			touchGesture(TOUCH_LONG_PRESS, touch.down_us + long_press_us);
+		}
+	}
+
+	if (!touch.level && touch.taps == 1) {
+		uint32_t double_tap_us = (uint32_t)cfg_touch_double_tap_ms * 1000;
+		if (now_us - touch.up_us >= double_tap_us) {
+			touch.taps = 0;
+			touchGesture(TOUCH_TAP, touch.up_us + double_tap_us);
+		}
+	}
+}
+
+void touchTransition(bool level, uint32_t t)
+{
+	touch.level = level;
+	touch.level_since_us = t;
+
+	if (level) {
+		touch.down_us = t;
+		touch.long_press_fired = false;
+		return;
+	}
+
+	if (touch.long_press_fired) {
+		touch.taps = 0;
+		return;
+	}
+
+	touch.taps++;
+	touch.up_us = t;
+	if (touch.taps == 2) {
+		touch.taps = 0;
+		touchGesture(TOUCH_DOUBLE_TAP, t);
+	} else if (cfg_touch_double_tap_ms == 0) {
+		touch.taps = 0;
+		touchGesture(TOUCH_TAP, t);
+	}
+}
+
+/*
+ * Act on a touch gesture. 'since_us' is the micros() time at which the
+ * gesture could first be recognized, used for the latency statistics.
+ */
+void touchGesture(uint8_t gesture, uint32_t since_us)
+{
+	switch (gesture) {
+	case TOUCH_TAP:
+		// Advance to the next display mode.
+		displayMode = (displayMode + 1) % DISPLAY_MODE_COUNT;
+		displayDirty = true;
+		nixieTap.setAnimation(true);
+		printTime(now());
+		break;
+	case TOUCH_DOUBLE_TAP:
+		// Return to the time display.
+		displayMode = 0;
+		displayDirty = true;
+		break;
+	case TOUCH_LONG_PRESS:
+		// Toggle between 12 and 24 hour format until the next restart.
+		cfg_24hr_enabled = !cfg_24hr_enabled;
+		displayDirty = true;
+		Serial.print("[Touch] Switched to ");
+		Serial.println(cfg_24hr_enabled ? "24 hour format." : "12 hour format.");
+		break;
+	}
+
+	uint32_t latency = micros() - since_us;
+	touch.gestures[gesture]++;
+	touch.last_latency_us = latency;
+	if (latency > touch.max_latency_us) {
+		touch.max_latency_us = latency;
+	}
+}
+
+void printTraceStats()
+{
+	static const struct {
+		uint8_t category;
+		const char *name;
+	} CATEGORIES[] = {
+		{ TRACE_ISR, "isr" },
+		{ TRACE_DISPLAY, "display" },
+		{ TRACE_LOOP, "loop" },
+		{ TRACE_NTP, "ntp" },
+		{ TRACE_WIFI, "wifi" },
+		{ TRACE_EEPROM, "eeprom" },
+		{ TRACE_WATCHDOG, "watchdog" },
+	};
+
+	Serial.print("[Trace] ");
+	Serial.print(trace.count());
+	Serial.print(" of ");
+	Serial.print(TRACE_SIZE);
+	Serial.print(" records, ");
+	Serial.print(trace.overwritten());
+	Serial.println(" overwritten");
+
+	Serial.print("[Trace] Categories:");
+	for (uint8_t i = 0; i < sizeof(CATEGORIES) / sizeof(CATEGORIES[0]); i++) {
+		Serial.print(' ');
+		Serial.print(CATEGORIES[i].name);
+		if (!(TRACE_CATEGORIES & CATEGORIES[i].category)) {
+			Serial.print(" (not compiled in)");
+		} else if (!(trace.categories() & CATEGORIES[i].category)) {
+			Serial.print(" (off)");
+		}
+	}
+	Serial.println();
+}
+
+void printTouchStats()
+{
+	for (int i = 0; i < TOUCH_GESTURE_COUNT; i++) {
+		Serial.print("[Touch] ");
+		Serial.print(TOUCH_GESTURE_NAMES[i]);
+		Serial.print(": ");
+		Serial.println(touch.gestures[i]);
+	}
+	Serial.print("[Touch] Bounces rejected: ");
+	Serial.println(touch.bounces);
+	Serial.print("[Touch] Gesture to action latency: last ");
+	Serial.print(touch.last_latency_us);
+	Serial.print(" us, max ");
+	Serial.print(touch.max_latency_us);
+	Serial.println(" us");
 }
 
 /*
- * An interrupt function for the touch sensor when it is touched.
+ * Time 'ops' calls of 'op' with the CPU cycle counter, each on its own, less
+ * the cost of reading the counter. The worst case shows flash cache misses,
+ * e.g. on the first call, and interrupts taken meanwhile.
  */
-void touchButtonPressed()
+static void benchmark(const char *name, uint16_t ops, void (*op)(uint16_t), uint32_t overhead)
+{
+	uint32_t best = UINT32_MAX, worst = 0;
+	uint64_t total = 0;
+
+	for (uint16_t i = 0; i < ops; i++) {
+		uint32_t start = ESP.getCycleCount();
+		op(i);
+		uint32_t cycles = ESP.getCycleCount() - start;
+		cycles = cycles > overhead ? cycles - overhead : 0;
+		best = min(best, cycles);
+		worst = max(worst, cycles);
+		total += cycles;
+	}
+	yield();
+
+	uint32_t mean = total / ops;
+	Serial.print("[Bench] ");
+	Serial.print(name);
+	Serial.print(": ");
+	Serial.print(mean);
+	Serial.print(" cycles/op (");
+	Serial.print((float)mean / ESP.getCpuFreqMHz(), 2);
+	Serial.print(" us), min ");
+	Serial.print(best);
+	Serial.print(", worst ");
+	Serial.print(worst);
+	Serial.print(" over ");
+	Serial.print(ops);
+	Serial.println(" ops");
+}
+
+void runBenchmarks()
 {
-	state++;
-	touch_button_pressed = true;
-	nixieTap.setAnimation(true);
+	static time_t t;
+	t = now();
+
+	// The least of a run of empty ops is the cost of the timing itself.
+	uint32_t overhead = UINT32_MAX;
+	for (uint8_t i = 0; i < 100; i++) {
+		uint32_t start = ESP.getCycleCount();
+		overhead = min(overhead, ESP.getCycleCount() - start);
+	}
+	Serial.print("[Bench] Running at ");
+	Serial.print(ESP.getCpuFreqMHz());
+	Serial.print(" MHz, timing overhead ");
+	Serial.print(overhead);
+	Serial.println(" cycles.");
+
+	benchmark("spi_write", 1000, [](uint16_t i) {
+		nixieTap.write(i % 10, i % 10, i % 10, i % 10, 0);
+	}, overhead);
+	benchmark("zone_offset", 1000, [](uint16_t i) {
+		localTime(t + i);
+	}, overhead);
+	benchmark("format_time", 1000, [](uint16_t i) {
+		formatTime(t + i);
+	}, overhead);
+	benchmark("rtc_read", 100, [](uint16_t) {
+		tmElements_t tm;
+		RTC.read(tm);
+	}, overhead);
+
+	// Put back what is there, so that the EEPROM isn't left dirty.
+	static char zone[sizeof(cfg_time_zone)];
+	static uint16_t address;
+	address = settings.named("time_zone")->address;
+	benchmark("eeprom_get", 1000, [](uint16_t) {
+		EEPROM.get(address, zone);
+	}, overhead);
+	benchmark("eeprom_put", 1000, [](uint16_t) {
+		EEPROM.put(address, zone);
+	}, overhead);
+
+	// Show the time again.
+	displayDirty = true;
 }
 
+/*
+ * Collect serial input into a line buffer. Lines end with CR, LF or both.
+ */
 void readAndParseSerial()
 {
-	if (Serial.available() > 0) {
-		serialCommand.concat(Serial.readStringUntil('\n'));
-
-		if (serialCommand.endsWith("\r")) {
-			serialCommand.trim();
-
-			if (serialCommand == "espinfo") {
-				printESPInfo();
-			} else if (serialCommand == "init") {
-				resetEepromToDefault();
-			} else if (serialCommand == "read") {
-				readParameters();
-			} else if (serialCommand == "restart") {
-				Serial.println("Nixie Tap is restarting!");
-				EEPROM.commit();
-				ESP.restart();
-			} else if (serialCommand == "set") {
-				Serial.println("Available 'set' commands: "
-					       "24hr_enabled, "
-					       "ntp_enabled, "
-					       "ntp_sync_interval, "
-					       "ntp_server, "
-					       "time_zone, "
-					       "ssid, "
-					       "password, "
-					       "time.");
-			} else if (serialCommand.startsWith("set ")) {
-				parseSerialSet(serialCommand.substring(strlen("set ")));
-			} else if (serialCommand == "ticker") {
-				if (serialTicker) {
-					Serial.println("[Time] Turning off serial ticker.");
-				} else {
-					Serial.println("[Time] Turning on serial ticker.");
-				}
-				serialTicker = !serialTicker;
-			} else if (serialCommand == "time") {
-				printTime(now());
-			} else if (serialCommand == "write") {
-				EEPROM.commit();
-				Serial.println("[EEPROM Commit] Writing settings to non-volatile memory.");
-			} else if (serialCommand == "help") {
-				Serial.println("Available commands: "
-					       "espinfo, "
-					       "init, "
-					       "read, "
-					       "restart, "
-					       "set, "
-					       "ticker, "
-					       "time, "
-					       "write, "
-					       "help.");
+	while (Serial.available() > 0) {
+		char c = Serial.read();
+
+		// Commands may allocate.
+		heapActivity.steady = false;
+
+		if (c != '\r' && c != '\n') {
+			if (serialCommandLength < sizeof(serialCommand) - 1) {
+				serialCommand[serialCommandLength++] = c;
 			} else {
-				Serial.print("Unknown command: ");
-				Serial.println(serialCommand);
+				serialCommandOverflow = true;
 			}
+			continue;
+		}
 
-			serialCommand = "";
-		}
-	}
-}
-
-void parseSerialSet(String s)
-{
-	if (s.startsWith("24hr_enabled ")) {
-		uint8_t val = (uint8_t)atoi(s.substring(strlen("24hr_enabled ")).c_str());
-		cfg_24hr_enabled = val;
-		Serial.print("[EEPROM Write] ");
-		Serial.print("24hr_enabled: ");
-		Serial.println(val);
-		EEPROM.put(EEPROM_ADDR__24HR_ENABLED, val);
-	} else if (s.startsWith("ntp_enabled ")) {
-		uint8_t val = (uint8_t)atoi(s.substring(strlen("ntp_enabled ")).c_str());
-		cfg_ntp_enabled = val;
-		Serial.print("[EEPROM Write] ");
-		Serial.print("ntp_enabled: ");
-		Serial.println(val);
-		EEPROM.put(EEPROM_ADDR__NTP_ENABLED, val);
-
-		// Stop or start the NTP client.
-		if (cfg_ntp_enabled == 0 && ntpInitialized) {
-			stopNTPClient();
-		} else if (cfg_ntp_enabled == 1 && !ntpInitialized) {
-			startNTPClient();
-		}
-	} else if (s.startsWith("ntp_sync_interval ")) {
-		uint32_t val = (uint8_t)atoi(s.substring(strlen("ntp_sync_interval ")).c_str());
-		cfg_ntp_sync_interval = val;
-		Serial.print("[EEPROM Write] ");
-		Serial.print("ntp_sync_interval: ");
-		Serial.println(val);
-		EEPROM.put(EEPROM_ADDR__NTP_SYNC_INTERVAL, val);
-
-		// Restart the NTP client if necessary.
-		if (cfg_ntp_enabled && ntpInitialized) {
-			startNTPClient();
-		}
-	} else if (s.startsWith("ntp_server ")) {
-		strcpy(cfg_ntp_server, s.substring(strlen("ntp_server ")).c_str());
-		Serial.print("[EEPROM Write] ");
-		Serial.print("ntp_server: ");
-		Serial.println(cfg_ntp_server);
-		EEPROM.put(EEPROM_ADDR__NTP_SERVER, cfg_ntp_server);
-
-		// Restart the NTP client if necessary.
-		if (cfg_ntp_enabled && ntpInitialized) {
-			startNTPClient();
-		}
-	} else if (s.startsWith("time_zone ")) {
-		strcpy(cfg_time_zone, s.substring(strlen("time_zone ")).c_str());
-		Serial.print("[EEPROM Write] ");
-		Serial.print("time_zone: ");
-		Serial.println(cfg_time_zone);
-		EEPROM.put(EEPROM_ADDR__TIME_ZONE, cfg_time_zone);
-
-		// Reload time zone.
-		loadTimeZone();
-	} else if (s.startsWith("ssid ")) {
-		strcpy(cfg_ssid, s.substring(strlen("ssid ")).c_str());
-		Serial.print("[EEPROM Write] ");
-		Serial.print("ssid: ");
-		Serial.println(cfg_ssid);
-		EEPROM.put(EEPROM_ADDR__SSID, cfg_ssid);
-
-		// Restart WiFi connection because the SSID has changed.
-		connectWiFi();
-	} else if (s.startsWith("password ")) {
-		strcpy(cfg_password, s.substring(strlen("password ")).c_str());
-		Serial.print("[EEPROM Write] ");
-		Serial.print("password: ");
-		Serial.println(cfg_password);
-		EEPROM.put(EEPROM_ADDR__PASSWORD, cfg_password);
-
-		// Restart WiFi connection because the password has changed.
-		connectWiFi();
-	} else if (s.startsWith("time ")) {
-		String s_time = s.substring(strlen("time "));
-		auto odt = OffsetDateTime::forDateString(s_time.c_str());
+		serialCommand[serialCommandLength] = '\0';
+		if (serialCommandOverflow) {
+			Serial.print("Command longer than ");
+			Serial.print(sizeof(serialCommand) - 1);
+			Serial.println(" characters ignored.");
+		} else {
+			// Trim leading and trailing whitespace.
+			char *cmd = serialCommand;
+			while (isspace(*cmd)) {
+				cmd++;
+			}
+			char *end = cmd + strlen(cmd);
+			while (end > cmd && isspace(end[-1])) {
+				*--end = '\0';
+			}
+			if (*cmd != '\0') {
+				parseSerialCommand(cmd);
+			}
+		}
+		serialCommandLength = 0;
+		serialCommandOverflow = false;
+	}
+}
+
+static bool startsWith(const char *s, const char *prefix)
+{
+	return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+void parseSerialCommand(const char *cmd)
+{
+	if (strcmp(cmd, "animation") == 0) {
+		if (animation.length() > 0) {
+			Serial.print("[Animation] ");
+			Serial.print(animation.length());
+			Serial.print(" frames, ");
+			Serial.print(animation.duration());
+			Serial.print(" ms: ");
+			Serial.println(cfg_animation);
+		} else {
+			Serial.println("[Animation] No script set, playing the built-in animation.");
+		}
+	} else if (strcmp(cmd, "animation play") == 0) {
+		if (displayMode != 0) {
+			Serial.println("[Animation] Animations are only played in the time display mode.");
+		} else if (animation.length() == 0) {
+			Serial.println("[Animation] No script set.");
+		} else {
+			animatedMinute = 0xff;
+			displayDirty = true;
+		}
+	} else if (strcmp(cmd, "bench") == 0) {
+		runBenchmarks();
+	} else if (strcmp(cmd, "boot") == 0) {
+		printBootReport();
+	} else if (strcmp(cmd, "display") == 0) {
+		printDisplayStats();
+	} else if (startsWith(cmd, "display ")) {
+		selectDisplayMode(cmd + strlen("display "));
+	} else if (strcmp(cmd, "espinfo") == 0) {
+		printESPInfo();
+	} else if (strcmp(cmd, "events") == 0) {
+		printEventStats();
+	} else if (strcmp(cmd, "heap") == 0) {
+		printHeapStats();
+	} else if (strcmp(cmd, "init") == 0) {
+		resetEepromToDefault();
+	} else if (strcmp(cmd, "metrics") == 0) {
+		printMetrics();
+	} else if (strcmp(cmd, "ota") == 0) {
+		printOtaStats();
+	} else if (strcmp(cmd, "postmortem") == 0) {
+		printPostmortem();
+	} else if (strcmp(cmd, "read") == 0) {
+		readParameters();
+	} else if (strcmp(cmd, "restart") == 0) {
+		Serial.println("Nixie Tap is restarting!");
+		TRACE(TRACE_EEPROM, TRACE_EVENT_EEPROM_COMMIT, 0);
+		EEPROM.commit();
+		savePostmortem(REASON_SOFT_RESTART);
+		ESP.restart();
+	} else if (strcmp(cmd, "set") == 0) {
+		Serial.print("Available 'set' commands: ");
+		settings.printNames(Serial);
+		Serial.println("time.");
+	} else if (startsWith(cmd, "set ")) {
+		parseSerialSet(cmd + strlen("set "));
+	} else if (strcmp(cmd, "sntp") == 0) {
+		printSntpStats();
+	} else if (strcmp(cmd, "ticksync") == 0) {
+		printTickSyncStats();
+	} else if (strcmp(cmd, "ticksync measure") == 0) {
+		if (tickSyncMeasure) {
+			Serial.println("[Tick Sync] Turning off phase error reports.");
+		} else {
+			Serial.println("[Tick Sync] Turning on phase error reports.");
+			tickSync.resetStats();
+			tickSyncReportMs = millis();
+		}
+		tickSyncMeasure = !tickSyncMeasure;
+	} else if (strcmp(cmd, "ticker") == 0) {
+		if (serialTicker) {
+			Serial.println("[Time] Turning off serial ticker.");
+		} else {
+			Serial.println("[Time] Turning on serial ticker.");
+		}
+		serialTicker = !serialTicker;
+	} else if (strcmp(cmd, "time") == 0) {
+		printTime(now());
+	} else if (strcmp(cmd, "trace") == 0) {
+		printTraceStats();
+	} else if (strcmp(cmd, "trace clear") == 0) {
+		trace.clear();
+		Serial.println("[Trace] Cleared.");
+	} else if (strcmp(cmd, "trace dump") == 0) {
+		trace.dump(Serial);
+	} else if (strcmp(cmd, "trace loop") == 0) {
+		if (trace.categories() & TRACE_LOOP) {
+			Serial.println("[Trace] Turning off loop stage tracing.");
+			trace.disable(TRACE_LOOP);
+		} else if (TRACE_CATEGORIES & TRACE_LOOP) {
+			Serial.println("[Trace] Turning on loop stage tracing.");
+			trace.enable(TRACE_LOOP);
+		} else {
+			Serial.println("[Trace] Loop stage trace points are not compiled in.");
+		}
+	} else if (strcmp(cmd, "touch") == 0) {
+		printTouchStats();
+	} else if (startsWith(cmd, "unset ")) {
+		const Setting *setting = settings.named(cmd + strlen("unset "));
+		if (setting == NULL) {
+			Serial.print("Unable to parse 'unset' command: ");
+			Serial.println(cmd + strlen("unset "));
+		} else if (settings.unset(*setting)) {
+			displayDirty = true;
+		}
+	} else if (strcmp(cmd, "watchdog") == 0) {
+		printWatchdogStats();
+	} else if (startsWith(cmd, "watchdog stall ")) {
+		uint32_t ms = min(strtoul(cmd + strlen("watchdog stall "), NULL, 10), (unsigned long)WATCHDOG_STALL_MAX_MS);
+		Serial.print("[Watchdog] Stalling the main loop for ");
+		Serial.print(ms);
+		Serial.println(" ms.");
+		Serial.flush();
+		uint32_t start = micros();
+		while (micros() - start < ms * 1000) {
+			delayMicroseconds(1000);
+		}
+	} else if (strcmp(cmd, "wifi") == 0) {
+		printWiFiStats();
+	} else if (strcmp(cmd, "write") == 0) {
+		TRACE(TRACE_EEPROM, TRACE_EVENT_EEPROM_COMMIT, 0);
+		EEPROM.commit();
+		Serial.println("[EEPROM Commit] Writing settings to non-volatile memory.");
+	} else if (strcmp(cmd, "zones") == 0) {
+		printZoneStats();
+	} else if (strcmp(cmd, "help") == 0) {
+		Serial.println("Available commands: "
+			       "animation, "
+			       "bench, "
+			       "boot, "
+			       "display, "
+			       "espinfo, "
+			       "events, "
+			       "heap, "
+			       "init, "
+			       "metrics, "
+			       "ota, "
+			       "postmortem, "
+			       "read, "
+			       "restart, "
+			       "set, "
+			       "sntp, "
+			       "ticksync, "
+			       "ticker, "
+			       "time, "
+			       "touch, "
+			       "trace, "
+			       "unset, "
+			       "watchdog, "
+			       "wifi, "
+			       "write, "
+			       "zones, "
+			       "help.");
+	} else {
+		Serial.print("Unknown command: ");
+		Serial.println(cmd);
+	}
+}
+
+void parseSerialSet(const char *s)
+{
+	const char *value;
+	const Setting *setting = settings.find(s, value);
+	if (setting != NULL) {
+		if (!settings.set(*setting, value)) {
+			return;
+		}
+	} else if (startsWith(s, "time ")) {
+		const char *s_time = s + strlen("time ");
+		auto odt = OffsetDateTime::forDateString(s_time);
 		if (!odt.isError()) {
 			time_t odt_unix = odt.toUnixSeconds64();
+			TRACE(TRACE_NTP, TRACE_EVENT_TIME_STEP, traceArg(odt_unix - now()));
 			setTime(odt_unix);
 			RTC.set(odt_unix);
+			sntpServer.setClock(odt_unix, micros());
 			last_printed_time = 0;
 			printTime(odt_unix);
 		} else {
@@ -530,6 +2928,9 @@ void parseSerialSet(String s)
 		Serial.print("Unable to parse 'set' command: ");
 		Serial.println(s);
 	}
+
+	// The setting may affect what is displayed.
+	displayDirty = true;
 }
 
 void printESPInfo()
@@ -589,98 +2990,63 @@ void printESPInfo()
 	Serial.println(ESP.getFlashChipSpeed());
 }
 
+/*
+ * Print the time as a single write. With the ticker on this runs every
+ * second, when usually only the seconds digits of the timestamp change.
+ */
 void printTime(time_t t)
 {
-	if (t > last_printed_time) {
-		Serial.print("[Time] The time is now: ");
-		ZonedDateTime::forUnixSeconds64(t, time_zone).printTo(Serial);
-		Serial.print(" @ ");
-		Serial.println(t);
-		last_printed_time = t;
+	static const char prefix[] = "[Time] The time is now: ";
+	char line[sizeof(prefix) + TIMESTAMP_SIZE + 24];
+	char digits[20];
+	size_t n = sizeof(prefix) - 1;
+	uint8_t d = 0;
+
+	if (t <= last_printed_time) {
+		return;
+	}
+
+	memcpy(line, prefix, n);
+	const char *timestamp = formatTime(t);
+	memcpy(line + n, timestamp, timestampFormatter.length());
+	n += timestampFormatter.length();
+	line[n++] = ' ';
+	line[n++] = '@';
+	line[n++] = ' ';
+
+	uint64_t v = t < 0 ? -(uint64_t)t : t;
+	do {
+		digits[d++] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0);
+	if (t < 0) {
+		line[n++] = '-';
+	}
+	while (d > 0) {
+		line[n++] = digits[--d];
 	}
+	line[n++] = '\r';
+	line[n++] = '\n';
+
+	Serial.write(line, n);
+	last_printed_time = t;
 }
 
 void readParameters()
 {
 	Serial.println("[EEPROM] Reading settings from non-volatile memory.");
-
-	EEPROM.get(EEPROM_ADDR__24HR_ENABLED, cfg_24hr_enabled);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("24hr_enabled: ");
-	Serial.println(cfg_24hr_enabled);
-
-	EEPROM.get(EEPROM_ADDR__NTP_ENABLED, cfg_ntp_enabled);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("ntp_enabled: ");
-	Serial.println(cfg_ntp_enabled);
-
-	EEPROM.get(EEPROM_ADDR__NTP_SYNC_INTERVAL, cfg_ntp_sync_interval);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("ntp_sync_interval: ");
-	Serial.println(cfg_ntp_sync_interval);
-
-	EEPROM.get(EEPROM_ADDR__NTP_SERVER, cfg_ntp_server);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("ntp_server: ");
-	Serial.println(cfg_ntp_server);
-
-	EEPROM.get(EEPROM_ADDR__TIME_ZONE, cfg_time_zone);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("time_zone: ");
-	Serial.println(cfg_time_zone);
-
-	EEPROM.get(EEPROM_ADDR__SSID, cfg_ssid);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("ssid: ");
-	Serial.println(cfg_ssid);
-
-	EEPROM.get(EEPROM_ADDR__PASSWORD, cfg_password);
-	Serial.print("[EEPROM Read] ");
-	Serial.print("password: ");
-	Serial.println(cfg_password);
+	settings.load();
 }
 
 void resetEepromToDefault()
 {
 	Serial.println("[EEPROM] Writing defaults to non-volatile memory.");
 
-	EEPROM.begin(512);
-
-	EEPROM.put(EEPROM_ADDR__24HR_ENABLED, DEFAULT__24HR_ENABLED);
-	Serial.print("[EEPROM Reset] ");
-	Serial.print("24hr_enabled: ");
-	Serial.println(DEFAULT__24HR_ENABLED);
-
-	EEPROM.put(EEPROM_ADDR__NTP_ENABLED, DEFAULT__NTP_ENABLED);
-	Serial.print("[EEPROM Reset] ");
-	Serial.print("ntp_enabled: ");
-	Serial.println(DEFAULT__NTP_ENABLED);
-
-	EEPROM.put(EEPROM_ADDR__NTP_SERVER, DEFAULT__NTP_SERVER);
-	Serial.print("[EEPROM Reset] ");
-	Serial.print("ntp_server: ");
-	Serial.println(DEFAULT__NTP_ENABLED);
-
-	EEPROM.put(EEPROM_ADDR__NTP_SYNC_INTERVAL, DEFAULT__NTP_SYNC_INTERVAL);
-	Serial.print("[EEPROM Reset] ");
-	Serial.print("ntp_sync_interval: ");
-	Serial.println(DEFAULT__NTP_SYNC_INTERVAL);
-
-	EEPROM.put(EEPROM_ADDR__TIME_ZONE, DEFAULT__TIME_ZONE);
-	Serial.print("[EEPROM Reset] ");
-	Serial.print("time_zone: ");
-	Serial.println(DEFAULT__TIME_ZONE);
-
-	EEPROM.put(EEPROM_ADDR__SSID, "");
-	Serial.print("[EEPROM Reset] ");
-	Serial.println("ssid: (not set)");
-
-	EEPROM.put(EEPROM_ADDR__PASSWORD, "");
-	Serial.print("[EEPROM Reset] ");
-	Serial.println("password: (not set)");
-
+	EEPROM.begin(EEPROM_SIZE);
+	settings.reset();
 	EEPROM.put(EEPROM_ADDR__MAGIC, EEPROM_MAGIC);
 
+	TRACE(TRACE_EEPROM, TRACE_EVENT_EEPROM_COMMIT, 0);
 	EEPROM.commit();
 }
 
@@ -696,7 +3062,7 @@ void readConfigButton()
 void firstRunInit()
 {
 	uint64_t magic = 0;
-	EEPROM.begin(512);
+	EEPROM.begin(EEPROM_SIZE);
 	EEPROM.get(EEPROM_ADDR__MAGIC, magic);
 	if (magic != EEPROM_MAGIC) {
 		Serial.println("[EEPROM] Magic value mismatch.");
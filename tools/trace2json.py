@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Convert a Nixie Tap 'trace dump' to the Chrome trace event format.
+
+Reads the serial output containing the dump, from a file or stdin, and writes
+JSON that chrome://tracing and https://ui.perfetto.dev open. If the input holds
+several dumps, the last one is converted. The dump lists the event names, so
+this script doesn't need to match the firmware version.
+
+Loop stages become slices on the "loop" track, each lasting until the next
+stage starts; the "end" stage is the time spent in the system context between
+loop() iterations. All other events are instants on a track per category.
+
+Usage: trace2json.py [serial.log] > trace.json
+"""
+
+import json
+import re
+import sys
+
+HEADER = re.compile(r"\[Trace\] Dump: (\d+) records, (\d+) overwritten, (\d+) MHz, now (\d+)")
+EVENT = re.compile(r"\[Trace\] Event (\d+) (\w+) (\w+)")
+DATA = re.compile(r"\[Trace\] Data((?: [0-9a-f]{14})+)\s*$")
+END = "[Trace] End of dump."
+
+# Loop stages in the order of their events, as counted by loop_overrun.
+STAGES = ["accounting", "events", "display", "serial", "background", "system"]
+TRACKS = ["loop", "isr", "display", "ntp", "wifi", "eeprom", "watchdog"]
+
+
+def parse(lines):
+    """Return (header, events, records) of the last complete dump."""
+    dump = None
+    current = None
+    for line in lines:
+        m = HEADER.search(line)
+        if m:
+            current = {
+                "count": int(m.group(1)),
+                "overwritten": int(m.group(2)),
+                "mhz": int(m.group(3)),
+                "events": {},
+                "records": [],
+            }
+            continue
+        if current is None:
+            continue
+        m = EVENT.search(line)
+        if m:
+            current["events"][int(m.group(1))] = (m.group(2), m.group(3))
+            continue
+        m = DATA.search(line)
+        if m:
+            for rec in m.group(1).split():
+                current["records"].append((int(rec[0:8], 16), int(rec[8:10], 16), int(rec[10:14], 16)))
+            continue
+        if END in line:
+            if len(current["records"]) != current["count"]:
+                sys.exit("trace2json: dump has %d records, header says %d"
+                         % (len(current["records"]), current["count"]))
+            dump = current
+            current = None
+    if dump is None:
+        sys.exit("trace2json: no complete trace dump found")
+    return dump
+
+
+def signed(v):
+    return v - 0x10000 if v & 0x8000 else v
+
+
+def describe(name, arg):
+    if name == "spi_latch":
+        return {"digits": "".join("%x" % ((arg >> s) & 0xF) for s in (12, 8, 4, 0)).replace("a", " ")}
+    if name == "time_step":
+        return {"seconds": signed(arg)}
+    if name == "auth_mode_changed":
+        return {"old": arg >> 8, "new": arg & 0xFF}
+    if name == "ntp_sync":
+        return {"event": signed(arg)}
+    if name == "loop_overrun":
+        return {"stage": STAGES[arg >> 12], "ms": arg & 0xFFF}
+    return {"arg": arg}
+
+
+def convert(dump):
+    out = []
+    for tid, track in enumerate(TRACKS):
+        out.append({"ph": "M", "pid": 1, "tid": tid, "name": "thread_name", "args": {"name": track}})
+
+    # Unwrap the 32-bit cycle count, relative to the oldest record.
+    times = []
+    total = 0
+    prev = None
+    for cycles, _, _ in dump["records"]:
+        if prev is not None:
+            total += (cycles - prev) & 0xFFFFFFFF
+        prev = cycles
+        times.append(total / dump["mhz"])
+
+    slice_start = None
+    for (cycles, event, arg), ts in zip(dump["records"], times):
+        category, name = dump["events"].get(event, ("unknown", "event_%d" % event))
+        if category == "loop":
+            if slice_start is not None:
+                start_ts, start_name = slice_start
+                out.append({"ph": "X", "pid": 1, "tid": 0, "ts": start_ts, "dur": ts - start_ts,
+                            "name": "system" if start_name == "end" else start_name, "cat": "loop"})
+            slice_start = (ts, name)
+            continue
+        tid = TRACKS.index(category) if category in TRACKS else len(TRACKS)
+        out.append({"ph": "i", "s": "t", "pid": 1, "tid": tid, "ts": ts, "name": name, "cat": category,
+                    "args": describe(name, arg)})
+
+    return {
+        "traceEvents": out,
+        "displayTimeUnit": "ms",
+        "otherData": {"records": dump["count"], "overwritten": dump["overwritten"], "cpu_mhz": dump["mhz"]},
+    }
+
+
+def main():
+    if len(sys.argv) > 2:
+        sys.exit(__doc__.strip().splitlines()[-1])
+    with (open(sys.argv[1], errors="replace") if len(sys.argv) == 2 else sys.stdin) as f:
+        dump = parse(f)
+    json.dump(convert(dump), sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()